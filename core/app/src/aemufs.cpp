@@ -0,0 +1,151 @@
+#include "emulator32bit/disk.h"
+#include "emulator32bit/file_system.h"
+#include "util/file.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/*
+    Formats and inspects the guest file system stored in a disk file.
+
+    USAGE: aemufs <disk.bin> <disk pages> <fs first page> <command> [args]
+
+    COMMANDS:
+        format <fs pages> [inodes]        Writes an empty file system.
+        info                            Prints the superblock and free space.
+        ls                                Lists the files in the root directory.
+        put <host file> <name>            Copies a host file into the file system.
+        get <name> <host file>            Copies a file out of the file system.
+        rm <name>                        Removes a file.
+*/
+
+#define AEMU_AEMUFS_DEFAULT_INODES 64
+
+static int usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " <disk.bin> <disk pages> <fs first page> <command> [args]\n"
+            "Commands:\n"
+            "    format <fs pages> [inodes]\n"
+            "    info\n"
+            "    ls\n"
+            "    put <host file> <name>\n"
+            "    get <name> <host file>\n"
+            "    rm <name>\n";
+    return 1;
+}
+
+static void info(FileSystem& fs)
+{
+    const FileSystem::SuperBlock& superblock = fs.get_superblock();
+    std::cout << "pages:        " << superblock.npages << "\n"
+              << "inodes:       " << superblock.ninodes << "\n"
+              << "bitmap:       " << superblock.bitmap_page << " (" << superblock.bitmap_npages << " pages)\n"
+              << "inode table:  " << superblock.inode_page << " (" << superblock.inode_npages << " pages)\n"
+              << "data:         " << superblock.data_page << "\n"
+              << "free pages:   " << fs.get_free_pages() << "\n";
+}
+
+static void ls(FileSystem& fs)
+{
+    for (const FileSystem::FileInfo& file : fs.list())
+    {
+        std::cout << file.inode << "\t" << file.size << "\t" << file.nextents << " extent(s)\t"
+                  << file.name << "\n";
+    }
+}
+
+static void put(FileSystem& fs, const std::string& host_path, const std::string& name)
+{
+    std::ifstream host_file(host_path, std::ios::binary);
+    if (!host_file)
+    {
+        throw FileSystem::FileSystemException("Could not open host file '" + host_path + "'.");
+    }
+    std::vector<byte> data((std::istreambuf_iterator<char>(host_file)), std::istreambuf_iterator<char>());
+
+    word inode = fs.lookup(name);
+    if (inode == 0)
+    {
+        inode = fs.create(name);
+    }
+    else
+    {
+        fs.truncate(inode);
+    }
+    fs.write(inode, 0, data.data(), data.size());
+}
+
+static void get(FileSystem& fs, const std::string& name, const std::string& host_path)
+{
+    word inode = fs.lookup(name);
+    if (inode == 0)
+    {
+        throw FileSystem::FileSystemException("File '" + name + "' does not exist.");
+    }
+
+    std::vector<byte> data(fs.read_inode(inode).size);
+    fs.read(inode, 0, data.data(), data.size());
+
+    std::ofstream host_file(host_path, std::ios::binary);
+    host_file.write((const char*) data.data(), data.size());
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 5)
+    {
+        return usage(argv[0]);
+    }
+
+    word npages = std::stoul(argv[2]);
+    word first_page = std::stoul(argv[3]);
+    std::string command = argv[4];
+
+    Disk disk(File(argv[1], true), npages, 0);
+    try
+    {
+        if (command == "format" && argc > 5)
+        {
+            word inodes = argc > 6 ? std::stoul(argv[6]) : AEMU_AEMUFS_DEFAULT_INODES;
+            FileSystem::format(disk, first_page, std::stoul(argv[5]), inodes);
+        }
+        else
+        {
+            FileSystem fs(disk, first_page);
+            if (command == "info")
+            {
+                info(fs);
+            }
+            else if (command == "ls")
+            {
+                ls(fs);
+            }
+            else if (command == "put" && argc > 6)
+            {
+                put(fs, argv[5], argv[6]);
+            }
+            else if (command == "get" && argc > 6)
+            {
+                get(fs, argv[5], argv[6]);
+            }
+            else if (command == "rm" && argc > 5)
+            {
+                fs.remove(argv[5]);
+            }
+            else
+            {
+                return usage(argv[0]);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    disk.save();
+    return 0;
+}
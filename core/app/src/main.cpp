@@ -1,14 +1,24 @@
 #include "assembler/assembler.h"
+#include "assembler/boot_image.h"
 #include "assembler/build.h"
 #include "assembler/linker.h"
-#include "assembler/load_executable.h"
 #include "assembler/object_file.h"
 #include "assembler/preprocessor.h"
+#include "emulator32bit/bios.h"
+#include "emulator32bit/block_device.h"
+#include "emulator32bit/cache_hierarchy.h"
+#include "emulator32bit/debugger.h"
 #include "emulator32bit/emulator32bit.h"
 #include "emulator32bit/disk.h"
+#include "emulator32bit/file_system.h"
+#include "emulator32bit/gdb_stub.h"
+#include "emulator32bit/timer.h"
 #include "util/file.h"
 #include "util/logger.h"
 
+#include <cstdlib>
+#include <memory>
+
 /*
 TODO
 
@@ -72,8 +82,6 @@ and the file reader to parse the bytes.
 
 Visualizer with raylib to visually show the state of the processor
 
-Bootloader that loads the kernel
-
 Add syscalls for virtual memory management, but for now, they will be controlled in c++ land
 Maybe have a toggle for virtual memory instead??, like using the mocks.
 */
@@ -105,6 +113,8 @@ const static std::string build_exe_from_library_dir = "-libdir ./programs/build
         "-o ./programs/build/palindrome_list -outdir ./programs/build";
 const static std::string build_long_loop = "-o ./programs/build/long_loop "
         "./programs/src/long_loop.basm -outdir ./programs/build";
+const static std::string build_kernel = "-o ./kernel/build/kernel "
+        "./kernel/src/kernel.basm -outdir ./kernel/build";
 
 #define AEMU_MAX_EXEC_INSTR 0x0
 
@@ -113,7 +123,7 @@ int main(int argc, char* argv[])
     PROFILE_START
 
     CLOCK_START("Parsing command arguments")
-    std::string build_command = build_long_loop;
+    std::string build_command = build_kernel;
     if (argc > 1)
     {
            INFO("Parsing command arguments");
@@ -135,22 +145,71 @@ int main(int argc, char* argv[])
 
     if (process.does_create_exe())
     {
-        CLOCK_START("Loading program into emulator")
+        CLOCK_START("Writing boot image to disk")
+        std::vector<byte> bios = BIOS::rom_image(16, 16, 15);
         RAM *ram = new RAM(16, 0);
-        ROM *rom = new ROM(File("../tests/rom.bin", true), 16, 16);
+        ROM *rom = new ROM(bios.data(), 16, 16);
         Disk *disk = new Disk(File("../tests/disk.bin", true), 32, 32);
+        WriteBootImage(*disk, process.get_exe_file());
+
+        /* The file system lives in the second half of the disk, after the boot image. */
+        try
+        {
+            FileSystem fs_probe(*disk, 16);
+        }
+        catch (const FileSystem::FileSystemException&)
+        {
+            FileSystem::format(*disk, 16, 16, 64);
+        }
+        FileSystem fs(*disk, 16);
 
         Emulator32bit emulator(ram, rom, disk);
-        long long pid = emulator.system_bus.mmu.begin_process();
-        LoadExecutable loader(emulator, process.get_exe_file());
+        BlockDevice block_device(emulator.system_bus, *disk, 0);
+        emulator.system_bus.register_device(32, 32, block_device);
+        Timer timer(&emulator, 1);
+        emulator.system_bus.register_device(33, 33, timer);
+        emulator.timer = &timer;
+        emulator.system_bus.enable_fastmem();
+        emulator.mount(&fs);
+        emulator.power_on();
         CLOCK_END
 
-        DEBUG("Running emulator");
-        CLOCK_START("Running emulator")
-        emulator.run(AEMU_MAX_EXEC_INSTR);
-        CLOCK_END
+        /* Set AEMU_GDB_PORT to debug the guest with GDB instead of running it. */
+        const char *gdb_port = getenv("AEMU_GDB_PORT");
+        if (gdb_port != nullptr)
+        {
+            Debugger debugger(&emulator);
+            GdbStub stub(debugger);
+            if (!stub.serve(atoi(gdb_port)))
+            {
+                printf("Could not listen for GDB on port %s\n", gdb_port);
+            }
+        }
+        else
+        {
+            /* Set AEMU_CACHE_REPORT to model the guest caches and print how they did. */
+            std::unique_ptr<CacheHierarchy> caches;
+            if (getenv("AEMU_CACHE_REPORT") != nullptr)
+            {
+                CacheHierarchy::Config config;
+                config.l1i = {16 * 1024, 4, 32, CacheHierarchy::Replacement::LRU};
+                config.l1d = {16 * 1024, 4, 32, CacheHierarchy::Replacement::LRU};
+                config.l2 = {256 * 1024, 8, 64, CacheHierarchy::Replacement::LRU};
+                caches = std::make_unique<CacheHierarchy>(config);
+                emulator.set_cache_hierarchy(caches.get());
+            }
+
+            DEBUG("Running emulator");
+            CLOCK_START("Running emulator")
+            Emulator32bit::StopReason reason = emulator.run(AEMU_MAX_EXEC_INSTR);
+            CLOCK_END
+            printf("Stopped: %s\n", reason.to_string().c_str());
+            if (caches != nullptr)
+            {
+                printf("%s", caches->report().c_str());
+            }
+        }
         emulator.print();
-        emulator.system_bus.mmu.end_process(pid);
     }
 
     PROFILE_STOP
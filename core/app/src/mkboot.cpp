@@ -0,0 +1,42 @@
+#include "assembler/boot_image.h"
+#include "emulator32bit/disk.h"
+#include "util/file.h"
+
+#include <iostream>
+#include <string>
+
+/*
+    Writes a kernel executable onto a disk file so the BIOS can boot it.
+
+    USAGE: mkboot <kernel.bexe> <disk.bin> [disk pages]
+*/
+
+#define AEMU_MKBOOT_DEFAULT_DISK_PAGES 32
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <kernel.bexe> <disk.bin> [disk pages]\n";
+        return 1;
+    }
+
+    word npages = AEMU_MKBOOT_DEFAULT_DISK_PAGES;
+    if (argc > 3)
+    {
+        npages = std::stoul(argv[3]);
+    }
+
+    Disk disk(File(argv[2], true), npages, 0);
+    try
+    {
+        WriteBootImage(disk, File(argv[1]));
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    disk.save();
+    return 0;
+}
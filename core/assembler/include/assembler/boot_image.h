@@ -0,0 +1,23 @@
+#pragma once
+#ifndef BOOT_IMAGE_H
+#define BOOT_IMAGE_H
+
+#include "emulator32bit/disk.h"
+#include "util/file.h"
+
+/**
+ * @brief             Writes an executable onto disk as a boot image the BIOS can load.
+ *
+ *                     The boot header (see @ref BootHeader) is written to @ref AEMU_BOOT_DISK_PAGE,
+ *                     followed by the .text, .data, and .bss sections, each starting on a new disk
+ *                     page. Section addresses are used as physical load addresses since the BIOS runs
+ *                     without virtual memory. The pages of the image are reserved so they are never
+ *                     handed out by the disk, but the disk is not saved.
+ *
+ * @throws            Disk::DiskWriteException if the image does not fit on the disk.
+ * @param disk         Disk to write the boot image to.
+ * @param exe         Executable to boot.
+ */
+void WriteBootImage(Disk& disk, File exe);
+
+#endif /* BOOT_IMAGE_H */
@@ -2,6 +2,7 @@
 #ifndef LOAD_EXECUTABLE_H
 #define LOAD_EXECUTABLE_H
 
+#include "assembler/object_file.h"
 #include "emulator32bit/emulator32bit.h"
 #include "util/file.h"
 
@@ -10,6 +11,13 @@ class LoadExecutable
     public:
         LoadExecutable(Emulator32bit& emu, File exe_file);
 
+        /**
+         * @brief             Resolves the relocation entries of the .text section of an executable.
+         *
+         * @param obj         Executable to relocate, modified in place.
+         */
+        static void relocate(ObjectFile& obj);
+
     private:
         Emulator32bit& m_emu;
         File m_exe_file;
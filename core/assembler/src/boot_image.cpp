@@ -0,0 +1,74 @@
+#include "assembler/boot_image.h"
+#include "assembler/load_executable.h"
+#include "assembler/object_file.h"
+#include "emulator32bit/bios.h"
+#include "util/logger.h"
+
+#include <algorithm>
+#include <cstring>
+
+void WriteBootImage(Disk& disk, File exe)
+{
+    ObjectFile obj(exe);
+    LoadExecutable::relocate(obj);
+
+    if (obj.string_table.find("_start") == obj.string_table.end()) {
+        ERROR("WriteBootImage() - Missing required _start entry point of program.");
+    }
+
+    BootHeader header;
+    header.entry = obj.symbol_table.at(obj.string_table.at("_start")).symbol_value;
+
+    /* Section contents in load order, .bss is stored as zeroes so the BIOS only has to copy. */
+    std::vector<byte> text;
+    for (word instr : obj.text_section) {
+        for (int i = 0; i < 4; i++) {
+            text.push_back(byte_from_word(instr, i));
+        }
+    }
+    std::vector<byte> bss(obj.bss_section, 0);
+
+    const std::pair<std::string, std::vector<byte>*> sections[] = {
+        {".text", &text},
+        {".data", &obj.data_section},
+        {".bss", &bss},
+    };
+
+    std::vector<std::vector<byte>> pages;
+    word disk_page = AEMU_BOOT_DISK_PAGE + 1;
+    for (const std::pair<std::string, std::vector<byte>*>& section : sections) {
+        const std::vector<byte>& data = *section.second;
+        if (data.empty()) {
+            continue;
+        }
+
+        header.segments[header.nsegments++] = {
+            obj.sections[obj.section_table.at(section.first)].address,
+            disk_page,
+            (word) data.size(),
+        };
+
+        for (size_t offset = 0; offset < data.size(); offset += PAGE_SIZE) {
+            std::vector<byte> page(PAGE_SIZE, 0);
+            std::copy(data.begin() + offset, data.begin() + std::min(offset + PAGE_SIZE, data.size()),
+                    page.begin());
+            pages.push_back(page);
+            disk_page++;
+        }
+    }
+
+    if (disk_page > disk.get_mem_pages()) {
+        throw Disk::DiskWriteException("Boot image of " + std::to_string(disk_page) + " pages does "
+                "not fit on disk of " + std::to_string(disk.get_mem_pages()) + " pages.");
+    }
+
+    std::vector<byte> header_page(PAGE_SIZE, 0);
+    memcpy(header_page.data(), &header, sizeof(header));
+    disk.write_page(AEMU_BOOT_DISK_PAGE, header_page);
+    for (size_t i = 0; i < pages.size(); i++) {
+        disk.write_page(AEMU_BOOT_DISK_PAGE + 1 + i, pages[i]);
+    }
+    disk.reserve_pages(AEMU_BOOT_DISK_PAGE, disk_page - 1);
+
+    INFO("Wrote boot image of %u pages with entry point %x.", disk_page, header.entry);
+}
@@ -7,10 +7,8 @@ LoadExecutable::LoadExecutable(Emulator32bit& emu, File exe_file) : m_emu(emu),
     load();
 }
 
-void LoadExecutable::load()
-{                                            /* For now load starting at address 0 */
-    ObjectFile obj(m_exe_file);
-
+void LoadExecutable::relocate(ObjectFile& obj)
+{
     for (ObjectFile::RelocationEntry& rel : obj.rel_text) {
         ObjectFile::SymbolTableEntry symbol_entry = obj.symbol_table.at(rel.symbol);
 
@@ -40,6 +38,13 @@ void LoadExecutable::load()
                 ERROR("Assembler::fill_local() - Unknown relocation entry type (%d)", (int)rel.type);
         }
     }
+}
+
+void LoadExecutable::load()
+{                                            /* For now load starting at address 0 */
+    ObjectFile obj(m_exe_file);
+
+    relocate(obj);
 
     // text -> data -> bss
     word cur_addr = obj.sections[obj.section_table.at(".text")].address;
@@ -0,0 +1,102 @@
+#pragma once
+#ifndef BIOS_H
+#define BIOS_H
+
+#include "emulator32bit/emulator32bit_util.h"
+
+#include <vector>
+
+/**
+ * @def             AEMU_BOOT_MAGIC
+ * @brief             Magic number ("AEBT" in little endian) at the start of the boot header.
+ */
+#define AEMU_BOOT_MAGIC 0x54424541
+
+/**
+ * @def             AEMU_BOOT_DISK_PAGE
+ * @brief             Disk page the BIOS reads the boot header from.
+ */
+#define AEMU_BOOT_DISK_PAGE 0
+
+/**
+ * @def             AEMU_BOOT_MAX_SEGMENTS
+ * @brief             Maximum number of segments that fit in the boot header page.
+ */
+#define AEMU_BOOT_MAX_SEGMENTS ((PAGE_SIZE - 3 * sizeof(word)) / (3 * sizeof(word)))
+
+/**
+ * @def             AEMU_SYSCALL_BIOS_DISK_READ
+ * @brief             Syscall the BIOS uses to copy pages from disk into physical memory.
+ */
+#define AEMU_SYSCALL_BIOS_DISK_READ 1030
+
+/**
+ * @brief             Layout of the boot header stored at @ref AEMU_BOOT_DISK_PAGE.
+ *
+ * @details         All fields are little endian words. The kernel image follows the header, each
+ *                     segment starting on its own disk page so the BIOS can copy it with a single
+ *                     bulk transfer.
+ *
+ *                     word 0        @ref AEMU_BOOT_MAGIC
+ *                     word 1        physical address of the kernel entry point
+ *                     word 2        number of segments
+ *                     word 3+3i    physical address to load segment i at
+ *                     word 4+3i    first disk page of segment i
+ *                     word 5+3i    size of segment i in bytes
+ */
+struct BootHeader
+{
+    struct Segment
+    {
+        word paddr;
+        word disk_page;
+        word nbytes;
+    };
+
+    word magic = AEMU_BOOT_MAGIC;
+    word entry = 0;
+    word nsegments = 0;
+    Segment segments[AEMU_BOOT_MAX_SEGMENTS];
+};
+
+/**
+ * @brief             Basic Input Output System stored in ROM.
+ *
+ * @details         On power on the processor starts executing at the start of ROM (the reset
+ *                     vector). The BIOS reads the boot header from disk into a scratch page of RAM,
+ *                     copies every segment of the kernel image into RAM with
+ *                     @ref AEMU_SYSCALL_BIOS_DISK_READ, and jumps to the kernel entry point. If
+ *                     the disk does not contain a boot header or a read fails it prints an error
+ *                     and halts.
+ *
+ *                     The BIOS runs with virtual memory disabled, so all addresses are physical.
+ *                     The scratch page is only used during boot, but a kernel segment must not be
+ *                     loaded over it.
+ */
+class BIOS
+{
+    public:
+        /**
+         * @brief             Assembles the BIOS program.
+         *
+         * @param rom_page     First page of ROM, where the BIOS will be stored.
+         * @param scratch_page
+         *                     Page of RAM the boot header is read into.
+         * @return             BIOS program, to be placed at the start of ROM.
+         */
+        static std::vector<byte> assemble(word rom_page, word scratch_page);
+
+        /**
+         * @brief             Assembles the BIOS into a full ROM image.
+         *
+         * @param rom_page     First page of ROM.
+         * @param rom_npages
+         *                     Number of pages of ROM.
+         * @param scratch_page
+         *                     Page of RAM the boot header is read into.
+         * @return             ROM image of rom_npages pages.
+         */
+        static std::vector<byte> rom_image(word rom_page, word rom_npages, word scratch_page);
+};
+
+#endif /* BIOS_H */
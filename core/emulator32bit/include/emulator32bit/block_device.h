@@ -0,0 +1,113 @@
+#pragma once
+#ifndef BLOCK_DEVICE_H
+#define BLOCK_DEVICE_H
+
+#include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/device.h"
+#include "emulator32bit/disk.h"
+#include "emulator32bit/system_bus.h"
+
+/**
+ * @def             AEMU_BLK_MAGIC
+ * @brief             Value of the magic register, 'AEBD' in little endian.
+ */
+#define AEMU_BLK_MAGIC 0x44424541
+
+/* Register offsets from the start of the device page. */
+#define AEMU_BLK_REG_MAGIC 0x00                        /* R: AEMU_BLK_MAGIC. */
+#define AEMU_BLK_REG_CAPACITY 0x04                    /* R: number of disk pages. */
+#define AEMU_BLK_REG_QUEUE_ADDR 0x08                /* RW: physical address of the descriptor ring. */
+#define AEMU_BLK_REG_QUEUE_SIZE 0x0C                /* RW: number of descriptors in the ring. */
+#define AEMU_BLK_REG_DOORBELL 0x10                    /* W: index one past the last available descriptor. */
+#define AEMU_BLK_REG_USED 0x14                        /* R: index one past the last completed descriptor. */
+#define AEMU_BLK_REG_ISR 0x18                        /* R: pending interrupt status, W: 1s to acknowledge. */
+
+/* Request types. */
+#define AEMU_BLK_T_READ 0                            /* Disk to guest RAM. */
+#define AEMU_BLK_T_WRITE 1                            /* Guest RAM to disk. */
+
+/* Request status, written back into the descriptor. */
+#define AEMU_BLK_S_OK 0
+#define AEMU_BLK_S_IOERR 1
+#define AEMU_BLK_S_UNSUPP 2
+
+/* ISR bits. */
+#define AEMU_BLK_ISR_USED 1                            /* Descriptors were completed. */
+#define AEMU_BLK_ISR_ERROR 2                        /* The doorbell was past the end of the ring, nothing was processed. */
+
+/**
+ * @brief             Request descriptor as laid out in guest RAM.
+ */
+struct BlockRequest
+{
+    word type;                                        /* AEMU_BLK_T_*. */
+    word disk_page;                                    /* First disk page. */
+    word paddr;                                        /* Page aligned physical address of the guest buffer. */
+    word npages;                                    /* Number of pages to transfer. */
+    word status;                                    /* Written by the device, AEMU_BLK_S_*. */
+};
+
+/**
+ * @brief             Block device with a request ring in guest RAM, modelled on virtio-blk.
+ *
+ * @details         Instead of mapping every disk byte onto the bus, the guest places an array of
+ *                     @ref BlockRequest descriptors in RAM, points the device at it, fills in
+ *                     requests and writes the index one past the last filled descriptor to the
+ *                     doorbell. The device processes every descriptor between the used and doorbell
+ *                     indices in one batch, transferring whole pages between the disk file and guest
+ *                     frames, writes each status back, advances the used index, sets the ISR and
+ *                     raises its interrupt line on the bus.
+ *
+ *                     Indices count up freely and are taken modulo the queue size, so the ring never
+ *                     needs resetting. A doorbell more than the queue size past the used index sets
+ *                     @ref AEMU_BLK_ISR_ERROR instead. The device occupies one page of the physical
+ *                     address space.
+ */
+class BlockDevice : public Device
+{
+    public:
+        /**
+         * @brief             Constructs a block device.
+         *
+         * @param bus         Bus to transfer guest frames on.
+         * @param disk         Disk backing the device.
+         * @param irq         Interrupt line raised on completion.
+         */
+        BlockDevice(SystemBus& bus, Disk& disk, word irq);
+
+        byte read_byte(word address) override;
+        hword read_hword(word address) override;
+        word read_word(word address) override;
+
+        /* Registers are only writable a word at a time, narrower writes are ignored. */
+        void write_byte(word address, byte value) override;
+        void write_hword(word address, hword value) override;
+        void write_word(word address, word value) override;
+
+    private:
+        SystemBus& m_bus;
+        Disk& m_disk;
+        word m_irq;
+
+        word m_queue_addr = 0;
+        word m_queue_size = 0;
+        word m_used = 0;
+        word m_isr = 0;
+
+        /**
+         * @brief             Processes available descriptors up to the doorbell index.
+         *
+         * @param avail     Index one past the last available descriptor.
+         */
+        void process_queue(word avail);
+
+        /**
+         * @brief             Performs a single request.
+         *
+         * @param request     Request read from guest RAM.
+         * @return             AEMU_BLK_S_* status of the request.
+         */
+        word process_request(const BlockRequest& request);
+};
+
+#endif /* BLOCK_DEVICE_H */
@@ -0,0 +1,264 @@
+#pragma once
+#ifndef CACHE_HIERARCHY_H
+#define CACHE_HIERARCHY_H
+
+#include "emulator32bit/emulator32bit_util.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @def             AEMU_CACHE_BATCH
+ * @brief             Number of accesses recorded before they are handed to the simulation.
+ */
+#define AEMU_CACHE_BATCH 4096
+
+/**
+ * @def             AEMU_CACHE_MAX_QUEUED
+ * @brief             Number of full batches the processor can get ahead of the simulation thread
+ *                     before it waits for it.
+ */
+#define AEMU_CACHE_MAX_QUEUED 16
+
+/**
+ * @brief             Model of a guest memory hierarchy, split L1 instruction and data caches
+ *                     backed by an optional unified L2, for seeing how guest code uses caches.
+ *
+ * @details         Set with @ref Emulator32bit::set_cache_hierarchy. The processor then records
+ *                     every instruction fetch, load and store it makes, with the program counter
+ *                     of the instruction making it, and does nothing else with them. Records are
+ *                     collected in batches of @ref AEMU_CACHE_BATCH and simulated on a thread of
+ *                     their own, so the processor only pays for appending to a buffer and the
+ *                     simulation overlaps with execution. The results are the same as simulating
+ *                     inline, since the batches are simulated in order.
+ *
+ *                     Caches are write allocate and do not model write backs. An access spanning
+ *                     lines accesses each of them. A miss in an L1 accesses the L2, if there is
+ *                     one. Misses are attributed to the symbol whose range holds the program
+ *                     counter of the access, see @ref CacheHierarchy::add_symbol.
+ *
+ *                     Addresses are the ones the program used, virtual if translation is on, so
+ *                     the caches behave as if virtually indexed and tagged.
+ */
+class CacheHierarchy
+{
+    public:
+        class Exception : public std::exception
+        {
+            private:
+                std::string message;
+
+            public:
+                Exception(const std::string& msg);
+
+                const char* what() const noexcept override;
+        };
+
+        enum class Replacement
+        {
+            LRU,                                    /* Evict the least recently used line */
+            FIFO,                                    /* Evict the line filled first */
+            RANDOM,                                    /* Evict a pseudo random line, the same on every run */
+        };
+
+        /**
+         * @brief             Geometry of one cache. The number of sets, size / (ways * line_size),
+         *                     and the line size must be powers of 2.
+         */
+        struct CacheConfig
+        {
+            word size = 0;                            /* Bytes, 0 if there is no such cache */
+            word ways = 1;
+            word line_size = 32;                    /* Bytes */
+            Replacement replacement = Replacement::LRU;
+        };
+
+        struct Config
+        {
+            CacheConfig l1i;
+            CacheConfig l1d;
+            CacheConfig l2;
+            bool threaded = true;                    /* Simulate on a thread, otherwise when a batch fills */
+        };
+
+        enum Level
+        {
+            L1I,
+            L1D,
+            L2,
+            NUM_LEVELS,
+        };
+
+        /* Kinds of access the processor records. */
+        enum AccessKind : byte
+        {
+            FETCH,
+            READ,
+            WRITE,
+        };
+
+        struct Stats
+        {
+            unsigned long long accesses = 0;
+            unsigned long long misses = 0;
+        };
+
+        struct SymbolStats
+        {
+            std::string name;
+            word lo;
+            word hi;
+            Stats levels[NUM_LEVELS];
+        };
+
+        /**
+         * @brief             Constructs the caches, all lines invalid.
+         *
+         * @throws            Exception if a cache has an invalid geometry, or there are no L1 caches.
+         */
+        CacheHierarchy(const Config& config);
+        ~CacheHierarchy();
+
+        CacheHierarchy(const CacheHierarchy&) = delete;
+        CacheHierarchy& operator=(const CacheHierarchy&) = delete;
+
+        /**
+         * @brief             Records an access, called by the processor.
+         *
+         * @param pc         Address of the instruction making it.
+         * @param address     Address of the first byte accessed.
+         * @param kind         Fetch, read or write.
+         * @param n_bytes     Number of bytes accessed.
+         */
+        inline void record(word pc, word address, AccessKind kind, byte n_bytes)
+        {
+            m_batch[m_batch_size++] = {pc, address, kind, n_bytes};
+            if (UNLIKELY(m_batch_size == AEMU_CACHE_BATCH))
+            {
+                submit();
+            }
+        }
+
+        /**
+         * @brief             Waits until every recorded access has been simulated.
+         */
+        void flush();
+
+        /**
+         * @brief             Attributes the misses of accesses made by instructions in a range of
+         *                     addresses to a symbol. Ranges should not overlap.
+         *
+         * @param name         Name the symbol is reported as.
+         * @param lo         First address of the symbol.
+         * @param hi         Address after the last byte of the symbol.
+         */
+        void add_symbol(const std::string& name, word lo, word hi);
+
+        /**
+         * @brief             Accesses and misses of a cache, after flushing.
+         */
+        Stats get_stats(Level level);
+
+        /**
+         * @brief             Accesses and misses of each symbol, in address order, after flushing.
+         *                     Accesses made outside every symbol are not included.
+         */
+        std::vector<SymbolStats> get_symbol_stats();
+
+        /**
+         * @brief             Table of the stats of each cache and the symbols with misses, after
+         *                     flushing.
+         */
+        std::string report();
+
+        /**
+         * @brief             Invalidates every line and zeroes the stats, after flushing.
+         */
+        void clear();
+
+    private:
+        struct Record
+        {
+            word pc;
+            word address;
+            AccessKind kind;
+            byte n_bytes;
+        };
+
+        /**
+         * @brief             Set associative cache of line addresses.
+         */
+        class Cache
+        {
+            public:
+                Cache(const CacheConfig& config, const char *name);
+
+                inline bool is_present() const
+                {
+                    return m_ways != 0;
+                }
+
+                inline word get_line_psize() const
+                {
+                    return m_line_psize;
+                }
+
+                /**
+                 * @brief     Looks up the line holding an address, filling it on a miss.
+                 *
+                 * @return     Whether it hit.
+                 */
+                bool access(word address);
+
+                void clear();
+
+            private:
+                static constexpr word INVALID = ~0U;
+
+                word m_ways = 0;
+                word m_line_psize = 0;
+                word m_set_mask = 0;
+                Replacement m_replacement = Replacement::LRU;
+                std::vector<word> m_lines;                        /* Line address of each way of each set */
+                std::vector<unsigned long long> m_stamps;        /* Last use for LRU, fill for FIFO */
+                unsigned long long m_clock = 0;
+                word m_random = 1;
+        };
+
+        Cache m_caches[NUM_LEVELS];
+        Stats m_stats[NUM_LEVELS];
+        std::vector<SymbolStats> m_symbols;                    /* Sorted by lo */
+        word m_last_symbol = 0;                                /* Symbol the last access was in, checked first */
+
+        std::vector<Record> m_batch;
+        word m_batch_size = 0;
+
+        bool m_threaded;
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_work_cv;                    /* A batch was queued or the thread should stop */
+        std::condition_variable m_done_cv;                    /* A batch was simulated */
+        std::deque<std::vector<Record>> m_queue;
+        std::vector<std::vector<Record>> m_free;            /* Simulated batches to reuse */
+        bool m_busy = false;                                /* The thread is simulating a batch */
+        bool m_stop = false;
+
+        /**
+         * @brief             Hands the current batch to the simulation and starts a new one.
+         */
+        void submit();
+
+        void simulate(const std::vector<Record>& batch);
+        void simulate_thread();
+
+        /**
+         * @brief             Symbol holding an address, nullptr if there is none.
+         */
+        SymbolStats* find_symbol(word pc);
+};
+
+#endif /* CACHE_HIERARCHY_H */
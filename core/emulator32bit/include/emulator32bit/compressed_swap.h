@@ -0,0 +1,132 @@
+#pragma once
+#ifndef COMPRESSED_SWAP_H
+#define COMPRESSED_SWAP_H
+
+#include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/disk.h"
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @def             AEMU_SWAP_MAX_COMPRESSED
+ * @brief             Largest size in bytes a page is kept in the pool at once compressed. Pages that
+ *                     compress worse go straight to disk, they would barely save any memory.
+ */
+#define AEMU_SWAP_MAX_COMPRESSED (PAGE_SIZE * 3 / 4)
+
+/**
+ * @brief             Compressed in memory tier for swapped out anonymous pages, in front of the
+ *                     @ref Disk, like zram.
+ *
+ * @details         Set with @ref VirtualMemory::set_compressed_swap. Evicted pages are compressed
+ *                     with a small LZ77 codec into a pool in host memory, under the swap disk page
+ *                     @ref VirtualMemory gave them, so the disk page stays reserved for when the
+ *                     page has to go to disk after all. Pages of all zeroes are only recorded as
+ *                     such. Once the compressed pages no longer fit in the pool, the oldest are
+ *                     written to their disk pages to make room. Faulting a page in takes it out of
+ *                     the pool.
+ *
+ *                     File backed pages bypass the pool, they have to end up in the file anyway.
+ */
+class CompressedSwap
+{
+    public:
+        struct Stats
+        {
+            unsigned long long stored_pages = 0;        /* Pages in the pool now, zero pages included */
+            unsigned long long zero_pages = 0;            /* Pages of all zeroes in the pool now */
+            unsigned long long stored_bytes = 0;        /* Uncompressed bytes of the pages in the pool */
+            unsigned long long compressed_bytes = 0;    /* Pool bytes they take */
+            unsigned long long incompressible_pages = 0;    /* Pages ever sent straight to disk */
+            unsigned long long spilled_pages = 0;        /* Pages ever written to disk to make room */
+            unsigned long long pool_hits = 0;            /* Pages ever faulted back in from the pool */
+        };
+
+        /**
+         * @brief             Constructs an empty pool.
+         *
+         * @param disk         Disk pages spill to, must outlive the pool.
+         * @param pool_size Bytes of compressed pages the pool holds at most.
+         */
+        CompressedSwap(Disk& disk, word pool_size);
+
+        /**
+         * @brief             Swaps a page out to the pool, or to disk if it does not compress.
+         *
+         * @param diskpage     Swap disk page reserved for the page.
+         * @param data         Page of @ref PAGE_SIZE bytes.
+         * @return             Number of pages written to disk, for charging disk time.
+         */
+        word store(word diskpage, const byte *data);
+
+        /**
+         * @brief             Takes a page out of the pool.
+         *
+         * @param diskpage     Swap disk page of the page.
+         * @param dst         Buffer of @ref PAGE_SIZE bytes.
+         * @return             False if the page is not in the pool, so it is on disk.
+         */
+        bool load(word diskpage, byte *dst);
+
+        /**
+         * @brief             Drops a page that is no longer needed, if it is in the pool.
+         */
+        void discard(word diskpage);
+
+        inline bool contains(word diskpage) const
+        {
+            return m_slots.find(diskpage) != m_slots.end();
+        }
+
+        inline const Stats& get_stats() const
+        {
+            return m_stats;
+        }
+
+        /**
+         * @brief             Compresses a buffer.
+         *
+         * @param src         Bytes to compress.
+         * @param n_bytes     Number of bytes.
+         * @param dst         Buffer to compress to.
+         * @param capacity     Size of dst.
+         * @return             Compressed size, 0 if it does not fit in capacity.
+         */
+        static word compress(const byte *src, word n_bytes, byte *dst, word capacity);
+
+        /**
+         * @brief             Decompresses a buffer made by @ref compress.
+         *
+         * @param src         Compressed bytes.
+         * @param n_bytes     Number of compressed bytes.
+         * @param dst         Buffer to decompress to.
+         * @param size         Size the data decompresses to.
+         * @return             False if src is corrupt or does not decompress to exactly size bytes.
+         */
+        static bool decompress(const byte *src, word n_bytes, byte *dst, word size);
+
+    private:
+        struct Slot
+        {
+            std::vector<byte> data;                    /* Compressed page, empty for zero pages */
+            std::list<word>::iterator age;            /* Position in m_order, compressed pages only */
+        };
+
+        Disk& m_disk;
+        word m_pool_size;
+        word m_used = 0;                            /* Bytes of compressed pages in the pool */
+        std::unordered_map<word, Slot> m_slots;        /* Swap disk page to its slot */
+        std::list<word> m_order;                    /* Compressed pages, oldest first */
+        Stats m_stats;
+
+        /**
+         * @brief             Writes the oldest compressed page to its disk page.
+         */
+        void spill();
+
+        void erase(std::unordered_map<word, Slot>::iterator it);
+};
+
+#endif /* COMPRESSED_SWAP_H */
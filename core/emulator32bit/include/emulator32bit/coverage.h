@@ -0,0 +1,98 @@
+#pragma once
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include "emulator32bit/emulator32bit_util.h"
+
+#include <memory>
+#include <vector>
+
+/**
+ * @def             AEMU_COVERAGE_MAP_SIZE
+ * @brief             Size of the edge coverage bitmap in bytes, the default map size of AFL++.
+ */
+#define AEMU_COVERAGE_MAP_SIZE (1 << 16)
+
+/**
+ * @def             AEMU_AFL_SHM_ENV
+ * @brief             Environment variable AFL++ passes the System V shared memory id of its
+ *                     bitmap in.
+ */
+#define AEMU_AFL_SHM_ENV "__AFL_SHM_ID"
+
+/**
+ * @brief             Edge coverage bitmap filled in by the processor on every taken branch, for
+ *                     coverage guided fuzzing of guest programs.
+ *
+ * @details         Each taken b, bl, bx or blx hashes its (branch site, target) pair to a byte of
+ *                     the bitmap and increments it, skipping 0 on overflow so a hit edge never
+ *                     reads as unhit. The layout and counting match what AFL++ expects of an
+ *                     instrumented target, so the bitmap can be AFL++'s own shared memory, see
+ *                     @ref Coverage::from_afl.
+ *
+ *                     Set with @ref Emulator32bit::set_coverage. Without it the branch
+ *                     instructions are not instrumented at all.
+ */
+class Coverage
+{
+    public:
+        /**
+         * @brief             Coverage into a private, zeroed bitmap.
+         */
+        Coverage();
+
+        /**
+         * @brief             Coverage into an existing bitmap of @ref AEMU_COVERAGE_MAP_SIZE bytes,
+         *                     which must outlive this.
+         */
+        Coverage(byte *map);
+
+        ~Coverage();
+
+        Coverage(const Coverage&) = delete;
+        Coverage& operator=(const Coverage&) = delete;
+
+        /**
+         * @brief             Attaches to the bitmap of the AFL++ instance that started this process.
+         *
+         * @return             nullptr if @ref AEMU_AFL_SHM_ENV is not set, the segment could not be
+         *                     attached, or shared memory is not supported on this platform.
+         */
+        static std::unique_ptr<Coverage> from_afl();
+
+        inline void edge(word site, word target)
+        {
+            byte& count = m_map[(hash(site) ^ (hash(target) >> 1)) & (AEMU_COVERAGE_MAP_SIZE - 1)];
+            count++;
+            count += (count == 0);
+        }
+
+        inline byte* get_map()
+        {
+            return m_map;
+        }
+
+        /**
+         * @brief             Zeroes the bitmap, done by the fuzzer between runs.
+         */
+        void clear();
+
+        /**
+         * @brief             Number of distinct edges hit since the last clear, up to collisions.
+         */
+        word count_edges() const;
+
+    private:
+        byte *m_map;
+        std::vector<byte> m_owned;                    /* Backs m_map for a private bitmap */
+        void *m_shm = nullptr;                        /* Attached segment to detach, if any */
+
+        static inline word hash(word address)
+        {
+            /* Instructions are word aligned, so the low bits carry nothing. */
+            word x = (address >> 2) * 0x9E3779B1U;
+            return x ^ (x >> 16);
+        }
+};
+
+#endif /* COVERAGE_H */
@@ -0,0 +1,154 @@
+#pragma once
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include "emulator32bit/emulator32bit.h"
+#include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/system_bus.h"
+
+#include <map>
+#include <vector>
+
+/**
+ * @brief             Breakpoints and watchpoints on a processor, with no cost to the run loop.
+ *
+ * @details         A breakpoint replaces the instruction at its address with a brk, which stops
+ *                     the run as @ref Emulator32bit::StopReason::BREAKPOINT with the program
+ *                     counter at it. The replaced instruction is kept here, so
+ *                     @ref Debugger::read_memory shows it and @ref Debugger::resume runs it before
+ *                     putting the brk back. Breakpoints can only be set in writable memory.
+ *
+ *                     A watchpoint marks the pages it covers as watched on the @ref SystemBus, which
+ *                     takes their direct pointers away. Only accesses to those pages go through
+ *                     the slow path, where the debugger checks them against the watched ranges.
+ *                     A hit stops the run as @ref Emulator32bit::StopReason::WATCHPOINT after the
+ *                     accessing instruction completes. Instruction fetches from a page watched for
+ *                     reads are checked too, so watching code reports its fetches.
+ *
+ *                     Addresses are physical. The guest sees a brk if it reads an instruction a
+ *                     breakpoint replaced, and overwrites the breakpoint if it writes there.
+ */
+class Debugger : public WatchListener
+{
+    public:
+        /**
+         * @brief             Attaches to a processor, whose bus reports watched accesses here.
+         *
+         * @param processor Processor to debug. Must outlive the debugger.
+         */
+        Debugger(Emulator32bit *processor);
+
+        /**
+         * @brief             Removes every breakpoint and watchpoint.
+         */
+        ~Debugger();
+
+        Debugger(const Debugger&) = delete;
+        Debugger& operator=(const Debugger&) = delete;
+
+        /**
+         * @return             False if the address is not word aligned or not in writable memory.
+         */
+        bool insert_breakpoint(word address);
+
+        /**
+         * @return             False if there is no breakpoint at the address.
+         */
+        bool remove_breakpoint(word address);
+
+        inline bool has_breakpoint(word address) const
+        {
+            return m_breakpoints.find(address) != m_breakpoints.end();
+        }
+
+        /**
+         * @param address     First byte watched.
+         * @param n_bytes     Number of bytes watched, at least 1.
+         * @param access     AEMU_WATCH_* bits of the accesses that stop the run.
+         * @return             False if a watched page has no device.
+         */
+        bool insert_watchpoint(word address, word n_bytes, byte access);
+
+        /**
+         * @return             False if no watchpoint was inserted with the same arguments.
+         */
+        bool remove_watchpoint(word address, word n_bytes, byte access);
+
+        /**
+         * @brief             Runs the processor, first stepping over a breakpoint at the program
+         *                     counter so resuming from one does not stop at it again.
+         *
+         * @param instructions Number of instructions to run, if 0 run until a trap.
+         */
+        Emulator32bit::StopReason resume(unsigned long long instructions);
+
+        inline Emulator32bit::StopReason step()
+        {
+            return resume(1);
+        }
+
+        /**
+         * @brief             Reads physical memory the way it was before breakpoints were inserted.
+         *
+         * @return             False if an address has no device, the rest is read as 0.
+         */
+        bool read_memory(word address, byte *dst, word n_bytes);
+
+        /**
+         * @brief             Writes physical memory, keeping breakpoints in place.
+         *
+         * @return             False if an address has no device or is read only.
+         */
+        bool write_memory(word address, const byte *src, word n_bytes);
+
+        /**
+         * @brief             Address and AEMU_WATCH_* bits of the watchpoint that stopped the last run.
+         */
+        inline word get_watch_address() const
+        {
+            return m_hit_address;
+        }
+
+        inline byte get_watch_access() const
+        {
+            return m_hit_access;
+        }
+
+        inline Emulator32bit* get_processor()
+        {
+            return processor;
+        }
+
+        void watch_access(word address, word n_bytes, byte access) override;
+
+    private:
+        Emulator32bit *processor;
+
+        std::map<word, word> m_breakpoints;            /* Address to the instruction the brk replaced */
+
+        struct Watchpoint
+        {
+            word address;
+            word n_bytes;
+            byte access;
+        };
+        std::vector<Watchpoint> m_watchpoints;
+
+        word m_hit_address = 0;
+        byte m_hit_access = 0;
+        bool m_quiet = false;                        /* Set while accessing memory on our own behalf */
+
+        /**
+         * @brief             Recomputes the watch bits of a range of pages from the watchpoints.
+         *
+         * @return             False if a page has no device.
+         */
+        bool update_watch(word page_lo, word page_hi);
+
+        /**
+         * @brief             Writes an instruction without reporting watched accesses.
+         */
+        void patch(word address, word instr);
+};
+
+#endif /* DEBUGGER_H */
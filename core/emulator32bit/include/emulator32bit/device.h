@@ -0,0 +1,85 @@
+#pragma once
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include "emulator32bit/emulator32bit_util.h"
+
+#include <memory>
+
+class SystemBus;
+
+/**
+ * @brief             Anything that can be attached to the @ref SystemBus at a range of physical
+ *                     pages, like memory, disk, or memory mapped I/O.
+ *
+ * @details         Accesses to the pages a device is registered at are forwarded to the read and
+ *                     write callbacks with the full physical address. A device can also expose a
+ *                     page as direct memory by returning a host pointer to the page from
+ *                     @ref Device::get_direct_read or @ref Device::get_direct_write, in which case
+ *                     the bus reads/writes the host memory itself without calling the device. Plain
+ *                     memory exposes all of its pages this way so adding devices does not slow down
+ *                     RAM accesses.
+ *
+ *                     Direct pointers and @ref Device::is_read_only are queried when the device is
+ *                     registered. A device that changes them afterwards has to call
+ *                     @ref SystemBus::update_direct, or @ref Device::direct_changed.
+ */
+class Device
+{
+    public:
+        /**
+         * @brief             Detaches the device from the pages of the bus it is registered at, if
+         *                     the bus still exists.
+         */
+        virtual ~Device();
+
+        virtual byte read_byte(word address) = 0;
+        virtual hword read_hword(word address) = 0;
+        virtual word read_word(word address) = 0;
+        virtual void write_byte(word address, byte value) = 0;
+        virtual void write_hword(word address, hword value) = 0;
+        virtual void write_word(word address, word value) = 0;
+
+        /**
+         * @brief             Host memory that reads of a page can be served from.
+         *
+         * @param page         Physical page.
+         * @return             Pointer to the first byte of the page, nullptr if reads have to go
+         *                     through the read callbacks.
+         */
+        virtual byte* get_direct_read(word page);
+
+        /**
+         * @brief             Host memory that writes to a page can be made to.
+         *
+         * @param page         Physical page.
+         * @return             Pointer to the first byte of the page, nullptr if writes have to go
+         *                     through the write callbacks.
+         */
+        virtual byte* get_direct_write(word page);
+
+        /**
+         * @brief             Whether writes to a page are rejected. The bus reports them as a fault
+         *                     at the address instead of calling the write callbacks.
+         *
+         * @param page         Physical page.
+         */
+        virtual bool is_read_only(word page);
+
+    protected:
+        /**
+         * @brief             Has the bus the device is registered at query the direct pointers of a
+         *                     range of pages again. Does nothing if it is not registered.
+         *
+         * @param page_lo     First physical page of the range.
+         * @param page_hi     Last physical page of the range, inclusive.
+         */
+        void direct_changed(word page_lo, word page_hi);
+
+    private:
+        /* Set by SystemBus::register_device, points at nullptr once the bus is destroyed. */
+        std::shared_ptr<SystemBus*> m_bus;
+        friend class SystemBus;
+};
+
+#endif /* DEVICE_H */
@@ -7,7 +7,9 @@
 #include "emulator32bit/fbl.h"
 #include "util/file.h"
 
+#include <cstdio>
 #include <fstream>
+#include <unordered_map>
 
 /**
  * @def             AEMU_DISK_CACHE_PSIZE
@@ -76,6 +78,27 @@ class Disk : public BaseMemory
                 const char* what() const noexcept override;
         };
 
+        /**
+         * @brief             How changes are made durable once journaling, see @ref set_journal.
+         *                     Larger groups and no fsync trade how much a crash can lose for fewer,
+         *                     larger log writes.
+         */
+        struct JournalConfig
+        {
+            word group_commit = 32;                    /* Records batched per commit, 1 commits every change */
+            bool fsync = true;                        /* fsync the log on commit, else the OS decides */
+            word checkpoint_bytes = 1 << 22;        /* Log size that triggers a checkpoint */
+        };
+
+        struct JournalStats
+        {
+            unsigned long long records = 0;            /* Page writes and free page changes logged */
+            unsigned long long commits = 0;
+            unsigned long long fsyncs = 0;
+            unsigned long long checkpoints = 0;
+            unsigned long long recovered_records = 0;    /* Records replayed when the disk was opened */
+        };
+
         /**
          * @brief             Get a free disk page that is not currently in use.
          *
@@ -92,6 +115,9 @@ class Disk : public BaseMemory
         /**
          * @brief             Returns a disk page back into the free page list.
          *
+         *                     A hole is punched in the disk file at the page, so it no longer takes
+         *                     space, where the file system supports it.
+         *
          * @todo             TODO: The returned exception should be a disk exception to wrap the
          *                     internal implementation (free block list) and to limit/make more
          *                     specific what exceptions can actually occur as a result of this request.
@@ -105,8 +131,9 @@ class Disk : public BaseMemory
         /**
          * @brief             Returns all disk pages back to the free page list.
          *
-         *                     This will essentially wipe the disk fully, though the contents of the
-         *                     pages that were in disk will still remain in disk memory.
+         *                     This will essentially wipe the disk fully. Like any returned page, the
+         *                     pages stop taking space in the disk file where the file system can
+         *                     punch holes, and read as zeros.
          */
         virtual void return_all_pages();
 
@@ -126,6 +153,18 @@ class Disk : public BaseMemory
          */
         virtual void return_pages(word page_lo, word page_hi);
 
+        /**
+         * @brief             Marks all pages in a specific range as in use.
+         *
+         *                     Used for pages with a fixed location, like the boot image, so they
+         *                     are never handed out by @ref Disk::get_free_page(). Pages in the range
+         *                     that are already in use are not an error.
+         *
+         * @param page_lo     Lowest page address to reserve.
+         * @param page_hi     Highest page address to reserve.
+         */
+        virtual void reserve_pages(word page_lo, word page_hi);
+
         /**
          * @brief             Reads a disk page.
          *
@@ -139,10 +178,23 @@ class Disk : public BaseMemory
          */
         virtual std::vector<byte> read_page(word page);
 
+        /**
+         * @brief             Reads a run of consecutive disk pages with a single file read.
+         *
+         *                     Pages that are dirty in cache are copied from cache, so the result is
+         *                     the same as calling @ref Disk::read_page for every page.
+         *
+         * @throws            DiskReadException if the pages are out of range or the read fails.
+         * @param page         First disk page to read.
+         * @param npages     Number of pages to read.
+         * @param dst         Buffer of npages * @ref PAGE_SIZE bytes to read to.
+         */
+        virtual void read_pages(word page, word npages, byte *dst);
+
         /**
          * @brief             Reads a byte from disk.
          *
-         * @param address     Full address of byte to read.
+         * @param address     Physical address of byte to read.
          * @param exception ReadException if the read fails. TODO: specify what exceptions can
          *                     occur.
          * @return             Byte located at the address in disk.
@@ -152,7 +204,7 @@ class Disk : public BaseMemory
         /**
          * @brief             Reads a half word (2 bytes) from disk.
          *
-         * @param address     Full address of hword to read.
+         * @param address     Physical address of hword to read.
          * @param exception ReadException if the read fails. TODO: specify what exceptions can
          *                     occur.
          * @return             Half word located at the address in disk in little endian format.
@@ -162,7 +214,7 @@ class Disk : public BaseMemory
         /**
          * @brief             Reads a word (4 bytes) from disk.
          *
-         * @param address     Full address of word to read.
+         * @param address     Physical address of word to read.
          * @param exception ReadException if the read fails. TODO: specify what exceptions can
          *                     occur.
          * @return             Word located at the address in disk in little endian format.
@@ -181,10 +233,22 @@ class Disk : public BaseMemory
          */
         virtual void write_page(word page, std::vector<byte>);
 
+        /**
+         * @brief             Writes a run of consecutive disk pages with a single file write.
+         *
+         *                     Cached copies of the pages are updated and marked clean.
+         *
+         * @throws            DiskWriteException if the pages are out of range or the write fails.
+         * @param page         First disk page to write.
+         * @param npages     Number of pages to write.
+         * @param src         Buffer of npages * @ref PAGE_SIZE bytes to write.
+         */
+        virtual void write_pages(word page, word npages, const byte *src);
+
         /**
          * @brief             Writes a byte to disk.
          *
-         * @param address     Full address of the location to write the byte to.
+         * @param address     Physical address of the location to write the byte to.
          * @param data         Byte to write.
          * @param exception WriteException if the write fails. TODO: specify what exceptions can
          *                     occur.
@@ -194,7 +258,7 @@ class Disk : public BaseMemory
         /**
          * @brief             Writes a half word (2 bytes) to disk in little endian format.
          *
-         * @param address     Full address of the location to write the half word to.
+         * @param address     Physical address of the location to write the half word to.
          * @param data         Half word to write.
          * @param exception WriteException if the write fails. TODO: specify what exceptions can
          *                     occur.
@@ -204,19 +268,138 @@ class Disk : public BaseMemory
         /**
          * @brief             Writes a word (4 bytes) to disk in little endian format.
          *
-         * @param address     Full address of the location to write the word to.
+         * @param address     Physical address of the location to write the word to.
          * @param data         Word to write.
          * @param exception WriteException if the write fails. TODO: specify what exceptions can
          *                     occur.
          */
         void write_word(word address, word data) override;
 
+        /**
+         * @brief             Cache frame of a disk page, while it is resident.
+         *
+         *                     Registered on the @ref SystemBus, accesses to resident pages are served
+         *                     from their frames like RAM and only the others go through the read and
+         *                     write callbacks, which bring them into the cache. The bus is told when a
+         *                     frame is loaded, evicted or changes between clean and dirty.
+         *
+         * @param page         Physical page, the disk page plus the disk's first page.
+         * @return             Frame of the page, nullptr if it is not in cache.
+         */
+        byte* get_direct_read(word page) override;
+
+        /**
+         * @brief             Cache frame of a disk page, while it is resident and dirty.
+         *
+         *                     The first write to a clean frame goes through the write callbacks to
+         *                     mark it dirty, so a frame written to directly is always written back
+         *                     when it is evicted or saved.
+         *
+         * @param page         Physical page, the disk page plus the disk's first page.
+         * @return             Frame of the page, nullptr if it is not in cache or is clean.
+         */
+        byte* get_direct_write(word page) override;
+
         /**
          * @brief             Saves the simulated disk to file.
          *
          *                     Saves both the disk file and free page management to file.
          */
         virtual void save();
+
+        /**
+         * @brief             Starts journaling changes to a write ahead log, the disk file's .wal file.
+         *
+         *                     Page writes leaving the cache and free page changes are logged, then
+         *                     committed to the log in groups, and only reach the disk file and its
+         *                     .info file after their commit. The .info file is only rewritten at
+         *                     checkpoints, which also empty the log. A disk opened with a log left
+         *                     over replays every complete commit in it, so a crash loses at most the
+         *                     changes since the last commit.
+         */
+        void set_journal(const JournalConfig& config);
+
+        /**
+         * @brief             Commits every change so far to the log, dirty cache pages included.
+         *                     Does nothing unless journaling.
+         */
+        void sync();
+
+        /**
+         * @brief             Commits, writes the committed pages and free pages to the disk file
+         *                     and .info file, and empties the log. Does nothing unless journaling.
+         */
+        void checkpoint();
+
+        inline const JournalStats& get_journal_stats() const
+        {
+            return m_journal_stats;
+        }
+
+        /**
+         * @brief             Bytes of storage the disk file takes, which is less than its
+         *                     logical size of @ref get_logical_bytes when it is sparse.
+         */
+        unsigned long long get_allocated_bytes() const;
+
+        inline unsigned long long get_logical_bytes() const
+        {
+            return (unsigned long long) m_npages << PAGE_PSIZE;
+        }
+
+    protected:
+        /**
+         * @brief             Constructs a disk whose pages are not stored as is in diskfile, like
+         *                     @ref OverlayDisk. The file is not created or padded.
+         *
+         *                     Free pages are read from diskfile's .info file, or from
+         *                     initial_manager if there is none yet.
+         */
+        Disk(File diskfile, word npages, word lo_page, const File& initial_manager);
+
+        /**
+         * @brief             Reads pages from where the disk stores them, bypassing the cache.
+         *
+         * @return             False if the read fails.
+         */
+        virtual bool read_backing(word page, word npages, byte *dst);
+
+        /**
+         * @brief             Writes pages to where the disk stores them, bypassing the cache.
+         *
+         * @return             False if the write fails.
+         */
+        virtual bool write_backing(word page, word npages, const byte *src);
+
+        /**
+         * @brief             Frees the storage of returned pages, punching a hole in the disk file.
+         *
+         * @return             False if the file system cannot.
+         */
+        virtual bool discard_backing(word page, word npages);
+
+        /**
+         * @brief             Punches a hole in a file with fallocate, keeping its size.
+         *
+         * @return             False if the file system or platform cannot.
+         */
+        static bool punch_hole(const std::string& path, std::streamoff offset, std::streamoff length);
+
+        /**
+         * @brief             Drops every cached page, dirty ones without writing them back.
+         */
+        void invalidate_cache();
+
+        /**
+         * @brief             Replaces the free pages with the ones saved in a disk manager file.
+         */
+        void reload_free_pages(const File& manager_file);
+
+        inline std::streamsize get_npages() const
+        {
+            return m_npages;
+        }
+
     private:
         /**
          * @brief             Disk page located in cache
@@ -247,6 +430,61 @@ class Disk : public BaseMemory
 
         FreeBlockList m_free_list;                ///< Disk manager, which pages are free to use
 
+        bool m_sparse = true;                    ///< Whether to punch holes for returned pages
+
+        FILE *m_wal = nullptr;                    ///< Write ahead log if journaling
+        JournalConfig m_journal_config;
+        JournalStats m_journal_stats;
+        std::vector<byte> m_wal_group;            ///< Records not committed yet
+        word m_wal_group_records = 0;
+        long m_wal_size = 0;                    ///< Bytes committed to the log since the last checkpoint
+        std::unordered_map<word, std::vector<byte>> m_wal_pages;    ///< Pages in m_wal_group, newest data
+
+        /**
+         * @brief             Marks a cache page dirty, handing its frame to the bus for writes.
+         */
+        void set_dirty(CachePage& cpage);
+
+        /**
+         * @brief             Marks a cache page clean, so the bus stops writing to its frame.
+         */
+        void set_clean(CachePage& cpage);
+
+        /**
+         * @brief             Has the bus query the frame of a disk page again.
+         */
+        inline void frame_changed(word page)
+        {
+            direct_changed(start_page + page, start_page + page);
+        }
+
+        /**
+         * @brief             Drops any copies of returned pages and frees their storage.
+         */
+        void discard_pages(word page, word npages);
+
+        /**
+         * @brief             Appends a record to the current group, committing it when full.
+         *
+         * @param data         Page data for page writes, nullptr for free page changes.
+         */
+        void log_record(word type, word page, word npages, const byte *data);
+
+        /**
+         * @brief             Commits the current group to the log, then writes its pages in place.
+         */
+        void commit_group();
+
+        /**
+         * @brief             Replays the complete commits of a log left over from a crash.
+         */
+        void recover_journal();
+
+        /**
+         * @brief             Writes the free page list to the .info file, replacing it atomically.
+         */
+        void write_disk_manager_file();
+
         /**
          * @brief             Reads a specified size little endian value from disk.
          *
@@ -316,8 +554,11 @@ class Disk : public BaseMemory
         /**
          * @brief             Reads and sets up the disk free page list from save file.
          * @note             Called from @ref Disk::read_disk_files()
+         *
+         * @param manager_file Disk manager file to read, all pages are free if it has no valid
+         *                     header.
          */
-        void read_disk_manager_file();
+        void read_disk_manager_file(const File& manager_file);
 };
 
 /**
@@ -332,13 +573,16 @@ class MockDisk : public Disk
         void return_page(word page) override;
         void return_all_pages() override;
         void return_pages(word p_addr_lo, word p_addr_hi) override;
+        void reserve_pages(word p_addr_lo, word p_addr_hi) override;
 
         std::vector<byte> read_page(word page) override;
+        void read_pages(word page, word npages, byte *dst) override;
         byte read_byte(word address) override;
         hword read_hword(word addressn) override;
         word read_word(word address) override;
 
         void write_page(word page, std::vector<byte>) override;
+        void write_pages(word page, word npages, const byte *src) override;
         void write_byte(word address, byte data) override;
         void write_hword(word address, hword data) override;
         void write_word(word address, word data) override;
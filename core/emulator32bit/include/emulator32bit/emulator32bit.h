@@ -2,15 +2,22 @@
 #ifndef EMULATOR32BIT_H
 #define EMULATOR32BIT_H
 
+#include "emulator32bit/cache_hierarchy.h"
 #include "emulator32bit/disk.h"
 #include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/file_system.h"
 #include "emulator32bit/memory.h"
+#include "emulator32bit/syscall_table.h"
 #include "emulator32bit/system_bus.h"
 
+#include <atomic>
 #include <string>
+#include <vector>
 
 class MMU;  /* Forward declare from 'better_virtual_memory.h' */
 class Timer; /* Forward declare from 'timer.h' */
+class Coverage; /* Forward declare from 'coverage.h' */
+class BlockVectors; /* Forward declare from 'sampler.h' */
 
 /**
  * @brief                    IDs for special registers
@@ -64,9 +71,21 @@ std::string disassemble_instr(word instr);
 class Emulator32bit
 {
     public:
+        /**
+         * @brief            How the CPU translates the addresses its instructions access. Fixed at
+         *                     construction, since the run loop is instantiated once per mode.
+         */
+        enum class AddressTranslation
+        {
+            PHYSICAL,                                    /* Bare metal, addresses are physical and VirtualMemory is ignored */
+            VIRTUAL_MEMORY,                                /* Translated by VirtualMemory while it is enabled */
+        };
+
         Emulator32bit();
-        Emulator32bit(word ram_npages, word ram_start_page, const byte rom_data[], word rom_npages, word rom_start_page);
-        Emulator32bit(RAM *ram, ROM *rom, Disk *disk);
+        Emulator32bit(word ram_npages, word ram_start_page, const byte rom_data[], word rom_npages, word rom_start_page,
+                AddressTranslation translation = AddressTranslation::VIRTUAL_MEMORY);
+        Emulator32bit(RAM *ram, ROM *rom, Disk *disk,
+                AddressTranslation translation = AddressTranslation::VIRTUAL_MEMORY);
         ~Emulator32bit();
         void print();
 
@@ -102,6 +121,47 @@ class Emulator32bit
                 const char* what() const noexcept override;
         };
 
+        /**
+         * @brief            Why @ref Emulator32bit::run returned.
+         *
+         *                     Traps leave the program counter at the instruction that raised them, and
+         *                     that instruction is not counted in @ref StopReason::instructions. The
+         *                     faulting load or store of a FAULT has no effect on registers, so after
+         *                     the host maps the address, calling run again retries it.
+         */
+        struct StopReason
+        {
+            enum Type
+            {
+                HALT,                                    /* hlt instruction */
+                FAULT,                                    /* Access to an unmapped address, see address */
+                SYSCALL_EXIT,                            /* exit syscall, code is the exit status */
+                BUDGET_EXHAUSTED,                        /* Ran the requested number of instructions */
+                BAD_INSTR,                                /* Undecodable instruction */
+                BAD_SYSCALL,                            /* Unregistered syscall, code is the syscall number */
+                FAILED_ASSERT,                            /* emu_assert* syscall failed */
+                BLOCKED,                                /* Syscall waiting on an event, retried on resume */
+                IDLE,                                    /* Spinning in a loop no pending event can end, pc is its head */
+                BREAKPOINT,                                /* brk instruction a @ref Debugger patched in, pc is at it */
+                WATCHPOINT,                                /* Access to a watched address, code is the address, pc is after the access */
+            };
+
+            Type type = BUDGET_EXHAUSTED;
+            word pc = 0;                                /* Program counter when execution stopped */
+            word address = 0;                            /* Faulting address if FAULT */
+            word code = 0;
+            unsigned long long instructions = 0;        /* Instructions completed by this call to run */
+            unsigned long long skipped_instructions = 0;    /* Part of instructions fast forwarded in spin loops */
+            unsigned long long cycles = 0;                /* Cycles elapsed by this call if timing is on, see set_timing */
+
+            /* Macro-op fusion, see @ref Emulator32bit::set_fusion */
+            unsigned long long fusion_candidates = 0;    /* cmp and sub instructions that could start a group */
+            unsigned long long fused_groups = 0;        /* Groups run as one fused handler */
+            unsigned long long fused_instructions = 0;    /* Instructions retired inside fused groups */
+
+            std::string to_string() const;
+        };
+
         enum class ConditionCode
         {
             EQ = 0,                 /* Equal                        : Z==1 */
@@ -142,17 +202,240 @@ class Emulator32bit
         VirtualMemory *mmu;
         SystemBus system_bus;
 
-        Timer *timer;
+        /**
+         * @brief            Timer fired by the run loop at its deadline, see @ref Timer. Set it after
+         *                     registering the timer on the bus, nullptr if there is none.
+         */
+        Timer *timer = nullptr;
+
+        /**
+         * @brief            System calls made with the swi instruction, indexed by the value of
+         *                     register NR. Host code can register additional syscalls at runtime.
+         */
+        SyscallTable syscalls;
+
+        /**
+         * @brief            File system the file syscalls operate on, nullptr if none is mounted.
+         *                     Not owned by the emulator.
+         */
+        FileSystem *file_system = nullptr;
 
         word _pagedir;                                  /* Pointer to Page directory for virtual address space. */
 
         /**
          * @brief            Run the emulator for a given number of instructions
          *
-         * @param             instructions: Number of instructions to run, if 0 run until HLT instruction or exception is thrown
-         * @throws            Exception
+         *                     Instructions do not throw to stop execution. They raise a trap with
+         *                     @ref raise_trap, or the bus records a fault, and the loop checks for
+         *                     either once per instruction. Execution can be resumed by calling run
+         *                     again.
+         *
+         * @param             instructions: Number of instructions to run, if 0 run until a trap
+         * @return             Why execution stopped.
+         */
+        StopReason run(unsigned long long instructions);
+
+        /**
+         * @brief            Runs one time slice, for host schedulers that multiplex many emulators
+         *                     on a thread.
+         *
+         *                     Stops after budget instructions or at the first trap, whichever comes
+         *                     first, and does no I/O of its own. Machine state is always at an
+         *                     instruction boundary when it returns, so slices of different emulators
+         *                     can be interleaved freely. A BLOCKED syscall is retried by the next
+         *                     slice, so a scheduler should skip the emulator until whatever it waits
+         *                     on, like an interrupt, has happened.
+         *
+         * @param             budget: Maximum number of instructions to retire.
+         * @return             Why the slice ended and how many instructions it retired.
+         */
+        StopReason step_slice(unsigned long long budget);
+
+        /**
+         * @brief            Turns macro-op fusion on or off. On by default.
+         *
+         *                     When on, the run loop recognizes a cmp followed by a b, and a sub
+         *                     followed by a cmp and a b, and runs each group as one handler that
+         *                     compares and branches directly, instead of dispatching every
+         *                     instruction and decoding the condition from the flags. The flags are
+         *                     still written, so the result is the same either way. Groups never
+         *                     cross a page or the instruction budget.
+         */
+        inline void set_fusion(bool enabled)
+        {
+            _fusion_enabled = enabled;
+            _fusion = enabled && _coverage == nullptr && _block_vectors == nullptr;
+        }
+
+        /**
+         * @brief            Cycles each kind of instruction takes in timing mode, see
+         *                     @ref Emulator32bit::set_timing. The defaults are loosely those of a
+         *                     small in order core with single cycle RAM.
+         */
+        struct Latencies
+        {
+            word alu = 1;                                /* Arithmetic, logic, compares, moves, adrp, nop */
+            word mul = 3;                                /* mul, umull, smull */
+            word fp = 3;                                /* Floating point, except divide and square root */
+            word fp_div = 14;                            /* vdiv, vsqrt */
+            word load = 2;                                /* ldr, ldrb, ldrh from memory */
+            word store = 1;                                /* str, strb, strh to memory */
+            word swap = 3;                                /* swp, swpb, swph */
+            word branch = 1;                            /* b, bl, bx, blx, taken or not */
+            word branch_taken = 2;                        /* Added when a branch is taken */
+            word syscall = 20;                            /* swi, not counting what the handler does */
+            word device_access = 10;                    /* Added per access to a device other than memory */
+            word disk_fault = 100000;                    /* Added per page moved between memory and disk */
+        };
+
+        /**
+         * @brief            Turns timing mode on or off. Off by default.
+         *
+         *                     In timing mode guest time, see @ref get_time, counts cycles instead of
+         *                     instructions. Each instruction adds the latency of its kind, so the
+         *                     @ref Timer fires, and guests read the time, in cycles. Accesses to
+         *                     devices other than memory and pages the virtual memory moves to or
+         *                     from disk are charged by the bus as they happen. The run loop is
+         *                     instantiated with and without timing, so it costs nothing when off, and
+         *                     an add and a compare per instruction when on.
+         *
+         *                     Guest time carries on from its current value in the new unit.
+         *
+         * @param             enabled: Whether to count cycles.
+         * @param             latencies: Cycles per kind of instruction, the defaults if not given.
+         * @param             guest_time: Whether guest time counts the cycles. If not, cycles are
+         *                     only counted for @ref get_cycles and the guest runs exactly as with
+         *                     timing off, which lets a run be measured without changing it.
+         */
+        void set_timing(bool enabled, const Latencies& latencies, bool guest_time = true);
+        void set_timing(bool enabled);
+
+        inline bool is_timing() const
+        {
+            return _timing;
+        }
+
+        /**
+         * @brief            Cycles counted while timing was on since the last reset.
+         */
+        inline unsigned long long get_cycles() const
+        {
+            return _cycle_base + _cycles;
+        }
+
+        /**
+         * @brief            Records every taken branch in a coverage bitmap, see @ref Coverage.
+         *
+         *                     The branch instructions in the instruction table are switched to
+         *                     instrumented versions, and back when turned off, so no branch pays
+         *                     for coverage unless it is on. Fusion is suspended while coverage is on,
+         *                     since fused groups branch without going through the table.
+         *
+         * @param             coverage: Bitmap to record into, must outlive its use. nullptr turns
+         *                     coverage off.
+         */
+        void set_coverage(Coverage *coverage);
+
+        /**
+         * @brief            Counts the instructions of each basic block executed in a basic block
+         *                     vector, see @ref BlockVectors.
+         *
+         *                     Uses the same instrumented branches as @ref set_coverage, and
+         *                     suspends fusion the same way.
+         *
+         * @param             vectors: Vector to count into, must outlive its use. nullptr stops
+         *                     counting.
+         */
+        void set_block_vectors(BlockVectors *vectors);
+
+        /**
+         * @brief            Reports every instruction fetch, load and store to a model of the
+         *                     guest caches, see @ref CacheHierarchy.
+         *
+         *                     Slices run with an access policy that records each access before
+         *                     making it, so nothing is recorded unless a hierarchy is set.
+         *                     Instructions fast forwarded in spin loops are not recorded, and the
+         *                     instructions fusion looks ahead at are recorded as fetches even when
+         *                     they do not fuse.
+         *
+         * @param             caches: Hierarchy to report to, must outlive its use. nullptr stops
+         *                     reporting. Takes effect from the next slice.
+         */
+        inline void set_cache_hierarchy(CacheHierarchy *caches)
+        {
+            _caches = caches;
+        }
+
+        /**
+         * @brief            Stops @ref run after the current instruction.
+         *
+         *                     Used by instructions and syscall handlers instead of throwing. Only the
+         *                     first trap raised during an instruction is kept.
+         *
+         * @param             type: Reported as @ref StopReason::type.
+         * @param             code: Reported as @ref StopReason::code.
+         */
+        inline void raise_trap(StopReason::Type type, word code = 0)
+        {
+            if (!_trap_pending)
+            {
+                _trap_pending = true;
+                _trap_type = type;
+                _trap_code = code;
+                _loop_work = true;
+            }
+        }
+
+        /**
+         * @brief            Guest time, the number of instructions retired since the last reset,
+         *                     including instructions fast forwarded in spin loops. Counts cycles
+         *                     instead while timing is on, see @ref set_timing.
+         */
+        inline unsigned long long get_time() const
+        {
+            return _time_base + (_cycle_time ? _cycles : _retired);
+        }
+
+        /**
+         * @brief            Has the run loop read the timer deadline again after the current
+         *                     instruction. Called by the timer when it is reprogrammed.
+         */
+        inline void reschedule()
+        {
+            _reschedule = true;
+            _loop_work = true;
+        }
+
+        /**
+         * @brief            Processor state and RAM contents, see @ref save_snapshot.
+         */
+        struct Snapshot
+        {
+            dword x[NUM_REG];
+            word pc;
+            word pstate;
+            word pagedir;
+            unsigned long long time;
+            unsigned long long cycles;
+            word pending_irqs;
+            std::vector<byte> ram;
+        };
+
+        /**
+         * @brief            Copies the registers, guest time, pending interrupts and RAM.
+         *
+         *                     Meant for rerunning a program from a point, like @ref Sampler does.
+         *                     Devices, ROM, the disk and the virtual memory manager are not
+         *                     captured, so a program that writes the disk, swaps pages or reads
+         *                     a device whose state matters does not rerun the same way. Must be
+         *                     called between slices.
+         */
+        Snapshot save_snapshot();
+
+        /**
+         * @brief            Puts back a state copied with @ref save_snapshot, between slices.
          */
-        void run(unsigned long long instructions);
+        void restore_snapshot(const Snapshot& snapshot);
 
         /**
          * @brief            Resets the processor state
@@ -160,6 +443,24 @@ class Emulator32bit
          */
         void reset();
 
+        /**
+         * @brief            Cold boots the emulator.
+         *
+         *                     Resets the processor state and sets the program counter to the reset
+         *                     vector, the start of ROM, where the BIOS is expected to be stored.
+         * @see                BIOS
+         */
+        void power_on();
+
+        /**
+         * @brief            Mounts a file system for the file syscalls.
+         *
+         *                     Attaches the file system to the system bus so file reads and writes see
+         *                     pages that guests have mapped with mmap.
+         * @param             fs: File system, must outlive the emulator or be unmounted first.
+         */
+        void mount(FileSystem *fs);
+
         inline void set_pc(word pc)
         {
             _pc = pc;
@@ -212,6 +513,16 @@ class Emulator32bit
             return test_bit(_pstate, flag);
         }
 
+        inline word get_pstate()
+        {
+            return _pstate;
+        }
+
+        inline void set_pstate(word pstate)
+        {
+            _pstate = pstate;
+        }
+
         /* @todo determine if fp registers are needed */
         // word fpcr;
         // word fpsr;
@@ -226,17 +537,448 @@ class Emulator32bit
         word _pc;                                        /* Program counter */
         word _pstate;                                    /* Program state. Bits 0-3 are NZCV flags. Rest are TODO */
 
+        bool _trap_pending = false;                        /* Set by @ref raise_trap, stops @ref run */
+        bool _loop_work = false;                        /* Run loop has to check for traps, spins or a new deadline */
+        bool _reschedule = false;                        /* Set by @ref reschedule */
+        unsigned long long _time_base = 0;                /* Guest time at the start of the slice */
+        unsigned long long _retired = 0;                /* Instructions retired in the slice */
+        StopReason::Type _trap_type = StopReason::HALT;
+        word _trap_code = 0;
+
         static constexpr int _num_instructions = 64;
         typedef void (Emulator32bit::*InstructionFunction)(word);
         InstructionFunction _instructions[_num_instructions];
 
+        /* Timing mode, see set_timing. */
+        bool _timing = false;
+        bool _cycle_time = false;                        /* Guest time counts cycles */
+        unsigned long long _cycle_base = 0;                /* Cycles counted before the slice */
+        unsigned long long _cycles = 0;                    /* Cycles elapsed in the slice */
+        unsigned long long _cycle_limit = ~0ULL;        /* _cycles the loop runs to before firing the timer */
+        word _step_cycles = 0;                            /* Cycles of the current step, not in _cycles yet */
+        word _latency[_num_instructions];                /* Cycles of each opcode */
+        word _taken_latency = 0;
+
         // note, stringstreams cannot use the static const for some reason
         #define _INSTR(func_name, opcode) \
         private: void _##func_name(word instr); \
         public: static const byte _op_##func_name = opcode;
         void fill_out_instructions();
 
-        word calc_mem_addr(word xn, sword offset, byte addr_mode);
+        /* Loads, stores and swaps, instantiated once per access policy below. */
+        #define _MEM_INSTR(func_name, opcode) \
+        private: template <typename Access> void _##func_name(word instr); \
+        public: static const byte _op_##func_name = opcode;
+
+        /* Branches, instantiated with and without coverage, see set_coverage. */
+        #define _BRANCH_INSTR(func_name, opcode) \
+        private: template <bool Traced> void _##func_name(word instr); \
+        public: static const byte _op_##func_name = opcode;
+
+        /**
+         * @brief            Address accessed by a load or store. Does not write back the base
+         *                     register, see @ref writeback_mem_addr.
+         *
+         * @return            False, after raising a BAD_INSTR trap, if the address mode is invalid.
+         */
+        bool calc_mem_addr(byte xn, sword offset, byte addr_mode, word& mem_addr);
+
+        /**
+         * @brief            Updates the base register of a pre or post indexed load or store. Done
+         *                     after the access so a faulting access leaves the base unchanged.
+         */
+        inline void writeback_mem_addr(byte xn, sword offset, byte addr_mode)
+        {
+            if (addr_mode != ADDR_OFFSET)
+            {
+                write_reg(xn, read_reg(xn) + offset);
+            }
+        }
+
+        const AddressTranslation _translation;
+
+        /**
+         * Base of the fast memory region while it can be used, nullptr to go through the bus. With
+         * VIRTUAL_MEMORY translation only physical mode accesses can use it, so it is refreshed
+         * whenever translation could have been turned on or off: at the start of a slice and
+         * after every syscall.
+         */
+        byte *_fastmem = nullptr;
+
+        inline void update_fastmem()
+        {
+            FastMemory *fastmem = system_bus.get_fastmem();
+            _fastmem = (fastmem != nullptr && (_translation == AddressTranslation::PHYSICAL ||
+                    !mmu->is_translating())) ? fastmem->get_base() : nullptr;
+        }
+
+        /**
+         * @brief            Runs the instruction at the program counter through the bus after its
+         *                     fast memory access faulted on the host.
+         *
+         * @return            Whether it completed without a trap or fault.
+         */
+        bool retry_host_fault();
+
+        /*
+         * Access policies of the memory instructions and the run loop. Each has fetch, read and
+         * write functions taking the emulator, and is chosen once per slice, so the checks the
+         * others need are compiled out of it.
+         *
+         * The fence keeps the compiler from moving the bus fault check an instruction does after
+         * a fast memory access before it, since a host fault sets the fault from the signal
+         * handler.
+         */
+        #define FASTMEM_FENCE() std::atomic_signal_fence(std::memory_order_seq_cst)
+
+        /* Bare metal through the bus, with no translation. */
+        struct PhysicalAccess
+        {
+            static inline word fetch(Emulator32bit& emu, word address)
+            {
+                return emu.system_bus.read_word_aligned_ram<PhysicalTranslation>(address);
+            }
+            static inline byte read_byte(Emulator32bit& emu, word address)
+            {
+                return emu.system_bus.read_byte<PhysicalTranslation>(address);
+            }
+            static inline hword read_hword(Emulator32bit& emu, word address)
+            {
+                return emu.system_bus.read_hword<PhysicalTranslation>(address);
+            }
+            static inline word read_word(Emulator32bit& emu, word address)
+            {
+                return emu.system_bus.read_word<PhysicalTranslation>(address);
+            }
+            static inline void write_byte(Emulator32bit& emu, word address, byte value)
+            {
+                emu.system_bus.write_byte<PhysicalTranslation>(address, value);
+            }
+            static inline void write_hword(Emulator32bit& emu, word address, hword value)
+            {
+                emu.system_bus.write_hword<PhysicalTranslation>(address, value);
+            }
+            static inline void write_word(Emulator32bit& emu, word address, word value)
+            {
+                emu.system_bus.write_word<PhysicalTranslation>(address, value);
+            }
+        };
+
+        /* Bare metal through the fast memory region, which must be enabled. */
+        struct FastPhysicalAccess
+        {
+            static inline word fetch(Emulator32bit& emu, word address)
+            {
+                return read_word(emu, address);
+            }
+            static inline byte read_byte(Emulator32bit& emu, word address)
+            {
+                byte val = emu._fastmem[address];
+                FASTMEM_FENCE();
+                return val;
+            }
+            static inline hword read_hword(Emulator32bit& emu, word address)
+            {
+                hword val = *((hword*) (emu._fastmem + address));
+                FASTMEM_FENCE();
+                return val;
+            }
+            static inline word read_word(Emulator32bit& emu, word address)
+            {
+                word val = *((word*) (emu._fastmem + address));
+                FASTMEM_FENCE();
+                return val;
+            }
+            static inline void write_byte(Emulator32bit& emu, word address, byte value)
+            {
+                emu._fastmem[address] = value;
+                FASTMEM_FENCE();
+            }
+            static inline void write_hword(Emulator32bit& emu, word address, hword value)
+            {
+                *((hword*) (emu._fastmem + address)) = value;
+                FASTMEM_FENCE();
+            }
+            static inline void write_word(Emulator32bit& emu, word address, word value)
+            {
+                *((word*) (emu._fastmem + address)) = value;
+                FASTMEM_FENCE();
+            }
+        };
+
+        /* Through fast memory while translation is off, otherwise through the translating bus. */
+        struct VirtualMemoryAccess
+        {
+            static inline word fetch(Emulator32bit& emu, word address)
+            {
+                if (LIKELY(emu._fastmem != nullptr))
+                {
+                    return FastPhysicalAccess::fetch(emu, address);
+                }
+                return emu.system_bus.read_word_aligned_ram(address);
+            }
+            static inline byte read_byte(Emulator32bit& emu, word address)
+            {
+                if (LIKELY(emu._fastmem != nullptr))
+                {
+                    return FastPhysicalAccess::read_byte(emu, address);
+                }
+                return emu.system_bus.read_byte(address);
+            }
+            static inline hword read_hword(Emulator32bit& emu, word address)
+            {
+                if (LIKELY(emu._fastmem != nullptr))
+                {
+                    return FastPhysicalAccess::read_hword(emu, address);
+                }
+                return emu.system_bus.read_hword(address);
+            }
+            static inline word read_word(Emulator32bit& emu, word address)
+            {
+                if (LIKELY(emu._fastmem != nullptr))
+                {
+                    return FastPhysicalAccess::read_word(emu, address);
+                }
+                return emu.system_bus.read_word(address);
+            }
+            static inline void write_byte(Emulator32bit& emu, word address, byte value)
+            {
+                if (LIKELY(emu._fastmem != nullptr))
+                {
+                    FastPhysicalAccess::write_byte(emu, address, value);
+                    return;
+                }
+                emu.system_bus.write_byte(address, value);
+            }
+            static inline void write_hword(Emulator32bit& emu, word address, hword value)
+            {
+                if (LIKELY(emu._fastmem != nullptr))
+                {
+                    FastPhysicalAccess::write_hword(emu, address, value);
+                    return;
+                }
+                emu.system_bus.write_hword(address, value);
+            }
+            static inline void write_word(Emulator32bit& emu, word address, word value)
+            {
+                if (LIKELY(emu._fastmem != nullptr))
+                {
+                    FastPhysicalAccess::write_word(emu, address, value);
+                    return;
+                }
+                emu.system_bus.write_word(address, value);
+            }
+        };
+
+        /* Records each access to the cache hierarchy, then makes it like the policies above. */
+        struct TracedAccess
+        {
+            static inline bool is_bare(Emulator32bit& emu)
+            {
+                return emu._translation == AddressTranslation::PHYSICAL && emu._fastmem == nullptr;
+            }
+            static inline word fetch(Emulator32bit& emu, word address)
+            {
+                emu._caches->record(emu._pc, address, CacheHierarchy::FETCH, 4);
+                return is_bare(emu) ? PhysicalAccess::fetch(emu, address) : VirtualMemoryAccess::fetch(emu, address);
+            }
+            static inline byte read_byte(Emulator32bit& emu, word address)
+            {
+                emu._caches->record(emu._pc, address, CacheHierarchy::READ, 1);
+                return is_bare(emu) ? PhysicalAccess::read_byte(emu, address) :
+                        VirtualMemoryAccess::read_byte(emu, address);
+            }
+            static inline hword read_hword(Emulator32bit& emu, word address)
+            {
+                emu._caches->record(emu._pc, address, CacheHierarchy::READ, 2);
+                return is_bare(emu) ? PhysicalAccess::read_hword(emu, address) :
+                        VirtualMemoryAccess::read_hword(emu, address);
+            }
+            static inline word read_word(Emulator32bit& emu, word address)
+            {
+                emu._caches->record(emu._pc, address, CacheHierarchy::READ, 4);
+                return is_bare(emu) ? PhysicalAccess::read_word(emu, address) :
+                        VirtualMemoryAccess::read_word(emu, address);
+            }
+            static inline void write_byte(Emulator32bit& emu, word address, byte value)
+            {
+                emu._caches->record(emu._pc, address, CacheHierarchy::WRITE, 1);
+                if (is_bare(emu))
+                {
+                    PhysicalAccess::write_byte(emu, address, value);
+                    return;
+                }
+                VirtualMemoryAccess::write_byte(emu, address, value);
+            }
+            static inline void write_hword(Emulator32bit& emu, word address, hword value)
+            {
+                emu._caches->record(emu._pc, address, CacheHierarchy::WRITE, 2);
+                if (is_bare(emu))
+                {
+                    PhysicalAccess::write_hword(emu, address, value);
+                    return;
+                }
+                VirtualMemoryAccess::write_hword(emu, address, value);
+            }
+            static inline void write_word(Emulator32bit& emu, word address, word value)
+            {
+                emu._caches->record(emu._pc, address, CacheHierarchy::WRITE, 4);
+                if (is_bare(emu))
+                {
+                    PhysicalAccess::write_word(emu, address, value);
+                    return;
+                }
+                VirtualMemoryAccess::write_word(emu, address, value);
+            }
+        };
+
+        enum class AccessPolicy
+        {
+            NONE,
+            PHYSICAL,
+            FAST_PHYSICAL,
+            VIRTUAL_MEMORY,
+            TRACED,
+        };
+        AccessPolicy _access = AccessPolicy::NONE;        /* Policy of the memory instructions in _instructions */
+
+        /**
+         * @brief            Points the memory instructions in the instruction table at their
+         *                     instantiation for a policy.
+         */
+        void select_access(AccessPolicy access);
+
+        /**
+         * @brief            Policy the run loop and memory instructions use for the current state.
+         */
+        AccessPolicy current_access();
+
+        /**
+         * @brief            Body of @ref step_slice for one access policy.
+         *
+         * @return            Number of instructions retired.
+         */
+        template <typename Access, bool Timed>
+        void run_slice(unsigned long long budget, StopReason& reason);
+
+        /**
+         * @brief            Slow path of the run loop after an instruction raised a trap, faulted,
+         *                     took a spin check or reprogrammed the timer.
+         *
+         * @param             budget: Budget of the slice.
+         * @param             limit: Retired count the loop runs to before firing the timer, updated.
+         * @param             pending: Instructions of the current step not counted in _retired yet,
+         *                     taking _step_cycles.
+         * @return            Whether the loop should go on.
+         */
+        bool handle_loop_work(unsigned long long budget, unsigned long long& limit, word pending,
+                StopReason& reason);
+
+        /**
+         * @brief            Retired count the loop can run to before the timer deadline or budget.
+         *                     In timing mode the deadline is in cycles and set as _cycle_limit
+         *                     instead.
+         */
+        unsigned long long event_limit(unsigned long long budget);
+
+        /*
+         * Spin loop detection. Taken backward branches of at most AEMU_SPIN_MAX_LOOP instructions
+         * are tracked by their source and target. Every so often the loop is checked: if its body has no
+         * stores, syscalls or calls, and a whole iteration left the registers and flags as they
+         * were, it only reads memory that nothing but a timer event can change, so guest time is
+         * fast forwarded by whole iterations to the timer deadline. With no deadline it would spin
+         * forever, and the slice stops as IDLE instead.
+         */
+        #define AEMU_SPIN_MAX_LOOP 8
+        #define AEMU_SPIN_MAX_BACKOFF 1024
+        word _spin_head = 1;                            /* Target of the tracked backward branch, unaligned if none */
+        word _spin_tail = 0;                            /* Address of the branch */
+        word _spin_countdown = 0;                        /* Branches left until the next check */
+        word _spin_backoff = 0;                            /* Branches between checks, doubles on a miss */
+        bool _spin_check = false;                        /* A check is due, see handle_loop_work */
+        bool _spin_scanned = false;                        /* _spin_pure is known */
+        bool _spin_pure = false;                        /* Body only reads memory */
+        bool _spin_have_snapshot = false;
+        unsigned long long _spin_snapshot_time = 0;        /* _retired when the snapshot was taken */
+        unsigned long long _spin_snapshot_cycles = 0;    /* _cycles when the snapshot was taken */
+        word _spin_snapshot_pstate = 0;
+        dword _spin_snapshot_x[NUM_REG];
+
+        inline void note_backward_branch(word branch, word target)
+        {
+            if (LIKELY(target == _spin_head))
+            {
+                /* Any other branch to the head skips or adds to the body that was checked. */
+                if (LIKELY(branch == _spin_tail) && UNLIKELY(--_spin_countdown == 0))
+                {
+                    _spin_check = true;
+                    _loop_work = true;
+                }
+                return;
+            }
+
+            if (target > branch || branch - target > (AEMU_SPIN_MAX_LOOP - 1) * 4)
+            {
+                return;
+            }
+            _spin_head = target;
+            _spin_tail = branch;
+            _spin_countdown = 2;
+            _spin_backoff = 2;
+            _spin_scanned = false;
+            _spin_have_snapshot = false;
+        }
+
+        /**
+         * @brief            Checks the tracked loop, see above.
+         *
+         * @return            Whether the loop should go on, false if the slice stops as IDLE.
+         */
+        bool check_spin(unsigned long long limit, word pending, StopReason& reason);
+
+        /**
+         * @brief            Whether a loop body only reads memory and registers.
+         */
+        bool loop_is_pure(word head, word tail);
+
+        bool _fusion = true;                            /* Fusion is enabled and not suspended by tracing */
+        bool _fusion_enabled = true;
+
+        Coverage *_coverage = nullptr;
+        BlockVectors *_block_vectors = nullptr;
+        CacheHierarchy *_caches = nullptr;
+
+        /**
+         * @brief            Points the branch instructions in the instruction table at their
+         *                     instrumented or plain instantiation.
+         */
+        void select_branches(bool traced);
+
+        /**
+         * @brief            Switches the branches and fusion after coverage or block vectors
+         *                     were set.
+         */
+        void update_tracing();
+
+        /**
+         * @brief            Reports a taken branch to coverage and block vectors, whichever are set.
+         */
+        inline void trace_branch(word site, word target);
+
+        /**
+         * @brief            Runs the fused group starting with the instruction at the program
+         *                     counter, if there is one.
+         *
+         * @param             instr: Instruction at the program counter, already fetched.
+         * @param             remaining: Instructions left in the budget.
+         * @return            Number of instructions retired, 0 if no group starts here.
+         */
+        template <typename Access>
+        word run_fused(word instr, unsigned long long remaining, StopReason& reason);
+
+        /* Fused handlers, given the instructions of the group. They update the program counter. */
+        void _fused_cmp_b(word cmp, word b);
+        void _fused_sub_cmp_b(word sub, word cmp, word b);
 
         inline void execute(word instr)
         {
@@ -336,22 +1078,23 @@ class Emulator32bit
         _INSTR(mov, 0b100010)
         _INSTR(mvn, 0b100011)
 
-        _INSTR(ldr, 0b100100)
-        _INSTR(ldrb, 0b100101)
-        _INSTR(ldrh, 0b100110)
-        _INSTR(str, 0b100111)
-        _INSTR(strb, 0b101000)
-        _INSTR(strh, 0b101001)
-        _INSTR(swp, 0b101010)
-        _INSTR(swpb, 0b101011)
-        _INSTR(swph, 0b101100)
-        _INSTR(b, 0b101101)
-        _INSTR(bl, 0b101110)
-        _INSTR(bx, 0b101111)
-        _INSTR(blx, 0b110000)
+        _MEM_INSTR(ldr, 0b100100)
+        _MEM_INSTR(ldrb, 0b100101)
+        _MEM_INSTR(ldrh, 0b100110)
+        _MEM_INSTR(str, 0b100111)
+        _MEM_INSTR(strb, 0b101000)
+        _MEM_INSTR(strh, 0b101001)
+        _MEM_INSTR(swp, 0b101010)
+        _MEM_INSTR(swpb, 0b101011)
+        _MEM_INSTR(swph, 0b101100)
+        _BRANCH_INSTR(b, 0b101101)
+        _BRANCH_INSTR(bl, 0b101110)
+        _BRANCH_INSTR(bx, 0b101111)
+        _BRANCH_INSTR(blx, 0b110000)
         _INSTR(swi, 0b110001)
 
         _INSTR(adrp, 0b110010)
+        _INSTR(brk, 0b110011)
 
         // _INSTR(nop_, 0b110100)
         // _INSTR(nop_, 0b110101)
@@ -368,6 +1111,8 @@ class Emulator32bit
         _INSTR(nop, 0b111111)
 
         #undef _INSTR
+        #undef _MEM_INSTR
+        #undef _BRANCH_INSTR
 
         /* Software Interrupt Handling */
         void _emu_print();
@@ -379,11 +1124,27 @@ class Emulator32bit
         void _emu_assertp(byte p_state_id, bool expected_value);
         void _emu_log(word str);
         void _emu_err(word err);
+        void _exit(word status);
+        void _wait_irq(word mask);
+        word _bios_disk_read(word disk_page, word paddr, word n_bytes);
+        word _open(word path, word flags);
+        word _close(word fd);
+        word _lseek(word fd, sword offset, word whence);
+        word _read(word fd, word buf, word count);
+        word _write(word fd, word buf, word count);
+        word _mmap(word addr, word length, word prot, word fd, word offset);
+        word _munmap(word addr, word length);
+
+        /**
+         * @brief            Registers the emulator specific syscalls into @ref syscalls.
+         */
+        void register_default_syscalls();
 
 
     public:
         // help assemble instructions
         static word asm_hlt();
+        static word asm_brk();
         static word asm_format_o(byte opcode, bool s, int xd, int xn, int imm14);
         static word asm_format_o(byte opcode, bool s, int xd, int xn, int xm, ShiftType shift, int imm5);
         static word asm_format_o1(byte opcode, int xd, int xn, bool imm, int xm, int imm5);
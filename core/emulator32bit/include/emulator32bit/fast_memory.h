@@ -0,0 +1,168 @@
+#pragma once
+#ifndef FAST_MEMORY_H
+#define FAST_MEMORY_H
+
+#include "emulator32bit/emulator32bit_util.h"
+
+#include <string>
+#include <vector>
+
+class Memory;        /* Forward declare from 'memory.h' */
+class SystemBus;    /* Forward declare from 'system_bus.h' */
+
+/**
+ * @def             AEMU_FASTMEM_SIZE
+ * @brief             Size of the host region reserved for a guest physical address space.
+ */
+#define AEMU_FASTMEM_SIZE (1ULL << (8 * sizeof(word)))
+
+/**
+ * @def             AEMU_FASTMEM_MAX_SCRATCH
+ * @brief             Most pages one instruction can fault on. A straddling access touches two.
+ */
+#define AEMU_FASTMEM_MAX_SCRATCH 4
+
+/**
+ * @brief             Guest physical address space reserved in host virtual memory, so physical
+ *                     mode loads and stores are a host access at base + address.
+ *
+ * @details         The whole 4 GiB region is reserved without access. The contents of every
+ *                     @ref Memory registered on the bus are moved into a memfd, which is mapped
+ *                     at the memory's physical offset in the region, with the protection its bus
+ *                     pages allow, and at a second address that the memory itself uses as its
+ *                     data. Pages of other devices and pages without a device are left
+ *                     inaccessible.
+ *
+ *                     A guest access to an inaccessible page raises SIGSEGV on the host. The
+ *                     handler maps a scratch page there so the access completes, and records a
+ *                     fault on the bus. The instruction sees the fault and discards its result,
+ *                     as it would for any bus fault, and @ref Emulator32bit::step_slice then
+ *                     restores the page with @ref FastMemory::take_host_fault and runs the
+ *                     instruction again through the bus, which routes it to the device or
+ *                     reports a guest fault.
+ *
+ *                     Only supported on Linux with 4 KiB host pages.
+ */
+class FastMemory
+{
+    public:
+        class FastMemoryException : public std::exception
+        {
+            private:
+                std::string message;
+
+            public:
+                FastMemoryException(const std::string& msg);
+
+                const char* what() const noexcept override;
+        };
+
+        /**
+         * @brief             Whether the host can reserve and fault handle a fast memory region.
+         */
+        static bool is_supported();
+
+        /**
+         * @brief             Reserves the region and installs the SIGSEGV handler.
+         *
+         * @throws            FastMemoryException if the region could not be reserved.
+         * @param bus         Bus that host faults are reported on.
+         */
+        FastMemory(SystemBus& bus);
+        ~FastMemory();
+
+        FastMemory(const FastMemory&) = delete;
+        FastMemory& operator=(const FastMemory&) = delete;
+
+        inline byte* get_base()
+        {
+            return m_base;
+        }
+
+        /**
+         * @brief             Moves the contents of a memory into the region. Does nothing if it was
+         *                     already added.
+         *
+         *                     The memory's data pointer changes, so the caller has to refresh the
+         *                     bus's direct pointers to it. A memory with a shared image, see
+         *                     @ref Memory::get_image_fd, is mapped from the image instead and keeps
+         *                     its data pointer, until adding it again after it stopped sharing.
+         *
+         * @throws            FastMemoryException if the memory could not be mapped.
+         */
+        void add_memory(Memory& memory);
+
+        /**
+         * @brief             Sets what guest accesses to a page of the region are allowed.
+         *
+         *                     Only pages of a memory added with @ref FastMemory::add_memory can be
+         *                     accessible, other pages stay faulting.
+         *
+         * @param page         Physical page.
+         * @param read         Whether reads are served directly.
+         * @param write     Whether writes are served directly.
+         */
+        void protect(word page, bool read, bool write);
+
+        /**
+         * @brief             Whether a guest access faulted on the host since the last call, and if so
+         *                     restores the pages the fault handler replaced.
+         */
+        bool take_host_fault();
+
+        /**
+         * @brief             Called by the SIGSEGV handler. Makes a faulting host address accessible
+         *                     with a scratch page and records a fault on the bus.
+         *
+         * @return             False if the address is not in the region.
+         */
+        bool handle_fault(byte *address);
+
+        /**
+         * @brief             Routes host faults on this thread to a region while in scope.
+         */
+        class Scope
+        {
+            public:
+                Scope(FastMemory *fastmem);
+                ~Scope();
+
+            private:
+                FastMemory *m_prev;
+        };
+
+    private:
+        SystemBus& m_bus;
+        byte *m_base = nullptr;
+        int m_fd = -1;
+
+        enum PageFlags
+        {
+            PAGE_BACKED = 1,                        /* Part of an added memory */
+            PAGE_READ = 2,
+            PAGE_WRITE = 4,
+        };
+        std::vector<byte> m_pages;                    /* PageFlags of each physical page */
+
+        struct View
+        {
+            Memory *memory;
+            word lo_page;
+            byte *data;                                /* Mapping the memory was moved to, nullptr for images */
+            size_t size;
+            int image_fd;                            /* Image mapped in place of a copy, -1 for none */
+        };
+        std::vector<View> m_views;
+
+        /* Written by the signal handler, so fixed size. */
+        word m_scratch[AEMU_FASTMEM_MAX_SCRATCH];
+        word m_nscratch = 0;
+        bool m_host_fault = false;
+
+        /**
+         * @brief             Maps a page of the region the way m_pages says it should be.
+         */
+        void map_page(word page);
+};
+
+#endif /* FAST_MEMORY_H */
@@ -0,0 +1,354 @@
+#pragma once
+#ifndef FILE_SYSTEM_H
+#define FILE_SYSTEM_H
+
+#include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/disk.h"
+#include "emulator32bit/system_bus.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * @def             AEMU_FS_MAGIC
+ * @brief             First word of the superblock, 'AEFS' in little endian.
+ */
+#define AEMU_FS_MAGIC 0x53464541
+
+/**
+ * @def             AEMU_FS_NAME_LEN
+ * @brief             Maximum length of a file name including the null terminator.
+ */
+#define AEMU_FS_NAME_LEN 28
+
+/**
+ * @def             AEMU_FS_INLINE_EXTENTS
+ * @brief             Number of extents stored directly in an inode. Files with more extents spill
+ *                     into an extent page.
+ */
+#define AEMU_FS_INLINE_EXTENTS 6
+
+/**
+ * @def             AEMU_FS_MAX_EXTENTS
+ * @brief             Maximum number of extents of a file, the inline extents plus one extent page.
+ */
+#define AEMU_FS_MAX_EXTENTS (AEMU_FS_INLINE_EXTENTS + PAGE_SIZE / sizeof(FileSystem::Extent))
+
+/**
+ * @def             AEMU_FS_MAX_FILES
+ * @brief             Maximum number of files open at once.
+ */
+#define AEMU_FS_MAX_FILES 64
+
+/* Open flags, same values as Linux. */
+#define AEMU_FS_O_RDONLY 0
+#define AEMU_FS_O_WRONLY 1
+#define AEMU_FS_O_RDWR 2
+#define AEMU_FS_O_ACCMODE 3
+#define AEMU_FS_O_CREAT 0x40
+#define AEMU_FS_O_TRUNC 0x200
+#define AEMU_FS_O_APPEND 0x400
+
+/* Seek origins, same values as Linux. */
+#define AEMU_FS_SEEK_SET 0
+#define AEMU_FS_SEEK_CUR 1
+#define AEMU_FS_SEEK_END 2
+
+/**
+ * @brief             Extent based file system stored in a range of disk pages.
+ *
+ * @details         Layout, in pages relative to the first page of the file system:
+ *                     - 0: superblock.
+ *                     - free space bitmap, one bit per page of the file system.
+ *                     - inode table, @ref Inode entries. Inode 0 is the root directory.
+ *                     - data pages.
+ *
+ *                     A file is a list of extents, runs of contiguous data pages. The first
+ *                     @ref AEMU_FS_INLINE_EXTENTS live in the inode, the rest in a single extent page
+ *                     the inode points to. Allocation grows the last extent when the page after it
+ *                     is free, so files written sequentially stay in few extents. The root directory
+ *                     is a file of @ref DirEntry, there are no subdirectories.
+ *
+ *                     All pages are accessed through @ref Disk::read_page and
+ *                     @ref Disk::write_page, so file data shares the disk cache with swap instead
+ *                     of having a cache of its own. Once attached to a bus, data pages that a guest
+ *                     has mapped with mmap and are resident in RAM are read and written in RAM,
+ *                     since the resident copy is the up to date one (see
+ *                     @ref VirtualMemory::map_file_page).
+ */
+class FileSystem
+{
+    public:
+        class FileSystemException : public std::exception
+        {
+            private:
+                std::string message;
+
+            public:
+                FileSystemException(const std::string& msg);
+
+                const char* what() const noexcept override;
+        };
+
+        struct Extent
+        {
+            word start;                                /* First page, relative to the file system. */
+            word npages;                            /* Number of pages. */
+        };
+
+        struct SuperBlock
+        {
+            word magic;
+            word npages;                            /* Pages in the file system. */
+            word ninodes;                            /* Inodes in the inode table. */
+            word bitmap_page;                        /* First page of the free space bitmap. */
+            word bitmap_npages;
+            word inode_page;                        /* First page of the inode table. */
+            word inode_npages;
+            word data_page;                            /* First data page. */
+        };
+
+        enum InodeType
+        {
+            INODE_FREE = 0,
+            INODE_FILE = 1,
+            INODE_DIR = 2,
+        };
+
+        struct Inode
+        {
+            word type;                                /* @ref InodeType. */
+            word size;                                /* Size in bytes. */
+            word nextents;                            /* Number of extents in use. */
+            word extent_page;                        /* Page holding extents past the inline ones, 0 if none. */
+            Extent extents[AEMU_FS_INLINE_EXTENTS];
+        };
+
+        struct DirEntry
+        {
+            word inode;                                /* 0 if the entry is free. */
+            char name[AEMU_FS_NAME_LEN];
+        };
+
+        struct FileInfo
+        {
+            std::string name;
+            word inode;
+            word size;
+            word nextents;
+        };
+
+        /**
+         * @brief             Writes an empty file system to a range of disk pages.
+         *
+         * @throws            FileSystemException if the range is too small for the metadata.
+         * @param disk         Disk to format.
+         * @param first_page Disk page the file system starts at.
+         * @param npages     Number of disk pages the file system takes.
+         * @param ninodes     Maximum number of files, including the root directory.
+         */
+        static void format(Disk& disk, word first_page, word npages, word ninodes);
+
+        /**
+         * @brief             Mounts the file system at a disk page.
+         *
+         *                     The pages of the file system are reserved on the disk so they are not
+         *                     handed out as swap.
+         *
+         * @throws            FileSystemException if there is no file system at first_page.
+         * @param disk         Disk the file system is stored in.
+         * @param first_page Disk page the file system starts at.
+         */
+        FileSystem(Disk& disk, word first_page);
+
+        /**
+         * @brief             Makes file data go through RAM for pages guests have mapped.
+         *
+         * @param bus         Bus of the emulator the file system is used by.
+         */
+        void attach(SystemBus& bus);
+
+        const SuperBlock& get_superblock() const;
+
+        /**
+         * @brief             Number of free pages.
+         */
+        word get_free_pages() const;
+
+        /**
+         * @brief             Finds a file in the root directory.
+         *
+         * @param name         File name.
+         * @return             Inode of the file, 0 if not found.
+         */
+        word lookup(const std::string& name);
+
+        /**
+         * @brief             Creates an empty file in the root directory.
+         *
+         * @throws            FileSystemException if the name is invalid or taken, or if there are no
+         *                     free inodes.
+         * @param name         File name.
+         * @return             Inode of the file.
+         */
+        word create(const std::string& name);
+
+        /**
+         * @brief             Removes a file and frees its pages.
+         *
+         * @throws            FileSystemException if the file does not exist or is open.
+         * @param name         File name.
+         */
+        void remove(const std::string& name);
+
+        /**
+         * @brief             Lists the files in the root directory.
+         */
+        std::vector<FileInfo> list();
+
+        Inode read_inode(word inode);
+
+        /**
+         * @brief             Reads from a file.
+         *
+         * @param inode     File inode.
+         * @param offset     Byte offset into the file.
+         * @param dst         Buffer of at least n_bytes.
+         * @param n_bytes     Number of bytes to read.
+         * @return             Number of bytes read, less than n_bytes at the end of the file.
+         */
+        word read(word inode, word offset, byte *dst, word n_bytes);
+
+        /**
+         * @brief             Writes to a file, growing it if needed.
+         *
+         * @throws            FileSystemException if the file system is out of pages, the file is out
+         *                     of extents or the write would end past the largest file size. Pages
+         *                     allocated before the error are freed again.
+         * @param inode     File inode.
+         * @param offset     Byte offset into the file.
+         * @param src         Buffer of at least n_bytes.
+         * @param n_bytes     Number of bytes to write.
+         */
+        void write(word inode, word offset, const byte *src, word n_bytes);
+
+        /**
+         * @brief             Frees every page of a file and sets its size to 0.
+         *
+         * @param inode     File inode.
+         */
+        void truncate(word inode);
+
+        /**
+         * @brief             Disk page that a page of a file is stored in.
+         *
+         * @throws            FileSystemException if the page is past the end of the file.
+         * @param inode     File inode.
+         * @param file_page Page index into the file.
+         * @return             Disk page.
+         */
+        word get_disk_page(word inode, word file_page);
+
+        /**
+         * @brief             Opens a file.
+         *
+         * @throws            FileSystemException if the file does not exist and AEMU_FS_O_CREAT is not
+         *                     set, or if too many files are open.
+         * @param name         File name.
+         * @param flags     AEMU_FS_O_* flags.
+         * @return             File descriptor.
+         */
+        word open(const std::string& name, word flags);
+
+        /**
+         * @brief             Closes a file descriptor.
+         *
+         * @throws            FileSystemException if the descriptor is not open.
+         */
+        void close(word fd);
+
+        /**
+         * @brief             Reads from the current offset of a file descriptor and advances it.
+         *
+         * @throws            FileSystemException if the descriptor is not open for reading.
+         * @return             Number of bytes read.
+         */
+        word read_fd(word fd, byte *dst, word n_bytes);
+
+        /**
+         * @brief             Writes at the current offset of a file descriptor and advances it.
+         *
+         * @throws            FileSystemException if the descriptor is not open for writing.
+         * @return             Number of bytes written.
+         */
+        word write_fd(word fd, const byte *src, word n_bytes);
+
+        /**
+         * @brief             Moves the offset of a file descriptor.
+         *
+         * @throws            FileSystemException if the descriptor is not open or the offset would be
+         *                     negative.
+         * @param whence     AEMU_FS_SEEK_* origin.
+         * @return             New offset.
+         */
+        word seek(word fd, sword offset, word whence);
+
+        /**
+         * @brief             Inode of an open file descriptor.
+         *
+         * @throws            FileSystemException if the descriptor is not open.
+         */
+        word get_fd_inode(word fd);
+
+        /**
+         * @brief             Whether a file descriptor was opened for writing.
+         *
+         * @throws            FileSystemException if the descriptor is not open.
+         */
+        bool is_fd_writable(word fd);
+
+    private:
+        Disk& m_disk;
+        word m_first_page;
+        SystemBus *m_bus = nullptr;
+
+        SuperBlock m_superblock;
+        std::vector<byte> m_bitmap;                    /* In memory copy of the free space bitmap. */
+
+        struct OpenFile
+        {
+            bool used = false;
+            word inode = 0;
+            word offset = 0;
+            word flags = 0;
+        };
+        OpenFile m_files[AEMU_FS_MAX_FILES];
+
+        OpenFile& get_open_file(word fd);
+
+        void write_inode(word inode, const Inode& data);
+        std::vector<Extent> read_extents(const Inode& inode);
+        void write_extents(Inode& inode, const std::vector<Extent>& extents);
+
+        /**
+         * @brief             Adds one page to the end of a file, growing the last extent if possible.
+         */
+        void append_page(Inode& inode, std::vector<Extent>& extents);
+
+        /**
+         * @brief             Frees the pages @ref FileSystem::append_page allocated since the inode and
+         *                     extents were old_inode and old_extents.
+         */
+        void free_appended(const Inode& old_inode, const std::vector<Extent>& old_extents,
+                const Inode& inode, const std::vector<Extent>& extents);
+
+        word alloc_page(word hint);
+        void free_page(word page);
+        bool is_free(word page) const;
+        void save_bitmap_page(word page);
+
+        void read_data_page(word page, byte *dst);
+        void write_data_page(word page, const byte *src);
+};
+
+#endif /* FILE_SYSTEM_H */
@@ -0,0 +1,109 @@
+#pragma once
+#ifndef GDB_STUB_H
+#define GDB_STUB_H
+
+#include "emulator32bit/debugger.h"
+#include "emulator32bit/emulator32bit_util.h"
+
+#include <string>
+
+/**
+ * @def             AEMU_GDB_SLICE
+ * @brief             Instructions run between checks for an interrupt from the debugger while the
+ *                     guest is running.
+ */
+#define AEMU_GDB_SLICE (1 << 20)
+
+/**
+ * @brief             GDB remote serial protocol server driving a @ref Debugger.
+ *
+ * @details         Serves one debugger connection over TCP on the loopback interface. Supports
+ *                     reading and writing registers and memory, continuing, single stepping,
+ *                     interrupting with Ctrl-C, software breakpoints (Z0) and write, read and
+ *                     access watchpoints (Z2, Z3, Z4). Registers are x0 to x31, pc and cpsr, 32
+ *                     bits each, described to GDB with a target description. Addresses are
+ *                     physical.
+ *
+ *                     Packets are handled by @ref GdbStub::handle_packet, which does not need a
+ *                     connection, so the protocol can be driven without a socket.
+ */
+class GdbStub
+{
+    public:
+        GdbStub(Debugger& debugger);
+        ~GdbStub();
+
+        GdbStub(const GdbStub&) = delete;
+        GdbStub& operator=(const GdbStub&) = delete;
+
+        /**
+         * @brief             Waits for a debugger on 127.0.0.1 and serves it until it detaches,
+         *                     kills the guest or disconnects.
+         *
+         * @param port         TCP port to listen on.
+         * @return             False if the port could not be listened on, or sockets are not
+         *                     supported on this platform.
+         */
+        bool serve(word port);
+
+        /**
+         * @brief             Handles one packet.
+         *
+         * @param packet     Packet data, without the framing and checksum.
+         * @return             Reply data, empty if the packet is not supported.
+         */
+        std::string handle_packet(const std::string& packet);
+
+        /**
+         * @brief             Whether the debugger detached or killed the guest.
+         */
+        inline bool is_done() const
+        {
+            return m_done;
+        }
+
+    private:
+        Debugger& m_debugger;
+        int m_fd = -1;                                /* Connection, -1 if there is none */
+        bool m_done = false;
+        std::string m_last_stop = "S05";            /* Reply to '?' */
+
+        /**
+         * @brief             Runs until the guest stops or the debugger interrupts it.
+         *
+         * @param instructions Instructions to run, 0 to run until a stop.
+         * @return             Stop reply.
+         */
+        std::string resume(unsigned long long instructions);
+        std::string stop_reply(const Emulator32bit::StopReason& reason);
+
+        std::string read_registers();
+        bool write_registers(const std::string& hex);
+        word read_register(word reg);
+        bool write_register(word reg, word value);
+
+        std::string read_memory(const std::string& args);
+        std::string write_memory(const std::string& args);
+        std::string set_point(const std::string& args, bool insert);
+        std::string read_features(const std::string& args);
+
+        /**
+         * @brief             Whether the debugger sent an interrupt, without blocking.
+         */
+        bool poll_interrupt();
+
+        /**
+         * @brief             Blocks until the debugger sends an interrupt or disconnects.
+         */
+        void wait_interrupt();
+
+        /**
+         * @brief             Reads the data of the next packet from the connection and acknowledges it.
+         *
+         * @return             False if the connection closed.
+         */
+        bool receive(std::string& packet);
+        void send(const std::string& packet);
+};
+
+#endif /* GDB_STUB_H */
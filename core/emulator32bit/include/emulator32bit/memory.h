@@ -2,24 +2,20 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include "emulator32bit/device.h"
 #include "emulator32bit/emulator32bit_util.h"
 #include "util/file.h"
 
+#include <memory>
 #include <string>
+#include <vector>
 
-class BaseMemory
+class BaseMemory : public Device
 {
     public:
         BaseMemory(word npages, word start_page);
         virtual ~BaseMemory();
 
-        virtual inline byte read_byte(word address) = 0;
-        virtual inline hword read_hword(word address) = 0;
-        virtual inline word read_word(word address) = 0;
-        virtual inline void write_byte(word address, byte value) = 0;
-        virtual inline void write_hword(word address, hword value) = 0;
-        virtual inline void write_word(word address, word value) = 0;
-
         inline word get_mem_pages()
         {
             return npages;
@@ -46,6 +42,13 @@ class BaseMemory
         word start_addr;
 };
 
+/**
+ * @brief             Memory whose contents are accessed directly by the bus.
+ *
+ * @details         On Linux the contents are an anonymous host mapping, so untouched pages cost
+ *                     nothing and read as 0, and @ref Memory::reset hands the touched pages back
+ *                     to the host instead of writing every byte.
+ */
 class Memory : public BaseMemory
 {
     public:
@@ -53,8 +56,7 @@ class Memory : public BaseMemory
         Memory(Memory& other);
         virtual ~Memory();
 
-        // FOR SEG FAULTS, WE CAN USE SIGNAL HANDLERS TO CATCH AND HANDLE THEM IN THE KERNEL, WITHOUT
-        // HAVING AN EXPENSIVE CONDITIONAL CHECK EVERYTIME MEMORY IS ACCESSED
+        /* No bounds checks here, see FastMemory for catching bad accesses with signal handlers. */
         inline byte read_byte(word address) override
         {
             return data[address - (start_page << PAGE_PSIZE)];
@@ -95,9 +97,51 @@ class Memory : public BaseMemory
         }
 
 
+        byte* get_direct_read(word page) override;
+        byte* get_direct_write(word page) override;
+
+        /**
+         * @brief             Zeroes the contents.
+         *
+         *                     Hands the pages back to the host where it can, so they cost nothing
+         *                     until touched again, and writes every byte otherwise.
+         */
         void reset();
 
+        /**
+         * @brief             Pages holding anything but 0, found by scanning the contents. Reading a
+         *                     page the host never populated does not populate it.
+         *
+         * @return             One flag per page.
+         */
+        std::vector<bool> get_touched_pages();
+
+        /**
+         * @brief             Moves the contents to host memory owned by someone else, like a
+         *                     @ref FastMemory view. The bus's direct pointers have to be refreshed.
+         *
+         * @param new_data     Memory of at least @ref get_mem_pages pages, holding a copy of the contents.
+         */
+        void relocate(byte *new_data);
+
+        /**
+         * @brief             Host file the contents are a read only mapping of, which a
+         *                     @ref FastMemory maps directly instead of copying.
+         *
+         * @return             File descriptor, -1 if the contents are only this memory's.
+         */
+        virtual int get_image_fd();
+
         byte* data;
+
+    protected:
+        /**
+         * @brief             Takes ownership of host memory for the contents, allocated the way
+         *                     memories allocate their own.
+         */
+        Memory(word npages, word start_page, byte *data);
+
+        bool owns_data = true;
 };
 
 class RAM : public Memory
@@ -106,11 +150,69 @@ class RAM : public Memory
         RAM(word npages, word start_pages);
 };
 
+/**
+ * @brief             Read only memory. Guest writes fault on the bus, the contents can only be
+ *                     changed from the host with @ref ROM::flash.
+ */
 class ROM : public Memory
 {
     public:
+        /**
+         * @brief             Contents that any number of ROMs can map without copying.
+         *
+         * @details         On Linux the contents are kept in a memfd that each ROM maps privately
+         *                     and read only, so they all share the same host pages until one of
+         *                     them is flashed. Elsewhere each ROM gets its own copy.
+         */
+        class Image
+        {
+            public:
+                /**
+                 * @param data         Contents, the rest of the pages are 0.
+                 * @param size         Size of data in bytes, at most npages pages.
+                 * @param npages     Size of the image in pages.
+                 */
+                Image(const byte *data, size_t size, word npages);
+                ~Image();
+
+                Image(const Image&) = delete;
+                Image& operator=(const Image&) = delete;
+
+                /**
+                 * @brief             Loads a ROM file, or returns the image already loaded from it if
+                 *                     a ROM still uses it.
+                 *
+                 * @throws            ROM_Exception if the file is larger than npages pages.
+                 */
+                static std::shared_ptr<Image> load(const File& file, word npages);
+
+                inline word get_npages() const
+                {
+                    return m_npages;
+                }
+
+                /**
+                 * @brief             Host file holding the contents, -1 where memfds are not supported.
+                 */
+                inline int get_fd() const
+                {
+                    return m_fd;
+                }
+
+                /**
+                 * @brief             Maps the contents read only, to be owned by a @ref Memory.
+                 */
+                byte* map() const;
+
+            private:
+                word m_npages;
+                int m_fd = -1;
+                std::vector<byte> m_data;                /* Contents where memfds are not supported */
+        };
+
         ROM(const byte* data, word npages, word start_page);
         ROM(File file, word npages, word start_page);
+        ROM(std::shared_ptr<Image> image, word start_page);
         ~ROM() override;
 
         class ROM_Exception : public std::exception
@@ -123,11 +225,28 @@ class ROM : public Memory
                 const char* what() const noexcept override;
         };
 
-        /* todo, prevent writes, have special way to flash memory */
-
+        byte* get_direct_write(word page) override;
+        bool is_read_only(word page) override;
+        int get_image_fd() override;
+
+        /**
+         * @brief             Writes to the contents from the host, like flashing firmware.
+         *
+         *                     Only this ROM sees the change, the pages written stop being shared
+         *                     with the image. A ROM loaded from a file saves its contents back to
+         *                     the file when destroyed if it was flashed.
+         *
+         * @throws            ROM_Exception if the range is not in the ROM.
+         * @param address     Physical address of the first byte.
+         * @param src         Bytes to write.
+         * @param n_bytes     Number of bytes to write.
+         */
+        void flash(word address, const byte *src, word n_bytes);
 
     private:
+        std::shared_ptr<Image> m_image;
         bool save_file = false;
+        bool flashed = false;
         File file;
 };
 
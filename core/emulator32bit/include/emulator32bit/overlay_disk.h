@@ -0,0 +1,85 @@
+#pragma once
+#ifndef OVERLAY_DISK_H
+#define OVERLAY_DISK_H
+
+#include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/disk.h"
+
+#include <unordered_map>
+
+/**
+ * @brief             Copy on write @ref Disk on top of a read only base image, like a qcow overlay.
+ *
+ * @details         The base is the disk file of a saved @ref Disk, shared by any number of
+ *                     overlays and never written by them. Pages written to the overlay are stored
+ *                     in the overlay file, appended in the order they are first written, and a page
+ *                     index maps disk pages to them. Reads of pages that were never written fall
+ *                     through to the base. Creating an overlay only creates empty files, no matter
+ *                     the size of the base, so every instance can have a disk of its own.
+ *
+ *                     The page index is saved to the overlay file's .index file and the free pages
+ *                     to its .info file, by @ref save. An overlay without them starts with the free
+ *                     pages of the base.
+ *
+ *                     @ref commit writes the overlay into the base, @ref discard drops it. Other
+ *                     overlays on the base must not be in use while committing.
+ */
+class OverlayDisk : public Disk
+{
+    public:
+        /**
+         * @brief             Opens an overlay, as it was last saved if it exists.
+         *
+         * @param base         Disk file of the base image, with its .info file.
+         * @param overlay     File the pages written are stored in.
+         * @param npages     Number of pages of the base.
+         * @param lo_page     Like for @ref Disk.
+         */
+        OverlayDisk(File base, File overlay, word npages, word lo_page);
+
+        void save() override;
+
+        /**
+         * @brief             Writes the pages of the overlay and its free pages into the base, then
+         *                     empties the overlay.
+         *
+         * @throws            DiskWriteException if writing the base fails.
+         */
+        void commit();
+
+        /**
+         * @brief             Drops every page written to the overlay since it was created or last
+         *                     committed, going back to the base.
+         */
+        void discard();
+
+        /**
+         * @brief             Number of pages stored in the overlay.
+         */
+        inline word get_overlay_pages() const
+        {
+            return m_index.size();
+        }
+
+    protected:
+        bool read_backing(word page, word npages, byte *dst) override;
+        bool write_backing(word page, word npages, const byte *src) override;
+        bool discard_backing(word page, word npages) override;
+
+    private:
+        File m_base;
+        File m_base_manager;                        /* Free pages of the base */
+        File m_overlay;
+        File m_overlay_index;
+        std::unordered_map<word, word> m_index;        /* Disk page to its slot in the overlay file */
+
+        void read_index();
+        void write_index();
+
+        /**
+         * @brief             Empties the overlay file, its page index and its free pages.
+         */
+        void truncate();
+};
+
+#endif /* OVERLAY_DISK_H */
@@ -0,0 +1,78 @@
+#pragma once
+#ifndef PAGE_DEDUP_H
+#define PAGE_DEDUP_H
+
+#include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/system_bus.h"
+
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief             Finds resident anonymous pages with the same contents and merges them, like
+ *                     Linux's KSM.
+ *
+ * @details         Each call to @ref scan hashes the next few resident physical pages of the bus's
+ *                     @ref VirtualMemory, going round them in passes. A page matching a merged page
+ *                     is merged into it. Otherwise, if the page is unchanged since the last pass, it
+ *                     is looked up among the unchanged pages seen so far this pass and merged with a
+ *                     match, or added to them. Pages written every pass are never merged, they would
+ *                     only be copied again. Hashes only find candidates, pages are compared in full
+ *                     before merging.
+ *
+ *                     Merged pages are shared read only by all the processes that had a copy, see
+ *                     @ref VirtualMemory::merge_ppages. Pages are only shared within one
+ *                     @ref VirtualMemory, so across the processes of one emulator.
+ */
+class PageDeduplicator
+{
+    public:
+        struct Stats
+        {
+            unsigned long long pages_scanned = 0;
+            unsigned long long pages_merged = 0;        /* Physical pages freed by merging */
+            unsigned long long full_scans = 0;            /* Passes over all resident pages started */
+        };
+
+        PageDeduplicator(SystemBus& bus);
+
+        /**
+         * @brief             Scans the next resident pages, merging duplicates.
+         *
+         * @param max_pages Most pages to scan.
+         * @return             Number of pages merged.
+         */
+        word scan(word max_pages);
+
+        inline const Stats& get_stats() const
+        {
+            return m_stats;
+        }
+
+        /**
+         * @brief             Bytes of physical memory merging saves now.
+         */
+        inline unsigned long long get_saved_bytes() const
+        {
+            return m_bus.mmu.get_dedup_stats().pages_sharing * PAGE_SIZE;
+        }
+
+    private:
+        SystemBus& m_bus;
+        std::vector<word> m_pass;                    /* Resident pages when the pass started */
+        size_t m_cursor = 0;                        /* Next page of m_pass to scan */
+
+        std::unordered_map<unsigned long long, word> m_stable;        /* Hash to merged page */
+        std::unordered_map<unsigned long long, word> m_unstable;    /* Hash to unchanged page this pass */
+        std::unordered_map<word, unsigned long long> m_checksums;    /* Page to its hash last pass */
+        Stats m_stats;
+
+        /**
+         * @brief             Merges ppage into candidate if it has the same contents.
+         */
+        bool try_merge(word candidate, word ppage, const std::vector<byte>& contents);
+
+        static unsigned long long hash(const std::vector<byte>& contents);
+};
+
+#endif /* PAGE_DEDUP_H */
@@ -0,0 +1,184 @@
+#pragma once
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/cache_hierarchy.h"
+#include "emulator32bit/emulator32bit.h"
+
+#include <vector>
+
+/**
+ * @def             AEMU_BBV_DIMENSIONS
+ * @brief             Number of buckets basic blocks are hashed into in a basic block vector. Must
+ *                     be a power of 2.
+ */
+#define AEMU_BBV_DIMENSIONS 256
+
+/**
+ * @brief             Counts the instructions executed in each basic block, hashed into
+ *                     @ref AEMU_BBV_DIMENSIONS buckets.
+ *
+ * @details         Set with @ref Emulator32bit::set_block_vectors. A block runs from the target
+ *                     of a taken branch to the next taken branch, so every taken branch adds the
+ *                     instructions since the last one to the bucket of the block they were in.
+ *                     Hashing into a fixed number of buckets is a random projection, like the one
+ *                     SimPoint applies to its vectors before clustering.
+ */
+class BlockVectors
+{
+    public:
+        BlockVectors();
+
+        inline void taken_branch(word site, word target)
+        {
+            add_block(site + 4);
+            m_block = target;
+        }
+
+        /**
+         * @brief             Vector of the blocks executed since the last call, normalized to sum to
+         *                     1, then starts a new one.
+         *
+         * @param pc         Program counter, the instructions of the current block before it are
+         *                     counted in this vector.
+         */
+        std::vector<double> take(word pc);
+
+    private:
+        unsigned long long m_counts[AEMU_BBV_DIMENSIONS];
+        word m_block = 0;                            /* Start of the current block */
+
+        /**
+         * @brief             Counts the instructions of the current block up to an address.
+         */
+        inline void add_block(word end)
+        {
+            /* Anything but a short forward run, like after a restore, counts as a single instruction. */
+            word length = end - m_block;
+            m_counts[hash(m_block)] += (length <= (1U << 20)) ? (length >> 2) : 1;
+        }
+
+        static inline word hash(word address)
+        {
+            word x = (address >> 2) * 0x9E3779B1U;
+            return (x ^ (x >> 16)) & (AEMU_BBV_DIMENSIONS - 1);
+        }
+};
+
+/**
+ * @brief             SimPoint style sampled simulation, for measuring long runs with the slow
+ *                     detailed models.
+ *
+ * @details         Three steps, each driving the processor itself:
+ *
+ *                     1. @ref Sampler::profile runs the program functionally, splitting it into
+ *                     intervals of a fixed number of instructions and collecting the basic block
+ *                     vector of each.
+ *
+ *                     2. @ref Sampler::pick clusters the vectors with k-means. Intervals in a
+ *                     cluster execute the same code in the same proportions, so one interval,
+ *                     the one closest to the centre, stands in for the whole cluster, weighted by
+ *                     the share of instructions the cluster ran.
+ *
+ *                     3. @ref Sampler::measure restores the processor to where profiling started,
+ *                     runs functionally to each picked interval, and runs only those in detail,
+ *                     with the cache hierarchy and cycle counting on, after a warm up with the
+ *                     caches on. Rates per instruction of the picked intervals, weighted, give
+ *                     estimates for the whole run.
+ *
+ *                     Measuring counts cycles without changing guest time, so the guest runs the
+ *                     same instructions it did while profiling. The program has to be
+ *                     deterministic from the snapshot taken at the start of profiling, see
+ *                     @ref Emulator32bit::save_snapshot for what it covers.
+ */
+class Sampler
+{
+    public:
+        struct Config
+        {
+            unsigned long long interval = 10000000;        /* Instructions per interval */
+            word max_phases = 10;                        /* Clusters, the k of k-means */
+            unsigned long long warmup = 1000000;        /* Instructions run with the caches on before each interval */
+            word iterations = 50;                        /* Maximum k-means iterations */
+        };
+
+        /**
+         * @brief             Interval picked to represent a cluster.
+         */
+        struct SimPoint
+        {
+            unsigned long long interval;                /* Index of the interval */
+            double weight;                                /* Share of instructions its cluster ran */
+        };
+
+        /**
+         * @brief             Whole run estimates extrapolated from the picked intervals.
+         */
+        struct Estimate
+        {
+            unsigned long long instructions = 0;        /* Instructions in the whole run */
+            unsigned long long detailed_instructions = 0;    /* Instructions run in detail */
+            double cycles = 0;
+            double accesses[CacheHierarchy::NUM_LEVELS] = {};
+            double misses[CacheHierarchy::NUM_LEVELS] = {};
+        };
+
+        Sampler(Emulator32bit& processor, const Config& config);
+
+        /**
+         * @brief             Runs the program functionally from the current state and collects a
+         *                     basic block vector per interval.
+         *
+         * @param max_instructions Instructions to run at most, 0 to run until the program stops.
+         * @return             Why the run stopped.
+         */
+        Emulator32bit::StopReason profile(unsigned long long max_instructions);
+
+        /**
+         * @brief             Clusters the profiled intervals and picks one per cluster.
+         *
+         * @return             Picked intervals in run order.
+         */
+        const std::vector<SimPoint>& pick();
+
+        /**
+         * @brief             Runs the picked intervals in detail and extrapolates.
+         *
+         *                     Leaves the processor after the last picked interval, with the cache
+         *                     hierarchy unset and timing off.
+         *
+         * @param caches     Hierarchy to measure with, nullptr to only count cycles.
+         * @param latencies Latencies to count cycles with.
+         */
+        Estimate measure(CacheHierarchy *caches, const Emulator32bit::Latencies& latencies);
+
+        inline word get_num_intervals() const
+        {
+            return m_vectors.size();
+        }
+
+        inline const std::vector<SimPoint>& get_simpoints() const
+        {
+            return m_simpoints;
+        }
+
+    private:
+        Emulator32bit& m_processor;
+        Config m_config;
+        Emulator32bit::Snapshot m_start;
+
+        std::vector<std::vector<double>> m_vectors;            /* Basic block vector of each interval */
+        std::vector<unsigned long long> m_lengths;            /* Instructions in each interval */
+        std::vector<SimPoint> m_simpoints;
+
+        /**
+         * @brief             Runs slices until a number of instructions has retired or the program
+         *                     stops.
+         *
+         * @return             Why it stopped, with the instructions of every slice.
+         */
+        Emulator32bit::StopReason run(unsigned long long instructions);
+};
+
+#endif /* SAMPLER_H */
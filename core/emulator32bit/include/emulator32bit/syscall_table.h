@@ -0,0 +1,168 @@
+#pragma once
+#ifndef SYSCALL_TABLE_H
+#define SYSCALL_TABLE_H
+
+#include "emulator32bit/emulator32bit_util.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+class Emulator32bit;  /* Forward declare from 'emulator32bit.h' */
+
+/**
+ * @def             AEMU_SYSCALL_TABLE_SIZE
+ * @brief             Number of syscall ids that can be registered, valid ids are 0 to
+ *                     @ref AEMU_SYSCALL_TABLE_SIZE - 1.
+ */
+#define AEMU_SYSCALL_TABLE_SIZE 2048
+
+/**
+ * @def             AEMU_SYSCALL_MAX_ARGS
+ * @brief             Maximum number of arguments a syscall can take, passed in registers x0 to x5.
+ */
+#define AEMU_SYSCALL_MAX_ARGS 6
+
+/**
+ * @def             AEMU_SYSCALL_LATENCY_BUCKETS
+ * @brief             Number of buckets in the latency histogram of a syscall. Bucket i counts the
+ *                     calls that took [2^i, 2^(i+1)) nanoseconds, the last bucket counts the rest.
+ */
+#define AEMU_SYSCALL_LATENCY_BUCKETS 32
+
+/**
+ * @brief             Registered system calls indexed by syscall number.
+ *
+ * @details         Replaces the hardcoded switch in @ref Emulator32bit::_swi so that host code can
+ *                     add (or override) system calls at runtime. Each entry stores the handler, the
+ *                     number of arguments to read from registers, and call statistics (call count
+ *                     and a log2 latency histogram).
+ */
+class SyscallTable
+{
+    public:
+        /**
+         * @brief         Syscall handler.
+         *
+         * @param emu     Emulator that executed the swi instruction.
+         * @param args     Arguments read from x0 to x5. Only the first nargs are valid.
+         */
+        typedef std::function<void(Emulator32bit& emu, const word args[AEMU_SYSCALL_MAX_ARGS])> Handler;
+
+        struct Stats
+        {
+            unsigned long long count = 0;                /* Number of times the syscall was made. */
+            unsigned long long total_ns = 0;            /* Total time spent in the handler. */
+            unsigned long long max_ns = 0;                /* Slowest call. */
+            unsigned long long latency_hist[AEMU_SYSCALL_LATENCY_BUCKETS] = {};
+        };
+
+        struct Entry
+        {
+            std::string name;                            /* Name used when printing statistics. */
+            byte nargs = 0;                                /* Number of arguments read from registers. */
+            Handler handler;                            /* Called on swi. */
+            Stats stats;
+        };
+
+        SyscallTable();
+        ~SyscallTable();
+
+        SyscallTable(const SyscallTable&) = delete;
+        SyscallTable& operator=(const SyscallTable&) = delete;
+
+        class Exception : public std::exception
+        {
+            private:
+                std::string message;
+
+            public:
+                Exception(const std::string& msg);
+
+                const char* what() const noexcept override;
+        };
+
+        /**
+         * @brief             Registers a syscall, replacing any syscall already registered with the id.
+         *
+         * @throws            Exception if the id is out of range or nargs is larger than
+         *                     @ref AEMU_SYSCALL_MAX_ARGS.
+         * @param id         Syscall number (value of register NR).
+         * @param name        Name of the syscall.
+         * @param nargs     Number of arguments passed in registers.
+         * @param handler     Function called when the syscall is made.
+         */
+        void register_syscall(word id, const std::string& name, byte nargs, Handler handler);
+
+        /**
+         * @brief             Removes a syscall. Making the syscall afterwards is an invalid syscall.
+         *
+         * @param id         Syscall number.
+         */
+        void unregister_syscall(word id);
+
+        /**
+         * @brief             Finds a registered syscall.
+         *
+         * @param id         Syscall number.
+         * @return             Entry of the syscall, nullptr if it is not registered. Stays valid while
+         *                     held even if a handler re-registers or removes the syscall.
+         */
+        inline std::shared_ptr<Entry> lookup(word id)
+        {
+            if (UNLIKELY(id >= AEMU_SYSCALL_TABLE_SIZE))
+            {
+                return nullptr;
+            }
+
+            return m_entries[id];
+        }
+
+        /**
+         * @brief             Records the latency of a single call to a syscall.
+         *
+         * @param entry     Syscall that was made.
+         * @param ns         Time spent in the handler in nanoseconds.
+         */
+        inline void record(Entry& entry, unsigned long long ns)
+        {
+            entry.stats.count++;
+            entry.stats.total_ns += ns;
+            if (ns > entry.stats.max_ns)
+            {
+                entry.stats.max_ns = ns;
+            }
+
+            int bucket = ns == 0 ? 0 : DWORD_BITS - 1 - __builtin_clzll(ns);
+            if (bucket >= AEMU_SYSCALL_LATENCY_BUCKETS)
+            {
+                bucket = AEMU_SYSCALL_LATENCY_BUCKETS - 1;
+            }
+            entry.stats.latency_hist[bucket]++;
+        }
+
+        /**
+         * @brief             Gets the statistics of a syscall.
+         *
+         * @throws            Exception if the syscall is not registered.
+         * @param id         Syscall number.
+         * @return             Statistics collected since registration or the last reset.
+         */
+        const Stats& get_stats(word id);
+
+        /**
+         * @brief             Clears the statistics of all syscalls.
+         */
+        void reset_stats();
+
+        /**
+         * @brief             Prints the count and latency distribution of every syscall made at
+         *                     least once.
+         */
+        void print_stats();
+
+    private:
+        std::shared_ptr<Entry> m_entries[AEMU_SYSCALL_TABLE_SIZE];
+};
+
+#endif /* SYSCALL_TABLE_H */
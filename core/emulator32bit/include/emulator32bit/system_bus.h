@@ -3,18 +3,113 @@
 #define SYSTEM_BUS_H
 
 #include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/device.h"
 #include "emulator32bit/disk.h"
+#include "emulator32bit/fast_memory.h"
 #include "emulator32bit/memory.h"
 #include "emulator32bit/virtual_memory.h"
 
 #define AEMU_ONLY_CRITICAL_LOG
 #include "util/logger.h"
 
+#include <memory>
 #include <vector>
+
+/**
+ * @def             AEMU_BUS_TABLE_PSIZE
+ * @brief             Log base 2 of the number of pages covered by one second level table of the
+ *                     @ref SystemBus page table.
+ */
+#define AEMU_BUS_TABLE_PSIZE 10
+#define AEMU_BUS_TABLE_SIZE (1 << AEMU_BUS_TABLE_PSIZE)
+
+/**
+ * @def             AEMU_BUS_DIR_SIZE
+ * @brief             Number of second level tables needed to cover the physical address space.
+ */
+#define AEMU_BUS_DIR_SIZE (1 << (8 * sizeof(word) - PAGE_PSIZE - AEMU_BUS_TABLE_PSIZE))
+
+/**
+ * @brief             Kinds of access a page can be watched for, see @ref SystemBus::set_page_watch.
+ */
+#define AEMU_WATCH_READ 1
+#define AEMU_WATCH_WRITE 2
+
+class SystemBus;
+
+/**
+ * @brief             Told about accesses to watched pages, see @ref SystemBus::set_page_watch.
+ */
+class WatchListener
+{
+    public:
+        virtual ~WatchListener() = default;
+
+        /**
+         * @brief             Called before an access to a page watched for its kind of access goes to
+         *                     the page's device.
+         *
+         * @param address     Physical address of the first byte accessed.
+         * @param n_bytes     Number of bytes accessed.
+         * @param access     AEMU_WATCH_READ or AEMU_WATCH_WRITE.
+         */
+        virtual void watch_access(word address, word n_bytes, byte access) = 0;
+};
+
+/**
+ * @brief             Address translation policies the @ref SystemBus accessors are templated on.
+ *
+ * @details         The policy is a compile time parameter so a caller that knows how its
+ *                     addresses are translated, like the CPU running a bare metal program, does
+ *                     not pay for the check of whether @ref VirtualMemory is enabled on every
+ *                     access. Accessors default to @ref VirtualMemoryTranslation.
+ *
+ *                     can_fault is whether translate can record a fault, which lets writes skip
+ *                     checking for one. Writes use translate_write, which also copies pages
+ *                     shared by @ref VirtualMemory::merge_ppages before they are written.
+ */
+struct PhysicalTranslation
+{
+    static constexpr bool can_fault = false;
+    static inline word translate(SystemBus& bus, word address);
+    static inline word translate_write(SystemBus& bus, word address);
+};
+
+/**
+ * @brief             Translates through the bus's @ref VirtualMemory when it is enabled, see
+ *                     @ref PhysicalTranslation.
+ */
+struct VirtualMemoryTranslation
+{
+    static constexpr bool can_fault = true;
+    static inline word translate(SystemBus& bus, word address);
+    static inline word translate_write(SystemBus& bus, word address);
+};
+
+/**
+ * @brief             Routes physical addresses to the devices registered at them.
+ *
+ * @details         Devices are registered at ranges of physical pages in a two level page table.
+ *                     Each page holds the device and, if the device allows it, host pointers that
+ *                     reads and writes to the page are served from directly. RAM is always direct,
+ *                     so the cost of an access is a translation and two table lookups no matter
+ *                     how many devices are attached. Second level tables are only allocated for
+ *                     parts of the address space with a device registered.
+ *
+ *                     Accesses to an address with no device, writes to a read only device like
+ *                     ROM, and accesses to a virtual page the running process has not mapped do
+ *                     not throw. The bus records the first faulting
+ *                     address, reads return 0 and writes are dropped, and the CPU checks
+ *                     @ref SystemBus::has_fault once per instruction (see @ref Emulator32bit::run).
+ */
 class SystemBus
 {
     public:
         SystemBus(RAM& ram, ROM& rom, Disk& disk, VirtualMemory& mmu);
+        ~SystemBus();
+
+        SystemBus(const SystemBus&) = delete;
+        SystemBus& operator=(const SystemBus&) = delete;
 
         /* expose for now */
         RAM& ram;
@@ -33,16 +128,111 @@ class SystemBus
                 const char* what() const noexcept override;
         };
 
+        /**
+         * @brief             Attaches a device at a range of physical pages.
+         *
+         * @throws            Exception if a page in the range already has a device.
+         * @param page_lo     First page of the range.
+         * @param page_hi     Last page of the range, inclusive.
+         * @param device     Device accesses to the range are routed to. Detaches itself when it is
+         *                     destroyed, either may be destroyed first.
+         */
+        void register_device(word page_lo, word page_hi, Device& device);
+
+        /**
+         * @brief             Detaches whatever devices are registered at a range of physical pages.
+         *
+         * @param page_lo     First page of the range.
+         * @param page_hi     Last page of the range, inclusive.
+         */
+        void unregister_device(word page_lo, word page_hi);
+
+        /**
+         * @brief             Queries the device at each page of a range for its direct pointers again.
+         *
+         *                     Devices call this when the memory they expose directly changes.
+         *
+         * @param page_lo     First page of the range.
+         * @param page_hi     Last page of the range, inclusive.
+         */
+        void update_direct(word page_lo, word page_hi);
+
+        /**
+         * @brief             Sends accesses to a page to the watch listener.
+         *
+         *                     The page loses the direct pointers for the watched kinds of access, so
+         *                     only those accesses take the slow path through its device, where the
+         *                     listener is told about them. Accesses to other pages cost nothing
+         *                     extra. The watch is dropped if the device is unregistered.
+         *
+         * @param page         Physical page.
+         * @param access     AEMU_WATCH_* bits to watch for, 0 to stop watching.
+         * @return             False if the page has no device.
+         */
+        bool set_page_watch(word page, byte access);
+
+        inline void set_watch_listener(WatchListener *listener)
+        {
+            m_watch_listener = listener;
+        }
+
+        /**
+         * @brief             Charges accesses to devices other than memory, and pages moved to or
+         *                     from disk by the virtual memory, to a cycle counter. Used by the
+         *                     timing mode of the processor, see @ref Emulator32bit::set_timing.
+         *
+         *                     Only the slow paths are charged, memory served directly costs
+         *                     nothing extra.
+         *
+         * @param counter     Counter to add to, nullptr to stop charging.
+         * @param device_latency Cycles per access to a device other than memory.
+         * @param disk_latency Cycles per page moved to or from disk.
+         */
+        inline void set_stall_counter(unsigned long long *counter, word device_latency, word disk_latency)
+        {
+            m_stall = counter;
+            m_device_latency = device_latency;
+            m_disk_latency = disk_latency;
+        }
+
+        /**
+         * @brief             Reserves the physical address space in host memory so the CPU can access
+         *                     memory at base + address in physical mode, see @ref FastMemory.
+         *
+         *                     Devices registered later are added too. Memories on the bus must outlive
+         *                     it once this is enabled.
+         *
+         * @return             False if the host does not support it.
+         */
+        bool enable_fastmem();
+
+        /**
+         * @brief             Fast memory region, nullptr if not enabled.
+         */
+        inline FastMemory* get_fastmem()
+        {
+            return m_fastmem.get();
+        }
+
+        /**
+         * @brief             Gets the device registered at a physical page.
+         *
+         * @param page         Physical page.
+         * @return             Device at the page, nullptr if there is none.
+         */
+        inline Device* get_device(word page)
+        {
+            return get_page(page << PAGE_PSIZE).device;
+        }
+
+        template <typename Translation = VirtualMemoryTranslation>
         inline dword read_val(word address, int n_bytes)
         {
             dword val = 0;
             for (int i = 0; i < n_bytes; i++)
             {
                 val <<= 8;
-                word real_adr = address;
-                real_adr = translate_address(address + n_bytes - i - 1);
-                BaseMemory *target = route_memory(real_adr);
-                val += target->read_byte(real_adr);
+                val += read_physical_byte(Translation::translate(*this, address + n_bytes - i - 1));
             }
             return val;
         }
@@ -65,60 +255,61 @@ class SystemBus
          * @param address The address to read from
          * @return The byte read from the address
          */
+        template <typename Translation = VirtualMemoryTranslation>
         inline byte read_byte(word address)
         {
-            address = translate_address(address);
-            return route_memory(address)->read_byte(address);
+            return read_physical_byte(Translation::translate(*this, address));
         }
 
         inline byte read_unmapped_byte(word address)
         {
             ensure_unmapped_mapping(address);
-            return route_memory(address)->read_byte(address);
+            return read_physical_byte(address);
         }
 
+        template <typename Translation = VirtualMemoryTranslation>
         inline hword read_hword(word address)
         {
             if ((address >> PAGE_PSIZE) == ((address + 1) >> PAGE_PSIZE))
             {
-                address = translate_address(address);
-                return route_memory(address)->read_hword(address);
+                return read_physical_hword(Translation::translate(*this, address));
             }
 
-            return read_val(address, 2);
+            return read_val<Translation>(address, 2);
         }
 
         inline hword read_unmapped_hword(word address)
         {
             ensure_unmapped_mapping(address);
-            return route_memory(address)->read_word(address);
+            return read_physical_hword(address);
         }
 
+        template <typename Translation = VirtualMemoryTranslation>
         inline word read_word(word address)
         {
             if ((address >> PAGE_PSIZE) == ((address + 3) >> PAGE_PSIZE))
             {
-                address = translate_address(address);
-                return route_memory(address)->read_word(address);
+                return read_physical_word(Translation::translate(*this, address));
             }
 
-            return read_val(address, 4);
+            return read_val<Translation>(address, 4);
         }
 
         inline word read_unmapped_word(word address)
         {
             ensure_unmapped_mapping(address);
-            return route_memory(address)->read_word(address);
+            return read_physical_word(address);
         }
 
+        template <typename Translation = VirtualMemoryTranslation>
         inline word read_word_aligned_ram(word address)
         {
-            return ram.read_word_aligned(translate_address(address));
+            return read_physical_word(Translation::translate(*this, address));
         }
 
         inline word read_unmapped_word_aligned_ram(word address)
         {
-            return ram.read_word_aligned(address);
+            return read_physical_word(address);
         }
 
         /**
@@ -128,68 +319,277 @@ class SystemBus
          * @param exception The exception raised by the write operation
          * @param data The byte to write
          */
+        template <typename Translation = VirtualMemoryTranslation>
         inline void write_byte(word address, byte data)
         {
-            address = translate_address(address);
-            route_memory(address)->write_byte(address, data);
+            word real_adr = Translation::translate_write(*this, address);
+            if (!Translation::can_fault || LIKELY(!m_fault))
+            {
+                write_physical_byte(real_adr, data);
+            }
         }
 
         inline void write_unmapped_byte(word address, byte data)
         {
             ensure_unmapped_mapping(address);
-            route_memory(address)->write_byte(address, data);
+            write_physical_byte(address, data);
         }
 
+        template <typename Translation = VirtualMemoryTranslation>
         inline void write_hword(word address, hword data)
         {
             if ((address >> PAGE_PSIZE) == ((address + 1) >> PAGE_PSIZE))
             {
-                address = translate_address(address);
-                route_memory(address)->write_hword(address, data);
+                word real_adr = Translation::translate_write(*this, address);
+                if (!Translation::can_fault || LIKELY(!m_fault))
+                {
+                    write_physical_hword(real_adr, data);
+                }
             }
             else
             {
-                write_val(address, data, 2);
+                write_val<Translation>(address, data, 2);
             }
         }
 
         inline void write_unmapped_hword(word address, hword data)
         {
             ensure_unmapped_mapping(address);
-            route_memory(address)->write_hword(address, data);
+            write_physical_hword(address, data);
         }
 
+        template <typename Translation = VirtualMemoryTranslation>
         inline void write_word(word address, word data)
         {
             if ((address >> PAGE_PSIZE) == ((address + 3) >> PAGE_PSIZE))
             {
-                address = translate_address(address);
-                route_memory(address)->write_word(address, data);
+                word real_adr = Translation::translate_write(*this, address);
+                if (!Translation::can_fault || LIKELY(!m_fault))
+                {
+                    write_physical_word(real_adr, data);
+                }
             }
             else
             {
-                write_val(address, data, 4);
+                write_val<Translation>(address, data, 4);
             }
         }
 
         inline void write_unmapped_word(word address, word data)
         {
             ensure_unmapped_mapping(address);
-            route_memory(address)->write_word(address, data);
+            write_physical_word(address, data);
         }
 
+        template <typename Translation = VirtualMemoryTranslation>
         inline void write_val(word address, dword val, int n_bytes)
         {
+            /* Check both pages before writing any byte, a faulting store must not be half applied. */
+            word first_adr = Translation::translate_write(*this, address);
+            word last_adr = Translation::translate_write(*this, address + n_bytes - 1);
+            if ((Translation::can_fault && UNLIKELY(m_fault)) ||
+                    UNLIKELY(!check_writable(first_adr) || !check_writable(last_adr & ~(PAGE_SIZE - 1))))
+            {
+                return;
+            }
+
+            word first_page = address >> PAGE_PSIZE;
             for (int i = 0; i < n_bytes; i++)
             {
-                word real_adr = address;
-                real_adr = translate_address(address + i);
-                BaseMemory *target = route_memory(real_adr);
-                target->write_byte(real_adr, val & 0xFF);
+                word real_adr = ((address + i) >> PAGE_PSIZE) == first_page ?
+                        first_adr + i : last_adr - (n_bytes - 1 - i);
+                write_physical_byte(real_adr, val & 0xFF);
                 val >>= 8;
             }
         }
 
+        /**
+         * @brief             Reads a block of bytes from the system bus.
+         *
+         *                     Translates and routes once per page instead of once per byte, and
+         *                     copies straight out of direct memory. Used by syscall handlers that need
+         *                     guest buffers. Stops at the first page that faults and zeroes the rest
+         *                     of dst.
+         *
+         * @param address     Address of the first byte.
+         * @param dst         Buffer of at least n_bytes bytes to read to.
+         * @param n_bytes     Number of bytes to read.
+         */
+        void read_bytes(word address, byte *dst, word n_bytes);
+
+        /**
+         * @brief             Writes a block of bytes to the system bus.
+         *
+         * @see             SystemBus::read_bytes
+         * @param address     Address of the first byte.
+         * @param src         Buffer of at least n_bytes bytes to write.
+         * @param n_bytes     Number of bytes to write.
+         */
+        void write_bytes(word address, const byte *src, word n_bytes);
+
+        /**
+         * @brief             Translates every page of a block for writing without writing to it.
+         *
+         *                     Lets a caller check a guest buffer before doing anything that cannot be
+         *                     undone. Raises the same fault the write would.
+         *
+         * @param address     Address of the first byte.
+         * @param n_bytes     Number of bytes that would be written.
+         * @return             Whether the whole block can be written.
+         */
+        bool probe_write(word address, word n_bytes);
+
+        /**
+         * @brief             Reads a null terminated string from the system bus.
+         *
+         * @param address     Address of the first character.
+         * @param max_len     Maximum number of characters to read if no null terminator is found.
+         * @return             The string, excluding the null terminator.
+         */
+        std::string read_string(word address, word max_len = PAGE_SIZE);
+
+        /*
+         * Physical accesses skip address translation. Devices that do DMA, like the
+         * BlockDevice, use these to access guest frames.
+         */
+        inline byte read_physical_byte(word address)
+        {
+            PageEntry& page = get_page(address);
+            if (LIKELY(page.read != nullptr))
+            {
+                return page.read[address & (PAGE_SIZE - 1)];
+            }
+
+            return route_memory(page, address, 1)->read_byte(address);
+        }
+
+        inline hword read_physical_hword(word address)
+        {
+            PageEntry& page = get_page(address);
+            if (LIKELY(page.read != nullptr))
+            {
+                return *((hword*) (page.read + (address & (PAGE_SIZE - 1))));
+            }
+
+            return route_memory(page, address, 2)->read_hword(address);
+        }
+
+        inline word read_physical_word(word address)
+        {
+            PageEntry& page = get_page(address);
+            if (LIKELY(page.read != nullptr))
+            {
+                return *((word*) (page.read + (address & (PAGE_SIZE - 1))));
+            }
+
+            return route_memory(page, address, 4)->read_word(address);
+        }
+
+        inline void write_physical_byte(word address, byte data)
+        {
+            PageEntry& page = get_page(address);
+            if (LIKELY(page.write != nullptr))
+            {
+                page.write[address & (PAGE_SIZE - 1)] = data;
+                return;
+            }
+
+            route_write(page, address, 1)->write_byte(address, data);
+        }
+
+        inline void write_physical_hword(word address, hword data)
+        {
+            PageEntry& page = get_page(address);
+            if (LIKELY(page.write != nullptr))
+            {
+                *((hword*) (page.write + (address & (PAGE_SIZE - 1)))) = data;
+                return;
+            }
+
+            route_write(page, address, 2)->write_hword(address, data);
+        }
+
+        inline void write_physical_word(word address, word data)
+        {
+            PageEntry& page = get_page(address);
+            if (LIKELY(page.write != nullptr))
+            {
+                *((word*) (page.write + (address & (PAGE_SIZE - 1)))) = data;
+                return;
+            }
+
+            route_write(page, address, 4)->write_word(address, data);
+        }
+
+        /**
+         * @brief             Copies a whole physical page out.
+         *
+         * @param ppage     Physical page.
+         * @param dst         Buffer of @ref PAGE_SIZE bytes.
+         */
+        void read_physical_page(word ppage, byte *dst);
+
+        /**
+         * @brief             Overwrites a whole physical page.
+         *
+         * @param ppage     Physical page.
+         * @param src         Buffer of @ref PAGE_SIZE bytes.
+         */
+        void write_physical_page(word ppage, const byte *src);
+
+        /**
+         * @brief             Raises an interrupt line.
+         *
+         *                     The CPU does not vector interrupts yet, so raised lines are only latched
+         *                     here for the guest or host to poll with @ref SystemBus::get_pending_irqs.
+         *
+         * @param line         Interrupt line, 0 to 31.
+         */
+        inline void raise_irq(word line)
+        {
+            m_pending_irqs |= (1U << line);
+        }
+
+        /**
+         * @brief             Acknowledges an interrupt line.
+         *
+         * @param line         Interrupt line, 0 to 31.
+         */
+        inline void clear_irq(word line)
+        {
+            m_pending_irqs &= ~(1U << line);
+        }
+
+        /**
+         * @brief             Bitmask of raised interrupt lines.
+         */
+        inline word get_pending_irqs() const
+        {
+            return m_pending_irqs;
+        }
+
+        /**
+         * @brief             Whether an access faulted since @ref SystemBus::clear_fault.
+         */
+        inline bool has_fault() const
+        {
+            return m_fault;
+        }
+
+        /**
+         * @brief             Address of the first faulting access, virtual if it was not mapped by
+         *                     the running process, physical if no device was registered at it.
+         */
+        inline word get_fault_address() const
+        {
+            return m_fault_address;
+        }
+
+        inline void clear_fault()
+        {
+            m_fault = false;
+        }
+
         void reset();
 
     private:
@@ -198,39 +598,68 @@ class SystemBus
             if (exception.type == VirtualMemory::Exception::Type::DISK_RETURN_AND_FETCH_SUCCESS)
             {
                 exception.type = VirtualMemory::Exception::Type::DISK_FETCH_SUCCESS; /* so the next conditional can handle */
+                write_back(exception.ppage_return, exception.disk_page_return, exception.swap_return);
+            }
+            for (const VirtualMemory::Exception::PageReturn& page_return : exception.prefetch_returns)
+            {
+                write_back(page_return.ppage, page_return.disk_page, page_return.swap);
+            }
 
+            if (exception.type == VirtualMemory::Exception::Type::DISK_FETCH_SUCCESS && exception.fetch_copy)
+            {
                 std::vector<byte> bytes(PAGE_SIZE);
+                read_physical_page(exception.ppage_copy, bytes.data());
+                write_physical_page(exception.ppage_fetch, bytes.data());
 
+                DEBUG("Copying shared physical page %u to %u.", exception.ppage_copy, exception.ppage_fetch);
+            }
+            else if (exception.type == VirtualMemory::Exception::Type::DISK_FETCH_SUCCESS)
+            {
+                /* handle exception by writing page fetched from disk to memory */
                 // EXPECTS page to be part of single memory target
-                word p_addr = exception.ppage_return << PAGE_PSIZE;
-                BaseMemory *target = route_memory(p_addr);
-
-                for (word i = 0; i < PAGE_SIZE; i++)
+                write_physical_page(exception.ppage_fetch, exception.disk_fetch.data());
+                if (!exception.swap_fetch)
                 {
-                    bytes.at(i) = target->read_byte(p_addr + i);
+                    charge_stall(m_disk_latency);
                 }
 
-                mmu.m_disk->write_page(exception.disk_page_return, bytes);
-
-                DEBUG("Writing physical page %u to disk page %u.",
-                        exception.ppage_return, exception.disk_page_return);
+                DEBUG("Reading physical page %u from disk.", exception.ppage_fetch);
             }
 
-            if (exception.type == VirtualMemory::Exception::Type::DISK_FETCH_SUCCESS)
+            if (UNLIKELY(!exception.prefetch_ppages.empty()))
             {
-                /* handle exception by writing page fetched from disk to memory */
-                word paddr = exception.ppage_fetch << PAGE_PSIZE;
-
-                // EXPECTS page to be part of single memory target
-                BaseMemory *target = route_memory(paddr);
-
-                for (word i = 0; i < PAGE_SIZE; i++)
+                for (size_t i = 0; i < exception.prefetch_ppages.size(); i++)
                 {
-                    target->write_byte(paddr + i, exception.disk_fetch.at(i));
+                    write_physical_page(exception.prefetch_ppages[i],
+                            exception.disk_fetch.data() + (i + 1) * PAGE_SIZE);
                 }
+                charge_stall(m_disk_latency * exception.prefetch_reads);
+            }
+        }
 
-                DEBUG("Reading physical page %u from disk.", exception.ppage_fetch);
+        /**
+         * @brief             Writes an evicted physical page to its disk page, or to the compressed
+         *                     swap pool.
+         */
+        inline void write_back(word ppage, word disk_page, bool swap_return)
+        {
+            std::vector<byte> bytes(PAGE_SIZE);
+
+            // EXPECTS page to be part of single memory target
+            read_physical_page(ppage, bytes.data());
+
+            CompressedSwap *swap = mmu.get_compressed_swap();
+            if (swap_return && swap != nullptr)
+            {
+                charge_stall(m_disk_latency * swap->store(disk_page, bytes.data()));
             }
+            else
+            {
+                mmu.m_disk->write_page(disk_page, bytes);
+                charge_stall(m_disk_latency);
+            }
+
+            DEBUG("Writing physical page %u to disk page %u.", ppage, disk_page);
         }
 
         inline word translate_address(word address)
@@ -240,31 +669,210 @@ class SystemBus
 
             if (exception.type != VirtualMemory::Exception::Type::AOK)
             {
+                if (UNLIKELY(exception.type == VirtualMemory::Exception::Type::INVALID_ADDRESS))
+                {
+                    set_fault(address);
+                    return 0;
+                }
                 handle_mmu_exception(exception);
             }
 
             return addr;
         }
 
-        inline BaseMemory* route_memory(const word address)
+        /**
+         * @brief             Translates an address about to be written, giving the current process
+         *                     its own copy first if it maps a merged page.
+         */
+        inline word translate_write_address(word address)
+        {
+            word addr = translate_address(address);
+            if (UNLIKELY(mmu.has_merged_pages()) && !m_fault)
+            {
+                VirtualMemory::Exception exception;
+                addr = mmu.copy_on_write(address, addr, exception);
+                if (exception.type != VirtualMemory::Exception::Type::AOK)
+                {
+                    handle_mmu_exception(exception);
+                }
+            }
+            return addr;
+        }
+
+        /**
+         * @brief             Device and direct memory of a physical page.
+         */
+        struct PageEntry
+        {
+            Device *device = nullptr;
+            byte *read = nullptr;                    /* Serve reads from here if not null. */
+            byte *write = nullptr;                    /* Serve writes to here if not null. */
+            bool read_only = false;                    /* Writes fault, see Device::is_read_only. */
+            bool memory = false;                    /* The device serves the page directly when not watched. */
+            byte watch = 0;                            /* AEMU_WATCH_* bits, see set_page_watch. */
+        };
+
+        /**
+         * @brief             Queries the device of a page for its direct pointers, leaving out the
+         *                     ones a watch needs to see.
+         */
+        inline void refresh_direct(PageEntry& entry, word page)
+        {
+            entry.read = (entry.watch & AEMU_WATCH_READ) ? nullptr : entry.device->get_direct_read(page);
+            entry.write = (entry.watch & AEMU_WATCH_WRITE) ? nullptr : entry.device->get_direct_write(page);
+            entry.read_only = entry.device->is_read_only(page);
+            entry.memory = entry.device->get_direct_read(page) != nullptr;
+        }
+
+        /**
+         * @brief             Second level tables indexed by the top bits of the physical address.
+         *                     Unused parts of the address space all point to @ref s_empty_table.
+         */
+        PageEntry *m_page_dir[AEMU_BUS_DIR_SIZE];
+
+        word m_pending_irqs = 0;
+
+        bool m_fault = false;
+        word m_fault_address = 0;
+
+        WatchListener *m_watch_listener = nullptr;
+
+        unsigned long long *m_stall = nullptr;        /* See set_stall_counter */
+        word m_device_latency = 0;
+        word m_disk_latency = 0;
+
+        inline void charge_stall(word cycles)
         {
-            if (ram.in_bounds(address))
+            if (m_stall != nullptr)
             {
-                return &ram;
+                *m_stall += cycles;
             }
-            else if (rom.in_bounds(address))
+        }
+
+        std::unique_ptr<FastMemory> m_fastmem;
+        friend class FastMemory;                    /* Reports host faults with set_fault */
+        friend struct VirtualMemoryTranslation;        /* Calls translate_address and translate_write_address */
+        friend class Device;                        /* Calls detach_device when destroyed */
+
+        std::shared_ptr<SystemBus*> m_self;            /* Handed to registered devices, cleared when destroyed */
+
+        /**
+         * @brief             Clears every page whose device is the given one. Only compares the
+         *                     device pointer, it may already be partially destroyed.
+         */
+        void detach_device(Device& device);
+
+        /**
+         * @brief             Whether any page is still registered to a device.
+         */
+        bool has_device(const Device& device) const;
+
+        /**
+         * @brief             Updates the fast memory protection of a range of pages to match their
+         *                     direct pointers.
+         */
+        void sync_fastmem(word page_lo, word page_hi);
+
+        inline void set_fault(word address)
+        {
+            if (!m_fault)
             {
-                return &rom;
+                m_fault = true;
+                m_fault_address = address;
             }
-            else if (disk.in_bounds(address))
+        }
+
+        /**
+         * @brief             Records a fault at an address with no device, or a write to a read only
+         *                     page, and returns a device that reads 0 and ignores writes, so the
+         *                     access can finish.
+         */
+        Device* fault_device(word address);
+
+        /**
+         * @brief             Shared table without any devices. Never written to.
+         */
+        static PageEntry s_empty_table[AEMU_BUS_TABLE_SIZE];
+
+        inline PageEntry& get_page(word address)
+        {
+            return m_page_dir[address >> (PAGE_PSIZE + AEMU_BUS_TABLE_PSIZE)]
+                    [(address >> PAGE_PSIZE) & (AEMU_BUS_TABLE_SIZE - 1)];
+        }
+
+        inline Device* route_memory(PageEntry& page, const word address, const word n_bytes)
+        {
+            if (UNLIKELY(page.watch & AEMU_WATCH_READ) && m_watch_listener != nullptr)
             {
-                return &disk;
+                m_watch_listener->watch_access(address, n_bytes, AEMU_WATCH_READ);
             }
-            else
+
+            if (UNLIKELY(page.device == nullptr))
+            {
+                return fault_device(address);
+            }
+
+            if (!page.memory)
+            {
+                charge_stall(m_device_latency);
+            }
+            return page.device;
+        }
+
+        /**
+         * @brief             Faults if writing to a physical address would, without writing to it.
+         */
+        inline bool check_writable(word address)
+        {
+            PageEntry& page = get_page(address);
+            if (UNLIKELY(page.read_only || page.device == nullptr))
+            {
+                fault_device(address);
+                return false;
+            }
+            return true;
+        }
+
+        inline Device* route_write(PageEntry& page, const word address, const word n_bytes)
+        {
+            if (UNLIKELY(page.watch & AEMU_WATCH_WRITE) && m_watch_listener != nullptr)
+            {
+                m_watch_listener->watch_access(address, n_bytes, AEMU_WATCH_WRITE);
+            }
+
+            if (UNLIKELY(page.read_only || page.device == nullptr))
+            {
+                return fault_device(address);
+            }
+
+            if (!page.memory)
             {
-                throw Exception("Could not route address " + std::to_string(address) + " to memory.");
+                charge_stall(m_device_latency);
             }
+            return page.device;
         }
 };
 
+word PhysicalTranslation::translate(SystemBus& bus, word address)
+{
+    (void) bus;
+    return address;
+}
+
+word PhysicalTranslation::translate_write(SystemBus& bus, word address)
+{
+    (void) bus;
+    return address;
+}
+
+word VirtualMemoryTranslation::translate(SystemBus& bus, word address)
+{
+    return bus.translate_address(address);
+}
+
+word VirtualMemoryTranslation::translate_write(SystemBus& bus, word address)
+{
+    return bus.translate_write_address(address);
+}
+
 #endif /* SYSTEM_BUS */
\ No newline at end of file
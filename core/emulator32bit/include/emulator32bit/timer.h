@@ -2,33 +2,93 @@
 #ifndef TIMER_H
 #define TIMER_H
 
-#include "emulator32bit/emulator32bit.h"
+#include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/device.h"
+
+class Emulator32bit; /* Forward declare from 'emulator32bit.h' */
+
+/* Register offsets from the start of the device page. */
+#define AEMU_TIMER_REG_TIME_LO 0x00                    /* R: guest time, low word. */
+#define AEMU_TIMER_REG_TIME_HI 0x04                    /* R: guest time, high word. */
+#define AEMU_TIMER_REG_COMPARE_LO 0x08                /* RW: deadline, low word. */
+#define AEMU_TIMER_REG_COMPARE_HI 0x0C                /* RW: deadline, high word. */
+#define AEMU_TIMER_REG_CTRL 0x10                    /* RW: AEMU_TIMER_CTRL_* bits. */
+#define AEMU_TIMER_REG_ISR 0x14                        /* R: pending interrupt status, W: 1s to acknowledge. */
+
+/* CTRL bits. */
+#define AEMU_TIMER_CTRL_ENABLE 1                    /* Fire once guest time reaches the deadline. */
+
+/* ISR bits. */
+#define AEMU_TIMER_ISR_FIRED 1                        /* The deadline was reached. */
 
 /**
- * @brief           Simulates a hardware timer
- * 
- * todo, goal of this is to generate timer interrupts every so often
- * in order to do this, we need a way of stopping processor execution to handle
- * this interrupt.
+ * @brief             One shot timer counting guest time.
+ *
+ * @details         Guest time is the number of instructions the processor has retired, see
+ *                     @ref Emulator32bit::get_time, so it advances the same no matter how fast the
+ *                     host is. The guest writes a deadline to the compare registers and sets the
+ *                     enable bit. When guest time reaches the deadline the timer sets its ISR and
+ *                     raises its interrupt line, and stays quiet until the deadline or control
+ *                     register is written again.
+ *
+ *                     The processor's run loop fires the timer at the exact instruction its deadline
+ *                     falls on, and uses the deadline to fast forward guest loops that only wait for
+ *                     it. Set @ref Emulator32bit::timer to the timer for that to happen. The device
+ *                     occupies one page of the physical address space.
  */
-class Timer
+class Timer : public Device
 {
     public:
-        Timer(Emulator32bit *processor);
+        /**
+         * @brief             Constructs a timer.
+         *
+         * @param processor Processor whose guest time is counted and whose bus interrupts are
+         *                     raised on.
+         * @param irq         Interrupt line raised when the deadline is reached.
+         */
+        Timer(Emulator32bit *processor, word irq = 0);
 
-        inline void tick()
-        {
-            clock++;
-        }
-        
-        inline unsigned long long time()
+        byte read_byte(word address) override;
+        hword read_hword(word address) override;
+        word read_word(word address) override;
+
+        /* Registers are only writable a word at a time, narrower writes are ignored. */
+        void write_byte(word address, byte value) override;
+        void write_hword(word address, hword value) override;
+        void write_word(word address, word value) override;
+
+        /**
+         * @brief             Current guest time.
+         */
+        unsigned long long time();
+
+        /**
+         * @brief             Guest time the timer fires at, ULLONG_MAX if it is not armed.
+         */
+        inline unsigned long long get_deadline() const
         {
-            return clock;
+            return (m_armed && (m_ctrl & AEMU_TIMER_CTRL_ENABLE)) ? m_compare : ~0ULL;
         }
 
+        /**
+         * @brief             Fires the timer if guest time has reached the deadline.
+         */
+        void update();
+
     private:
         Emulator32bit *processor;
-        unsigned long long clock = 0;
+        word m_irq;
+
+        unsigned long long m_compare = 0;
+        word m_ctrl = 0;
+        word m_isr = 0;
+        bool m_armed = false;
+
+        /**
+         * @brief             Arms the timer after the deadline or control register changed, and has
+         *                     the run loop pick up the new deadline.
+         */
+        void rearm();
 };
 
-#endif
\ No newline at end of file
+#endif /* TIMER_H */
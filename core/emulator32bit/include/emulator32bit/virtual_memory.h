@@ -3,12 +3,21 @@
 #define VIRTUAL_MEMORY_H
 
 #include "emulator32bit/emulator32bit_util.h"
+#include "emulator32bit/compressed_swap.h"
 #include "emulator32bit/disk.h"
 #include "emulator32bit/fbl.h"
 
 #include <unordered_map>
+#include <vector>
 
 #define VM_MAX_PAGES 1024
+
+/**
+ * @def             AEMU_READAHEAD_MAX_STRIDE
+ * @brief             Largest distance in virtual pages between faults that still counts as a
+ *                     strided access pattern worth reading ahead of.
+ */
+#define AEMU_READAHEAD_MAX_STRIDE 16
 #define TLB_PSIZE 12
 #define TLB_SIZE (1 << TLB_PSIZE)
 #define MAX_PROCESSES 1024
@@ -96,9 +105,8 @@ class VirtualMemory
          * @brief             Represents recoverable exception states that should be handled by the
          *                     caller.
          *
-         * @note             INVALID_ADDRESS and DISK_FETCH_FAILED should be instead through as a
-         *                     c++ exception. These should not be recovered from and the running user
-         *                     program should exit (or the kernel should just crash???).
+         * @note             INVALID_ADDRESS is reported for a virtual page the process has not
+         *                     mapped. The system bus turns it into a fault that stops the CPU.
          */
         struct Exception
         {
@@ -125,8 +133,180 @@ class VirtualMemory
             word ppage_fetch;                        /* physical page to write disk fetch results to. */
             word ppage_return;                        /* physical page to read from and write to disk at disk_page_return. */
             word disk_page_return;                    /* disk page to write the read physical page to. */
+            bool swap_return = false;                /* returned page is anonymous, it goes to compressed swap if there is one. */
+            bool swap_fetch = false;                /* disk_fetch came from compressed swap instead of disk. */
+            bool fetch_copy = false;                /* fetch by copying physical page ppage_copy instead of disk_fetch. */
+            word ppage_copy;                        /* physical page to copy to ppage_fetch if fetch_copy. */
+
+            /*
+             * Pages read ahead of the fault, see set_readahead. Their contents follow the fetched
+             * page in disk_fetch, the pages evicted to make room for them are written back first.
+             */
+            struct PageReturn
+            {
+                word ppage;
+                word disk_page;
+                bool swap;                            /* like swap_return. */
+            };
+            std::vector<PageReturn> prefetch_returns;
+            std::vector<word> prefetch_ppages;        /* physical pages to write the rest of disk_fetch to. */
+            word prefetch_reads = 0;                /* disk reads the pages took, charged like a fetch each. */
+        };
+
+        /**
+         * @brief             Counters of pages deduplicated with @ref merge_ppages.
+         */
+        struct DedupStats
+        {
+            unsigned long long pages_shared = 0;    /* Resident physical pages shared by several virtual pages */
+            unsigned long long pages_sharing = 0;    /* Virtual pages using them beyond the first, the pages saved */
+            unsigned long long cow_copies = 0;        /* Shared pages copied because a virtual page was written */
         };
 
+        /**
+         * @brief             Counters of pages read ahead of faults, see @ref set_readahead.
+         *                     Accuracy is hits over prefetched pages.
+         */
+        struct ReadaheadStats
+        {
+            unsigned long long faults = 0;            /* Faults reading a page from swap or disk */
+            unsigned long long prefetched = 0;        /* Pages read ahead */
+            unsigned long long hits = 0;            /* Pages read ahead then accessed */
+            unsigned long long wasted = 0;            /* Pages read ahead then evicted before any access */
+            unsigned long long disk_reads = 0;        /* Batched disk reads the pages read ahead took */
+        };
+
+        /**
+         * @brief             Puts a compressed in memory tier in front of the disk for swapped out
+         *                     anonymous pages, see @ref CompressedSwap.
+         *
+         * @param             swap: Pool to swap to, must outlive its use. nullptr swaps straight to
+         *                     disk, only after every page in the pool has been faulted back in or
+         *                     removed.
+         */
+        inline void set_compressed_swap(CompressedSwap *swap)
+        {
+            m_swap = swap;
+        }
+
+        inline CompressedSwap* get_compressed_swap()
+        {
+            return m_swap;
+        }
+
+        /**
+         * @brief             Whether a physical page can be merged with an identical one, a resident
+         *                     page mapped only by anonymous virtual pages.
+         */
+        bool is_mergeable(word ppage);
+
+        /**
+         * @brief             Whether a physical page is shared by virtual pages merged onto it.
+         */
+        inline bool is_merged(word ppage)
+        {
+            return physical_page(ppage).merged;
+        }
+
+        /**
+         * @brief             Merges a physical page into another with the same contents.
+         *
+         *                     The virtual pages mapping the duplicate are mapped to ppage instead, and
+         *                     the duplicate is freed. The merged page is shared read only: the first
+         *                     write through one of its virtual pages copies it to a page of its own,
+         *                     see @ref copy_on_write. Evicting a merged page keeps it merged on disk.
+         *                     The caller checks the contents are the same, see @ref PageDeduplicator.
+         *
+         * @throws            VirtualMemoryException if either page is not mergeable.
+         * @param             ppage: Physical page to keep.
+         * @param             duplicate: Physical page to merge into it.
+         */
+        void merge_ppages(word ppage, word duplicate);
+
+        /**
+         * @brief             Resident physical pages in ascending order.
+         */
+        std::vector<word> get_resident_ppages();
+
+        inline bool has_merged_pages() const
+        {
+            return m_dedup_stats.pages_shared != 0;
+        }
+
+        /**
+         * @brief             Gives the current process a page of its own before it writes to a merged
+         *                     page. Called by the system bus with the translation of every write
+         *                     while there are merged pages.
+         *
+         * @param             address: Virtual address written.
+         * @param             paddr: Physical address it translated to.
+         * @param             exception: Set to copy the merged page, after evicting a page if
+         *                     there is no free one.
+         * @return             Physical address to write to.
+         */
+        word copy_on_write(word address, word paddr, Exception& exception);
+
+        inline const DedupStats& get_dedup_stats() const
+        {
+            return m_dedup_stats;
+        }
+
+        /**
+         * @brief             Limits the physical pages virtual pages are brought into to a range,
+         *                     like the pages of RAM. Otherwise any free physical page is used and
+         *                     pages are only evicted once the whole physical address space is in use.
+         *
+         *                     Must be called before any virtual page is resident.
+         *
+         * @param             ppage_lo: First physical page.
+         * @param             ppage_hi: Last physical page, inclusive.
+         */
+        void set_frames(word ppage_lo, word ppage_hi);
+
+        /**
+         * @brief             Reads pages ahead of faults that follow a sequential or strided pattern.
+         *
+         *                     A fault on a page stride pages after the last fault of the process,
+         *                     or right after the pages last read ahead, reads the next pages along
+         *                     the stride too, with runs of consecutive disk pages read at once. The
+         *                     number of pages starts at 2 and doubles while all the pages read
+         *                     ahead get accessed, halving when less than half do. Pages are evicted
+         *                     to make room for them like for the faulting page.
+         *
+         * @param             max_pages: Most pages read ahead of a fault, also limited to half of
+         *                     the frames. 0 turns reading ahead off, the default.
+         */
+        inline void set_readahead(word max_pages)
+        {
+            m_readahead_max = max_pages;
+        }
+
+        inline const ReadaheadStats& get_readahead_stats() const
+        {
+            return m_readahead_stats;
+        }
+
+        /**
+         * @brief             Samples the working set of a process, the virtual pages it accessed
+         *                     since the last sample, and starts the next sample.
+         *
+         *                     Clears the accessed bits of the pages and their TLB entries, so the
+         *                     next access to each sets its bit again. Call it periodically, like
+         *                     from a timer interrupt.
+         *
+         * @throws            InvalidPIDException when the pid is not a valid process.
+         * @param             pid: Process id.
+         * @return             Number of pages accessed.
+         */
+        word sample_working_set(long long pid);
+
+        /**
+         * @brief             Working set of a process at its last sample, see @ref sample_working_set.
+         *
+         * @throws            InvalidPIDException when the pid is not a valid process.
+         */
+        word get_working_set(long long pid);
+
         /**
          * @brief             Sets the current proccess to change the virtual space mappings.
          *
@@ -160,6 +340,14 @@ class VirtualMemory
          */
         long long current_process();
 
+        /**
+         * @brief             Whether addresses are currently translated, false in physical mode.
+         */
+        inline bool is_translating() const
+        {
+            return enabled && m_cur_ptable != nullptr;
+        }
+
         /**
          * @brief             Set the the access permissions of physical memory. Used by the kernel
          *                     to set up memory mapped regions for I/O.
@@ -284,6 +472,61 @@ class VirtualMemory
         void ensure_physical_page_mapping(long long pid, word vpage, word ppage,
                                           Exception& exception);
 
+        /**
+         * @brief             Maps a virtual page of a process onto a page of a file stored on disk.
+         *
+         *                     Unlike pages added with @ref add_vpage, the disk page is owned by the
+         *                     file, so faulting the page in does not free it and evicting the page
+         *                     writes it back to the same disk page. If the disk page is already
+         *                     resident because another process mapped it, the new virtual page shares
+         *                     that physical page, so a file page is never in RAM twice.
+         *
+         * @throws            InvalidPIDException when pid is invalid.
+         * @throws            InvalidVPageException when the virtual page has already been added.
+         * @param             pid: Process identifier.
+         * @param             vpage: Virtual page to map.
+         * @param             diskpage: Disk page of the file.
+         * @param             write: Whether virtual page can be written to.
+         * @param             execute: Whether code can be executed from the virtual page.
+         */
+        void map_file_page(long long pid, word vpage, word diskpage, bool write, bool execute);
+
+        /**
+         * @brief             Gets the file page a virtual page was mapped to.
+         *
+         * @throws            InvalidPIDException when pid is invalid.
+         * @param             pid: Process identifier.
+         * @param             vpage: Virtual page.
+         * @param             diskpage: Set to the disk page of the file if file backed.
+         * @return             Whether the virtual page is mapped to a file page.
+         */
+        bool get_file_page(long long pid, word vpage, word& diskpage);
+
+        /**
+         * @brief             Finds the physical page a file backed disk page is resident in.
+         *
+         *                     While a file page is resident the physical page holds the only up to
+         *                     date copy, so file reads and writes have to go to it instead of disk.
+         *
+         * @param             diskpage: Disk page of the file.
+         * @param             ppage: Set to the physical page if resident.
+         * @return             Whether the disk page is resident.
+         */
+        bool get_resident_file_page(word diskpage, word& ppage);
+
+        /**
+         * @brief             Removes the virtual page from a process referenced by it's pid.
+         *
+         *                     File backed pages are not written back, the caller should write back
+         *                     resident file pages first.
+         *
+         * @throws            InvalidPIDException if pid is invalid.
+         * @throws             InvalidVPageException if virtual page is not mapped to process.
+         * @param             pid: Process id.
+         * @param             vpage: Virtual page to remove.
+         */
+        void remove_vpage(long long pid, word vpage);
+
 
     private:
         /**
@@ -313,6 +556,9 @@ class VirtualMemory
 
             bool write;                        /* Whether this virtual page can be written to. */
             bool execute;                    /* Whether this virtual page contains code to execute. */
+            bool file_backed = false;        /* Whether diskpage belongs to a file instead of swap. */
+            bool accessed = false;            /* Whether accessed since the last working set sample. */
+            bool prefetched = false;        /* Whether read ahead of a fault and not accessed since. */
         };
 
         struct PhysicalPage
@@ -326,6 +572,7 @@ class VirtualMemory
 
             bool swappable;                    /* Whether this physical page can be evicted/swapped. */
             bool kernel_locked;                /* Whether this physical page requires kernel level permission to access. */
+            bool merged;                    /* Whether mapped_vpages were merged onto it and share it read only. */
         };
 
         /**
@@ -339,6 +586,15 @@ class VirtualMemory
             std::unordered_map<word, PageTableEntry*> entries = std::unordered_map<word,PageTableEntry*>();
 
             bool kernel_privilege;
+            word working_set = 0;            /* Pages accessed in the last working set sample. */
+
+            /* Read ahead state, see set_readahead. */
+            word ra_last = 0;                /* Virtual page of the last fault. */
+            int ra_stride = 0;                /* Pages between the last two faults, 0 if no pattern. */
+            word ra_next = 0;                /* Fault continuing the pattern after the pages read ahead. */
+            word ra_window = 2;                /* Pages to read ahead next. */
+            word ra_issued = 0;                /* Pages last read ahead. */
+            word ra_hits = 0;                /* Of those, pages accessed since. */
         };
 
         /**
@@ -375,7 +631,84 @@ class VirtualMemory
          * @brief              Map of physical pages to the corresponding PageTableEntry.
          */
         // std::unordered_map<word, PhysicalPage*> m_physical_memory_map;
-        PhysicalPage* m_physical_memory_map = new PhysicalPage[NUM_PPAGES];
+        PhysicalPage* m_physical_memory_map = nullptr;
+
+        /**
+         * @brief             Gets a physical page, allocating the physical memory map on first use.
+         *
+         *                     The map covers the full physical address space, so it is only built
+         *                     once virtual memory is actually used. An emulator that only boots
+         *                     and runs in physical memory never pays for it.
+         *
+         * @param ppage     Physical page.
+         * @return             Physical page information.
+         */
+        inline PhysicalPage& physical_page(word ppage)
+        {
+            if (UNLIKELY(m_physical_memory_map == nullptr))
+            {
+                m_physical_memory_map = new PhysicalPage[NUM_PPAGES];
+                for (int i = 0; i < NUM_PPAGES; i++)
+                {
+                    m_physical_memory_map[i].ppage = (word) i;
+                }
+            }
+
+            return m_physical_memory_map[ppage];
+        }
+
+        CompressedSwap *m_swap = nullptr;
+
+        DedupStats m_dedup_stats;
+
+        word m_frames = NUM_PPAGES;                    /* Physical pages in the range of set_frames */
+        word m_readahead_max = 0;
+        ReadaheadStats m_readahead_stats;
+
+        /**
+         * @brief             Reads ahead of a fault of the process on a virtual page, see
+         *                     @ref set_readahead.
+         *
+         * @param             ptable: Page table of the process.
+         * @param             vpage: Virtual page faulted in.
+         * @param             exception: Fault of the virtual page, the pages read ahead are added.
+         */
+        void read_ahead(PageTable *ptable, word vpage, Exception& exception);
+
+        /**
+         * @brief             Makes a virtual page resident in a physical page, once its contents
+         *                     have been read.
+         */
+        void bind_vpage(PageTableEntry *entry, word ppage);
+
+        /**
+         * @brief             Virtual pages of merged pages that were evicted, by their shared swap
+         *                     disk page, so they are merged again when one is faulted in.
+         */
+        std::unordered_map<word, std::vector<PageTableEntry*>> m_merged_swap;
+
+        /**
+         * @brief             Drops a virtual page from a merged physical page, which stops being
+         *                     merged once a single virtual page is left.
+         */
+        void unshare(PhysicalPage& ppage, PageTableEntry *entry);
+
+        /**
+         * @brief             Drops the TLB entry of a virtual page if it translates to ppage.
+         */
+        inline void invalidate_tlb(PageTableEntry *entry, word ppage)
+        {
+            TLB_Entry& tlb_entry = tlb[entry->vpage & (TLB_SIZE-1)];
+            if (tlb_entry.valid && tlb_entry.ppage == ppage && tlb_entry.vpage == entry->vpage)
+            {
+                tlb_entry.valid = false;
+            }
+        }
+
+        /**
+         * @brief             Map of resident file backed disk pages to the physical page holding them.
+         */
+        std::unordered_map<word, word> m_file_pages;
 
         /**
          * @brief            Free physical pages that new virtual pages can map to.
@@ -478,16 +811,6 @@ class VirtualMemory
          */
         void map_ppage(long long pid, word vpage, word ppage, Exception& exception);
 
-        /**
-         * @brief             Removes the virtual page from a process referenced by it's pid.
-         *
-         * @throws            InvalidPIDException if pid is invalid.
-         * @throws             InvalidVPageException if virtual page is not mapped to process.
-         * @param             pid: Process id.
-         * @param             vpage: Virtual page to remove.
-         */
-        void remove_vpage(long long pid, word vpage);
-
         /**
          * @brief            Translates a virtual space address to a physical space address. Note these
          *                     are not page addresses, but full memory address in the 0 to 2^31 - 1
@@ -540,7 +863,9 @@ class VirtualMemory
                  */
                 if (UNLIKELY(ptable->entries.find(vpage) == ptable->entries.end()))
                 {
-                    throw VirtualMemoryException("SIGSEGV");
+                    exception.type = Exception::Type::INVALID_ADDRESS;
+                    exception.address = vpage << PAGE_PSIZE;
+                    return 0;
                 }
                 else if (!ptable->entries.at(vpage)->disk)
                 {
@@ -560,6 +885,13 @@ class VirtualMemory
             }
 
             PageTableEntry *entry = ptable->entries.at(vpage);
+            entry->accessed = true;
+            if (UNLIKELY(entry->prefetched))
+            {
+                entry->prefetched = false;
+                ptable->ra_hits++;
+                m_readahead_stats.hits++;
+            }
 
             /*
              * Likely that the virtual page being accessed has not been evicted to the disk.
@@ -585,7 +917,7 @@ class VirtualMemory
                  * Since the virtual page is mapped to a physical page on disk, we can assume it was
                  * evicted and some other page is in use at the spot.
                  */
-                if (LIKELY(m_physical_memory_map[entry->mapped_ppage].used))
+                if (LIKELY(physical_page(entry->mapped_ppage).used))
                 {
                     evict_ppage(entry->mapped_ppage, exception);
                 }
@@ -604,6 +936,11 @@ class VirtualMemory
 
                 word ppage = m_freelist.get_free_block(1);
                 map_vpage_to_ppage(ptable->pid, vpage, ppage, exception);
+
+                if (m_readahead_max != 0)
+                {
+                    read_ahead(ptable, vpage, exception);
+                }
             }
 
             // DEBUG("Accessing virtual page %u (maps to %u) of process %llu.",
@@ -0,0 +1,116 @@
+#include "emulator32bit/bios.h"
+#include "emulator32bit/emulator32bit.h"
+
+#include <algorithm>
+#include <string>
+
+#define EMU Emulator32bit
+#define ALWAYS Emulator32bit::ConditionCode::AL
+
+/* Registers used by the BIOS, all are free for the kernel to use after the jump. */
+#define HEADER 19                                    /* Address of the boot header in RAM. */
+#define SEGMENTS_LEFT 20                            /* Number of segments left to load. */
+#define SEGMENT 21                                    /* Address of the current segment descriptor. */
+
+std::vector<byte> BIOS::assemble(word rom_page, word scratch_page)
+{
+    const std::string no_os_msg = "BIOS: No operating system found.";
+
+    /*
+     * Branch targets are taken from the position they are emitted at. Forward branches are emitted
+     * as placeholders and patched once their target is known.
+     */
+    std::vector<word> program;
+    auto here = [&program]() { return (sword) program.size(); };
+    auto placeholder = [&program, &here]() { sword at = here(); program.push_back(0); return at; };
+    auto branch = [](EMU::ConditionCode cond, sword from, sword to) {
+        return EMU::asm_format_b1(EMU::_op_b, cond, to - from);
+    };
+
+    /* Read the boot header into the scratch page. */
+    program.push_back(EMU::asm_format_m2(EMU::_op_adrp, HEADER, scratch_page));
+    program.push_back(EMU::asm_format_o3(EMU::_op_mov, false, 0, AEMU_BOOT_DISK_PAGE));
+    program.push_back(EMU::asm_format_o(EMU::_op_add, false, 1, HEADER, 0));
+    program.push_back(EMU::asm_format_o3(EMU::_op_mov, false, 2, PAGE_SIZE));
+    program.push_back(EMU::asm_format_o3(EMU::_op_mov, false, NR, AEMU_SYSCALL_BIOS_DISK_READ));
+    program.push_back(EMU::asm_format_b1(EMU::_op_swi, ALWAYS, 0));
+    program.push_back(EMU::asm_format_o(EMU::_op_cmp, false, 0, 0, 0));
+    const sword header_failed = placeholder();
+
+    /* Check the magic number. */
+    program.push_back(EMU::asm_format_m(EMU::_op_ldr, false, 3, HEADER, 0, EMU::ADDR_OFFSET));
+    program.push_back(EMU::asm_format_m2(EMU::_op_adrp, 4, AEMU_BOOT_MAGIC >> PAGE_PSIZE));
+    program.push_back(EMU::asm_format_o(EMU::_op_add, false, 4, 4, AEMU_BOOT_MAGIC & (PAGE_SIZE - 1)));
+    program.push_back(EMU::asm_format_o(EMU::_op_cmp, false, 0, 3, 4, EMU::SHIFT_LSL, 0));
+    const sword bad_magic = placeholder();
+
+    program.push_back(EMU::asm_format_m(EMU::_op_ldr, false, SEGMENTS_LEFT, HEADER, 8, EMU::ADDR_OFFSET));
+    program.push_back(EMU::asm_format_o(EMU::_op_add, false, SEGMENT, HEADER, 12));
+
+    /* Copy every segment from disk with one bulk transfer each. */
+    const sword loop = here();
+    program.push_back(EMU::asm_format_o(EMU::_op_cmp, false, 0, SEGMENTS_LEFT, 0));
+    const sword loaded = placeholder();
+    program.push_back(EMU::asm_format_m(EMU::_op_ldr, false, 1, SEGMENT, 0, EMU::ADDR_OFFSET));
+    program.push_back(EMU::asm_format_m(EMU::_op_ldr, false, 0, SEGMENT, 4, EMU::ADDR_OFFSET));
+    program.push_back(EMU::asm_format_m(EMU::_op_ldr, false, 2, SEGMENT, 8, EMU::ADDR_OFFSET));
+    program.push_back(EMU::asm_format_o3(EMU::_op_mov, false, NR, AEMU_SYSCALL_BIOS_DISK_READ));
+    program.push_back(EMU::asm_format_b1(EMU::_op_swi, ALWAYS, 0));
+    program.push_back(EMU::asm_format_o(EMU::_op_cmp, false, 0, 0, 0));
+    const sword segment_failed = placeholder();
+    program.push_back(EMU::asm_format_o(EMU::_op_add, false, SEGMENT, SEGMENT, 12));
+    program.push_back(EMU::asm_format_o(EMU::_op_sub, false, SEGMENTS_LEFT, SEGMENTS_LEFT, 1));
+    program.push_back(branch(ALWAYS, here(), loop));
+
+    /* Jump to the kernel. */
+    const sword done = here();
+    program.push_back(EMU::asm_format_m(EMU::_op_ldr, false, 0, HEADER, 4, EMU::ADDR_OFFSET));
+    program.push_back(EMU::asm_format_b2(EMU::_op_bx, ALWAYS, 0));
+
+    /* No bootable disk, or reading it failed. */
+    const sword no_os = here();
+    program.push_back(EMU::asm_format_m2(EMU::_op_adrp, 0, rom_page));
+    const sword msg_addr = placeholder();
+    program.push_back(EMU::asm_format_o3(EMU::_op_mov, false, NR, 1021));
+    program.push_back(EMU::asm_format_b1(EMU::_op_swi, ALWAYS, 0));
+    program.push_back(EMU::asm_hlt());
+
+    /* The message follows the last instruction. */
+    const sword msg = here();
+    program[header_failed] = branch(EMU::ConditionCode::NE, header_failed, no_os);
+    program[bad_magic] = branch(EMU::ConditionCode::NE, bad_magic, no_os);
+    program[loaded] = branch(EMU::ConditionCode::EQ, loaded, done);
+    program[segment_failed] = branch(EMU::ConditionCode::NE, segment_failed, no_os);
+    program[msg_addr] = EMU::asm_format_o(EMU::_op_add, false, 0, 0, msg * 4);
+
+    std::vector<byte> bios;
+    for (word instr : program)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            bios.push_back(byte_from_word(instr, i));
+        }
+    }
+
+    for (char c : no_os_msg)
+    {
+        bios.push_back(c);
+    }
+    bios.push_back('\0');
+
+    return bios;
+}
+
+std::vector<byte> BIOS::rom_image(word rom_page, word rom_npages, word scratch_page)
+{
+    std::vector<byte> rom(rom_npages << PAGE_PSIZE);
+    std::vector<byte> bios = assemble(rom_page, scratch_page);
+    if (bios.size() > rom.size())
+    {
+        throw ROM::ROM_Exception("BIOS of " + std::to_string(bios.size()) + " bytes does not fit in "
+                "ROM of " + std::to_string(rom.size()) + " bytes.");
+    }
+
+    std::copy(bios.begin(), bios.end(), rom.begin());
+    return rom;
+}
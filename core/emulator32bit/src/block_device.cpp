@@ -0,0 +1,198 @@
+#include "emulator32bit/block_device.h"
+
+#define AEMU_ONLY_CRITICAL_LOG
+#include "util/logger.h"
+
+#include <vector>
+
+#define UNUSED(x) (void)(x)
+
+/* Word offsets of the descriptor fields. */
+#define DESC_WORDS (sizeof(BlockRequest) / sizeof(word))
+#define DESC_STATUS 4
+
+BlockDevice::BlockDevice(SystemBus& bus, Disk& disk, word irq) :
+    m_bus(bus),
+    m_disk(disk),
+    m_irq(irq)
+{
+
+}
+
+byte BlockDevice::read_byte(word address)
+{
+    return byte_from_word(read_word(address & ~3), (address & 3));
+}
+
+hword BlockDevice::read_hword(word address)
+{
+    return read_word(address & ~3) >> ((address & 2) * 8);
+}
+
+word BlockDevice::read_word(word address)
+{
+    switch (address & (PAGE_SIZE - 1))
+    {
+        case AEMU_BLK_REG_MAGIC:
+            return AEMU_BLK_MAGIC;
+        case AEMU_BLK_REG_CAPACITY:
+            return m_disk.get_mem_pages();
+        case AEMU_BLK_REG_QUEUE_ADDR:
+            return m_queue_addr;
+        case AEMU_BLK_REG_QUEUE_SIZE:
+            return m_queue_size;
+        case AEMU_BLK_REG_USED:
+            return m_used;
+        case AEMU_BLK_REG_ISR:
+            return m_isr;
+        default:
+            return 0;
+    }
+}
+
+void BlockDevice::write_byte(word address, byte value)
+{
+    UNUSED(address);
+    UNUSED(value);
+}
+
+void BlockDevice::write_hword(word address, hword value)
+{
+    UNUSED(address);
+    UNUSED(value);
+}
+
+void BlockDevice::write_word(word address, word value)
+{
+    switch (address & (PAGE_SIZE - 1))
+    {
+        case AEMU_BLK_REG_QUEUE_ADDR:
+            m_queue_addr = value;
+            break;
+        case AEMU_BLK_REG_QUEUE_SIZE:
+            m_queue_size = value;
+            break;
+        case AEMU_BLK_REG_DOORBELL:
+            process_queue(value);
+            break;
+        case AEMU_BLK_REG_ISR:
+            m_isr &= ~value;
+            if (m_isr == 0)
+            {
+                m_bus.clear_irq(m_irq);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void BlockDevice::process_queue(word avail)
+{
+    if (m_queue_size == 0 || m_used == avail)
+    {
+        return;
+    }
+
+    /* The guest can not have more descriptors available than fit in the ring. */
+    if (avail - m_used > m_queue_size)
+    {
+        DEBUG("Block device doorbell %u is more than %u descriptors past %u.", avail, m_queue_size, m_used);
+        m_isr |= AEMU_BLK_ISR_ERROR;
+        m_bus.raise_irq(m_irq);
+        return;
+    }
+
+    while (m_used != avail)
+    {
+        word desc_addr = m_queue_addr + (m_used % m_queue_size) * sizeof(BlockRequest);
+        word fields[DESC_WORDS];
+        for (word i = 0; i < DESC_WORDS; i++)
+        {
+            fields[i] = m_bus.read_physical_word(desc_addr + i * sizeof(word));
+        }
+        if (m_bus.has_fault())
+        {
+            DEBUG("Block device queue at %u is not in memory.", m_queue_addr);
+            m_bus.clear_fault();
+            return;
+        }
+
+        BlockRequest request = {fields[0], fields[1], fields[2], fields[3], fields[4]};
+        m_bus.write_physical_word(desc_addr + DESC_STATUS * sizeof(word), process_request(request));
+        m_used++;
+    }
+
+    /* One interrupt for the whole batch. */
+    m_isr |= AEMU_BLK_ISR_USED;
+    m_bus.raise_irq(m_irq);
+}
+
+word BlockDevice::process_request(const BlockRequest& request)
+{
+    if ((request.type != AEMU_BLK_T_READ && request.type != AEMU_BLK_T_WRITE) ||
+            (request.paddr & (PAGE_SIZE - 1)) != 0)
+    {
+        return AEMU_BLK_S_UNSUPP;
+    }
+
+    /* Check the ranges before sizing the buffer from the descriptor. */
+    if (request.npages == 0 ||
+            (unsigned long long) request.disk_page + request.npages > m_disk.get_mem_pages() ||
+            (unsigned long long) (request.paddr >> PAGE_PSIZE) + request.npages > (1ULL << (32 - PAGE_PSIZE)))
+    {
+        DEBUG("Block request of %u pages at disk page %u to %u is out of range.", request.npages,
+                request.disk_page, request.paddr);
+        return AEMU_BLK_S_IOERR;
+    }
+
+    std::vector<byte> buffer(((size_t) request.npages) << PAGE_PSIZE);
+    word ppage = request.paddr >> PAGE_PSIZE;
+    try
+    {
+        if (request.type == AEMU_BLK_T_READ)
+        {
+            m_disk.read_pages(request.disk_page, request.npages, buffer.data());
+            for (word i = 0; i < request.npages; i++)
+            {
+                m_bus.write_physical_page(ppage + i, buffer.data() + (i << PAGE_PSIZE));
+            }
+        }
+        else
+        {
+            for (word i = 0; i < request.npages; i++)
+            {
+                m_bus.read_physical_page(ppage + i, buffer.data() + (i << PAGE_PSIZE));
+            }
+
+            /* Faulting pages read back as zeroes, which must not reach the disk. */
+            if (m_bus.has_fault())
+            {
+                DEBUG("Block device transfer from %u faulted.", m_bus.get_fault_address());
+                m_bus.clear_fault();
+                return AEMU_BLK_S_IOERR;
+            }
+            m_disk.write_pages(request.disk_page, request.npages, buffer.data());
+        }
+    }
+    catch (const Disk::DiskReadException& e)
+    {
+        DEBUG("Block device read failed: %s", e.what());
+        return AEMU_BLK_S_IOERR;
+    }
+    catch (const Disk::DiskWriteException& e)
+    {
+        DEBUG("Block device write failed: %s", e.what());
+        return AEMU_BLK_S_IOERR;
+    }
+
+    /* DMA to a page without a device is the guest's error, not a fault of the CPU. */
+    if (m_bus.has_fault())
+    {
+        DEBUG("Block device transfer to %u faulted.", m_bus.get_fault_address());
+        m_bus.clear_fault();
+        return AEMU_BLK_S_IOERR;
+    }
+
+    return AEMU_BLK_S_OK;
+}
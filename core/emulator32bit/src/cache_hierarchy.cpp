@@ -0,0 +1,366 @@
+#include "emulator32bit/cache_hierarchy.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#define UNUSED(x) (void)(x)
+
+static const char *s_level_names[CacheHierarchy::NUM_LEVELS] = {"L1I", "L1D", "L2"};
+
+static bool is_pow2(word x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+static word log2_pow2(word x)
+{
+    word psize = 0;
+    while ((1U << psize) < x)
+    {
+        psize++;
+    }
+    return psize;
+}
+
+CacheHierarchy::Exception::Exception(const std::string& msg) :
+    message(msg)
+{
+
+}
+
+const char* CacheHierarchy::Exception::what() const noexcept
+{
+    return message.c_str();
+}
+
+CacheHierarchy::Cache::Cache(const CacheConfig& config, const char *name)
+{
+    if (config.size == 0)
+    {
+        return;
+    }
+
+    if (config.ways == 0 || !is_pow2(config.line_size) || config.size % (config.ways * config.line_size) != 0 ||
+            !is_pow2(config.size / (config.ways * config.line_size)))
+    {
+        throw Exception(std::string(name) + " cache of " + std::to_string(config.size) + " bytes, " +
+                std::to_string(config.ways) + " ways and " + std::to_string(config.line_size) +
+                " byte lines does not have a power of 2 number of sets and line size.");
+    }
+
+    m_ways = config.ways;
+    m_line_psize = log2_pow2(config.line_size);
+    m_set_mask = config.size / (config.ways * config.line_size) - 1;
+    m_replacement = config.replacement;
+    m_lines.resize(config.size >> m_line_psize);
+    m_stamps.resize(m_lines.size());
+    clear();
+}
+
+bool CacheHierarchy::Cache::access(word address)
+{
+    const word line = address >> m_line_psize;
+    const word base = (line & m_set_mask) * m_ways;
+    m_clock++;
+
+    word victim = base;
+    for (word i = base; i < base + m_ways; i++)
+    {
+        if (m_lines[i] == line)
+        {
+            if (m_replacement == Replacement::LRU)
+            {
+                m_stamps[i] = m_clock;
+            }
+            return true;
+        }
+
+        /* Invalid lines have a stamp of 0, so both LRU and FIFO fill them first. */
+        if (m_stamps[i] < m_stamps[victim])
+        {
+            victim = i;
+        }
+    }
+
+    if (m_replacement == Replacement::RANDOM && m_lines[victim] != INVALID)
+    {
+        /* xorshift32 */
+        m_random ^= m_random << 13;
+        m_random ^= m_random >> 17;
+        m_random ^= m_random << 5;
+        victim = base + m_random % m_ways;
+    }
+
+    m_lines[victim] = line;
+    m_stamps[victim] = m_clock;
+    return false;
+}
+
+void CacheHierarchy::Cache::clear()
+{
+    std::fill(m_lines.begin(), m_lines.end(), INVALID);
+    std::fill(m_stamps.begin(), m_stamps.end(), 0);
+    m_clock = 0;
+    m_random = 1;
+}
+
+CacheHierarchy::CacheHierarchy(const Config& config) :
+    m_caches{Cache(config.l1i, "L1I"), Cache(config.l1d, "L1D"), Cache(config.l2, "L2")},
+    m_batch(AEMU_CACHE_BATCH),
+    m_threaded(config.threaded)
+{
+    if (!m_caches[L1I].is_present() || !m_caches[L1D].is_present())
+    {
+        throw Exception("Cache hierarchy needs both L1 caches.");
+    }
+
+    if (m_threaded)
+    {
+        m_thread = std::thread(&CacheHierarchy::simulate_thread, this);
+    }
+}
+
+CacheHierarchy::~CacheHierarchy()
+{
+    if (m_threaded)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_work_cv.notify_one();
+        m_thread.join();
+    }
+}
+
+void CacheHierarchy::submit()
+{
+    m_batch.resize(m_batch_size);
+    m_batch_size = 0;
+    if (!m_threaded)
+    {
+        simulate(m_batch);
+        m_batch.resize(AEMU_CACHE_BATCH);
+        return;
+    }
+
+    std::vector<Record> next;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [this] { return m_queue.size() < AEMU_CACHE_MAX_QUEUED; });
+        m_queue.push_back(std::move(m_batch));
+        if (!m_free.empty())
+        {
+            next = std::move(m_free.back());
+            m_free.pop_back();
+        }
+    }
+    m_work_cv.notify_one();
+
+    next.resize(AEMU_CACHE_BATCH);
+    m_batch = std::move(next);
+}
+
+void CacheHierarchy::simulate_thread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_work_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+        if (m_queue.empty())
+        {
+            return;
+        }
+
+        std::vector<Record> batch = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_busy = true;
+        lock.unlock();
+
+        simulate(batch);
+
+        lock.lock();
+        m_busy = false;
+        m_free.push_back(std::move(batch));
+        m_done_cv.notify_all();
+    }
+}
+
+void CacheHierarchy::flush()
+{
+    if (m_batch_size > 0)
+    {
+        submit();
+    }
+
+    if (m_threaded)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done_cv.wait(lock, [this] { return m_queue.empty() && !m_busy; });
+    }
+}
+
+void CacheHierarchy::simulate(const std::vector<Record>& batch)
+{
+    Cache& l2 = m_caches[L2];
+    for (const Record& record : batch)
+    {
+        const Level level = record.kind == FETCH ? L1I : L1D;
+        Cache& l1 = m_caches[level];
+        SymbolStats *symbol = find_symbol(record.pc);
+
+        /* Each line the access touches. */
+        const word psize = l1.get_line_psize();
+        const word last = (record.address + record.n_bytes - 1) >> psize;
+        for (word line = record.address >> psize; ; line = (line + 1) & (~0U >> psize))
+        {
+            const word address = line << psize;
+            m_stats[level].accesses++;
+            bool hit = l1.access(address);
+            if (!hit)
+            {
+                m_stats[level].misses++;
+            }
+            if (symbol != nullptr)
+            {
+                symbol->levels[level].accesses++;
+                symbol->levels[level].misses += !hit;
+            }
+
+            if (!hit && l2.is_present())
+            {
+                m_stats[L2].accesses++;
+                bool l2_hit = l2.access(address);
+                m_stats[L2].misses += !l2_hit;
+                if (symbol != nullptr)
+                {
+                    symbol->levels[L2].accesses++;
+                    symbol->levels[L2].misses += !l2_hit;
+                }
+            }
+
+            /* Lines wrap like addresses, an access can run off the end of the address space. */
+            if (line == last)
+            {
+                break;
+            }
+        }
+    }
+}
+
+CacheHierarchy::SymbolStats* CacheHierarchy::find_symbol(word pc)
+{
+    if (m_symbols.empty())
+    {
+        return nullptr;
+    }
+
+    /* Consecutive accesses are almost always made by the same function. */
+    SymbolStats& last = m_symbols[m_last_symbol];
+    if (pc >= last.lo && pc < last.hi)
+    {
+        return &last;
+    }
+
+    auto it = std::upper_bound(m_symbols.begin(), m_symbols.end(), pc,
+            [](word pc, const SymbolStats& symbol) { return pc < symbol.lo; });
+    if (it == m_symbols.begin() || pc >= (it - 1)->hi)
+    {
+        return nullptr;
+    }
+
+    m_last_symbol = (it - 1) - m_symbols.begin();
+    return &*(it - 1);
+}
+
+void CacheHierarchy::add_symbol(const std::string& name, word lo, word hi)
+{
+    flush();
+
+    SymbolStats symbol;
+    symbol.name = name;
+    symbol.lo = lo;
+    symbol.hi = hi;
+    auto it = std::upper_bound(m_symbols.begin(), m_symbols.end(), lo,
+            [](word lo, const SymbolStats& symbol) { return lo < symbol.lo; });
+    m_symbols.insert(it, symbol);
+    m_last_symbol = 0;
+}
+
+CacheHierarchy::Stats CacheHierarchy::get_stats(Level level)
+{
+    flush();
+    return m_stats[level];
+}
+
+std::vector<CacheHierarchy::SymbolStats> CacheHierarchy::get_symbol_stats()
+{
+    flush();
+    return m_symbols;
+}
+
+std::string CacheHierarchy::report()
+{
+    flush();
+
+    char line[128];
+    std::string report = "level        accesses          misses  miss rate\n";
+    for (int level = 0; level < NUM_LEVELS; level++)
+    {
+        if (!m_caches[level].is_present())
+        {
+            continue;
+        }
+
+        const Stats& stats = m_stats[level];
+        snprintf(line, sizeof(line), "%-5s %15llu %15llu %9.2f%%\n", s_level_names[level], stats.accesses,
+                stats.misses, stats.accesses == 0 ? 0.0 : 100.0 * stats.misses / stats.accesses);
+        report += line;
+    }
+
+    /* Symbols with the most misses first. */
+    std::vector<const SymbolStats*> symbols;
+    for (const SymbolStats& symbol : m_symbols)
+    {
+        if (symbol.levels[L1I].misses + symbol.levels[L1D].misses > 0)
+        {
+            symbols.push_back(&symbol);
+        }
+    }
+    if (symbols.empty())
+    {
+        return report;
+    }
+
+    std::stable_sort(symbols.begin(), symbols.end(), [](const SymbolStats *a, const SymbolStats *b) {
+        return a->levels[L1I].misses + a->levels[L1D].misses > b->levels[L1I].misses + b->levels[L1D].misses;
+    });
+
+    report += "\nsymbol                       L1I misses      L1D misses       L2 misses\n";
+    for (const SymbolStats *symbol : symbols)
+    {
+        snprintf(line, sizeof(line), "%-24.24s %15llu %15llu %15llu\n", symbol->name.c_str(),
+                symbol->levels[L1I].misses, symbol->levels[L1D].misses, symbol->levels[L2].misses);
+        report += line;
+    }
+    return report;
+}
+
+void CacheHierarchy::clear()
+{
+    flush();
+
+    for (int level = 0; level < NUM_LEVELS; level++)
+    {
+        m_caches[level].clear();
+        m_stats[level] = Stats();
+    }
+
+    for (SymbolStats& symbol : m_symbols)
+    {
+        for (int level = 0; level < NUM_LEVELS; level++)
+        {
+            symbol.levels[level] = Stats();
+        }
+    }
+}
@@ -0,0 +1,302 @@
+#include "emulator32bit/compressed_swap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#define UNUSED(x) (void)(x)
+
+/*
+ * Codec, a sequence of tokens like LZ4 blocks. Each token byte holds a literal count in its high
+ * nibble and a match length minus MIN_MATCH in its low one, 15 meaning more length bytes follow,
+ * each added on until one is not 255. The literals follow the token, then the 2 byte little endian
+ * offset back to the match. The last token has only literals.
+ */
+#define MIN_MATCH 4
+#define HASH_PSIZE 12
+
+static inline word load_word(const byte *p)
+{
+    word val;
+    memcpy(&val, p, sizeof(val));
+    return val;
+}
+
+static bool put_length(byte *dst, word& out, word capacity, word length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        if (out >= capacity)
+        {
+            return false;
+        }
+        dst[out++] = 255;
+    }
+
+    if (out >= capacity)
+    {
+        return false;
+    }
+    dst[out++] = (byte) length;
+    return true;
+}
+
+/* Emits a token with its literals, and the match if length is not 0. */
+static bool put_sequence(byte *dst, word& out, word capacity, const byte *literals, word n_literals,
+        word offset, word length)
+{
+    if (out >= capacity)
+    {
+        return false;
+    }
+
+    const word match = length == 0 ? 0 : length - MIN_MATCH;
+    dst[out++] = (byte) ((std::min(n_literals, 15U) << 4) | std::min(match, 15U));
+    if (n_literals >= 15 && !put_length(dst, out, capacity, n_literals - 15))
+    {
+        return false;
+    }
+
+    if (capacity - out < n_literals)
+    {
+        return false;
+    }
+    /* Empty buffers may be null, which memcpy does not allow even for 0 bytes. */
+    if (n_literals > 0)
+    {
+        memcpy(dst + out, literals, n_literals);
+    }
+    out += n_literals;
+
+    if (length == 0)
+    {
+        return true;
+    }
+
+    if (capacity - out < 2)
+    {
+        return false;
+    }
+    dst[out++] = (byte) offset;
+    dst[out++] = (byte) (offset >> 8);
+    return match < 15 || put_length(dst, out, capacity, match - 15);
+}
+
+static bool get_length(const byte *src, word& in, word n_bytes, word& length)
+{
+    byte next;
+    do
+    {
+        if (in >= n_bytes)
+        {
+            return false;
+        }
+        next = src[in++];
+        length += next;
+    } while (next == 255);
+    return true;
+}
+
+word CompressedSwap::compress(const byte *src, word n_bytes, byte *dst, word capacity)
+{
+    /* Position + 1 of the last 4 bytes with each hash, 0 if none. */
+    word table[1 << HASH_PSIZE] = {};
+    word out = 0;
+    word anchor = 0;
+    word i = 0;
+    while (n_bytes - i >= MIN_MATCH)
+    {
+        const word sequence = load_word(src + i);
+        const word hash = (sequence * 2654435761U) >> (32 - HASH_PSIZE);
+        const word candidate = table[hash];
+        table[hash] = i + 1;
+        if (candidate == 0 || i - (candidate - 1) > 0xFFFF || load_word(src + candidate - 1) != sequence)
+        {
+            i++;
+            continue;
+        }
+
+        const word match = candidate - 1;
+        word length = MIN_MATCH;
+        while (i + length < n_bytes && src[match + length] == src[i + length])
+        {
+            length++;
+        }
+
+        if (!put_sequence(dst, out, capacity, src + anchor, i - anchor, i - match, length))
+        {
+            return 0;
+        }
+        i += length;
+        anchor = i;
+    }
+
+    if (!put_sequence(dst, out, capacity, src + anchor, n_bytes - anchor, 0, 0))
+    {
+        return 0;
+    }
+    return out;
+}
+
+bool CompressedSwap::decompress(const byte *src, word n_bytes, byte *dst, word size)
+{
+    word in = 0;
+    word out = 0;
+    while (in < n_bytes)
+    {
+        const byte token = src[in++];
+        word n_literals = token >> 4;
+        if (n_literals == 15 && !get_length(src, in, n_bytes, n_literals))
+        {
+            return false;
+        }
+        if (n_bytes - in < n_literals || size - out < n_literals)
+        {
+            return false;
+        }
+        if (n_literals > 0)
+        {
+            memcpy(dst + out, src + in, n_literals);
+        }
+        in += n_literals;
+        out += n_literals;
+
+        if (in == n_bytes)
+        {
+            break;
+        }
+
+        if (n_bytes - in < 2)
+        {
+            return false;
+        }
+        const word offset = src[in] | (src[in + 1] << 8);
+        in += 2;
+        word length = token & 15;
+        if (length == 15 && !get_length(src, in, n_bytes, length))
+        {
+            return false;
+        }
+        length += MIN_MATCH;
+        if (offset == 0 || offset > out || size - out < length)
+        {
+            return false;
+        }
+
+        /* Byte by byte, the match can overlap what it copies to. */
+        for (word j = 0; j < length; j++, out++)
+        {
+            dst[out] = dst[out - offset];
+        }
+    }
+    return out == size;
+}
+
+CompressedSwap::CompressedSwap(Disk& disk, word pool_size) :
+    m_disk(disk),
+    m_pool_size(pool_size)
+{
+
+}
+
+word CompressedSwap::store(word diskpage, const byte *data)
+{
+    discard(diskpage);
+
+    bool zero = true;
+    for (word i = 0; i < PAGE_SIZE && zero; i += sizeof(word))
+    {
+        zero = load_word(data + i) == 0;
+    }
+    if (zero)
+    {
+        m_slots[diskpage] = Slot{{}, m_order.end()};
+        m_stats.stored_pages++;
+        m_stats.zero_pages++;
+        m_stats.stored_bytes += PAGE_SIZE;
+        return 0;
+    }
+
+    byte compressed[AEMU_SWAP_MAX_COMPRESSED];
+    const word size = compress(data, PAGE_SIZE, compressed, sizeof(compressed));
+    if (size == 0 || size > m_pool_size)
+    {
+        m_disk.write_page(diskpage, std::vector<byte>(data, data + PAGE_SIZE));
+        m_stats.incompressible_pages++;
+        return 1;
+    }
+
+    word written = 0;
+    while (m_pool_size - m_used < size)
+    {
+        spill();
+        written++;
+    }
+
+    m_order.push_back(diskpage);
+    m_slots[diskpage] = Slot{std::vector<byte>(compressed, compressed + size), std::prev(m_order.end())};
+    m_used += size;
+    m_stats.stored_pages++;
+    m_stats.stored_bytes += PAGE_SIZE;
+    m_stats.compressed_bytes += size;
+    return written;
+}
+
+bool CompressedSwap::load(word diskpage, byte *dst)
+{
+    auto it = m_slots.find(diskpage);
+    if (it == m_slots.end())
+    {
+        return false;
+    }
+
+    if (it->second.data.empty())
+    {
+        memset(dst, 0, PAGE_SIZE);
+    }
+    else if (!decompress(it->second.data.data(), it->second.data.size(), dst, PAGE_SIZE))
+    {
+        throw Disk::DiskReadException("Compressed swap page " + std::to_string(diskpage) + " is corrupt.");
+    }
+
+    m_stats.pool_hits++;
+    erase(it);
+    return true;
+}
+
+void CompressedSwap::discard(word diskpage)
+{
+    auto it = m_slots.find(diskpage);
+    if (it != m_slots.end())
+    {
+        erase(it);
+    }
+}
+
+void CompressedSwap::spill()
+{
+    auto it = m_slots.find(m_order.front());
+    std::vector<byte> page(PAGE_SIZE);
+    decompress(it->second.data.data(), it->second.data.size(), page.data(), PAGE_SIZE);
+    m_disk.write_page(it->first, page);
+    m_stats.spilled_pages++;
+    erase(it);
+}
+
+void CompressedSwap::erase(std::unordered_map<word, Slot>::iterator it)
+{
+    Slot& slot = it->second;
+    m_stats.stored_pages--;
+    m_stats.stored_bytes -= PAGE_SIZE;
+    if (slot.data.empty())
+    {
+        m_stats.zero_pages--;
+    }
+    else
+    {
+        m_used -= slot.data.size();
+        m_stats.compressed_bytes -= slot.data.size();
+        m_order.erase(slot.age);
+    }
+    m_slots.erase(it);
+}
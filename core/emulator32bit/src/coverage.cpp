@@ -0,0 +1,73 @@
+#include "emulator32bit/coverage.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/shm.h>
+#define AEMU_COVERAGE_SHM 1
+#else
+#define AEMU_COVERAGE_SHM 0
+#endif
+
+#define UNUSED(x) (void)(x)
+
+Coverage::Coverage() :
+    m_owned(AEMU_COVERAGE_MAP_SIZE, 0)
+{
+    m_map = m_owned.data();
+}
+
+Coverage::Coverage(byte *map) :
+    m_map(map)
+{
+
+}
+
+Coverage::~Coverage()
+{
+#if AEMU_COVERAGE_SHM
+    if (m_shm != nullptr)
+    {
+        shmdt(m_shm);
+    }
+#endif
+}
+
+std::unique_ptr<Coverage> Coverage::from_afl()
+{
+#if AEMU_COVERAGE_SHM
+    const char *id = getenv(AEMU_AFL_SHM_ENV);
+    if (id == nullptr)
+    {
+        return nullptr;
+    }
+
+    void *shm = shmat(atoi(id), nullptr, 0);
+    if (shm == (void*) -1)
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<Coverage> coverage = std::make_unique<Coverage>((byte*) shm);
+    coverage->m_shm = shm;
+    return coverage;
+#else
+    return nullptr;
+#endif
+}
+
+void Coverage::clear()
+{
+    memset(m_map, 0, AEMU_COVERAGE_MAP_SIZE);
+}
+
+word Coverage::count_edges() const
+{
+    word edges = 0;
+    for (word i = 0; i < AEMU_COVERAGE_MAP_SIZE; i++)
+    {
+        edges += m_map[i] != 0;
+    }
+    return edges;
+}
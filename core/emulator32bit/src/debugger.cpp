@@ -0,0 +1,221 @@
+#include "emulator32bit/debugger.h"
+#include "emulator32bit/memory.h"
+
+#define UNUSED(x) (void)(x)
+
+Debugger::Debugger(Emulator32bit *processor) :
+    processor(processor)
+{
+    processor->system_bus.set_watch_listener(this);
+}
+
+Debugger::~Debugger()
+{
+    for (const auto& [address, instr] : m_breakpoints)
+    {
+        patch(address, instr);
+    }
+
+    std::vector<Watchpoint> watchpoints = m_watchpoints;
+    m_watchpoints.clear();
+    for (const Watchpoint& watchpoint : watchpoints)
+    {
+        update_watch(watchpoint.address >> PAGE_PSIZE, (watchpoint.address + watchpoint.n_bytes - 1) >> PAGE_PSIZE);
+    }
+    processor->system_bus.set_watch_listener(nullptr);
+}
+
+bool Debugger::insert_breakpoint(word address)
+{
+    if ((address & 3) != 0)
+    {
+        return false;
+    }
+    if (has_breakpoint(address))
+    {
+        return true;
+    }
+
+    word page = address >> PAGE_PSIZE;
+    Device *device = processor->system_bus.get_device(page);
+    if (dynamic_cast<Memory*>(device) == nullptr || device->is_read_only(page))
+    {
+        return false;
+    }
+
+    m_quiet = true;
+    word instr = processor->system_bus.read_physical_word(address);
+    m_quiet = false;
+
+    m_breakpoints[address] = instr;
+    patch(address, Emulator32bit::asm_brk());
+    return true;
+}
+
+bool Debugger::remove_breakpoint(word address)
+{
+    auto it = m_breakpoints.find(address);
+    if (it == m_breakpoints.end())
+    {
+        return false;
+    }
+
+    patch(address, it->second);
+    m_breakpoints.erase(it);
+    return true;
+}
+
+bool Debugger::insert_watchpoint(word address, word n_bytes, byte access)
+{
+    if (n_bytes == 0 || (access & (AEMU_WATCH_READ | AEMU_WATCH_WRITE)) == 0 || address + n_bytes - 1 < address)
+    {
+        return false;
+    }
+
+    m_watchpoints.push_back({address, n_bytes, access});
+    if (!update_watch(address >> PAGE_PSIZE, (address + n_bytes - 1) >> PAGE_PSIZE))
+    {
+        m_watchpoints.pop_back();
+        update_watch(address >> PAGE_PSIZE, (address + n_bytes - 1) >> PAGE_PSIZE);
+        return false;
+    }
+    return true;
+}
+
+bool Debugger::remove_watchpoint(word address, word n_bytes, byte access)
+{
+    for (auto it = m_watchpoints.begin(); it != m_watchpoints.end(); it++)
+    {
+        if (it->address == address && it->n_bytes == n_bytes && it->access == access)
+        {
+            m_watchpoints.erase(it);
+            update_watch(address >> PAGE_PSIZE, (address + n_bytes - 1) >> PAGE_PSIZE);
+            return true;
+        }
+    }
+    return false;
+}
+
+Emulator32bit::StopReason Debugger::resume(unsigned long long instructions)
+{
+    word pc = processor->get_pc();
+    auto it = m_breakpoints.find(pc);
+    if (it == m_breakpoints.end())
+    {
+        return processor->run(instructions);
+    }
+
+    /* Step over the breakpoint with the original instruction in place. */
+    patch(pc, it->second);
+    Emulator32bit::StopReason stepped = processor->run(1);
+    patch(pc, Emulator32bit::asm_brk());
+    if (instructions == 1 || stepped.type != Emulator32bit::StopReason::BUDGET_EXHAUSTED)
+    {
+        return stepped;
+    }
+
+    Emulator32bit::StopReason reason = processor->run(instructions == 0 ? 0 : instructions - 1);
+    reason.instructions += stepped.instructions;
+    reason.fusion_candidates += stepped.fusion_candidates;
+    reason.fused_groups += stepped.fused_groups;
+    reason.fused_instructions += stepped.fused_instructions;
+    return reason;
+}
+
+bool Debugger::read_memory(word address, byte *dst, word n_bytes)
+{
+    SystemBus& bus = processor->system_bus;
+    m_quiet = true;
+    for (word i = 0; i < n_bytes; i++)
+    {
+        dst[i] = bus.read_physical_byte(address + i);
+    }
+    m_quiet = false;
+
+    for (const auto& [bp_address, instr] : m_breakpoints)
+    {
+        for (word i = 0; i < 4; i++)
+        {
+            if (bp_address + i - address < n_bytes)
+            {
+                dst[bp_address + i - address] = byte_from_word(instr, i);
+            }
+        }
+    }
+
+    bool ok = !bus.has_fault();
+    bus.clear_fault();
+    return ok;
+}
+
+bool Debugger::write_memory(word address, const byte *src, word n_bytes)
+{
+    SystemBus& bus = processor->system_bus;
+    m_quiet = true;
+    for (word i = 0; i < n_bytes; i++)
+    {
+        word byte_address = address + i;
+        auto it = m_breakpoints.find(byte_address & ~3);
+        if (it != m_breakpoints.end())
+        {
+            /* Goes in the saved instruction, the brk stays. */
+            word shift = (byte_address & 3) * 8;
+            it->second = (it->second & ~(0xFFU << shift)) | (((word) src[i]) << shift);
+            continue;
+        }
+        bus.write_physical_byte(byte_address, src[i]);
+    }
+    m_quiet = false;
+
+    bool ok = !bus.has_fault();
+    bus.clear_fault();
+    return ok;
+}
+
+void Debugger::watch_access(word address, word n_bytes, byte access)
+{
+    if (m_quiet)
+    {
+        return;
+    }
+
+    for (const Watchpoint& watchpoint : m_watchpoints)
+    {
+        /* Written so it cannot overflow at the top of the address space. */
+        bool overlaps = address <= watchpoint.address ? watchpoint.address - address < n_bytes :
+                address - watchpoint.address < watchpoint.n_bytes;
+        if ((watchpoint.access & access) && overlaps)
+        {
+            m_hit_address = watchpoint.address;
+            m_hit_access = watchpoint.access;
+            processor->raise_trap(Emulator32bit::StopReason::WATCHPOINT, address);
+            return;
+        }
+    }
+}
+
+bool Debugger::update_watch(word page_lo, word page_hi)
+{
+    bool ok = true;
+    for (word page = page_lo; page <= page_hi; page++)
+    {
+        byte access = 0;
+        for (const Watchpoint& watchpoint : m_watchpoints)
+        {
+            if ((watchpoint.address >> PAGE_PSIZE) <= page &&
+                    page <= ((watchpoint.address + watchpoint.n_bytes - 1) >> PAGE_PSIZE))
+            {
+                access |= watchpoint.access;
+            }
+        }
+        ok &= processor->system_bus.set_page_watch(page, access);
+    }
+    return ok;
+}
+
+void Debugger::patch(word address, word instr)
+{
+    m_quiet = true;
+    processor->system_bus.write_physical_word(address, instr);
+    m_quiet = false;
+}
@@ -0,0 +1,38 @@
+#include "emulator32bit/device.h"
+#include "emulator32bit/system_bus.h"
+
+#define UNUSED(x) (void)(x)
+
+Device::~Device()
+{
+    if (m_bus != nullptr && *m_bus != nullptr)
+    {
+        (*m_bus)->detach_device(*this);
+    }
+}
+
+byte* Device::get_direct_read(word page)
+{
+    UNUSED(page);
+    return nullptr;
+}
+
+byte* Device::get_direct_write(word page)
+{
+    UNUSED(page);
+    return nullptr;
+}
+
+bool Device::is_read_only(word page)
+{
+    UNUSED(page);
+    return false;
+}
+
+void Device::direct_changed(word page_lo, word page_hi)
+{
+    if (m_bus != nullptr && *m_bus != nullptr)
+    {
+        (*m_bus)->update_direct(page_lo, page_hi);
+    }
+}
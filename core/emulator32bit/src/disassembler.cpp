@@ -548,6 +548,12 @@ std::string disassemble_hlt(word instruction)
     return "hlt";
 }
 
+std::string disassemble_brk(word instruction)
+{
+    UNUSED(instruction);
+    return "brk";
+}
+
 /* construct disassembler instruction mapping */
 typedef std::string (*DisassemblerFunction)(word);
 DisassemblerFunction _disassembler_instructions[64] =
@@ -606,6 +612,7 @@ DisassemblerFunction _disassembler_instructions[64] =
     disassemble_swi,
 
     disassemble_adrp,
+    disassemble_brk,
 };
 
 std::string disassemble_instr(word instr)
@@ -4,14 +4,53 @@
 #define AEMU_ONLY_CRITICAL_LOG
 #include "util/logger.h"
 
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <unistd.h>
+
 /*
  * Located at the beginning of disk and the disk page management files
  * to detect invlaid disk/disk management files.
 */
 #define MAGIC_HEADER 0x4b534944
 
+/*
+ * Write ahead log records, each a type, page and number of pages word, followed by the page data
+ * for WAL_PAGE. A WAL_COMMIT ends a group, with the number of records in the group for page and
+ * the FNV-1a hash of the group's bytes for npages.
+ */
+#define WAL_PAGE 1
+#define WAL_ALLOC 2
+#define WAL_FREE 3
+#define WAL_FREE_ALL 4
+#define WAL_COMMIT 5
+#define WAL_HEADER_SIZE 12
+
 #define UNUSED(x) (void)(x)
 
+static word fnv1a(const byte *data, size_t n_bytes)
+{
+    word hash = 2166136261U;
+    for (size_t i = 0; i < n_bytes; i++) {
+        hash = (hash ^ data[i]) * 16777619U;
+    }
+    return hash;
+}
+
+static void put_word(std::vector<byte>& bytes, word val)
+{
+    for (int i = 0; i < 4; i++) {
+        bytes.push_back((val >> (8 * i)) & 0xFF);
+    }
+}
+
+static word get_word(const byte *bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((word) bytes[3] << 24);
+}
+
 Disk::Disk(File diskfile, word npages, word lo_page) :
     BaseMemory(npages, lo_page),
     m_free_list(0, npages, false)
@@ -22,6 +61,22 @@ Disk::Disk(File diskfile, word npages, word lo_page) :
     this->m_cache = new CachePage[AEMU_DISK_CACHE_SIZE];
 
     read_disk_files();
+    recover_journal();
+}
+
+Disk::Disk(File diskfile, word npages, word lo_page, const File& initial_manager) :
+    BaseMemory(npages, lo_page),
+    m_free_list(0, npages, false)
+{
+    this->m_diskfile = diskfile;
+    this->m_diskfile_manager = File(diskfile.get_path() + ".info", true);
+    this->m_npages = npages;
+    this->m_cache = new CachePage[AEMU_DISK_CACHE_SIZE];
+
+    FileReader freader(m_diskfile_manager, std::ios::binary | std::ios::in);
+    bool saved = freader.has_next_byte();
+    freader.close();
+    read_disk_manager_file(saved ? m_diskfile_manager : initial_manager);
 }
 
 Disk::Disk() :
@@ -40,14 +95,18 @@ void Disk::read_disk_files()
      * would mean we would have to add free pages to the disk free page manager FBL,
      * so it is better to create the disk free page manager before adding such free pages.
      */
-    read_disk_manager_file();
+    read_disk_manager_file(m_diskfile_manager);
 
     /* TODO: Determine what it means if m_npages == 0: should we clear the disk files? */
     if (m_npages == 0) {
         return;
     }
 
-    std::ofstream disk_file(m_diskfile.get_path(), std::ios::binary | std::ios::ate | std::ios::out);
+    /* std::ios::in so an existing disk file is not truncated. */
+    std::ofstream disk_file(m_diskfile.get_path(), std::ios::binary | std::ios::ate | std::ios::out | std::ios::in);
+    if (!disk_file.is_open()) {
+        disk_file.open(m_diskfile.get_path(), std::ios::binary | std::ios::ate | std::ios::out);
+    }
     if (!disk_file.is_open()) {
         ERROR("Error opening disk file.");
         return;
@@ -73,22 +132,26 @@ void Disk::read_disk_files()
     }
 
     /*
-     * Disk file size is smaller than what is needed,
-     * we can correct this by increasing the size to what we want.
+     * Disk file size is smaller than what is needed, we can correct this by increasing the size
+     * to what we want. Growing it with ftruncate leaves a hole that reads as zeros without
+     * taking any space, so creating even a large disk is instant.
      */
-    std::streamsize padding_size = target_size - actual_size;
-    DEBUG("Padding disk file of size %llu bytes with %llu bytes.", actual_size, padding_size);
-
-    std::vector<char> padding(padding_size, 0);
-    disk_file.write(padding.data(), padding_size);
-
     disk_file.close();
+    DEBUG("Growing disk file of size %llu bytes to %llu bytes.", actual_size, target_size);
+
+    int fd = open(m_diskfile.get_path().c_str(), O_WRONLY);
+    if (fd < 0 || ftruncate(fd, target_size) != 0) {
+        ERROR("Error growing disk file.");
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
     DEBUG("Successfully created disk file of size %llu pages.", m_npages);
 }
 
-void Disk::read_disk_manager_file()
+void Disk::read_disk_manager_file(const File& manager_file)
 {
-    FileReader freader(m_diskfile_manager, std::ios::binary | std::ios::in);
+    FileReader freader(manager_file, std::ios::binary | std::ios::in);
     std::vector<byte> bytes;
     while (freader.has_next_byte()) {
         bytes.push_back(freader.read_byte());
@@ -115,6 +178,10 @@ void Disk::read_disk_manager_file()
 
 Disk::~Disk()
 {
+    /* Like a crash, anything not committed is lost. */
+    if (m_wal != nullptr) {
+        fclose(m_wal);
+    }
     delete[] this->m_cache;
 }
 
@@ -143,6 +210,9 @@ const char* Disk::DiskWriteException::what() const noexcept
 word Disk::get_free_page()
 {
     word addr = m_free_list.get_free_block(1);
+    if (m_wal != nullptr) {
+        log_record(WAL_ALLOC, addr, 1, nullptr);
+    }
 
     DEBUG("Getting free disk page %u.", addr);
     return addr;
@@ -151,6 +221,10 @@ word Disk::get_free_page()
 void Disk::return_page(word page)
 {
     m_free_list.return_block(page, 1);
+    if (m_wal != nullptr) {
+        log_record(WAL_FREE, page, 1, nullptr);
+    }
+    discard_pages(page, 1);
 
     DEBUG("Returning disk page %u back to disk.", page);
 }
@@ -158,6 +232,10 @@ void Disk::return_page(word page)
 void Disk::return_all_pages()
 {
     m_free_list.return_all();
+    if (m_wal != nullptr) {
+        log_record(WAL_FREE_ALL, 0, 0, nullptr);
+    }
+    discard_pages(0, m_npages);
 
     DEBUG("Returning all disk pages back to disk");
 }
@@ -165,23 +243,67 @@ void Disk::return_all_pages()
 void Disk::return_pages(word page_lo, word page_hi)
 {
     m_free_list.force_return_block(page_lo, page_hi - page_lo + 1);
+    if (m_wal != nullptr) {
+        log_record(WAL_FREE, page_lo, page_hi - page_lo + 1, nullptr);
+    }
+    discard_pages(page_lo, page_hi - page_lo + 1);
 
     DEBUG("Returned all disk pages from %u to %u back to disk.", page_lo, page_hi);
 }
 
+void Disk::reserve_pages(word page_lo, word page_hi)
+{
+    /* The pages might already be in use from a previous reservation. */
+    m_free_list.force_return_block(page_lo, page_hi - page_lo + 1);
+    m_free_list.remove_block(page_lo, page_hi - page_lo + 1);
+    if (m_wal != nullptr) {
+        log_record(WAL_ALLOC, page_lo, page_hi - page_lo + 1, nullptr);
+    }
+
+    DEBUG("Reserving disk pages %u to %u.", page_lo, page_hi);
+}
+
 std::vector<byte> Disk::read_page(word page)
 {
     CachePage& cpage = get_cpage(page);
 
-    std::vector<byte> data(PAGE_SIZE);
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        data.push_back(cpage.data[i]);
-    }
+    std::vector<byte> data(cpage.data, cpage.data + PAGE_SIZE);
 
     DEBUG("Reading disk page %u.", page);
     return data;
 }
 
+void Disk::read_pages(word page, word npages, byte *dst)
+{
+    if (page + npages > m_npages || page + npages < page) {
+        throw DiskReadException("Cannot read disk pages " + std::to_string(page) + " to " +
+                std::to_string(page + npages - 1) + " of disk with " + std::to_string(m_npages) +
+                " pages.");
+    }
+
+    if (!read_backing(page, npages, dst)) {
+        throw DiskReadException("Error reading disk pages " + std::to_string(page) + " to " +
+                std::to_string(page + npages - 1) + " from disk file.");
+    }
+
+    /* Pages logged but not committed have not been written in place yet. */
+    for (const std::pair<const word, std::vector<byte>>& pair : m_wal_pages) {
+        if (pair.first >= page && pair.first < page + npages) {
+            memcpy(dst + ((pair.first - page) << PAGE_PSIZE), pair.second.data(), PAGE_SIZE);
+        }
+    }
+
+    /* Dirty cache pages have not been written back to the file yet. */
+    for (int i = 0; i < AEMU_DISK_CACHE_SIZE; i++) {
+        CachePage& cpage = m_cache[i];
+        if (cpage.valid && cpage.dirty && cpage.page >= page && cpage.page < page + npages) {
+            memcpy(dst + ((cpage.page - page) << PAGE_PSIZE), cpage.data, PAGE_SIZE);
+        }
+    }
+
+    DEBUG("Reading disk pages %u to %u.", page, page + npages - 1);
+}
+
 byte Disk::read_byte(word address)
 {
     return read_val(address, 1);
@@ -200,10 +322,10 @@ dword Disk::read_val(word address, int n_bytes)
     /* TODO: Add warning for when n_bytes is larger than 8. */
 
     /* Read from the end since the most significant byte will be located there in little endian. */
-    address += n_bytes - 1;
+    address += n_bytes - 1 - start_addr;
     word page = address >> PAGE_PSIZE;                /* Get the page address (upper bits). */
     word offset = address & (PAGE_SIZE - 1);        /* Offset into the page (lower bits). */
-    CachePage& cpage = get_cpage(page);
+    CachePage *cpage = &get_cpage(page);
 
     dword val = 0;
     for (int i = 0; i < n_bytes; i++) {
@@ -214,11 +336,11 @@ dword Disk::read_val(word address, int n_bytes)
              */
             offset = PAGE_SIZE - 1;
             page--;
-            cpage = get_cpage(page);
+            cpage = &get_cpage(page);
         }
 
         val <<= 8;
-        val += cpage.data[offset];
+        val += cpage->data[offset];
         offset--;
     }
     return val;
@@ -235,7 +357,7 @@ void Disk::write_page(word page, std::vector<byte> data)
     }
 
     CachePage& cpage = get_cpage(page);
-    cpage.dirty = true;                             /* Mark as dirty since it is written to. */
+    set_dirty(cpage);                                /* Mark as dirty since it is written to. */
     for (int i = 0; i < PAGE_SIZE; i++) {
         cpage.data[i] = data.at(i);
     }
@@ -243,6 +365,34 @@ void Disk::write_page(word page, std::vector<byte> data)
     DEBUG("Wrote to disk page %u.", cpage.page);
 }
 
+void Disk::write_pages(word page, word npages, const byte *src)
+{
+    if (page + npages > m_npages || page + npages < page) {
+        throw DiskWriteException("Cannot write disk pages " + std::to_string(page) + " to " +
+                std::to_string(page + npages - 1) + " of disk with " + std::to_string(m_npages) +
+                " pages.");
+    }
+
+    if (m_wal != nullptr) {
+        for (word i = 0; i < npages; i++) {
+            log_record(WAL_PAGE, page + i, 1, src + (i << PAGE_PSIZE));
+        }
+    } else if (!write_backing(page, npages, src)) {
+        throw DiskWriteException("Error writing disk pages " + std::to_string(page) + " to " +
+                std::to_string(page + npages - 1) + " to disk file.");
+    }
+
+    for (int i = 0; i < AEMU_DISK_CACHE_SIZE; i++) {
+        CachePage& cpage = m_cache[i];
+        if (cpage.valid && cpage.page >= page && cpage.page < page + npages) {
+            memcpy(cpage.data, src + ((cpage.page - page) << PAGE_PSIZE), PAGE_SIZE);
+            set_clean(cpage);
+        }
+    }
+
+    DEBUG("Wrote disk pages %u to %u.", page, page + npages - 1);
+}
+
 void Disk::write_byte(word address, byte data)
 {
     write_val(address, data, 1);
@@ -260,10 +410,11 @@ void Disk::write_val(word address, dword val, int n_bytes)
 {
     /* TODO: Warn when n_bytes is larger than 8. */
 
+    address -= start_addr;
     word page = address >> PAGE_PSIZE;                /* Get the page address (upper bits). */
     word offset = address & (PAGE_SIZE - 1);        /* Offset into the page (lower bits). */
-    CachePage& cpage = get_cpage(page);
-    cpage.dirty = true;
+    CachePage *cpage = &get_cpage(page);
+    set_dirty(*cpage);
 
     /* Write the bytes in little endian. */
     for (int i = 0; i < n_bytes; i++) {
@@ -275,11 +426,11 @@ void Disk::write_val(word address, dword val, int n_bytes)
 
             offset = 0;
             page++;
-            cpage = get_cpage(page);
-            cpage.dirty = true;
+            cpage = &get_cpage(page);
+            set_dirty(*cpage);
         }
 
-        cpage.data[offset] = val & 0xFF;            /* Get lower 8 bits. */
+        cpage->data[offset] = val & 0xFF;            /* Get lower 8 bits. */
         val >>= 8;
         offset++;
     }
@@ -293,92 +444,195 @@ Disk::CachePage& Disk::get_cpage(word addr)
     }
 
     /* Bitwise AND does the same as modulus to index into table since cache size is a power of 2. */
-    CachePage& cpage = m_cache[(addr >> PAGE_PSIZE) & (AEMU_DISK_CACHE_SIZE - 1)];
+    CachePage& cpage = m_cache[addr & (AEMU_DISK_CACHE_SIZE - 1)];
 
     cpage.last_acc = n_acc++;                        /* LRU information, but unused for now. */
     if (cpage.valid && cpage.page == addr) {
         return cpage;
     }
 
+    const bool evicted = cpage.valid;
+    const word evicted_page = cpage.page;
     if (cpage.valid && cpage.dirty) {
         write_cpage(cpage);
     }
 
     cpage.valid = true;
+    cpage.dirty = false;
     cpage.page = addr;
     read_cpage(cpage);
 
+    /* The bus maps the frame to the page it now holds. */
+    if (evicted) {
+        frame_changed(evicted_page);
+    }
+    frame_changed(addr);
+
     DEBUG("Getting cached page %u.", cpage.page);
     return cpage;
 }
 
-void Disk::write_cpage(CachePage& cpage)
+void Disk::set_dirty(CachePage& cpage)
 {
-    /*
-     * Note, even though nothing is being read, std::ios::in has to be passed in otherwise
-     * the file stream will truncate the remaining bytes in the file for some reason.
-     */
-    std::ofstream file(m_diskfile.get_path(), std::ios::binary | std::ios::out | std::ios::in);
-    if (!file.is_open()) {
-        ERROR("Error opening disk file");
+    if (!cpage.dirty) {
+        cpage.dirty = true;
+        frame_changed(cpage.page);
     }
+}
 
-    /* Go to location of the cached page in disk so we can write to file. */
-    file.seekp(cpage.page << PAGE_PSIZE);
-    if (!file) {
-        file.close();
-        ERROR("Error seeking position in disk file");
+void Disk::set_clean(CachePage& cpage)
+{
+    if (cpage.dirty) {
+        cpage.dirty = false;
+        frame_changed(cpage.page);
     }
+}
 
-    std::vector<char> data;
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        data.push_back(cpage.data[i]);
+byte* Disk::get_direct_read(word page)
+{
+    page -= start_page;
+    CachePage& cpage = m_cache[page & (AEMU_DISK_CACHE_SIZE - 1)];
+    return (cpage.valid && cpage.page == page) ? cpage.data : nullptr;
+}
+
+byte* Disk::get_direct_write(word page)
+{
+    page -= start_page;
+    CachePage& cpage = m_cache[page & (AEMU_DISK_CACHE_SIZE - 1)];
+    return (cpage.valid && cpage.dirty && cpage.page == page) ? cpage.data : nullptr;
+}
+
+void Disk::write_cpage(CachePage& cpage)
+{
+    if (m_wal != nullptr) {
+        log_record(WAL_PAGE, cpage.page, 1, cpage.data);
+        return;
+    }
+
+    if (!write_backing(cpage.page, 1, cpage.data)) {
+        ERROR("Error writing page %u to disk file.", cpage.page);
+        return;
     }
-    file.write(data.data(), PAGE_SIZE);
 
-    file.close();
     DEBUG("Successfully wrote page %u to disk.", cpage.page);
 }
 
 void Disk::read_cpage(CachePage& cpage)
 {
-    std::ifstream file(m_diskfile.get_path(), std::ios::binary | std::ios::in);
-    if (!file.is_open()) {
-        ERROR("Error opening disk file");
+    auto logged = m_wal_pages.find(cpage.page);
+    if (logged != m_wal_pages.end()) {
+        memcpy(cpage.data, logged->second.data(), PAGE_SIZE);
         return;
     }
 
-    /* Go to location of the page so we can read from file. */
-    file.seekg(cpage.page << PAGE_PSIZE);
-    if (!file) {
-        file.close();
-        ERROR("Error seeking position of page %u in disk file.", cpage.page);
+    if (!read_backing(cpage.page, 1, cpage.data)) {
+        ERROR("Error reading page %u from disk file", cpage.page);
         return;
     }
 
-    std::vector<char> buffer(PAGE_SIZE);
-    file.read(buffer.data(), PAGE_SIZE);
+    DEBUG("Successfully read page %u from disk.", cpage.page);
+}
 
-    if (!file) {
-        file.close();
-        ERROR("Error reading page %u from disk file", cpage.page);
-        return;
+bool Disk::read_backing(word page, word npages, byte *dst)
+{
+    std::ifstream file(m_diskfile.get_path(), std::ios::binary | std::ios::in);
+    file.seekg(((std::streamoff) page) << PAGE_PSIZE);
+    file.read((char*) dst, ((std::streamsize) npages) << PAGE_PSIZE);
+    return (bool) file;
+}
+
+bool Disk::write_backing(word page, word npages, const byte *src)
+{
+    /*
+     * Note, even though nothing is being read, std::ios::in has to be passed in otherwise
+     * the file stream will truncate the remaining bytes in the file.
+     */
+    std::ofstream file(m_diskfile.get_path(), std::ios::binary | std::ios::out | std::ios::in);
+    file.seekp(((std::streamoff) page) << PAGE_PSIZE);
+    file.write((const char*) src, ((std::streamsize) npages) << PAGE_PSIZE);
+    return (bool) file;
+}
+
+void Disk::discard_pages(word page, word npages)
+{
+    /* Cached or logged copies would fill the hole again when written back. */
+    for (int i = 0; i < AEMU_DISK_CACHE_SIZE; i++) {
+        CachePage& cpage = m_cache[i];
+        if (cpage.valid && cpage.page >= page && cpage.page - page < npages) {
+            cpage.valid = false;
+            cpage.dirty = false;
+            frame_changed(cpage.page);
+        }
+    }
+    for (auto it = m_wal_pages.begin(); it != m_wal_pages.end();) {
+        it = (it->first >= page && it->first - page < npages) ? m_wal_pages.erase(it) : std::next(it);
     }
 
-    for (int i = 0; i < PAGE_SIZE; i++) {
-        cpage.data[i] = buffer[i];
+    if (m_sparse && !discard_backing(page, npages)) {
+        /* Likely not supported by the file system, so stop trying. */
+        m_sparse = false;
     }
-    file.close();
-    DEBUG("Successfully read page %u from disk.", cpage.page);
 }
 
-/*  When the program ends, we want to save all the pages in cache to disk. Instead of
-    creating many I/O streams, just create one and write all dirty and valid cache pages to disk. */
+bool Disk::discard_backing(word page, word npages)
+{
+    return punch_hole(m_diskfile.get_path(), ((std::streamoff) page) << PAGE_PSIZE,
+            ((std::streamoff) npages) << PAGE_PSIZE);
+}
+
+bool Disk::punch_hole(const std::string& path, std::streamoff offset, std::streamoff length)
+{
+#ifdef FALLOC_FL_PUNCH_HOLE
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+    int ret = fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length);
+    close(fd);
+    return ret == 0;
+#else
+    UNUSED(path);
+    UNUSED(offset);
+    UNUSED(length);
+    return false;
+#endif
+}
+
+unsigned long long Disk::get_allocated_bytes() const
+{
+    struct stat st;
+    if (stat(m_diskfile.get_path().c_str(), &st) != 0) {
+        return 0;
+    }
+    return (unsigned long long) st.st_blocks * 512;
+}
+
+void Disk::invalidate_cache()
+{
+    for (int i = 0; i < AEMU_DISK_CACHE_SIZE; i++) {
+        const bool valid = m_cache[i].valid;
+        m_cache[i].valid = false;
+        m_cache[i].dirty = false;
+        if (valid) {
+            frame_changed(m_cache[i].page);
+        }
+    }
+}
+
+void Disk::reload_free_pages(const File& manager_file)
+{
+    /* Everything in use, then free what the file lists. */
+    m_free_list.return_all();
+    m_free_list.remove_block(0, m_npages);
+    read_disk_manager_file(manager_file);
+}
+
+/*  When the program ends, we want to save all the pages in cache to disk. */
 void Disk::save()
 {
-    std::ofstream file(m_diskfile.get_path(), std::ios::binary | std::ios::in | std::ios::out);
-    if (!file.is_open()) {
-        ERROR("Error opening disk file");
+    if (m_wal != nullptr) {
+        /* The .info file is only rewritten at checkpoints. */
+        sync();
         return;
     }
 
@@ -389,32 +643,25 @@ void Disk::save()
             continue;
         }
 
-        file.seekp(cpage.page << PAGE_PSIZE);
-        if (!file) {
-            file.close();
-            ERROR("Error seeking position in disk file");
-            return;
-        }
-
-        std::vector<char> data;
-        for (int i = 0; i < PAGE_SIZE; i++) {
-            data.push_back(cpage.data[i]);
-        }
-        file.write(data.data(), PAGE_SIZE);
-
-        if (!file) {
-            file.close();
+        if (!write_backing(cpage.page, 1, cpage.data)) {
             ERROR("Error writing to disk file");
             return;
         }
+        set_clean(cpage);
 
         DEBUG("WRITING CACHE PAGE TO DISK %u.", cpage.page);
     }
-    file.close();
     DEBUG("Successfully wrote dirty cache pages to disk");
 
-    /* store disk management info. */
-    FileWriter fwriter(m_diskfile_manager, std::ios::binary | std::ios::out);
+    write_disk_manager_file();
+}
+
+void Disk::write_disk_manager_file()
+{
+    /* Written next to the file then renamed over it, so a crash leaves either the old or the new. */
+    const std::string path = m_diskfile_manager.get_path();
+    File tmp(path + ".tmp", true);
+    FileWriter fwriter(tmp, std::ios::binary | std::ios::out);
     ByteWriter writer(fwriter);
 
     std::vector<std::pair<word,word>> blocks = m_free_list.get_blocks();
@@ -425,6 +672,188 @@ void Disk::save()
     }
 
     fwriter.close();
+    std::filesystem::rename(tmp.get_path(), path);
+}
+
+void Disk::set_journal(const JournalConfig& config)
+{
+    m_journal_config = config;
+    if (m_wal == nullptr) {
+        m_wal = fopen((m_diskfile.get_path() + ".wal").c_str(), "ab");
+        if (m_wal == nullptr) {
+            throw DiskWriteException("Cannot open write ahead log of " + m_diskfile.get_path() + ".");
+        }
+        m_wal_size = ftell(m_wal);
+    }
+}
+
+void Disk::log_record(word type, word page, word npages, const byte *data)
+{
+    put_word(m_wal_group, type);
+    put_word(m_wal_group, page);
+    put_word(m_wal_group, npages);
+    if (type == WAL_PAGE) {
+        m_wal_group.insert(m_wal_group.end(), data, data + PAGE_SIZE);
+        m_wal_pages[page] = std::vector<byte>(data, data + PAGE_SIZE);
+    }
+    m_wal_group_records++;
+    m_journal_stats.records++;
+
+    if (m_wal_group_records >= m_journal_config.group_commit) {
+        commit_group();
+    }
+}
+
+void Disk::commit_group()
+{
+    if (m_wal_group_records == 0) {
+        return;
+    }
+
+    const word checksum = fnv1a(m_wal_group.data(), m_wal_group.size());
+    put_word(m_wal_group, WAL_COMMIT);
+    put_word(m_wal_group, m_wal_group_records);
+    put_word(m_wal_group, checksum);
+    if (fwrite(m_wal_group.data(), 1, m_wal_group.size(), m_wal) != m_wal_group.size() || fflush(m_wal) != 0) {
+        throw DiskWriteException("Error writing write ahead log of " + m_diskfile.get_path() + ".");
+    }
+    if (m_journal_config.fsync) {
+        fsync(fileno(m_wal));
+        m_journal_stats.fsyncs++;
+    }
+    m_wal_size += m_wal_group.size();
+    m_journal_stats.commits++;
+
+    /* Committed, so the pages can go in place. */
+    for (const std::pair<const word, std::vector<byte>>& pair : m_wal_pages) {
+        if (!write_backing(pair.first, 1, pair.second.data())) {
+            ERROR("Error writing page %u to disk file.", pair.first);
+        }
+    }
+    m_wal_pages.clear();
+    m_wal_group.clear();
+    m_wal_group_records = 0;
+
+    if (m_wal_size >= (long) m_journal_config.checkpoint_bytes) {
+        checkpoint();
+    }
+}
+
+void Disk::sync()
+{
+    if (m_wal == nullptr) {
+        return;
+    }
+
+    for (int i = 0; i < AEMU_DISK_CACHE_SIZE; i++) {
+        CachePage& cpage = m_cache[i];
+        if (cpage.valid && cpage.dirty) {
+            log_record(WAL_PAGE, cpage.page, 1, cpage.data);
+            set_clean(cpage);
+        }
+    }
+    commit_group();
+}
+
+void Disk::checkpoint()
+{
+    if (m_wal == nullptr) {
+        return;
+    }
+
+    /* Pages logged since the last commit are kept for the next one. */
+    if (m_wal_group_records != 0) {
+        commit_group();
+        if (m_wal_size == 0) {
+            return;                                    /* commit_group checkpointed */
+        }
+    }
+
+    /* The pages in place have to be durable before the log that has them is emptied. */
+    FILE *file = fopen(m_diskfile.get_path().c_str(), "rb+");
+    if (file != nullptr) {
+        fsync(fileno(file));
+        fclose(file);
+    }
+    write_disk_manager_file();
+
+    fclose(m_wal);
+    m_wal = fopen((m_diskfile.get_path() + ".wal").c_str(), "wb");
+    if (m_wal == nullptr) {
+        throw DiskWriteException("Cannot open write ahead log of " + m_diskfile.get_path() + ".");
+    }
+    m_wal_size = 0;
+    m_journal_stats.checkpoints++;
+
+    DEBUG("Checkpointed disk %s.", m_diskfile.get_path().c_str());
+}
+
+void Disk::recover_journal()
+{
+    const std::string path = m_diskfile.get_path() + ".wal";
+    std::ifstream file(path, std::ios::binary | std::ios::in);
+    std::vector<byte> log((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    if (log.empty()) {
+        return;
+    }
+
+    /* Replays groups up to the first one that is torn or corrupt, replaying is idempotent. */
+    size_t group = 0;
+    size_t pos = 0;
+    word records = 0;
+    while (log.size() - pos >= WAL_HEADER_SIZE) {
+        const word type = get_word(&log[pos]);
+        if (type == WAL_PAGE) {
+            if (log.size() - pos < WAL_HEADER_SIZE + PAGE_SIZE) {
+                break;
+            }
+            pos += WAL_HEADER_SIZE + PAGE_SIZE;
+            records++;
+            continue;
+        } else if (type == WAL_ALLOC || type == WAL_FREE || type == WAL_FREE_ALL) {
+            pos += WAL_HEADER_SIZE;
+            records++;
+            continue;
+        } else if (type != WAL_COMMIT || get_word(&log[pos + 4]) != records ||
+                get_word(&log[pos + 8]) != fnv1a(&log[group], pos - group)) {
+            break;
+        }
+
+        for (size_t record = group; record < pos;) {
+            const word record_type = get_word(&log[record]);
+            const word page = get_word(&log[record + 4]);
+            const word npages = get_word(&log[record + 8]);
+            if (record_type == WAL_PAGE) {
+                write_backing(page, 1, &log[record + WAL_HEADER_SIZE]);
+                record += PAGE_SIZE;
+            } else if (record_type == WAL_ALLOC) {
+                m_free_list.force_return_block(page, npages);
+                m_free_list.remove_block(page, npages);
+            } else if (record_type == WAL_FREE) {
+                m_free_list.force_return_block(page, npages);
+            } else {
+                m_free_list.return_all();
+            }
+            record += WAL_HEADER_SIZE;
+        }
+        m_journal_stats.recovered_records += records;
+
+        pos += WAL_HEADER_SIZE;
+        group = pos;
+        records = 0;
+    }
+
+    DEBUG("Recovered %llu records from %s.", m_journal_stats.recovered_records, path.c_str());
+
+    /* Checkpoint what was replayed, dropping any torn tail. */
+    FILE *disk_file = fopen(m_diskfile.get_path().c_str(), "rb+");
+    if (disk_file != nullptr) {
+        fsync(fileno(disk_file));
+        fclose(disk_file);
+    }
+    write_disk_manager_file();
+    std::filesystem::remove(path);
 }
 
 MockDisk::MockDisk()
@@ -453,10 +882,22 @@ void MockDisk::return_pages(word page_lo, word page_hi)
     UNUSED(page_hi);
 }
 
+void MockDisk::reserve_pages(word page_lo, word page_hi)
+{
+    UNUSED(page_lo);
+    UNUSED(page_hi);
+}
+
 std::vector<byte> MockDisk::read_page(word page)
 {
     UNUSED(page);
-    return std::vector<byte>();
+    return std::vector<byte>(PAGE_SIZE);
+}
+
+void MockDisk::read_pages(word page, word npages, byte *dst)
+{
+    UNUSED(page);
+    memset(dst, 0, ((size_t) npages) << PAGE_PSIZE);
 }
 
 byte MockDisk::read_byte(word address)
@@ -481,6 +922,13 @@ void MockDisk::write_page(word page, std::vector<byte> data)
     UNUSED(data);
 }
 
+void MockDisk::write_pages(word page, word npages, const byte *src)
+{
+    UNUSED(page);
+    UNUSED(npages);
+    UNUSED(src);
+}
+
 void MockDisk::write_byte(word address, byte data)
 {
     UNUSED(address);
@@ -6,6 +6,9 @@
 
 #include "util/types.h"
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <stdio.h>
 
 const word Emulator32bit::RAM_NPAGES = 16;
@@ -15,14 +18,16 @@ const word Emulator32bit::ROM_NPAGES = 16;
 const word Emulator32bit::ROM_START_PAGE = 16;
 
 Emulator32bit::Emulator32bit(word ram_npages, word ram_start_page, const byte rom_data[],
-        word rom_npages, word rom_start_page) :
+        word rom_npages, word rom_start_page, AddressTranslation translation) :
     ram(new RAM(ram_npages, ram_start_page)),
     rom(new ROM(rom_data, rom_npages, rom_start_page)),
     disk(new MockDisk()),
     mmu(new VirtualMemory(disk)),
-    system_bus(*ram, *rom, *disk, *mmu)
+    system_bus(*ram, *rom, *disk, *mmu),
+    _translation(translation)
 {
     fill_out_instructions();
+    register_default_syscalls();
     reset();
 }
 
@@ -32,14 +37,16 @@ Emulator32bit::Emulator32bit() :
 
 }
 
-Emulator32bit::Emulator32bit(RAM *ram, ROM *rom, Disk *disk) :
+Emulator32bit::Emulator32bit(RAM *ram, ROM *rom, Disk *disk, AddressTranslation translation) :
     ram(ram),
     rom(rom),
     disk(disk),
     mmu(new VirtualMemory(disk)),
-    system_bus(*ram, *rom, *disk, *mmu)
+    system_bus(*ram, *rom, *disk, *mmu),
+    _translation(translation)
 {
     fill_out_instructions();
+    register_default_syscalls();
     reset();
 }
 
@@ -114,23 +121,13 @@ void Emulator32bit::fill_out_instructions()
     _INSTR(mov)
     _INSTR(mvn)
 
-    _INSTR(ldr)
-    _INSTR(ldrb)
-    _INSTR(ldrh)
-    _INSTR(str)
-    _INSTR(strb)
-    _INSTR(strh)
-    _INSTR(swp)
-    _INSTR(swpb)
-    _INSTR(swph)
-
-    _INSTR(b)
-    _INSTR(bl)
-    _INSTR(bx)
-    _INSTR(blx)
+    select_access(current_access());
+
+    select_branches(false);
     _INSTR(swi)
 
     _INSTR(adrp)
+    _INSTR(brk)
 
     _INSTR(hlt)
 
@@ -161,50 +158,407 @@ void Emulator32bit::print()
     printf("\nMemory Dump: TODO");
 }
 
-void Emulator32bit::run(unsigned long long instructions)
+Emulator32bit::StopReason Emulator32bit::run(unsigned long long instructions)
 {
-    word instr = _op_hlt;
-    unsigned long long num_instructions_ran = 0;
-    try
+    return step_slice(instructions == 0 ? ULLONG_MAX : instructions);
+}
+
+Emulator32bit::StopReason Emulator32bit::step_slice(unsigned long long budget)
+{
+    StopReason reason;
+    _trap_pending = false;
+    _loop_work = false;
+    _reschedule = false;
+    _spin_check = false;
+    _spin_have_snapshot = false;
+    system_bus.clear_fault();
+    update_fastmem();
+    FastMemory::Scope fastmem_scope(system_bus.get_fastmem());
+
+    AccessPolicy access = current_access();
+    select_access(access);
+
+    #define RUN_SLICE(Access) \
+        if (_timing) run_slice<Access, true>(budget, reason); \
+        else run_slice<Access, false>(budget, reason);
+
+    switch (access)
+    {
+        case AccessPolicy::PHYSICAL:
+            RUN_SLICE(PhysicalAccess)
+            break;
+        case AccessPolicy::FAST_PHYSICAL:
+            RUN_SLICE(FastPhysicalAccess)
+            break;
+        case AccessPolicy::TRACED:
+            RUN_SLICE(TracedAccess)
+            break;
+        default:
+            RUN_SLICE(VirtualMemoryAccess)
+            break;
+    }
+
+    #undef RUN_SLICE
+    _fastmem = nullptr;
+    _time_base += _cycle_time ? _cycles : _retired;
+    _cycle_base += _cycles;
+    _retired = 0;
+    _cycles = 0;
+
+    reason.pc = _pc;
+    if (system_bus.has_fault())
+    {
+        reason.type = StopReason::FAULT;
+        reason.address = system_bus.get_fault_address();
+    }
+    else if (_trap_pending)
+    {
+        reason.type = _trap_type;
+        reason.code = _trap_code;
+    }
+
+    _trap_pending = false;
+    _loop_work = false;
+    system_bus.clear_fault();
+    return reason;
+}
+
+template <typename Access>
+inline word Emulator32bit::run_fused(word instr, unsigned long long remaining, StopReason& reason)
+{
+    const byte op = bitfield_u32(instr, 26, 6);
+    if (op != _op_cmp && (op != _op_sub || test_bit(instr, S_BIT)))
+    {
+        return 0;
+    }
+    reason.fusion_candidates++;
+
+    /* The rest of the group is fetched from the same page, which cannot fault since this did not. */
+    word group = op == _op_cmp ? 2 : 3;
+    word page_left = (PAGE_SIZE - (_pc & (PAGE_SIZE - 1))) >> 2;
+    if (remaining < group || page_left < group)
     {
-        if (instructions == 0)
+        return 0;
+    }
+
+    if (op == _op_cmp)
+    {
+        word b = Access::fetch(*this, _pc + 4);
+        if (bitfield_u32(b, 26, 6) != _op_b)
+        {
+            return 0;
+        }
+        _fused_cmp_b(instr, b);
+    }
+    else
+    {
+        word cmp = Access::fetch(*this, _pc + 4);
+        word b = Access::fetch(*this, _pc + 8);
+        if (bitfield_u32(cmp, 26, 6) != _op_cmp || bitfield_u32(b, 26, 6) != _op_b)
+        {
+            return 0;
+        }
+        _fused_sub_cmp_b(instr, cmp, b);
+    }
+
+    reason.fused_groups++;
+    reason.fused_instructions += group;
+    return group;
+}
+
+template <typename Access, bool Timed>
+void Emulator32bit::run_slice(unsigned long long budget, StopReason& reason)
+{
+    _retired = 0;
+    _cycles = 0;
+    _step_cycles = 0;
+    unsigned long long limit = event_limit(budget);
+    while (true)
+    {
+        if (UNLIKELY(_retired >= limit || (Timed && _cycles >= _cycle_limit)))
         {
-            while (true)
+            if (_retired >= budget)
             {
-                instr = system_bus.read_word_aligned_ram(_pc);
-                execute(instr);
-                _pc += 4;
-                num_instructions_ran++;
+                break;
             }
+
+            /* At the timer deadline. What a spinning loop reads may change now. */
+            timer->update();
+            _spin_have_snapshot = false;
+            limit = event_limit(budget);
+            continue;
         }
-        else
+
+        /* A fetch from an unmapped address reads 0, a hlt, and is reported as a fault below. */
+        word instr = Access::fetch(*this, _pc);
+
+        /* Fused groups only compare and branch, so they cannot trap. */
+        const word pc = _pc;
+        if (_fusion)
         {
-            unsigned long long start_instructions = instructions;
-            while (instructions > 0)
+            /* With timing, groups are kept from running far past the deadline, at least a cycle each. */
+            word fused = run_fused<Access>(instr, Timed ? std::min(limit - _retired, _cycle_limit - _cycles) :
+                    limit - _retired, reason);
+            if (fused != 0)
             {
-                instr = system_bus.read_word_aligned_ram(_pc);
-                execute(instr);
-                _pc += 4;
-                instructions--;
+                _retired += fused;
+                if constexpr (Timed)
+                {
+                    _cycles += _latency[_op_cmp] + _latency[_op_b] + (fused == 3 ? _latency[_op_sub] : 0) +
+                            (_pc != pc + fused * 4 ? _taken_latency : 0);
+                }
+                if (UNLIKELY(_loop_work) && !handle_loop_work(budget, limit, 0, reason))
+                {
+                    break;
+                }
+                continue;
             }
-            num_instructions_ran = start_instructions - instructions;
         }
+
+        execute(instr);
+        if constexpr (Timed)
+        {
+            /* Branches leave the program counter at the target, less the 4 added below. */
+            _step_cycles = _latency[bitfield_u32(instr, 26, 6)] + (_pc != pc ? _taken_latency : 0);
+        }
+
+        if (UNLIKELY(_loop_work || system_bus.has_fault()) && !handle_loop_work(budget, limit, 1, reason))
+        {
+            break;
+        }
+
+        _pc += 4;
+        _retired++;
+        if constexpr (Timed)
+        {
+            _cycles += _step_cycles;
+        }
+    }
+    reason.instructions = _retired;
+    reason.cycles = Timed ? _cycles : 0;
+}
+
+bool Emulator32bit::handle_loop_work(unsigned long long budget, unsigned long long& limit, word pending,
+        StopReason& reason)
+{
+    _loop_work = false;
+    if (_reschedule)
+    {
+        _reschedule = false;
+        limit = event_limit(budget);
+    }
+    if (_spin_check && !_trap_pending)
+    {
+        _spin_check = false;
+        if (!check_spin(limit, pending, reason))
+        {
+            return false;
+        }
+    }
+
+    if (_trap_pending || system_bus.has_fault())
+    {
+        if (retry_host_fault())
+        {
+            return true;
+        }
+        if (_trap_pending && _trap_type == StopReason::WATCHPOINT && !system_bus.has_fault())
+        {
+            /* The access completed, stop after the instruction like a hardware watchpoint. */
+            _pc += pending * 4;
+            _retired += pending;
+            _cycles += pending * _step_cycles;
+        }
+        return false;
+    }
+    return true;
+}
+
+unsigned long long Emulator32bit::event_limit(unsigned long long budget)
+{
+    _cycle_limit = ~0ULL;
+    if (timer == nullptr)
+    {
+        return budget;
+    }
+
+    unsigned long long deadline = timer->get_deadline();
+    if (_cycle_time)
+    {
+        /* Already due fires it before the next instruction too. */
+        _cycle_limit = deadline <= _time_base + _cycles ? _cycles : deadline - _time_base;
+        return budget;
+    }
+
+    if (deadline <= _time_base + _retired)
+    {
+        /* Already due, fire it before the next instruction. */
+        return _retired;
+    }
+    return std::min(budget, deadline - _time_base);
+}
+
+bool Emulator32bit::check_spin(unsigned long long limit, word pending, StopReason& reason)
+{
+    if (!_spin_scanned)
+    {
+        _spin_scanned = true;
+        _spin_pure = loop_is_pure(_spin_head, _spin_tail);
+    }
+    if (!_spin_pure)
+    {
+        _spin_countdown = 0;                            /* Wraps, so it is practically never checked again */
+        return true;
+    }
+
+    /* Taken right after the branch, so the state is compared at the same point of each iteration. */
+    unsigned long long now = _retired + pending;
+    unsigned long long now_cycles = _cycles + pending * _step_cycles;
+    if (!_spin_have_snapshot || _spin_snapshot_pstate != _pstate ||
+            memcmp(_spin_snapshot_x, _x, sizeof(_x)) != 0)
+    {
+        _spin_have_snapshot = true;
+        _spin_snapshot_time = now;
+        _spin_snapshot_cycles = now_cycles;
+        _spin_snapshot_pstate = _pstate;
+        memcpy(_spin_snapshot_x, _x, sizeof(_x));
+
+        _spin_countdown = _spin_backoff;
+        _spin_backoff = std::min(_spin_backoff * 2, (word) AEMU_SPIN_MAX_BACKOFF);
+        return true;
+    }
+
+    if (timer == nullptr || timer->get_deadline() == ULLONG_MAX)
+    {
+        /* Finish the branch so the slice stops at the head of the loop. */
+        _pc += pending * 4;
+        _retired += pending;
+        _cycles += pending * _step_cycles;
+        raise_trap(StopReason::IDLE);
+        return false;
+    }
+
+    /* Skip whole iterations up to the deadline, the rest run normally so the timer fires on time. */
+    unsigned long long period = now - _spin_snapshot_time;
+    unsigned long long iterations = limit > now ? (limit - now) / period : 0;
+    unsigned long long cycle_period = now_cycles - _spin_snapshot_cycles;
+    if (_cycle_time && cycle_period > 0)
+    {
+        iterations = std::min(iterations, _cycle_limit > now_cycles ? (_cycle_limit - now_cycles) / cycle_period : 0);
+    }
+    _retired += iterations * period;
+    _cycles += iterations * cycle_period;
+    reason.skipped_instructions += iterations * period;
+    _spin_snapshot_time = now + iterations * period;
+    _spin_snapshot_cycles = now_cycles + iterations * cycle_period;
+    _spin_countdown = 1;
+    return true;
+}
+
+bool Emulator32bit::loop_is_pure(word head, word tail)
+{
+    for (word address = head; address <= tail; address += 4)
+    {
+        word instr = _translation == AddressTranslation::PHYSICAL ?
+                system_bus.read_word<PhysicalTranslation>(address) : system_bus.read_word(address);
+        switch (bitfield_u32(instr, 26, 6))
+        {
+            case _op_str:
+            case _op_strb:
+            case _op_strh:
+            case _op_swp:
+            case _op_swpb:
+            case _op_swph:
+            case _op_swi:
+            case _op_bl:
+            case _op_bx:
+            case _op_blx:
+            case _op_hlt:
+                return false;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+Emulator32bit::AccessPolicy Emulator32bit::current_access()
+{
+    if (_caches != nullptr)
+    {
+        return AccessPolicy::TRACED;
     }
-    catch(const Exception& e)
+    if (_translation == AddressTranslation::VIRTUAL_MEMORY)
     {
-        std::cerr << "Caught Emulator Exception: " << e.what() << std::endl;
+        return AccessPolicy::VIRTUAL_MEMORY;
     }
-    catch(const SystemBus::Exception& e)
+    return _fastmem != nullptr ? AccessPolicy::FAST_PHYSICAL : AccessPolicy::PHYSICAL;
+}
+
+bool Emulator32bit::retry_host_fault()
+{
+    FastMemory *fastmem = system_bus.get_fastmem();
+    if (fastmem == nullptr || !fastmem->take_host_fault())
     {
-        std::cerr << "Caught System Bus Exception: " << e.what() << std::endl;
+        return false;
     }
 
-    printf("Ran %llu instructions\n", num_instructions_ran);
+    /* Whatever the instruction did with the scratch page is discarded. */
+    _trap_pending = false;
+    system_bus.clear_fault();
+
+    /* Run it with the policy that goes through the bus, then switch back. */
+    AccessPolicy access = _access;
+    _fastmem = nullptr;
+    select_access(current_access());
+    execute(_translation == AddressTranslation::PHYSICAL ? PhysicalAccess::fetch(*this, _pc) :
+            VirtualMemoryAccess::fetch(*this, _pc));
+    update_fastmem();
+    select_access(access);
+    return !_trap_pending && !system_bus.has_fault();
+}
+
+std::string Emulator32bit::StopReason::to_string() const
+{
+    static const char *names[] = {
+        "halt", "fault", "exit", "instruction budget exhausted", "bad instruction", "bad syscall",
+        "failed assertion", "blocked", "idle", "breakpoint", "watchpoint",
+    };
+
+    std::string str = std::string(names[type]) + " at pc " + to_hex_str(pc);
+    if (type == FAULT)
+    {
+        str += " accessing " + to_hex_str(address);
+    }
+    else if (type == WATCHPOINT)
+    {
+        str += " accessing " + to_hex_str(code);
+    }
+    else if (type == SYSCALL_EXIT)
+    {
+        str += " with status " + std::to_string(code);
+    }
+    else if (type == BAD_SYSCALL)
+    {
+        str += ", syscall " + std::to_string(code);
+    }
+    str += " after " + std::to_string(instructions) + " instructions";
+    if (skipped_instructions > 0)
+    {
+        str += " (" + std::to_string(skipped_instructions) + " fast forwarded)";
+    }
+    if (fusion_candidates > 0)
+    {
+        str += ", fused " + std::to_string(fused_groups) + " of " + std::to_string(fusion_candidates) +
+                " candidates (" + std::to_string(fused_groups * 100 / fusion_candidates) + "%)";
+    }
+    return str;
 }
 
 void Emulator32bit::reset()
 {
     system_bus.reset();
+    _trap_pending = false;
     for (unsigned long long i = 0; i < sizeof(_x) / sizeof(_x[0]); i++)
     {
         _x[i] = (1ULL << (8 * sizeof(word))) - 1;
@@ -212,5 +566,81 @@ void Emulator32bit::reset()
     _x[XZR] = 0;
     _pstate = 0;
     _pc = 0;
+    _time_base = 0;
+    _retired = 0;
+    _cycles = 0;
+    _cycle_base = 0;
+}
 
+Emulator32bit::Snapshot Emulator32bit::save_snapshot()
+{
+    Snapshot snapshot;
+    memcpy(snapshot.x, _x, sizeof(_x));
+    snapshot.pc = _pc;
+    snapshot.pstate = _pstate;
+    snapshot.pagedir = _pagedir;
+    snapshot.time = get_time();
+    snapshot.cycles = get_cycles();
+    snapshot.pending_irqs = system_bus.get_pending_irqs();
+
+    const word lo = system_bus.ram.get_lo_page();
+    const word hi = system_bus.ram.get_hi_page();
+    snapshot.ram.resize((unsigned long long) (hi - lo + 1) << PAGE_PSIZE);
+    for (word page = lo; page <= hi; page++)
+    {
+        system_bus.read_physical_page(page, snapshot.ram.data() + ((unsigned long long) (page - lo) << PAGE_PSIZE));
+    }
+    return snapshot;
+}
+
+void Emulator32bit::restore_snapshot(const Snapshot& snapshot)
+{
+    memcpy(_x, snapshot.x, sizeof(_x));
+    _pc = snapshot.pc;
+    _pstate = snapshot.pstate;
+    _pagedir = snapshot.pagedir;
+    _time_base = snapshot.time;
+    _cycle_base = snapshot.cycles;
+    _retired = 0;
+    _cycles = 0;
+    _trap_pending = false;
+
+    for (word line = 0; line < 32; line++)
+    {
+        if (test_bit(snapshot.pending_irqs, line))
+        {
+            system_bus.raise_irq(line);
+        }
+        else
+        {
+            system_bus.clear_irq(line);
+        }
+    }
+
+    const word lo = system_bus.ram.get_lo_page();
+    for (word page = lo; page <= system_bus.ram.get_hi_page(); page++)
+    {
+        system_bus.write_physical_page(page, snapshot.ram.data() + ((unsigned long long) (page - lo) << PAGE_PSIZE));
+    }
+
+    /* Loops tracked before no longer mean anything. */
+    _spin_head = 1;
+    _spin_countdown = 0;
+    _spin_backoff = 0;
+    _spin_scanned = false;
+}
+
+void Emulator32bit::power_on()
+{
+    reset();
+    _pc = rom->get_lo_page() << PAGE_PSIZE;
+}
+
+void Emulator32bit::mount(FileSystem *fs)
+{
+    file_system = fs;
+    if (fs != nullptr)
+    {
+        fs->attach(system_bus);
+    }
 }
\ No newline at end of file
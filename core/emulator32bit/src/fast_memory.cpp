@@ -0,0 +1,333 @@
+#include "emulator32bit/fast_memory.h"
+#include "emulator32bit/memory.h"
+#include "emulator32bit/system_bus.h"
+
+#include <cstring>
+
+#if defined(__linux__)
+#include <mutex>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define AEMU_FASTMEM_SUPPORTED 1
+#else
+#define AEMU_FASTMEM_SUPPORTED 0
+#endif
+
+#define UNUSED(x) (void)(x)
+
+FastMemory::FastMemoryException::FastMemoryException(const std::string& msg) :
+    message(msg)
+{
+
+}
+
+const char* FastMemory::FastMemoryException::what() const noexcept
+{
+    return message.c_str();
+}
+
+#if AEMU_FASTMEM_SUPPORTED
+
+/* Region that host faults on this thread belong to, set by FastMemory::Scope. */
+static thread_local FastMemory *t_active = nullptr;
+static struct sigaction s_prev_action;
+
+static void handle_sigsegv(int sig, siginfo_t *info, void *context)
+{
+    FastMemory *fastmem = t_active;
+    if (fastmem != nullptr && fastmem->handle_fault((byte*) info->si_addr))
+    {
+        return;
+    }
+
+    /* Not a guest access, hand it to whoever handled SIGSEGV before. */
+    if (s_prev_action.sa_flags & SA_SIGINFO)
+    {
+        s_prev_action.sa_sigaction(sig, info, context);
+    }
+    else if (s_prev_action.sa_handler != SIG_DFL && s_prev_action.sa_handler != SIG_IGN)
+    {
+        s_prev_action.sa_handler(sig);
+    }
+    else
+    {
+        /* Returning retries the access, which now terminates the process as usual. */
+        signal(SIGSEGV, SIG_DFL);
+    }
+}
+
+bool FastMemory::is_supported()
+{
+    return sysconf(_SC_PAGESIZE) == PAGE_SIZE;
+}
+
+FastMemory::FastMemory(SystemBus& bus) :
+    m_bus(bus)
+{
+    if (!is_supported())
+    {
+        throw FastMemoryException("Host page size is not " + std::to_string(PAGE_SIZE) + " bytes.");
+    }
+
+    void *base = mmap(nullptr, AEMU_FASTMEM_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+            -1, 0);
+    if (base == MAP_FAILED)
+    {
+        throw FastMemoryException("Could not reserve the fast memory region.");
+    }
+    m_base = (byte*) base;
+
+    /* Sparse, pages are only allocated for memories that are added. */
+    m_fd = memfd_create("aemu-fastmem", MFD_CLOEXEC);
+    if (m_fd < 0 || ftruncate(m_fd, AEMU_FASTMEM_SIZE) != 0)
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+        munmap(m_base, AEMU_FASTMEM_SIZE);
+        throw FastMemoryException("Could not create the fast memory backing file.");
+    }
+
+    m_pages.resize(AEMU_FASTMEM_SIZE >> PAGE_PSIZE, 0);
+
+    static std::once_flag s_install;
+    std::call_once(s_install, []() {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = handle_sigsegv;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &s_prev_action);
+    });
+}
+
+FastMemory::~FastMemory()
+{
+    for (View& view : m_views)
+    {
+        if (view.data != nullptr)
+        {
+            munmap(view.data, view.size);
+        }
+    }
+    munmap(m_base, AEMU_FASTMEM_SIZE);
+    close(m_fd);
+}
+
+void FastMemory::add_memory(Memory& memory)
+{
+    View *added = nullptr;
+    for (View& view : m_views)
+    {
+        if (view.memory == &memory)
+        {
+            added = &view;
+        }
+    }
+
+    /* Only a view of an image the memory stopped sharing has to be redone. */
+    int image_fd = memory.get_image_fd();
+    if (added != nullptr && (added->image_fd < 0 || added->image_fd == image_fd))
+    {
+        return;
+    }
+
+    size_t size = ((size_t) memory.get_mem_pages()) << PAGE_PSIZE;
+    if (size == 0)
+    {
+        return;
+    }
+    off_t offset = ((off_t) memory.get_lo_page()) << PAGE_PSIZE;
+
+    if (added == nullptr && image_fd >= 0)
+    {
+        /* Map shared images, like a ROM, as they are so every emulator shares the host pages. */
+        if (mmap(m_base + offset, size, PROT_NONE, MAP_PRIVATE | MAP_FIXED, image_fd, 0) == MAP_FAILED)
+        {
+            throw FastMemoryException("Could not map memory at page " + std::to_string(memory.get_lo_page()) +
+                    " into the fast memory region.");
+        }
+
+        m_views.push_back({&memory, memory.get_lo_page(), nullptr, size, image_fd});
+        for (word page = memory.get_lo_page(); page <= memory.get_hi_page(); page++)
+        {
+            m_pages[page] = PAGE_BACKED;
+        }
+        return;
+    }
+
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+    if (data == MAP_FAILED)
+    {
+        throw FastMemoryException("Could not map memory at page " + std::to_string(memory.get_lo_page()) +
+                " into the fast memory region.");
+    }
+    if (mmap(m_base + offset, size, PROT_NONE, MAP_SHARED | MAP_FIXED, m_fd, offset) == MAP_FAILED)
+    {
+        munmap(data, size);
+        throw FastMemoryException("Could not map memory at page " + std::to_string(memory.get_lo_page()) +
+                " into the fast memory region.");
+    }
+
+    memcpy(data, memory.data, size);
+    memory.relocate((byte*) data);
+    if (added != nullptr)
+    {
+        added->data = (byte*) data;
+        added->image_fd = -1;
+    }
+    else
+    {
+        m_views.push_back({&memory, memory.get_lo_page(), (byte*) data, size, -1});
+    }
+
+    for (word page = memory.get_lo_page(); page <= memory.get_hi_page(); page++)
+    {
+        m_pages[page] = PAGE_BACKED;
+    }
+}
+
+void FastMemory::protect(word page, bool read, bool write)
+{
+    if (!(m_pages[page] & PAGE_BACKED))
+    {
+        return;
+    }
+
+    m_pages[page] = PAGE_BACKED | (read ? PAGE_READ : 0) | (write ? PAGE_WRITE : 0);
+    mprotect(m_base + (((size_t) page) << PAGE_PSIZE), PAGE_SIZE,
+            (read ? PROT_READ : 0) | (write ? PROT_WRITE : 0));
+}
+
+void FastMemory::map_page(word page)
+{
+    byte *address = m_base + (((size_t) page) << PAGE_PSIZE);
+    byte flags = m_pages[page];
+    if (flags & PAGE_BACKED)
+    {
+        int prot = ((flags & PAGE_READ) ? PROT_READ : 0) | ((flags & PAGE_WRITE) ? PROT_WRITE : 0);
+        for (View& view : m_views)
+        {
+            if (view.image_fd >= 0 && page >= view.lo_page && page - view.lo_page < (view.size >> PAGE_PSIZE))
+            {
+                mmap(address, PAGE_SIZE, prot, MAP_PRIVATE | MAP_FIXED, view.image_fd,
+                        ((off_t) (page - view.lo_page)) << PAGE_PSIZE);
+                return;
+            }
+        }
+        mmap(address, PAGE_SIZE, prot, MAP_SHARED | MAP_FIXED, m_fd, ((off_t) page) << PAGE_PSIZE);
+    }
+    else
+    {
+        mmap(address, PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    }
+}
+
+bool FastMemory::handle_fault(byte *address)
+{
+    if (address < m_base || address >= m_base + AEMU_FASTMEM_SIZE || m_nscratch == AEMU_FASTMEM_MAX_SCRATCH)
+    {
+        return false;
+    }
+
+    word paddr = address - m_base;
+    word page = paddr >> PAGE_PSIZE;
+    if (mmap(m_base + (((size_t) page) << PAGE_PSIZE), PAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_scratch[m_nscratch++] = page;
+    m_host_fault = true;
+    m_bus.set_fault(paddr);
+    return true;
+}
+
+bool FastMemory::take_host_fault()
+{
+    if (!m_host_fault)
+    {
+        return false;
+    }
+
+    for (word i = 0; i < m_nscratch; i++)
+    {
+        map_page(m_scratch[i]);
+    }
+    m_nscratch = 0;
+    m_host_fault = false;
+    return true;
+}
+
+FastMemory::Scope::Scope(FastMemory *fastmem) :
+    m_prev(t_active)
+{
+    t_active = fastmem;
+}
+
+FastMemory::Scope::~Scope()
+{
+    t_active = m_prev;
+}
+
+#else
+
+bool FastMemory::is_supported()
+{
+    return false;
+}
+
+FastMemory::FastMemory(SystemBus& bus) :
+    m_bus(bus)
+{
+    throw FastMemoryException("Fast memory is not supported on this platform.");
+}
+
+FastMemory::~FastMemory()
+{
+
+}
+
+void FastMemory::add_memory(Memory& memory)
+{
+    UNUSED(memory);
+}
+
+void FastMemory::protect(word page, bool read, bool write)
+{
+    UNUSED(page);
+    UNUSED(read);
+    UNUSED(write);
+}
+
+void FastMemory::map_page(word page)
+{
+    UNUSED(page);
+}
+
+bool FastMemory::handle_fault(byte *address)
+{
+    UNUSED(address);
+    return false;
+}
+
+bool FastMemory::take_host_fault()
+{
+    return false;
+}
+
+FastMemory::Scope::Scope(FastMemory *fastmem) :
+    m_prev(nullptr)
+{
+    UNUSED(fastmem);
+}
+
+FastMemory::Scope::~Scope()
+{
+
+}
+
+#endif
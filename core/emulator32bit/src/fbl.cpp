@@ -82,6 +82,7 @@ void FreeBlockList::remove_block (word addr, word length)
         return;
     }
 
+    word block_addr = cur->addr;
     word remaining_before = addr - cur->addr;
     word remaining_after = cur->addr + cur->len - (addr + length);
 
@@ -89,7 +90,7 @@ void FreeBlockList::remove_block (word addr, word length)
 
     if (remaining_before > 0)
     {
-        return_block (addr, remaining_before);
+        return_block (block_addr, remaining_before);
     }
 
     if (remaining_after > 0)
@@ -126,7 +127,7 @@ FreeBlockList::FreeBlock *FreeBlockList::insert (word addr, word length)
     FreeBlock *next = new FreeBlock
     {
         .addr = addr,
-        .len = 1,
+        .len = length,
         .next = cur->next,
         .prev = cur,
     };
@@ -194,11 +195,18 @@ void FreeBlockList::force_return_block (word addr, word length)
 
     while (ret_block->next && ret_block->next->addr < ret_block->addr + ret_block->len)
     {
-        ret_block->len += ret_block->next->addr + ret_block->next->len -
-                (ret_block->addr + ret_block->len);
+        /* The next block may be contained in the returned one. */
+        if (ret_block->next->addr + ret_block->next->len > ret_block->addr + ret_block->len)
+        {
+            ret_block->len = ret_block->next->addr + ret_block->next->len - ret_block->addr;
+        }
 
         remove (ret_block->next);
     }
+
+    /* Merge with blocks that are adjacent but not overlapping. */
+    coalesce (ret_block);
+    coalesce (ret_block->prev);
 }
 
 
@@ -0,0 +1,687 @@
+#include "emulator32bit/file_system.h"
+
+#define AEMU_ONLY_CRITICAL_LOG
+#include "util/logger.h"
+
+#include <cstring>
+
+#define INODES_PER_PAGE (PAGE_SIZE / sizeof(FileSystem::Inode))
+#define ROOT_INODE 0
+
+FileSystem::FileSystemException::FileSystemException(const std::string& msg) :
+    message(msg)
+{
+
+}
+
+const char* FileSystem::FileSystemException::what() const noexcept
+{
+    return message.c_str();
+}
+
+void FileSystem::format(Disk& disk, word first_page, word npages, word ninodes)
+{
+    SuperBlock superblock;
+    superblock.magic = AEMU_FS_MAGIC;
+    superblock.npages = npages;
+    superblock.ninodes = ninodes;
+    superblock.bitmap_page = 1;
+    superblock.bitmap_npages = (npages + 8 * PAGE_SIZE - 1) / (8 * PAGE_SIZE);
+    superblock.inode_page = superblock.bitmap_page + superblock.bitmap_npages;
+    superblock.inode_npages = (ninodes + INODES_PER_PAGE - 1) / INODES_PER_PAGE;
+    superblock.data_page = superblock.inode_page + superblock.inode_npages;
+
+    if (ninodes == 0 || superblock.data_page >= npages)
+    {
+        throw FileSystemException("File system of " + std::to_string(npages) + " pages is too small "
+                "for " + std::to_string(ninodes) + " inodes.");
+    }
+
+    std::vector<byte> page(PAGE_SIZE);
+    memcpy(page.data(), &superblock, sizeof(superblock));
+    disk.write_page(first_page, page);
+
+    /* Metadata pages are always in use. */
+    for (word i = 0; i < superblock.bitmap_npages; i++)
+    {
+        std::fill(page.begin(), page.end(), 0);
+        for (word bit = 0; bit < 8 * PAGE_SIZE; bit++)
+        {
+            word fs_page = i * 8 * PAGE_SIZE + bit;
+            if (fs_page < superblock.data_page)
+            {
+                page[bit / 8] |= 1 << (bit % 8);
+            }
+        }
+        disk.write_page(first_page + superblock.bitmap_page + i, page);
+    }
+
+    std::fill(page.begin(), page.end(), 0);
+    for (word i = 0; i < superblock.inode_npages; i++)
+    {
+        disk.write_page(first_page + superblock.inode_page + i, page);
+    }
+
+    Inode root = {};
+    root.type = INODE_DIR;
+    memcpy(page.data(), &root, sizeof(root));
+    disk.write_page(first_page + superblock.inode_page, page);
+
+    DEBUG("Formatted file system at disk pages %u to %u.", first_page, first_page + npages - 1);
+}
+
+FileSystem::FileSystem(Disk& disk, word first_page) :
+    m_disk(disk),
+    m_first_page(first_page)
+{
+    std::vector<byte> page = disk.read_page(first_page);
+    memcpy(&m_superblock, page.data(), sizeof(m_superblock));
+    if (m_superblock.magic != AEMU_FS_MAGIC)
+    {
+        throw FileSystemException("No file system at disk page " + std::to_string(first_page) + ".");
+    }
+
+    m_bitmap.resize(((size_t) m_superblock.bitmap_npages) << PAGE_PSIZE);
+    for (word i = 0; i < m_superblock.bitmap_npages; i++)
+    {
+        page = disk.read_page(first_page + m_superblock.bitmap_page + i);
+        std::copy(page.begin(), page.end(), m_bitmap.begin() + (i << PAGE_PSIZE));
+    }
+
+    disk.reserve_pages(first_page, first_page + m_superblock.npages - 1);
+}
+
+void FileSystem::attach(SystemBus& bus)
+{
+    m_bus = &bus;
+}
+
+const FileSystem::SuperBlock& FileSystem::get_superblock() const
+{
+    return m_superblock;
+}
+
+word FileSystem::get_free_pages() const
+{
+    word free_pages = 0;
+    for (word page = m_superblock.data_page; page < m_superblock.npages; page++)
+    {
+        if (is_free(page))
+        {
+            free_pages++;
+        }
+    }
+    return free_pages;
+}
+
+word FileSystem::lookup(const std::string& name)
+{
+    Inode root = read_inode(ROOT_INODE);
+    std::vector<byte> dir(root.size);
+    read(ROOT_INODE, 0, dir.data(), root.size);
+
+    DirEntry *entries = (DirEntry*) dir.data();
+    for (word i = 0; i < root.size / sizeof(DirEntry); i++)
+    {
+        if (entries[i].inode != 0 && strncmp(entries[i].name, name.c_str(), AEMU_FS_NAME_LEN) == 0)
+        {
+            return entries[i].inode;
+        }
+    }
+    return 0;
+}
+
+word FileSystem::create(const std::string& name)
+{
+    if (name.empty() || name.size() >= AEMU_FS_NAME_LEN)
+    {
+        throw FileSystemException("Invalid file name '" + name + "'.");
+    }
+
+    if (lookup(name) != 0)
+    {
+        throw FileSystemException("File '" + name + "' already exists.");
+    }
+
+    word inode = 0;
+    for (word i = 1; i < m_superblock.ninodes; i++)
+    {
+        if (read_inode(i).type == INODE_FREE)
+        {
+            inode = i;
+            break;
+        }
+    }
+
+    if (inode == 0)
+    {
+        throw FileSystemException("No free inodes to create file '" + name + "'.");
+    }
+
+    Inode file = {};
+    file.type = INODE_FILE;
+    write_inode(inode, file);
+
+    /* Reuse a free directory entry or append a new one. */
+    DirEntry entry = {};
+    entry.inode = inode;
+    strncpy(entry.name, name.c_str(), AEMU_FS_NAME_LEN - 1);
+
+    Inode root = read_inode(ROOT_INODE);
+    word offset = root.size;
+    for (word i = 0; i < root.size / sizeof(DirEntry); i++)
+    {
+        DirEntry existing;
+        read(ROOT_INODE, i * sizeof(DirEntry), (byte*) &existing, sizeof(DirEntry));
+        if (existing.inode == 0)
+        {
+            offset = i * sizeof(DirEntry);
+            break;
+        }
+    }
+    write(ROOT_INODE, offset, (const byte*) &entry, sizeof(DirEntry));
+
+    DEBUG("Created file '%s' at inode %u.", name.c_str(), inode);
+    return inode;
+}
+
+void FileSystem::remove(const std::string& name)
+{
+    word inode = lookup(name);
+    if (inode == 0)
+    {
+        throw FileSystemException("File '" + name + "' does not exist.");
+    }
+
+    for (const OpenFile& file : m_files)
+    {
+        if (file.used && file.inode == inode)
+        {
+            throw FileSystemException("Cannot remove file '" + name + "' while it is open.");
+        }
+    }
+
+    truncate(inode);
+    write_inode(inode, Inode());
+
+    Inode root = read_inode(ROOT_INODE);
+    for (word i = 0; i < root.size / sizeof(DirEntry); i++)
+    {
+        DirEntry entry;
+        read(ROOT_INODE, i * sizeof(DirEntry), (byte*) &entry, sizeof(DirEntry));
+        if (entry.inode == inode)
+        {
+            entry = DirEntry();
+            write(ROOT_INODE, i * sizeof(DirEntry), (const byte*) &entry, sizeof(DirEntry));
+            break;
+        }
+    }
+
+    DEBUG("Removed file '%s'.", name.c_str());
+}
+
+std::vector<FileSystem::FileInfo> FileSystem::list()
+{
+    std::vector<FileInfo> files;
+    Inode root = read_inode(ROOT_INODE);
+    for (word i = 0; i < root.size / sizeof(DirEntry); i++)
+    {
+        DirEntry entry;
+        read(ROOT_INODE, i * sizeof(DirEntry), (byte*) &entry, sizeof(DirEntry));
+        if (entry.inode == 0)
+        {
+            continue;
+        }
+
+        Inode inode = read_inode(entry.inode);
+        files.push_back(FileInfo{
+            .name = std::string(entry.name, strnlen(entry.name, AEMU_FS_NAME_LEN)),
+            .inode = entry.inode,
+            .size = inode.size,
+            .nextents = inode.nextents,
+        });
+    }
+    return files;
+}
+
+FileSystem::Inode FileSystem::read_inode(word inode)
+{
+    if (inode >= m_superblock.ninodes)
+    {
+        throw FileSystemException("Invalid inode " + std::to_string(inode) + ".");
+    }
+
+    std::vector<byte> page = m_disk.read_page(m_first_page + m_superblock.inode_page +
+            inode / INODES_PER_PAGE);
+    Inode data;
+    memcpy(&data, page.data() + (inode % INODES_PER_PAGE) * sizeof(Inode), sizeof(Inode));
+    return data;
+}
+
+void FileSystem::write_inode(word inode, const Inode& data)
+{
+    word disk_page = m_first_page + m_superblock.inode_page + inode / INODES_PER_PAGE;
+    std::vector<byte> page = m_disk.read_page(disk_page);
+    memcpy(page.data() + (inode % INODES_PER_PAGE) * sizeof(Inode), &data, sizeof(Inode));
+    m_disk.write_page(disk_page, page);
+}
+
+std::vector<FileSystem::Extent> FileSystem::read_extents(const Inode& inode)
+{
+    std::vector<Extent> extents(inode.nextents);
+    for (word i = 0; i < inode.nextents && i < AEMU_FS_INLINE_EXTENTS; i++)
+    {
+        extents[i] = inode.extents[i];
+    }
+
+    if (inode.nextents > AEMU_FS_INLINE_EXTENTS)
+    {
+        std::vector<byte> page = m_disk.read_page(m_first_page + inode.extent_page);
+        memcpy(extents.data() + AEMU_FS_INLINE_EXTENTS, page.data(),
+                (inode.nextents - AEMU_FS_INLINE_EXTENTS) * sizeof(Extent));
+    }
+    return extents;
+}
+
+void FileSystem::write_extents(Inode& inode, const std::vector<Extent>& extents)
+{
+    inode.nextents = extents.size();
+    for (word i = 0; i < inode.nextents && i < AEMU_FS_INLINE_EXTENTS; i++)
+    {
+        inode.extents[i] = extents[i];
+    }
+
+    if (inode.nextents > AEMU_FS_INLINE_EXTENTS)
+    {
+        std::vector<byte> page(PAGE_SIZE);
+        memcpy(page.data(), extents.data() + AEMU_FS_INLINE_EXTENTS,
+                (inode.nextents - AEMU_FS_INLINE_EXTENTS) * sizeof(Extent));
+        m_disk.write_page(m_first_page + inode.extent_page, page);
+    }
+}
+
+void FileSystem::append_page(Inode& inode, std::vector<Extent>& extents)
+{
+    /* Grow the last extent if the page right after it is free. */
+    if (!extents.empty())
+    {
+        Extent& last = extents.back();
+        word next = last.start + last.npages;
+        if (next < m_superblock.npages && is_free(next))
+        {
+            alloc_page(next);
+            last.npages++;
+            return;
+        }
+    }
+
+    if (extents.size() >= AEMU_FS_MAX_EXTENTS)
+    {
+        throw FileSystemException("File is too fragmented, out of extents.");
+    }
+
+    /* The extent page is allocated the first time the inline extents run out. */
+    if (extents.size() == AEMU_FS_INLINE_EXTENTS)
+    {
+        inode.extent_page = alloc_page(m_superblock.data_page);
+    }
+
+    word hint = extents.empty() ? m_superblock.data_page : extents.back().start + extents.back().npages;
+    extents.push_back(Extent{.start = alloc_page(hint), .npages = 1});
+}
+
+void FileSystem::free_appended(const Inode& old_inode, const std::vector<Extent>& old_extents,
+        const Inode& inode, const std::vector<Extent>& extents)
+{
+    for (size_t i = 0; i < extents.size(); i++)
+    {
+        word kept = i < old_extents.size() ? old_extents[i].npages : 0;
+        for (word j = kept; j < extents[i].npages; j++)
+        {
+            free_page(extents[i].start + j);
+        }
+    }
+
+    if (inode.extent_page != old_inode.extent_page)
+    {
+        free_page(inode.extent_page);
+    }
+}
+
+word FileSystem::alloc_page(word hint)
+{
+    /* First fit starting at the hint, wrapping around the data pages. */
+    word data_npages = m_superblock.npages - m_superblock.data_page;
+    for (word i = 0; i < data_npages; i++)
+    {
+        word page = m_superblock.data_page + (hint - m_superblock.data_page + i) % data_npages;
+        if (is_free(page))
+        {
+            m_bitmap[page / 8] |= 1 << (page % 8);
+            save_bitmap_page(page);
+            return page;
+        }
+    }
+
+    throw FileSystemException("File system is out of free pages.");
+}
+
+void FileSystem::free_page(word page)
+{
+    m_bitmap[page / 8] &= ~(1 << (page % 8));
+    save_bitmap_page(page);
+}
+
+bool FileSystem::is_free(word page) const
+{
+    return !(m_bitmap[page / 8] & (1 << (page % 8)));
+}
+
+void FileSystem::save_bitmap_page(word page)
+{
+    word bitmap_page = page / (8 * PAGE_SIZE);
+    std::vector<byte> data(m_bitmap.begin() + (bitmap_page << PAGE_PSIZE),
+            m_bitmap.begin() + ((bitmap_page + 1) << PAGE_PSIZE));
+    m_disk.write_page(m_first_page + m_superblock.bitmap_page + bitmap_page, data);
+}
+
+void FileSystem::read_data_page(word page, byte *dst)
+{
+    word disk_page = m_first_page + page;
+    word ppage;
+    if (m_bus != nullptr && m_bus->mmu.get_resident_file_page(disk_page, ppage))
+    {
+        m_bus->read_physical_page(ppage, dst);
+        return;
+    }
+
+    std::vector<byte> data = m_disk.read_page(disk_page);
+    memcpy(dst, data.data(), PAGE_SIZE);
+}
+
+void FileSystem::write_data_page(word page, const byte *src)
+{
+    word disk_page = m_first_page + page;
+    word ppage;
+    if (m_bus != nullptr && m_bus->mmu.get_resident_file_page(disk_page, ppage))
+    {
+        m_bus->write_physical_page(ppage, src);
+        return;
+    }
+
+    m_disk.write_page(disk_page, std::vector<byte>(src, src + PAGE_SIZE));
+}
+
+word FileSystem::read(word inode, word offset, byte *dst, word n_bytes)
+{
+    Inode file = read_inode(inode);
+    if (offset >= file.size)
+    {
+        return 0;
+    }
+
+    if (n_bytes > file.size - offset)
+    {
+        n_bytes = file.size - offset;
+    }
+
+    std::vector<Extent> extents = read_extents(file);
+    std::vector<byte> page(PAGE_SIZE);
+    word file_page = 0;
+    word done = 0;
+    for (const Extent& extent : extents)
+    {
+        for (word i = 0; i < extent.npages && done < n_bytes; i++, file_page++)
+        {
+            word page_start = file_page << PAGE_PSIZE;
+            if (page_start + PAGE_SIZE <= offset + done)
+            {
+                continue;
+            }
+
+            word page_offset = offset + done - page_start;
+            word chunk = PAGE_SIZE - page_offset;
+            if (chunk > n_bytes - done)
+            {
+                chunk = n_bytes - done;
+            }
+
+            read_data_page(extent.start + i, page.data());
+            memcpy(dst + done, page.data() + page_offset, chunk);
+            done += chunk;
+        }
+    }
+    return done;
+}
+
+void FileSystem::write(word inode, word offset, const byte *src, word n_bytes)
+{
+    Inode file = read_inode(inode);
+    std::vector<Extent> extents = read_extents(file);
+
+    word allocated = 0;
+    for (const Extent& extent : extents)
+    {
+        allocated += extent.npages;
+    }
+
+    word end = offset + n_bytes;
+    if (end < offset)
+    {
+        throw FileSystemException("Write of " + std::to_string(n_bytes) + " bytes at offset " +
+                std::to_string(offset) + " is past the largest file size.");
+    }
+
+    /* Newly allocated pages are zeroed so gaps in the file read back as zeroes. */
+    std::vector<byte> page(PAGE_SIZE);
+    const Inode old_file = file;
+    const std::vector<Extent> old_extents = extents;
+    try
+    {
+        while (((word) allocated << PAGE_PSIZE) < end)
+        {
+            append_page(file, extents);
+            write_data_page(extents.back().start + extents.back().npages - 1, page.data());
+            allocated++;
+        }
+    }
+    catch (...)
+    {
+        /* Nothing was written to the file yet, give back what the write allocated. */
+        free_appended(old_file, old_extents, file, extents);
+        throw;
+    }
+
+    word file_page = 0;
+    word done = 0;
+    for (const Extent& extent : extents)
+    {
+        for (word i = 0; i < extent.npages && done < n_bytes; i++, file_page++)
+        {
+            word page_start = file_page << PAGE_PSIZE;
+            if (page_start + PAGE_SIZE <= offset + done)
+            {
+                continue;
+            }
+
+            word page_offset = offset + done - page_start;
+            word chunk = PAGE_SIZE - page_offset;
+            if (chunk > n_bytes - done)
+            {
+                chunk = n_bytes - done;
+            }
+
+            /* Whole pages do not need to be read first. */
+            if (chunk != PAGE_SIZE)
+            {
+                read_data_page(extent.start + i, page.data());
+            }
+            memcpy(page.data() + page_offset, src + done, chunk);
+            write_data_page(extent.start + i, page.data());
+            done += chunk;
+        }
+    }
+
+    if (end > file.size)
+    {
+        file.size = end;
+    }
+    write_extents(file, extents);
+    write_inode(inode, file);
+}
+
+void FileSystem::truncate(word inode)
+{
+    Inode file = read_inode(inode);
+    for (const Extent& extent : read_extents(file))
+    {
+        for (word i = 0; i < extent.npages; i++)
+        {
+            free_page(extent.start + i);
+        }
+    }
+
+    if (file.nextents > AEMU_FS_INLINE_EXTENTS)
+    {
+        free_page(file.extent_page);
+    }
+
+    file.size = 0;
+    file.nextents = 0;
+    file.extent_page = 0;
+    write_inode(inode, file);
+}
+
+word FileSystem::get_disk_page(word inode, word file_page)
+{
+    Inode file = read_inode(inode);
+    word index = file_page;
+    for (const Extent& extent : read_extents(file))
+    {
+        if (index < extent.npages)
+        {
+            return m_first_page + extent.start + index;
+        }
+        index -= extent.npages;
+    }
+
+    throw FileSystemException("Page " + std::to_string(file_page) + " is past the end of inode " +
+            std::to_string(inode) + ".");
+}
+
+FileSystem::OpenFile& FileSystem::get_open_file(word fd)
+{
+    if (fd >= AEMU_FS_MAX_FILES || !m_files[fd].used)
+    {
+        throw FileSystemException("Bad file descriptor " + std::to_string(fd) + ".");
+    }
+    return m_files[fd];
+}
+
+word FileSystem::open(const std::string& name, word flags)
+{
+    word fd = 0;
+    while (fd < AEMU_FS_MAX_FILES && m_files[fd].used)
+    {
+        fd++;
+    }
+
+    if (fd == AEMU_FS_MAX_FILES)
+    {
+        throw FileSystemException("Too many open files.");
+    }
+
+    word inode = lookup(name);
+    if (inode == 0)
+    {
+        if (!(flags & AEMU_FS_O_CREAT))
+        {
+            throw FileSystemException("File '" + name + "' does not exist.");
+        }
+        inode = create(name);
+    }
+    else if ((flags & AEMU_FS_O_TRUNC) && (flags & AEMU_FS_O_ACCMODE) != AEMU_FS_O_RDONLY)
+    {
+        truncate(inode);
+    }
+
+    m_files[fd] = OpenFile{
+        .used = true,
+        .inode = inode,
+        .offset = 0,
+        .flags = flags,
+    };
+    return fd;
+}
+
+void FileSystem::close(word fd)
+{
+    get_open_file(fd) = OpenFile();
+}
+
+word FileSystem::read_fd(word fd, byte *dst, word n_bytes)
+{
+    OpenFile& file = get_open_file(fd);
+    if ((file.flags & AEMU_FS_O_ACCMODE) == AEMU_FS_O_WRONLY)
+    {
+        throw FileSystemException("File descriptor " + std::to_string(fd) + " is not open for reading.");
+    }
+
+    word n_read = read(file.inode, file.offset, dst, n_bytes);
+    file.offset += n_read;
+    return n_read;
+}
+
+word FileSystem::write_fd(word fd, const byte *src, word n_bytes)
+{
+    OpenFile& file = get_open_file(fd);
+    if ((file.flags & AEMU_FS_O_ACCMODE) == AEMU_FS_O_RDONLY)
+    {
+        throw FileSystemException("File descriptor " + std::to_string(fd) + " is not open for writing.");
+    }
+
+    if (file.flags & AEMU_FS_O_APPEND)
+    {
+        file.offset = read_inode(file.inode).size;
+    }
+
+    write(file.inode, file.offset, src, n_bytes);
+    file.offset += n_bytes;
+    return n_bytes;
+}
+
+word FileSystem::seek(word fd, sword offset, word whence)
+{
+    OpenFile& file = get_open_file(fd);
+    long long base = 0;
+    if (whence == AEMU_FS_SEEK_CUR)
+    {
+        base = file.offset;
+    }
+    else if (whence == AEMU_FS_SEEK_END)
+    {
+        base = read_inode(file.inode).size;
+    }
+    else if (whence != AEMU_FS_SEEK_SET)
+    {
+        throw FileSystemException("Invalid seek origin " + std::to_string(whence) + ".");
+    }
+
+    if (base + offset < 0)
+    {
+        throw FileSystemException("Cannot seek before the start of the file.");
+    }
+
+    file.offset = base + offset;
+    return file.offset;
+}
+
+word FileSystem::get_fd_inode(word fd)
+{
+    return get_open_file(fd).inode;
+}
+
+bool FileSystem::is_fd_writable(word fd)
+{
+    return (get_open_file(fd).flags & AEMU_FS_O_ACCMODE) != AEMU_FS_O_RDONLY;
+}
@@ -0,0 +1,679 @@
+#include "emulator32bit/gdb_stub.h"
+
+#include "util/logger.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define AEMU_GDB_SOCKETS 1
+#else
+#define AEMU_GDB_SOCKETS 0
+#endif
+
+#define UNUSED(x) (void)(x)
+
+/* x0 to x31, then pc and cpsr. */
+#define GDB_NUM_REGS (NUM_REG + 2)
+#define GDB_REG_PC NUM_REG
+#define GDB_REG_CPSR (NUM_REG + 1)
+
+/* Largest packet we accept, advertised in qSupported. */
+#define GDB_PACKET_SIZE 0x1000
+
+/* GDB signal numbers used in stop replies. */
+#define GDB_SIGINT 2
+#define GDB_SIGILL 4
+#define GDB_SIGTRAP 5
+#define GDB_SIGABRT 6
+#define GDB_SIGSEGV 11
+#define GDB_SIGSYS 12
+
+static const char s_hex_digits[] = "0123456789abcdef";
+
+static std::string hex_byte(byte value)
+{
+    return std::string(1, s_hex_digits[value >> 4]) + s_hex_digits[value & 0xF];
+}
+
+/* Registers and memory are sent in target byte order, which is little endian. */
+static std::string hex_word_le(word value)
+{
+    std::string str;
+    for (int i = 0; i < 4; i++)
+    {
+        str += hex_byte(byte_from_word(value, i));
+    }
+    return str;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static bool parse_word_le(const std::string& hex, size_t pos, word& value)
+{
+    if (pos + 8 > hex.size())
+    {
+        return false;
+    }
+
+    value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int hi = hex_value(hex[pos + 2 * i]);
+        int lo = hex_value(hex[pos + 2 * i + 1]);
+        if (hi < 0 || lo < 0)
+        {
+            return false;
+        }
+        value |= ((word) ((hi << 4) | lo)) << (8 * i);
+    }
+    return true;
+}
+
+/* Splits "a,b,c" style arguments into numbers, which GDB sends as big endian hex. */
+static std::vector<word> parse_numbers(const std::string& args)
+{
+    std::vector<word> numbers;
+    size_t pos = 0;
+    while (pos <= args.size())
+    {
+        size_t end = args.find_first_of(",:=;", pos);
+        if (end == std::string::npos)
+        {
+            end = args.size();
+        }
+        numbers.push_back(strtoul(args.substr(pos, end - pos).c_str(), nullptr, 16));
+        pos = end + 1;
+    }
+    return numbers;
+}
+
+static std::string target_xml()
+{
+    std::string xml = "<?xml version=\"1.0\"?>"
+            "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+            "<target version=\"1.0\"><feature name=\"org.aemu.core\">";
+    for (int i = 0; i < NUM_REG; i++)
+    {
+        std::string name = "x" + std::to_string(i);
+        std::string type = "uint32";
+        if (i == FP)
+        {
+            name = "fp";
+            type = "data_ptr";
+        }
+        else if (i == LINKR)
+        {
+            name = "lr";
+            type = "code_ptr";
+        }
+        else if (i == SP)
+        {
+            name = "sp";
+            type = "data_ptr";
+        }
+        else if (i == XZR)
+        {
+            name = "xzr";
+        }
+        xml += "<reg name=\"" + name + "\" bitsize=\"32\" type=\"" + type + "\"/>";
+    }
+    xml += "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+            "<reg name=\"cpsr\" bitsize=\"32\" type=\"uint32\"/>"
+            "</feature></target>";
+    return xml;
+}
+
+GdbStub::GdbStub(Debugger& debugger) :
+    m_debugger(debugger)
+{
+
+}
+
+GdbStub::~GdbStub()
+{
+#if AEMU_GDB_SOCKETS
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+#endif
+}
+
+std::string GdbStub::handle_packet(const std::string& packet)
+{
+    if (packet.empty())
+    {
+        return "";
+    }
+
+    Emulator32bit *processor = m_debugger.get_processor();
+    std::string args = packet.substr(1);
+    switch (packet[0])
+    {
+        case '?':
+            return m_last_stop;
+        case 'g':
+            return read_registers();
+        case 'G':
+            return write_registers(args) ? "OK" : "E01";
+        case 'p':
+        {
+            word reg = strtoul(args.c_str(), nullptr, 16);
+            return reg < GDB_NUM_REGS ? hex_word_le(read_register(reg)) : "E01";
+        }
+        case 'P':
+        {
+            size_t eq = args.find('=');
+            word value;
+            if (eq == std::string::npos || !parse_word_le(args, eq + 1, value))
+            {
+                return "E01";
+            }
+            return write_register(strtoul(args.substr(0, eq).c_str(), nullptr, 16), value) ? "OK" : "E01";
+        }
+        case 'm':
+            return read_memory(args);
+        case 'M':
+            return write_memory(args);
+        case 'c':
+        case 's':
+            if (!args.empty())
+            {
+                processor->set_pc(strtoul(args.c_str(), nullptr, 16));
+            }
+            return resume(packet[0] == 's' ? 1 : 0);
+        case 'Z':
+            return set_point(args, true);
+        case 'z':
+            return set_point(args, false);
+        case 'D':
+            m_done = true;
+            return "OK";
+        case 'k':
+            m_done = true;
+            return "";
+        case 'H':
+        case 'T':
+            return "OK";
+        case 'q':
+            if (packet.rfind("qSupported", 0) == 0)
+            {
+                char supported[64];
+                snprintf(supported, sizeof(supported), "PacketSize=%x;qXfer:features:read+;swbreak+", GDB_PACKET_SIZE);
+                return supported;
+            }
+            if (packet == "qAttached")
+            {
+                return "1";
+            }
+            if (packet == "qC")
+            {
+                return "QC1";
+            }
+            if (packet == "qfThreadInfo")
+            {
+                return "m1";
+            }
+            if (packet == "qsThreadInfo")
+            {
+                return "l";
+            }
+            if (packet.rfind("qXfer:features:read:", 0) == 0)
+            {
+                return read_features(packet.substr(sizeof("qXfer:features:read:") - 1));
+            }
+            return "";
+        default:
+            return "";
+    }
+}
+
+std::string GdbStub::resume(unsigned long long instructions)
+{
+    std::string reply;
+    if (instructions == 1)
+    {
+        reply = stop_reply(m_debugger.step());
+    }
+    else
+    {
+        while (true)
+        {
+            Emulator32bit::StopReason reason = m_debugger.resume(AEMU_GDB_SLICE);
+            if (reason.type == Emulator32bit::StopReason::BUDGET_EXHAUSTED)
+            {
+                if (poll_interrupt())
+                {
+                    reply = "S" + hex_byte(GDB_SIGINT);
+                    break;
+                }
+                continue;
+            }
+
+            /* Nothing the guest can do ends the wait, so it is up to the debugger. */
+            if (reason.type == Emulator32bit::StopReason::IDLE || reason.type == Emulator32bit::StopReason::BLOCKED)
+            {
+                wait_interrupt();
+                reply = "S" + hex_byte(GDB_SIGINT);
+                break;
+            }
+
+            reply = stop_reply(reason);
+            break;
+        }
+    }
+
+    m_last_stop = reply;
+    return reply;
+}
+
+std::string GdbStub::stop_reply(const Emulator32bit::StopReason& reason)
+{
+    switch (reason.type)
+    {
+        case Emulator32bit::StopReason::BREAKPOINT:
+            return "T" + hex_byte(GDB_SIGTRAP) + "swbreak:;";
+        case Emulator32bit::StopReason::WATCHPOINT:
+        {
+            byte access = m_debugger.get_watch_access();
+            std::string kind = access == AEMU_WATCH_WRITE ? "watch" : access == AEMU_WATCH_READ ? "rwatch" : "awatch";
+            char address[9];
+            snprintf(address, sizeof(address), "%x", m_debugger.get_watch_address());
+            return "T" + hex_byte(GDB_SIGTRAP) + kind + ":" + address + ";";
+        }
+        case Emulator32bit::StopReason::HALT:
+            return "W00";
+        case Emulator32bit::StopReason::SYSCALL_EXIT:
+            return "W" + hex_byte(reason.code);
+        case Emulator32bit::StopReason::FAULT:
+            return "S" + hex_byte(GDB_SIGSEGV);
+        case Emulator32bit::StopReason::BAD_INSTR:
+            return "S" + hex_byte(GDB_SIGILL);
+        case Emulator32bit::StopReason::BAD_SYSCALL:
+            return "S" + hex_byte(GDB_SIGSYS);
+        case Emulator32bit::StopReason::FAILED_ASSERT:
+            return "S" + hex_byte(GDB_SIGABRT);
+        default:
+            return "S" + hex_byte(GDB_SIGTRAP);
+    }
+}
+
+word GdbStub::read_register(word reg)
+{
+    Emulator32bit *processor = m_debugger.get_processor();
+    if (reg == GDB_REG_PC)
+    {
+        return processor->get_pc();
+    }
+    if (reg == GDB_REG_CPSR)
+    {
+        return processor->get_pstate();
+    }
+    return processor->read_reg(reg);
+}
+
+bool GdbStub::write_register(word reg, word value)
+{
+    Emulator32bit *processor = m_debugger.get_processor();
+    if (reg == GDB_REG_PC)
+    {
+        processor->set_pc(value);
+    }
+    else if (reg == GDB_REG_CPSR)
+    {
+        processor->set_pstate(value);
+    }
+    else if (reg < XZR)
+    {
+        processor->write_reg(reg, value);
+    }
+    else if (reg != XZR)
+    {
+        return false;
+    }
+    return true;
+}
+
+std::string GdbStub::read_registers()
+{
+    std::string reply;
+    for (word reg = 0; reg < GDB_NUM_REGS; reg++)
+    {
+        reply += hex_word_le(read_register(reg));
+    }
+    return reply;
+}
+
+bool GdbStub::write_registers(const std::string& hex)
+{
+    if (hex.size() != GDB_NUM_REGS * 8)
+    {
+        return false;
+    }
+
+    for (word reg = 0; reg < GDB_NUM_REGS; reg++)
+    {
+        word value;
+        if (!parse_word_le(hex, reg * 8, value))
+        {
+            return false;
+        }
+        write_register(reg, value);
+    }
+    return true;
+}
+
+std::string GdbStub::read_memory(const std::string& args)
+{
+    std::vector<word> numbers = parse_numbers(args);
+    if (numbers.size() != 2 || numbers[1] > GDB_PACKET_SIZE / 2)
+    {
+        return "E01";
+    }
+
+    std::vector<byte> data(numbers[1]);
+    if (!m_debugger.read_memory(numbers[0], data.data(), numbers[1]))
+    {
+        return "E01";
+    }
+
+    std::string reply;
+    for (byte value : data)
+    {
+        reply += hex_byte(value);
+    }
+    return reply;
+}
+
+std::string GdbStub::write_memory(const std::string& args)
+{
+    size_t colon = args.find(':');
+    if (colon == std::string::npos)
+    {
+        return "E01";
+    }
+
+    std::vector<word> numbers = parse_numbers(args.substr(0, colon));
+    if (numbers.size() != 2 || args.size() - colon - 1 != numbers[1] * 2)
+    {
+        return "E01";
+    }
+
+    std::vector<byte> data(numbers[1]);
+    for (word i = 0; i < numbers[1]; i++)
+    {
+        int hi = hex_value(args[colon + 1 + 2 * i]);
+        int lo = hex_value(args[colon + 2 + 2 * i]);
+        if (hi < 0 || lo < 0)
+        {
+            return "E01";
+        }
+        data[i] = (hi << 4) | lo;
+    }
+    return m_debugger.write_memory(numbers[0], data.data(), numbers[1]) ? "OK" : "E01";
+}
+
+std::string GdbStub::set_point(const std::string& args, bool insert)
+{
+    std::vector<word> numbers = parse_numbers(args);
+    if (numbers.size() < 3)
+    {
+        return "E01";
+    }
+
+    word address = numbers[1];
+    word kind = numbers[2];
+    bool ok;
+    switch (numbers[0])
+    {
+        case 0:
+            ok = insert ? m_debugger.insert_breakpoint(address) : m_debugger.remove_breakpoint(address);
+            break;
+        case 2:
+        case 3:
+        case 4:
+        {
+            byte access = numbers[0] == 2 ? AEMU_WATCH_WRITE : numbers[0] == 3 ? AEMU_WATCH_READ :
+                    AEMU_WATCH_READ | AEMU_WATCH_WRITE;
+            ok = insert ? m_debugger.insert_watchpoint(address, kind, access) :
+                    m_debugger.remove_watchpoint(address, kind, access);
+            break;
+        }
+        default:
+            return "";                                /* Hardware breakpoints are not supported */
+    }
+    return ok ? "OK" : "E01";
+}
+
+std::string GdbStub::read_features(const std::string& args)
+{
+    size_t colon = args.find(':');
+    if (colon == std::string::npos || args.substr(0, colon) != "target.xml")
+    {
+        return "E00";
+    }
+
+    std::vector<word> numbers = parse_numbers(args.substr(colon + 1));
+    if (numbers.size() != 2)
+    {
+        return "E01";
+    }
+
+    std::string xml = target_xml();
+    if (numbers[0] >= xml.size())
+    {
+        return "l";
+    }
+    std::string chunk = xml.substr(numbers[0], numbers[1]);
+    return (numbers[0] + chunk.size() < xml.size() ? "m" : "l") + chunk;
+}
+
+#if AEMU_GDB_SOCKETS
+
+bool GdbStub::serve(word port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0)
+    {
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, (sockaddr*) &address, sizeof(address)) != 0 || listen(listener, 1) != 0)
+    {
+        close(listener);
+        return false;
+    }
+
+    INFO("Waiting for GDB on port %u.", port);
+    m_fd = accept(listener, nullptr, nullptr);
+    close(listener);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+    setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    std::string packet;
+    while (!m_done && receive(packet))
+    {
+        std::string reply = handle_packet(packet);
+        if (packet[0] != 'k')
+        {
+            send(reply);
+        }
+    }
+
+    close(m_fd);
+    m_fd = -1;
+    return true;
+}
+
+bool GdbStub::poll_interrupt()
+{
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    pollfd fd = {m_fd, POLLIN, 0};
+    while (poll(&fd, 1, 0) > 0)
+    {
+        char c;
+        if (recv(m_fd, &c, 1, 0) != 1)
+        {
+            m_done = true;
+            return true;
+        }
+        if (c == 0x03)
+        {
+            return true;
+        }
+        /* Anything else is a stray acknowledgement. */
+    }
+    return false;
+}
+
+void GdbStub::wait_interrupt()
+{
+    while (m_fd >= 0)
+    {
+        char c;
+        if (recv(m_fd, &c, 1, 0) != 1)
+        {
+            m_done = true;
+            return;
+        }
+        if (c == 0x03)
+        {
+            return;
+        }
+    }
+}
+
+bool GdbStub::receive(std::string& packet)
+{
+    while (true)
+    {
+        char c;
+        do
+        {
+            if (recv(m_fd, &c, 1, 0) != 1)
+            {
+                return false;
+            }
+        } while (c != '$');                            /* Skips acknowledgements and stray interrupts */
+
+        packet.clear();
+        byte checksum = 0;
+        while (true)
+        {
+            if (recv(m_fd, &c, 1, 0) != 1)
+            {
+                return false;
+            }
+            if (c == '#')
+            {
+                break;
+            }
+            packet += c;
+            checksum += c;
+        }
+
+        char sent[2];
+        if (recv(m_fd, sent, 1, 0) != 1 || recv(m_fd, sent + 1, 1, 0) != 1)
+        {
+            return false;
+        }
+
+        bool valid = hex_value(sent[0]) >= 0 && hex_value(sent[1]) >= 0 &&
+                ((hex_value(sent[0]) << 4) | hex_value(sent[1])) == checksum;
+        const char ack = valid ? '+' : '-';
+        ::send(m_fd, &ack, 1, 0);
+        if (valid && !packet.empty())
+        {
+            return true;
+        }
+    }
+}
+
+void GdbStub::send(const std::string& packet)
+{
+    byte checksum = 0;
+    for (char c : packet)
+    {
+        checksum += c;
+    }
+
+    std::string framed = "$" + packet + "#" + hex_byte(checksum);
+    size_t sent = 0;
+    while (sent < framed.size())
+    {
+        ssize_t n = ::send(m_fd, framed.data() + sent, framed.size() - sent, 0);
+        if (n <= 0)
+        {
+            return;
+        }
+        sent += n;
+    }
+}
+
+#else
+
+bool GdbStub::serve(word port)
+{
+    UNUSED(port);
+    return false;
+}
+
+bool GdbStub::poll_interrupt()
+{
+    return false;
+}
+
+void GdbStub::wait_interrupt()
+{
+
+}
+
+bool GdbStub::receive(std::string& packet)
+{
+    UNUSED(packet);
+    return false;
+}
+
+void GdbStub::send(const std::string& packet)
+{
+    UNUSED(packet);
+}
+
+#endif
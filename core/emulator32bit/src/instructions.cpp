@@ -1,4 +1,6 @@
 #include <emulator32bit/emulator32bit.h>
+#include <emulator32bit/coverage.h>
+#include <emulator32bit/sampler.h>
 
 #define AEMU_ONLY_CRITICAL_LOG
 #include <util/logger.h>
@@ -302,7 +304,7 @@ word Emulator32bit::asm_format_b2(const byte opcode, const ConditionCode cond, c
 void Emulator32bit::_hlt(const word instr)
 {
     UNUSED(instr);
-    throw Exception(HALT_INSTR, "HLT Exception");
+    raise_trap(StopReason::HALT);
 }
 
 word Emulator32bit::asm_hlt()
@@ -310,6 +312,17 @@ word Emulator32bit::asm_hlt()
     return Joiner() << JPart(6, _op_hlt) << 26;
 }
 
+void Emulator32bit::_brk(const word instr)
+{
+    UNUSED(instr);
+    raise_trap(StopReason::BREAKPOINT);
+}
+
+word Emulator32bit::asm_brk()
+{
+    return Joiner() << JPart(6, _op_brk) << 26;
+}
+
 void Emulator32bit::_nop(const word instr)
 {
     UNUSED(instr);
@@ -808,24 +821,22 @@ void Emulator32bit::_mvn(const word instr)
     write_reg(xd, dst_val);
 }
 
-word Emulator32bit::calc_mem_addr(word xn, sword offset, byte addr_mode)
+bool Emulator32bit::calc_mem_addr(byte xn, sword offset, byte addr_mode, word& mem_addr)
 {
-    word mem_addr = 0;
     const word xn_val = read_reg(xn);
-    if (addr_mode == 0) {
-        mem_addr = xn_val + offset;
-    } else if (addr_mode == 1) {
+    if (addr_mode == ADDR_OFFSET || addr_mode == ADDR_PRE_INC) {
         mem_addr = xn_val + offset;
-        write_reg(xn, mem_addr);
-    } else if (addr_mode == 2) {
+    } else if (addr_mode == ADDR_POST_INC) {
         mem_addr = xn_val;
-        write_reg(xn, xn_val + offset);
     } else {
-        throw Exception(BAD_INSTR, "Bad memory address mode " + std::to_string(addr_mode));
+        DEBUG("Bad memory address mode %u", (unsigned) addr_mode);
+        raise_trap(StopReason::BAD_INSTR);
+        return false;
     }
-    return mem_addr;
+    return true;
 }
 
+template <typename Access>
 void Emulator32bit::_ldr(const word instr)
 {
     const byte xt = _X1(instr);
@@ -839,8 +850,15 @@ void Emulator32bit::_ldr(const word instr)
     }
 
     const byte address_mode = bitfield_u32(instr, 0, 2);
-    const word mem_addr = calc_mem_addr(xn, offset, address_mode);
-    const word read_val = system_bus.read_word(mem_addr);
+    word mem_addr = 0;
+    if (UNLIKELY(!calc_mem_addr(xn, offset, address_mode, mem_addr))) {
+        return;
+    }
+    const word read_val = Access::read_word(*this, mem_addr);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
+    writeback_mem_addr(xn, offset, address_mode);
 
     if (address_mode == 0) {
         DEBUG_SS(std::stringstream() << "ldr x" << std::to_string(xt) << ", [x"
@@ -858,6 +876,7 @@ void Emulator32bit::_ldr(const word instr)
     write_reg(xt, read_val);
 }
 
+template <typename Access>
 void Emulator32bit::_ldrb(const word instr)
 {
     const bool sign = test_bit(instr, 25);
@@ -872,8 +891,15 @@ void Emulator32bit::_ldrb(const word instr)
     }
 
     const byte address_mode = bitfield_u32(instr, 0, 2);
-    const word mem_addr = calc_mem_addr(xn, offset, address_mode);
-    word read_val = system_bus.read_byte(mem_addr);
+    word mem_addr = 0;
+    if (UNLIKELY(!calc_mem_addr(xn, offset, address_mode, mem_addr))) {
+        return;
+    }
+    word read_val = Access::read_byte(*this, mem_addr);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
+    writeback_mem_addr(xn, offset, address_mode);
     if (sign) {
         read_val = (sword) ((byte) read_val);
     }
@@ -894,6 +920,7 @@ void Emulator32bit::_ldrb(const word instr)
     write_reg(xt, read_val);
 }
 
+template <typename Access>
 void Emulator32bit::_ldrh(const word instr)
 {
     const bool sign = test_bit(instr, 25);
@@ -908,8 +935,15 @@ void Emulator32bit::_ldrh(const word instr)
     }
 
     const byte address_mode = bitfield_u32(instr, 0, 2);
-    const word mem_addr = calc_mem_addr(xn, offset, address_mode);
-    word read_val = system_bus.read_hword(mem_addr);
+    word mem_addr = 0;
+    if (UNLIKELY(!calc_mem_addr(xn, offset, address_mode, mem_addr))) {
+        return;
+    }
+    word read_val = Access::read_hword(*this, mem_addr);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
+    writeback_mem_addr(xn, offset, address_mode);
     if (sign) {
         read_val = (sword) ((hword) read_val);
     }
@@ -930,6 +964,7 @@ void Emulator32bit::_ldrh(const word instr)
     write_reg(xt, read_val);
 }
 
+template <typename Access>
 void Emulator32bit::_str(const word instr)
 {
     const byte xt = _X1(instr);
@@ -943,7 +978,10 @@ void Emulator32bit::_str(const word instr)
     }
 
     const byte address_mode = bitfield_u32(instr, 0, 2);
-    const word mem_addr = calc_mem_addr(xn, offset, address_mode);
+    word mem_addr = 0;
+    if (UNLIKELY(!calc_mem_addr(xn, offset, address_mode, mem_addr))) {
+        return;
+    }
     const word write_val = read_reg(xt);
 
     if (address_mode == 0) {
@@ -959,9 +997,14 @@ void Emulator32bit::_str(const word instr)
                 << std::to_string(xn) << "], #" << offset << " (" << std::to_string(mem_addr)
                 << ") = " << std::to_string(write_val));
     }
-    system_bus.write_word(mem_addr, write_val);
+    Access::write_word(*this, mem_addr, write_val);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
+    writeback_mem_addr(xn, offset, address_mode);
 }
 
+template <typename Access>
 void Emulator32bit::_strb(const word instr)
 {
     const bool sign = test_bit(instr, 25);
@@ -976,7 +1019,10 @@ void Emulator32bit::_strb(const word instr)
     }
 
     const byte address_mode = bitfield_u32(instr, 0, 2);
-    const word mem_addr = calc_mem_addr(xn, offset, address_mode);
+    word mem_addr = 0;
+    if (UNLIKELY(!calc_mem_addr(xn, offset, address_mode, mem_addr))) {
+        return;
+    }
     word write_val = read_reg(xt);
     if (sign) {
         write_val = (sword) ((byte) write_val);
@@ -995,9 +1041,14 @@ void Emulator32bit::_strb(const word instr)
                 << std::to_string(xn) << "], " << offset << " [" << std::to_string(mem_addr)
                 << "] = " << std::to_string(write_val));
     }
-    system_bus.write_byte(mem_addr, write_val);
+    Access::write_byte(*this, mem_addr, write_val);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
+    writeback_mem_addr(xn, offset, address_mode);
 }
 
+template <typename Access>
 void Emulator32bit::_strh(const word instr)
 {
     const bool sign = test_bit(instr, 25);
@@ -1012,7 +1063,10 @@ void Emulator32bit::_strh(const word instr)
     }
 
     const byte address_mode = bitfield_u32(instr, 0, 2);
-    const word mem_addr = calc_mem_addr(xn, offset, address_mode);
+    word mem_addr = 0;
+    if (UNLIKELY(!calc_mem_addr(xn, offset, address_mode, mem_addr))) {
+        return;
+    }
     word write_val = read_reg(xt);
     if (sign) {
         write_val = (sword) ((hword)write_val);
@@ -1031,9 +1085,14 @@ void Emulator32bit::_strh(const word instr)
                 << std::to_string(xn) << "], " << offset << " [" << std::to_string(mem_addr)
                 << "] = " << std::to_string(write_val));
     }
-    system_bus.write_hword(mem_addr, write_val);
+    Access::write_hword(*this, mem_addr, write_val);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
+    writeback_mem_addr(xn, offset, address_mode);
 }
 
+template <typename Access>
 void Emulator32bit::_swp(const word instr)
 {
     const byte xt = _X1(instr);
@@ -1045,12 +1104,20 @@ void Emulator32bit::_swp(const word instr)
              << ", [x" << std::to_string(xm) << "]");
 
     const word val_reg = read_reg(xn);
-    const word val_mem = system_bus.read_word(mem_adr);
+    const word val_mem = Access::read_word(*this, mem_adr);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
 
+    /* A faulting instruction has no effect, only write xt once the store went through. */
+    Access::write_word(*this, mem_adr, val_reg);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
     write_reg(xt, val_mem);
-    system_bus.write_word(mem_adr, val_reg);
 }
 
+template <typename Access>
 void Emulator32bit::_swpb(const word instr)
 {
     const byte xt = _X1(instr);
@@ -1062,12 +1129,19 @@ void Emulator32bit::_swpb(const word instr)
              << ", [x" << std::to_string(xm) << "]");
 
     const word val_reg = read_reg(xn) & 0xFF;
-    const word val_mem = system_bus.read_byte(mem_adr);
+    const word val_mem = Access::read_byte(*this, mem_adr);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
 
+    Access::write_byte(*this, mem_adr, val_reg);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
     write_reg(xt, (val_reg & ~(0xFF)) + val_mem);
-    system_bus.write_byte(mem_adr, val_reg);
 }
 
+template <typename Access>
 void Emulator32bit::_swph(const word instr)
 {
     const byte xt = _X1(instr);
@@ -1079,49 +1153,257 @@ void Emulator32bit::_swph(const word instr)
              << ", [x" << std::to_string(xm) << "]");
 
     const word val_reg = read_reg(xn) & 0xFFFF;
-    const word val_mem = system_bus.read_byte(mem_adr);
+    const word val_mem = Access::read_byte(*this, mem_adr);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
 
+    Access::write_byte(*this, mem_adr, val_reg);
+    if (UNLIKELY(system_bus.has_fault())) {
+        return;
+    }
     write_reg(xt, (val_reg & ~(0xFFFF)) + val_mem);
-    system_bus.write_byte(mem_adr, val_reg);
 }
 
 
+void Emulator32bit::select_access(AccessPolicy access)
+{
+    if (access == _access) {
+        return;
+    }
+    _access = access;
+
+    #define _MEM_INSTR(op, Access) _instructions[_op_##op] = &Emulator32bit::_##op<Access>;
+    #define _MEM_INSTRS(Access) \
+        _MEM_INSTR(ldr, Access) \
+        _MEM_INSTR(ldrb, Access) \
+        _MEM_INSTR(ldrh, Access) \
+        _MEM_INSTR(str, Access) \
+        _MEM_INSTR(strb, Access) \
+        _MEM_INSTR(strh, Access) \
+        _MEM_INSTR(swp, Access) \
+        _MEM_INSTR(swpb, Access) \
+        _MEM_INSTR(swph, Access)
+
+    switch (access) {
+        case AccessPolicy::PHYSICAL:
+            _MEM_INSTRS(PhysicalAccess)
+            break;
+        case AccessPolicy::FAST_PHYSICAL:
+            _MEM_INSTRS(FastPhysicalAccess)
+            break;
+        case AccessPolicy::TRACED:
+            _MEM_INSTRS(TracedAccess)
+            break;
+        default:
+            _MEM_INSTRS(VirtualMemoryAccess)
+            break;
+    }
+
+    #undef _MEM_INSTRS
+    #undef _MEM_INSTR
+}
+
+
+void Emulator32bit::set_timing(bool enabled, const Latencies& latencies, bool guest_time)
+{
+    /* Guest time carries on in the new unit. */
+    _time_base += _cycle_time ? _cycles : _retired;
+    _cycle_base += _cycles;
+    _retired = 0;
+    _cycles = 0;
+    _timing = enabled;
+    _cycle_time = enabled && guest_time;
+    system_bus.set_stall_counter(enabled ? &_cycles : nullptr, latencies.device_access, latencies.disk_fault);
+
+    for (int op = 0; op < _num_instructions; op++) {
+        _latency[op] = latencies.alu;
+    }
+    _latency[_op_mul] = _latency[_op_umull] = _latency[_op_smull] = latencies.mul;
+    for (int op = _op_vabs; op <= _op_vmov; op++) {
+        _latency[op] = latencies.fp;
+    }
+    _latency[_op_vdiv] = _latency[_op_vsqrt] = latencies.fp_div;
+    _latency[_op_ldr] = _latency[_op_ldrb] = _latency[_op_ldrh] = latencies.load;
+    _latency[_op_str] = _latency[_op_strb] = _latency[_op_strh] = latencies.store;
+    _latency[_op_swp] = _latency[_op_swpb] = _latency[_op_swph] = latencies.swap;
+    _latency[_op_b] = _latency[_op_bl] = _latency[_op_bx] = _latency[_op_blx] = latencies.branch;
+    _latency[_op_swi] = latencies.syscall;
+    _taken_latency = latencies.branch_taken;
+}
+
+void Emulator32bit::set_timing(bool enabled)
+{
+    set_timing(enabled, Latencies());
+}
+
+void Emulator32bit::set_coverage(Coverage *coverage)
+{
+    _coverage = coverage;
+    update_tracing();
+}
+
+void Emulator32bit::set_block_vectors(BlockVectors *vectors)
+{
+    _block_vectors = vectors;
+    update_tracing();
+}
+
+void Emulator32bit::update_tracing()
+{
+    const bool traced = _coverage != nullptr || _block_vectors != nullptr;
+    _fusion = _fusion_enabled && !traced;
+    select_branches(traced);
+}
+
+inline void Emulator32bit::trace_branch(word site, word target)
+{
+    if (_coverage != nullptr) {
+        _coverage->edge(site, target);
+    }
+    if (_block_vectors != nullptr) {
+        _block_vectors->taken_branch(site, target);
+    }
+}
+
+void Emulator32bit::select_branches(bool traced)
+{
+    #define _BRANCH_INSTR(op) _instructions[_op_##op] = traced ? &Emulator32bit::_##op<true> : \
+            &Emulator32bit::_##op<false>;
+
+    _BRANCH_INSTR(b)
+    _BRANCH_INSTR(bl)
+    _BRANCH_INSTR(bx)
+    _BRANCH_INSTR(blx)
+
+    #undef _BRANCH_INSTR
+}
+
+template <bool Traced>
 void Emulator32bit::_b(const word instr)
 {
     const byte cond = bitfield_u32(instr, 22, 4);
     if (check_cond(_pstate, cond)) {
-        _pc += (bitfield_s32(instr, 0, 22) << 2) - 4;            /* account for execution loop incrementing _pc by 4 */
+        const word target = _pc + ((word) bitfield_s32(instr, 0, 22) << 2);
+        if constexpr (Traced) {
+            trace_branch(_pc, target);
+        }
+        note_backward_branch(_pc, target);
+        _pc = target - 4;            /* account for execution loop incrementing _pc by 4 */
     }
     DEBUG_SS(std::stringstream() << "b " << std::to_string(cond));
 }
 
+/**
+ * @internal
+ * @brief                     Whether a b with a condition is taken after a cmp, from the compared values
+ *                             instead of the flags. Matches the flags cmp sets, where C is the borrow.
+ *
+ * @param                     op1: value of the first cmp operand
+ * @param                     op2: value of the second cmp operand
+ * @param                     cond: condition of the b
+ * @return                     whether the branch is taken
+ */
+static bool compare_cond(const word op1, const word op2, const byte cond)
+{
+    switch ((Emulator32bit::ConditionCode) cond) {
+        case Emulator32bit::ConditionCode::EQ:
+            return op1 == op2;
+        case Emulator32bit::ConditionCode::NE:
+            return op1 != op2;
+        case Emulator32bit::ConditionCode::CS:
+        case Emulator32bit::ConditionCode::HI:        /* C set and Z clear, a borrow implies not equal */
+            return op1 < op2;
+        case Emulator32bit::ConditionCode::CC:
+        case Emulator32bit::ConditionCode::LS:
+            return op1 >= op2;
+        case Emulator32bit::ConditionCode::MI:
+            return test_bit((word) (op1 - op2), 31);
+        case Emulator32bit::ConditionCode::PL:
+            return !test_bit((word) (op1 - op2), 31);
+        case Emulator32bit::ConditionCode::VS:
+            return get_v_flag_sub(op1, op2);
+        case Emulator32bit::ConditionCode::VC:
+            return !get_v_flag_sub(op1, op2);
+        case Emulator32bit::ConditionCode::GE:
+            return (sword) op1 >= (sword) op2;
+        case Emulator32bit::ConditionCode::LT:
+            return (sword) op1 < (sword) op2;
+        case Emulator32bit::ConditionCode::GT:
+            return (sword) op1 > (sword) op2;
+        case Emulator32bit::ConditionCode::LE:
+            return (sword) op1 <= (sword) op2;
+        case Emulator32bit::ConditionCode::AL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void Emulator32bit::_fused_cmp_b(const word cmp, const word b)
+{
+    const word xn_val = read_reg(_X2(cmp));
+    const word cmp_val = FORMAT_O__get_arg(cmp);
+    const word dst_val = xn_val - cmp_val;
+
+    set_NZCV(test_bit(dst_val, 31), dst_val == 0, get_c_flag_sub(xn_val, cmp_val),
+             get_v_flag_sub(xn_val, cmp_val));
+
+    if (compare_cond(xn_val, cmp_val, bitfield_u32(b, 22, 4))) {
+        const word target = _pc + 4 + ((word) bitfield_s32(b, 0, 22) << 2);
+        note_backward_branch(_pc + 4, target);
+        _pc = target;
+    } else {
+        _pc += 8;
+    }
+}
+
+void Emulator32bit::_fused_sub_cmp_b(const word sub, const word cmp, const word b)
+{
+    write_reg(_X1(sub), read_reg(_X2(sub)) - FORMAT_O__get_arg(sub));
+    _pc += 4;
+    _fused_cmp_b(cmp, b);
+}
+
+template <bool Traced>
 void Emulator32bit::_bl(const word instr)
 {
     const byte cond = bitfield_u32(instr, 22, 4);
     if (check_cond(_pstate, cond)) {
+        if constexpr (Traced) {
+            trace_branch(_pc, _pc + ((word) bitfield_s32(instr, 0, 22) << 2));
+        }
         write_reg(LINKR, _pc+4);
-        _pc += (bitfield_s32(instr, 0, 22) << 2) - 4;
+        _pc += ((word) bitfield_s32(instr, 0, 22) << 2) - 4;
     }
     DEBUG_SS(std::stringstream() << "bl " << std::to_string(cond));
 }
 
+template <bool Traced>
 void Emulator32bit::_bx(const word instr)
 {
     const byte cond = bitfield_u32(instr, 22, 4);
     const byte reg = bitfield_u32(instr, 17, 5);
     if (check_cond(_pstate, cond)) {
+        if constexpr (Traced) {
+            trace_branch(_pc, read_reg(reg));
+        }
         _pc = (sword) read_reg(reg) - 4;
     }
     DEBUG_SS(std::stringstream() << "bx " << std::to_string(reg) << " (" << std::to_string(cond)
              << ")");
 }
 
+template <bool Traced>
 void Emulator32bit::_blx(const word instr)
 {
     const byte cond = bitfield_u32(instr, 22, 4);
     const byte reg = bitfield_u32(instr, 17, 5);
     if (check_cond(_pstate, cond)) {
         write_reg(LINKR, _pc+4);
+        if constexpr (Traced) {
+            trace_branch(_pc, read_reg(reg));
+        }
         _pc = (sword) read_reg(reg) - 4;
     }
     DEBUG_SS(std::stringstream() << "blx " << std::to_string(reg) << "(" << std::to_string(cond)
@@ -1,7 +1,56 @@
 #include "emulator32bit/memory.h"
 
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define AEMU_MEMORY_MMAP 1
+#else
+#define AEMU_MEMORY_MMAP 0
+#endif
+
 #define UNUSED(x) (void)(x)
 
+/* Host memory for the contents of a memory, zeroed. */
+static byte* alloc_pages(word npages)
+{
+    if (npages == 0)
+    {
+        return nullptr;
+    }
+
+#if AEMU_MEMORY_MMAP
+    void *data = mmap(nullptr, ((size_t) npages) << PAGE_PSIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED)
+    {
+        throw std::bad_alloc();
+    }
+    return (byte*) data;
+#else
+    return new byte[((size_t) npages) << PAGE_PSIZE]();
+#endif
+}
+
+static void free_pages(byte *data, word npages)
+{
+    if (data == nullptr)
+    {
+        return;
+    }
+
+#if AEMU_MEMORY_MMAP
+    munmap(data, ((size_t) npages) << PAGE_PSIZE);
+#else
+    UNUSED(npages);
+    delete[] data;
+#endif
+}
+
 
 BaseMemory::BaseMemory(word npages, word start_page) :
     npages(npages),
@@ -19,34 +68,109 @@ BaseMemory::~BaseMemory()
 
 Memory::Memory(word npages, word start_page) :
     BaseMemory(npages, start_page),
-    data(new byte[(npages << PAGE_PSIZE)])
+    data(alloc_pages(npages))
+{
+
+}
+
+Memory::Memory(word npages, word start_page, byte *data) :
+    BaseMemory(npages, start_page),
+    data(data)
 {
 
 }
 
 Memory::Memory(Memory& other) :
     BaseMemory(other.npages, other.start_page),
-    data(new byte[(other.npages << PAGE_PSIZE)])
+    data(alloc_pages(other.npages))
 {
-    for (word i = 0; i < (npages << PAGE_PSIZE); i++)
+    /* Pages of 0 are already 0 here, skip them so they stay unpopulated. */
+    std::vector<bool> touched = other.get_touched_pages();
+    for (word page = 0; page < npages; page++)
     {
-        data[i] = other.data[i];
+        if (touched[page])
+        {
+            memcpy(data + (page << PAGE_PSIZE), other.data + (page << PAGE_PSIZE), PAGE_SIZE);
+        }
     }
 }
 
 Memory::~Memory()
 {
-    if (data)
+    if (owns_data)
+    {
+        free_pages(data, npages);
+    }
+}
+
+void Memory::relocate(byte *new_data)
+{
+    if (owns_data)
     {
-        delete[] data;
+        free_pages(data, npages);
     }
+    data = new_data;
+    owns_data = false;
+}
+
+byte* Memory::get_direct_read(word page)
+{
+    return data + ((page - start_page) << PAGE_PSIZE);
+}
+
+byte* Memory::get_direct_write(word page)
+{
+    return data + ((page - start_page) << PAGE_PSIZE);
 }
 
 void Memory::reset()
 {
-    for (word addr = start_page << PAGE_PSIZE; addr < get_hi_page() << PAGE_PSIZE; addr++) {
-        Memory::write_byte(addr, 0);
+    if (npages == 0)
+    {
+        return;
+    }
+
+#if AEMU_MEMORY_MMAP
+    /* Private anonymous pages read as 0 again once dropped. */
+    if (owns_data && madvise(data, ((size_t) npages) << PAGE_PSIZE, MADV_DONTNEED) == 0)
+    {
+        return;
+    }
+#endif
+
+#if AEMU_MEMORY_MMAP
+    /* Someone else's shared mapping, like a FastMemory view, zeroes by freeing the backing pages. */
+    if (!owns_data && madvise(data, ((size_t) npages) << PAGE_PSIZE, MADV_REMOVE) == 0)
+    {
+        return;
+    }
+#endif
+
+    memset(data, 0, ((size_t) npages) << PAGE_PSIZE);
+}
+
+int Memory::get_image_fd()
+{
+    return -1;
+}
+
+std::vector<bool> Memory::get_touched_pages()
+{
+    std::vector<bool> touched(npages, false);
+    for (word page = 0; page < npages; page++)
+    {
+        /* Host residency is no use here, a written page may have been swapped out. */
+        const unsigned long long *contents = (const unsigned long long*) (data + (page << PAGE_PSIZE));
+        for (word i = 0; i < PAGE_SIZE / sizeof(unsigned long long); i++)
+        {
+            if (contents[i] != 0)
+            {
+                touched[page] = true;
+                break;
+            }
+        }
     }
+    return touched;
 }
 
 
@@ -64,19 +188,84 @@ RAM::RAM(word npages, word start_page) :
     ROM
 */
 
-ROM::ROM(const byte* rom_data, word npages, word start_page) :
-    Memory(npages, start_page)
+/* ROM files loaded by ROM::Image::load, so ROMs of the same file share one image. */
+static std::mutex s_images_mutex;
+static std::map<std::string, std::weak_ptr<ROM::Image>> s_images;
+
+static std::string image_key(const File& file, word npages)
+{
+    return file.get_abs_path() + ":" + std::to_string(npages);
+}
+
+ROM::Image::Image(const byte *data, size_t size, word npages) :
+    m_npages(npages)
+{
+    size_t image_size = ((size_t) npages) << PAGE_PSIZE;
+    if (size > image_size)
+    {
+        throw ROM_Exception("ROM image is larger than the specified ROM size " +
+                std::to_string(image_size) + " bytes. Got " + std::to_string(size) + " bytes.");
+    }
+
+#if AEMU_MEMORY_MMAP
+    if (npages == 0)
+    {
+        return;
+    }
+
+    m_fd = memfd_create("aemu-rom", MFD_CLOEXEC);
+    void *contents = MAP_FAILED;
+    if (m_fd >= 0 && ftruncate(m_fd, image_size) == 0)
+    {
+        contents = mmap(nullptr, image_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    }
+    if (contents == MAP_FAILED)
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+        throw ROM_Exception("Could not create a ROM image of " + std::to_string(npages) + " pages.");
+    }
+
+    if (size > 0)
+    {
+        memcpy(contents, data, size);
+    }
+    munmap(contents, image_size);
+#else
+    m_data.resize(image_size, 0);
+    if (size > 0)
+    {
+        memcpy(m_data.data(), data, size);
+    }
+#endif
+}
+
+ROM::Image::~Image()
 {
-    for (word i = 0; i < npages << PAGE_PSIZE; i++) {
-        data[i] = rom_data[i];
+#if AEMU_MEMORY_MMAP
+    if (m_fd >= 0)
+    {
+        close(m_fd);
     }
+#endif
 }
 
-ROM::ROM(File file, word npages, word start_page) :
-    Memory(npages, start_page),
-    save_file(true),
-    file(file)
+std::shared_ptr<ROM::Image> ROM::Image::load(const File& file, word npages)
 {
+    std::lock_guard<std::mutex> lock(s_images_mutex);
+    std::string key = image_key(file, npages);
+    auto it = s_images.find(key);
+    if (it != s_images.end())
+    {
+        std::shared_ptr<Image> image = it->second.lock();
+        if (image != nullptr)
+        {
+            return image;
+        }
+    }
+
     FileReader fr(file, std::ios::binary | std::ios::in);
     std::vector<byte> bytes;
     while (fr.has_next_byte())
@@ -84,20 +273,56 @@ ROM::ROM(File file, word npages, word start_page) :
         bytes.push_back(fr.read_byte());
     }
 
-    if (bytes.size() > npages << PAGE_PSIZE) {
-        throw ROM_Exception("ROM File is larger than the specified ROM size " +
-                std::to_string(npages << PAGE_PSIZE) + " bytes. Got " +
-                std::to_string(bytes.size()) + " bytes.");
+    std::shared_ptr<Image> image = std::make_shared<Image>(bytes.data(), bytes.size(), npages);
+    s_images[key] = image;
+    return image;
+}
+
+byte* ROM::Image::map() const
+{
+    if (m_npages == 0)
+    {
+        return nullptr;
     }
 
-    for (size_t i = 0; i < bytes.size(); i++) {
-        data[i] = bytes[i];
+#if AEMU_MEMORY_MMAP
+    /* Private, so flashing a ROM copies the pages it writes instead of changing the image. */
+    void *data = mmap(nullptr, ((size_t) m_npages) << PAGE_PSIZE, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        throw std::bad_alloc();
     }
+    return (byte*) data;
+#else
+    byte *data = alloc_pages(m_npages);
+    memcpy(data, m_data.data(), m_data.size());
+    return data;
+#endif
+}
+
+ROM::ROM(const byte* rom_data, word npages, word start_page) :
+    ROM(std::make_shared<Image>(rom_data, ((size_t) npages) << PAGE_PSIZE, npages), start_page)
+{
+
+}
+
+ROM::ROM(File file, word npages, word start_page) :
+    ROM(Image::load(file, npages), start_page)
+{
+    save_file = true;
+    this->file = file;
+}
+
+ROM::ROM(std::shared_ptr<Image> image, word start_page) :
+    Memory(image->get_npages(), start_page, image->map()),
+    m_image(image)
+{
+
 }
 
 ROM::~ROM()
 {
-    if (save_file)
+    if (save_file && flashed)
     {
         // save data to file
         FileWriter fw(file, std::ios::out | std::ios::binary);
@@ -105,6 +330,67 @@ ROM::~ROM()
         {
             fw.write(data[i]);
         }
+
+        /* So ROMs created later load what was saved. */
+        std::lock_guard<std::mutex> lock(s_images_mutex);
+        s_images.erase(image_key(file, npages));
+    }
+}
+
+byte* ROM::get_direct_write(word page)
+{
+    UNUSED(page);
+    return nullptr;
+}
+
+bool ROM::is_read_only(word page)
+{
+    UNUSED(page);
+    return true;
+}
+
+int ROM::get_image_fd()
+{
+    /* Flashed pages are only in our own mapping. */
+    return flashed || !owns_data ? -1 : m_image->get_fd();
+}
+
+void ROM::flash(word address, const byte *src, word n_bytes)
+{
+    if (n_bytes == 0)
+    {
+        return;
+    }
+    if (!in_bounds(address) || !in_bounds(address + n_bytes - 1) || address + n_bytes < address)
+    {
+        throw ROM_Exception("Could not flash " + std::to_string(n_bytes) + " bytes at " +
+                std::to_string(address) + ", outside of the ROM.");
+    }
+
+    word offset = address - start_addr;
+    bool shared = get_image_fd() >= 0;
+#if AEMU_MEMORY_MMAP
+    /* Our own mapping is read only. Memory moved into a FastMemory view is writable already. */
+    word lo = offset & ~(PAGE_SIZE - 1);
+    size_t len = ((offset + n_bytes - 1) | (PAGE_SIZE - 1)) + 1 - lo;
+    if (owns_data)
+    {
+        mprotect(data + lo, len, PROT_READ | PROT_WRITE);
+    }
+    memcpy(data + offset, src, n_bytes);
+    if (owns_data)
+    {
+        mprotect(data + lo, len, PROT_READ);
+    }
+#else
+    memcpy(data + offset, src, n_bytes);
+#endif
+    flashed = true;
+
+    if (shared)
+    {
+        /* A FastMemory region maps the image, have it take a copy of our contents instead. */
+        direct_changed(start_page, start_page + npages - 1);
     }
 }
 
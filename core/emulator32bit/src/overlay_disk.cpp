@@ -0,0 +1,175 @@
+#include "emulator32bit/overlay_disk.h"
+
+#define AEMU_ONLY_CRITICAL_LOG
+#include "util/logger.h"
+
+#include <fstream>
+#include <vector>
+
+/* Located at the beginning of the page index file. */
+#define MAGIC_HEADER 0x594c564f
+
+#define UNUSED(x) (void)(x)
+
+OverlayDisk::OverlayDisk(File base, File overlay, word npages, word lo_page) :
+    Disk(File(overlay.get_path(), true), npages, lo_page, File(base.get_path() + ".info")),
+    m_base(base),
+    m_base_manager(base.get_path() + ".info"),
+    m_overlay(overlay.get_path(), true),
+    m_overlay_index(overlay.get_path() + ".index", true)
+{
+    read_index();
+}
+
+void OverlayDisk::read_index()
+{
+    FileReader freader(m_overlay_index, std::ios::binary | std::ios::in);
+    std::vector<byte> bytes;
+    while (freader.has_next_byte()) {
+        bytes.push_back(freader.read_byte());
+    }
+    freader.close();
+    ByteReader reader(bytes);
+
+    if (!reader.has_next() || reader.read_word() != MAGIC_HEADER) {
+        return;
+    }
+
+    while (reader.has_next()) {
+        word page = reader.read_word();
+        word slot = reader.read_word();
+        m_index[page] = slot;
+    }
+}
+
+void OverlayDisk::write_index()
+{
+    FileWriter fwriter(m_overlay_index, std::ios::binary | std::ios::out);
+    ByteWriter writer(fwriter);
+
+    writer << ByteWriter::Data(MAGIC_HEADER, 4);
+    for (const std::pair<const word, word>& pair : m_index) {
+        writer << ByteWriter::Data(pair.first, 4);
+        writer << ByteWriter::Data(pair.second, 4);
+    }
+
+    fwriter.close();
+}
+
+bool OverlayDisk::read_backing(word page, word npages, byte *dst)
+{
+    std::ifstream base(m_base.get_path(), std::ios::binary | std::ios::in);
+    std::ifstream overlay(m_overlay.get_path(), std::ios::binary | std::ios::in);
+
+    /* Runs of pages that are consecutive in the same file are read at once. */
+    word i = 0;
+    while (i < npages) {
+        auto it = m_index.find(page + i);
+        const bool in_overlay = it != m_index.end();
+        const word start = in_overlay ? it->second : page + i;
+
+        word n = 1;
+        while (i + n < npages) {
+            auto next = m_index.find(page + i + n);
+            if ((next != m_index.end()) != in_overlay || (in_overlay && next->second != start + n)) {
+                break;
+            }
+            n++;
+        }
+
+        std::ifstream& file = in_overlay ? overlay : base;
+        file.seekg(((std::streamoff) start) << PAGE_PSIZE);
+        file.read((char*) dst + ((size_t) i << PAGE_PSIZE), ((std::streamsize) n) << PAGE_PSIZE);
+        if (!file) {
+            return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+bool OverlayDisk::write_backing(word page, word npages, const byte *src)
+{
+    std::ofstream overlay(m_overlay.get_path(), std::ios::binary | std::ios::out | std::ios::in);
+    for (word i = 0; i < npages; i++) {
+        auto it = m_index.find(page + i);
+        if (it == m_index.end()) {
+            /* New pages go to the end of the overlay file. */
+            word slot = m_index.size();
+            it = m_index.insert(std::make_pair(page + i, slot)).first;
+        }
+
+        overlay.seekp(((std::streamoff) it->second) << PAGE_PSIZE);
+        overlay.write((const char*) src + ((size_t) i << PAGE_PSIZE), PAGE_SIZE);
+    }
+    return (bool) overlay;
+}
+
+bool OverlayDisk::discard_backing(word page, word npages)
+{
+    /* The base is never written, only pages stored in the overlay take space to free. */
+    bool punched = true;
+    for (word i = 0; i < npages; i++) {
+        auto it = m_index.find(page + i);
+        if (it != m_index.end()) {
+            punched &= punch_hole(m_overlay.get_path(), ((std::streamoff) it->second) << PAGE_PSIZE, PAGE_SIZE);
+        }
+    }
+    return punched;
+}
+
+void OverlayDisk::save()
+{
+    Disk::save();
+    write_index();
+}
+
+void OverlayDisk::commit()
+{
+    save();
+
+    std::ifstream overlay(m_overlay.get_path(), std::ios::binary | std::ios::in);
+    std::ofstream base(m_base.get_path(), std::ios::binary | std::ios::out | std::ios::in);
+    std::vector<char> data(PAGE_SIZE);
+    for (const std::pair<const word, word>& pair : m_index) {
+        overlay.seekg(((std::streamoff) pair.second) << PAGE_PSIZE);
+        overlay.read(data.data(), PAGE_SIZE);
+        base.seekp(((std::streamoff) pair.first) << PAGE_PSIZE);
+        base.write(data.data(), PAGE_SIZE);
+    }
+    if (!overlay || !base) {
+        throw DiskWriteException("Error committing overlay " + m_overlay.get_path() + " to " +
+                m_base.get_path() + ".");
+    }
+    base.close();
+
+    /* The free pages of the overlay become the base's. */
+    {
+        std::ifstream src(m_overlay.get_path() + ".info", std::ios::binary | std::ios::in);
+        std::ofstream dst(m_base_manager.get_path(), std::ios::binary | std::ios::out | std::ios::trunc);
+        dst << src.rdbuf();
+    }
+
+    DEBUG("Committed %zu overlay pages to %s.", m_index.size(), m_base.get_path().c_str());
+
+    /* Cached pages are clean and now the same as the base, so they stay. */
+    truncate();
+    Disk::save();
+}
+
+void OverlayDisk::discard()
+{
+    invalidate_cache();
+    truncate();
+    reload_free_pages(m_base_manager);
+
+    DEBUG("Discarded overlay %s.", m_overlay.get_path().c_str());
+}
+
+void OverlayDisk::truncate()
+{
+    m_index.clear();
+    std::ofstream(m_overlay.get_path(), std::ios::binary | std::ios::out | std::ios::trunc);
+    std::ofstream(m_overlay.get_path() + ".info", std::ios::binary | std::ios::out | std::ios::trunc);
+    write_index();
+}
@@ -0,0 +1,118 @@
+#include "emulator32bit/page_dedup.h"
+
+#include <cstring>
+
+#define UNUSED(x) (void)(x)
+
+PageDeduplicator::PageDeduplicator(SystemBus& bus) :
+    m_bus(bus)
+{
+
+}
+
+word PageDeduplicator::scan(word max_pages)
+{
+    VirtualMemory& mmu = m_bus.mmu;
+    std::vector<byte> contents(PAGE_SIZE);
+    word merged = 0;
+    for (word scanned = 0; scanned < max_pages; scanned++)
+    {
+        if (m_cursor == m_pass.size())
+        {
+            m_pass = mmu.get_resident_ppages();
+            m_cursor = 0;
+            m_unstable.clear();
+            m_stats.full_scans++;
+            if (m_pass.empty())
+            {
+                break;
+            }
+        }
+
+        const word ppage = m_pass[m_cursor++];
+        if (!mmu.is_mergeable(ppage))
+        {
+            continue;
+        }
+
+        m_stats.pages_scanned++;
+        m_bus.read_physical_page(ppage, contents.data());
+        const unsigned long long checksum = hash(contents);
+        if (mmu.is_merged(ppage))
+        {
+            m_stable.insert(std::make_pair(checksum, ppage));
+            continue;
+        }
+
+        auto stable = m_stable.find(checksum);
+        if (stable != m_stable.end())
+        {
+            if (try_merge(stable->second, ppage, contents))
+            {
+                merged++;
+                continue;
+            }
+            if (!mmu.is_merged(stable->second))
+            {
+                m_stable.erase(stable);
+            }
+        }
+
+        /* Only pages left alone for a whole pass are worth sharing. */
+        auto previous = m_checksums.find(ppage);
+        if (previous == m_checksums.end() || previous->second != checksum)
+        {
+            m_checksums[ppage] = checksum;
+            continue;
+        }
+
+        auto unstable = m_unstable.find(checksum);
+        if (unstable != m_unstable.end() && try_merge(unstable->second, ppage, contents))
+        {
+            m_stable[checksum] = unstable->second;
+            m_unstable.erase(unstable);
+            merged++;
+        }
+        else
+        {
+            m_unstable[checksum] = ppage;
+        }
+    }
+
+    m_stats.pages_merged += merged;
+    return merged;
+}
+
+bool PageDeduplicator::try_merge(word candidate, word ppage, const std::vector<byte>& contents)
+{
+    VirtualMemory& mmu = m_bus.mmu;
+    if (candidate == ppage || !mmu.is_mergeable(candidate))
+    {
+        return false;
+    }
+
+    /* The candidate may have been written or freed and reused since it was hashed. */
+    std::vector<byte> candidate_contents(PAGE_SIZE);
+    m_bus.read_physical_page(candidate, candidate_contents.data());
+    if (memcmp(candidate_contents.data(), contents.data(), PAGE_SIZE) != 0)
+    {
+        return false;
+    }
+
+    mmu.merge_ppages(candidate, ppage);
+    m_checksums.erase(ppage);
+    return true;
+}
+
+unsigned long long PageDeduplicator::hash(const std::vector<byte>& contents)
+{
+    /* FNV-1a over words. */
+    unsigned long long hash = 14695981039346656037ULL;
+    for (word i = 0; i < contents.size(); i += sizeof(word))
+    {
+        word val;
+        memcpy(&val, contents.data() + i, sizeof(val));
+        hash = (hash ^ val) * 1099511628211ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,290 @@
+#include "emulator32bit/sampler.h"
+
+#include <algorithm>
+
+#define UNUSED(x) (void)(x)
+
+BlockVectors::BlockVectors()
+{
+    std::fill(m_counts, m_counts + AEMU_BBV_DIMENSIONS, 0);
+}
+
+std::vector<double> BlockVectors::take(word pc)
+{
+    add_block(pc);
+    m_block = pc;
+
+    unsigned long long total = 0;
+    for (word i = 0; i < AEMU_BBV_DIMENSIONS; i++)
+    {
+        total += m_counts[i];
+    }
+
+    std::vector<double> vector(AEMU_BBV_DIMENSIONS);
+    for (word i = 0; i < AEMU_BBV_DIMENSIONS; i++)
+    {
+        vector[i] = total == 0 ? 0 : (double) m_counts[i] / total;
+        m_counts[i] = 0;
+    }
+    return vector;
+}
+
+static double distance(const std::vector<double>& a, const std::vector<double>& b)
+{
+    double sum = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        sum += (a[i] - b[i]) * (a[i] - b[i]);
+    }
+    return sum;
+}
+
+Sampler::Sampler(Emulator32bit& processor, const Config& config) :
+    m_processor(processor),
+    m_config(config)
+{
+
+}
+
+Emulator32bit::StopReason Sampler::run(unsigned long long instructions)
+{
+    Emulator32bit::StopReason reason;
+    unsigned long long done = 0;
+    while (done < instructions)
+    {
+        reason = m_processor.step_slice(instructions - done);
+        done += reason.instructions;
+        if (reason.type != Emulator32bit::StopReason::BUDGET_EXHAUSTED)
+        {
+            break;
+        }
+    }
+    reason.instructions = done;
+    return reason;
+}
+
+Emulator32bit::StopReason Sampler::profile(unsigned long long max_instructions)
+{
+    m_start = m_processor.save_snapshot();
+    m_vectors.clear();
+    m_lengths.clear();
+    m_simpoints.clear();
+
+    BlockVectors vectors;
+    vectors.take(m_processor.get_pc());
+    m_processor.set_block_vectors(&vectors);
+
+    Emulator32bit::StopReason reason;
+    unsigned long long total = 0;
+    while (max_instructions == 0 || total < max_instructions)
+    {
+        unsigned long long budget = m_config.interval;
+        if (max_instructions != 0)
+        {
+            budget = std::min(budget, max_instructions - total);
+        }
+
+        reason = run(budget);
+        total += reason.instructions;
+        if (reason.instructions > 0)
+        {
+            m_vectors.push_back(vectors.take(m_processor.get_pc()));
+            m_lengths.push_back(reason.instructions);
+        }
+
+        if (reason.type != Emulator32bit::StopReason::BUDGET_EXHAUSTED)
+        {
+            break;
+        }
+    }
+
+    m_processor.set_block_vectors(nullptr);
+    reason.instructions = total;
+    return reason;
+}
+
+const std::vector<Sampler::SimPoint>& Sampler::pick()
+{
+    m_simpoints.clear();
+    const word n = m_vectors.size();
+    if (n == 0)
+    {
+        return m_simpoints;
+    }
+
+    /* Farthest point initialization, deterministic, and stops early when every interval is
+       already a centroid's copy, so identical phases do not split into several clusters. */
+    std::vector<std::vector<double>> centroids = {m_vectors[0]};
+    std::vector<double> nearest(n);
+    for (word i = 0; i < n; i++)
+    {
+        nearest[i] = distance(m_vectors[i], centroids[0]);
+    }
+    while (centroids.size() < m_config.max_phases)
+    {
+        word farthest = std::max_element(nearest.begin(), nearest.end()) - nearest.begin();
+        if (nearest[farthest] == 0)
+        {
+            break;
+        }
+
+        centroids.push_back(m_vectors[farthest]);
+        for (word i = 0; i < n; i++)
+        {
+            nearest[i] = std::min(nearest[i], distance(m_vectors[i], centroids.back()));
+        }
+    }
+
+    const word k = centroids.size();
+    std::vector<word> cluster(n, k);
+    for (word iteration = 0; iteration < m_config.iterations; iteration++)
+    {
+        bool changed = false;
+        for (word i = 0; i < n; i++)
+        {
+            word best = 0;
+            double best_distance = distance(m_vectors[i], centroids[0]);
+            for (word c = 1; c < k; c++)
+            {
+                double d = distance(m_vectors[i], centroids[c]);
+                if (d < best_distance)
+                {
+                    best = c;
+                    best_distance = d;
+                }
+            }
+            changed |= cluster[i] != best;
+            cluster[i] = best;
+        }
+
+        if (!changed)
+        {
+            break;
+        }
+
+        /* A cluster left empty keeps its centroid. */
+        std::vector<word> sizes(k, 0);
+        std::vector<std::vector<double>> sums(k, std::vector<double>(AEMU_BBV_DIMENSIONS, 0));
+        for (word i = 0; i < n; i++)
+        {
+            sizes[cluster[i]]++;
+            for (word d = 0; d < AEMU_BBV_DIMENSIONS; d++)
+            {
+                sums[cluster[i]][d] += m_vectors[i][d];
+            }
+        }
+        for (word c = 0; c < k; c++)
+        {
+            if (sizes[c] == 0)
+            {
+                continue;
+            }
+            for (word d = 0; d < AEMU_BBV_DIMENSIONS; d++)
+            {
+                centroids[c][d] = sums[c][d] / sizes[c];
+            }
+        }
+    }
+
+    /* The interval closest to each centroid represents its cluster. */
+    unsigned long long total = 0;
+    for (unsigned long long length : m_lengths)
+    {
+        total += length;
+    }
+    for (word c = 0; c < k; c++)
+    {
+        word representative = n;
+        double best_distance = 0;
+        unsigned long long instructions = 0;
+        for (word i = 0; i < n; i++)
+        {
+            if (cluster[i] != c)
+            {
+                continue;
+            }
+
+            instructions += m_lengths[i];
+            double d = distance(m_vectors[i], centroids[c]);
+            if (representative == n || d < best_distance)
+            {
+                representative = i;
+                best_distance = d;
+            }
+        }
+
+        if (representative != n)
+        {
+            m_simpoints.push_back({representative, (double) instructions / total});
+        }
+    }
+
+    std::sort(m_simpoints.begin(), m_simpoints.end(),
+            [](const SimPoint& a, const SimPoint& b) { return a.interval < b.interval; });
+    return m_simpoints;
+}
+
+Sampler::Estimate Sampler::measure(CacheHierarchy *caches, const Emulator32bit::Latencies& latencies)
+{
+    if (m_simpoints.empty())
+    {
+        pick();
+    }
+
+    Estimate estimate;
+    std::vector<unsigned long long> starts;
+    for (unsigned long long length : m_lengths)
+    {
+        starts.push_back(estimate.instructions);
+        estimate.instructions += length;
+    }
+
+    m_processor.restore_snapshot(m_start);
+    unsigned long long position = 0;
+    for (const SimPoint& point : m_simpoints)
+    {
+        const unsigned long long start = starts[point.interval];
+        const unsigned long long warmup = caches == nullptr ? 0 : std::min(m_config.warmup, start - position);
+        if (run(start - position - warmup).type != Emulator32bit::StopReason::BUDGET_EXHAUSTED)
+        {
+            break;
+        }
+
+        m_processor.set_cache_hierarchy(caches);
+        if (run(warmup).type != Emulator32bit::StopReason::BUDGET_EXHAUSTED)
+        {
+            break;
+        }
+
+        CacheHierarchy::Stats before[CacheHierarchy::NUM_LEVELS];
+        for (int level = 0; caches != nullptr && level < CacheHierarchy::NUM_LEVELS; level++)
+        {
+            before[level] = caches->get_stats((CacheHierarchy::Level) level);
+        }
+        const unsigned long long cycles = m_processor.get_cycles();
+
+        m_processor.set_timing(true, latencies, false);
+        Emulator32bit::StopReason reason = run(m_lengths[point.interval]);
+        m_processor.set_timing(false);
+        m_processor.set_cache_hierarchy(nullptr);
+        position = start + reason.instructions;
+        if (reason.instructions == 0)
+        {
+            break;
+        }
+
+        /* Rates per instruction of the interval stand for its cluster's share of the run. */
+        const double scale = point.weight * estimate.instructions / reason.instructions;
+        estimate.detailed_instructions += reason.instructions;
+        estimate.cycles += scale * (m_processor.get_cycles() - cycles);
+        for (int level = 0; caches != nullptr && level < CacheHierarchy::NUM_LEVELS; level++)
+        {
+            CacheHierarchy::Stats after = caches->get_stats((CacheHierarchy::Level) level);
+            estimate.accesses[level] += scale * (after.accesses - before[level].accesses);
+            estimate.misses[level] += scale * (after.misses - before[level].misses);
+        }
+    }
+
+    m_processor.set_cache_hierarchy(nullptr);
+    return estimate;
+}
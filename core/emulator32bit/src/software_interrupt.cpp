@@ -1,13 +1,23 @@
 
 #include "emulator32bit/emulator32bit.h"
+#include "emulator32bit/bios.h"
 
 #define AEMU_ONLY_CRITICAL_LOG
 #include "util/logger.h"
 
+#include <chrono>
 #include <iostream>
+#include <vector>
 
 #define UNUSED(x) (void)(x)
 
+/* Returned in x0 by the file syscalls on failure. */
+#define SYSCALL_ERROR ((word) -1)
+
+/* mmap protection bits, same values as Linux. */
+#define PROT_WRITE 2
+#define PROT_EXEC 4
+
 void Emulator32bit::_emu_print()
 {
     print();
@@ -20,16 +30,19 @@ void Emulator32bit::_emu_printr(byte reg_id)
 
 void Emulator32bit::_emu_printm(word mem_addr, byte size, bool little_endian)
 {
+    std::vector<byte> bytes(size);
+    system_bus.read_bytes(mem_addr, bytes.data(), size);
+
     word val = 0;
     if (little_endian) {
         for (byte i = 0; i < size; i++) {
             val <<= 8;
-            val += system_bus.read_byte(mem_addr + i);
+            val += bytes[i];
         }
     } else {
         for (int i = size - 1; i >= 0; i--) {
             val <<= 8;
-            val += system_bus.read_byte(mem_addr + i);
+            val += bytes[i];
         }
     }
 
@@ -48,33 +61,36 @@ void Emulator32bit::_emu_assertr(byte reg_id, word min_value, word max_value) {
     if (val >= min_value && val <= max_value) {
 
     } else {
-        throw Exception(FAILED_ASSERT, "Failed system call assertion. Expected register " +
-                std::to_string(reg_id) + " to contain a value between " +
-                std::to_string(min_value) + " and " + std::to_string(max_value) +
-                " but it contains " + std::to_string(val) + ".");
+        std::cerr << "Failed system call assertion. Expected register " << (int) reg_id
+                  << " to contain a value between " << min_value << " and " << max_value
+                  << " but it contains " << val << ".\n";
+        raise_trap(StopReason::FAILED_ASSERT);
     }
 }
 
 void Emulator32bit::_emu_assertm(word mem_addr, byte size, bool little_endian, word min_value,
                                  word max_value)
 {
+    std::vector<byte> bytes(size);
+    system_bus.read_bytes(mem_addr, bytes.data(), size);
+
     word val = 0;
     if (little_endian) {
         for (byte i = 0; i < size; i++) {
             val <<= 8;
-            val += system_bus.read_byte(mem_addr + i);
+            val += bytes[i];
         }
     } else {
         for (int i = size - 1; i >= 0; i--) {
             val <<= 8;
-            val += system_bus.read_byte(mem_addr + i);
+            val += bytes[i];
         }
     }
 
     if (val < min_value || val > max_value) {
-        throw Exception(FAILED_ASSERT, "Expected value at memory address " + std::to_string(mem_addr) +
-                " to be between " + std::to_string(min_value) + " and " +
-                std::to_string(max_value) + ". Got " + std::to_string(val) + ".");
+        std::cerr << "Expected value at memory address " << mem_addr << " to be between "
+                  << min_value << " and " << max_value << ". Got " << val << ".\n";
+        raise_trap(StopReason::FAILED_ASSERT);
     }
 }
 
@@ -83,33 +99,283 @@ void Emulator32bit::_emu_assertp(byte p_state_id, bool expected_value)
     bool val = test_bit(_pstate, p_state_id);
 
     if (val != expected_value) {
-        throw Exception(FAILED_ASSERT, "Failed system call assertion. Expected PSTATE " +
-                std::to_string(p_state_id) + " to be " + std::to_string(expected_value) +
-                ". Got " + std::to_string(val) + ".");
+        std::cerr << "Failed system call assertion. Expected PSTATE " << (int) p_state_id
+                  << " to be " << expected_value << ". Got " << val << ".\n";
+        raise_trap(StopReason::FAILED_ASSERT);
     }
 }
 
 void Emulator32bit::_emu_log(word str)
 {
-    std::string msg;
-    while (system_bus.read_byte(str) != '\0') {
-        msg += (char) system_bus.read_byte(str);
-        str++;
-    }
-
-    std::cout << msg << "\n";
+    std::cout << system_bus.read_string(str) << "\n";
 }
 
 // todo, raise interrupt so kernel can handle
 void Emulator32bit::_emu_err(word err)
 {
-    std::string msg;
-    while (system_bus.read_byte(err) != '\0') {
-        msg += (char) system_bus.read_byte(err);
-        err++;
+    std::cerr << system_bus.read_string(err) << "\n";
+}
+
+void Emulator32bit::_exit(word status)
+{
+    raise_trap(StopReason::SYSCALL_EXIT, status);
+}
+
+void Emulator32bit::_wait_irq(word mask)
+{
+    word pending = system_bus.get_pending_irqs() & mask;
+    if (pending == 0) {
+        raise_trap(StopReason::BLOCKED);
+        return;
+    }
+    write_reg(0, pending);
+}
+
+word Emulator32bit::_bios_disk_read(word disk_page, word paddr, word n_bytes)
+{
+    /* The arguments come from the boot header on disk, check them before sizing the buffer. */
+    unsigned long long npages = ((unsigned long long) n_bytes + PAGE_SIZE - 1) >> PAGE_PSIZE;
+    if (disk_page + npages > disk->get_mem_pages()) {
+        DEBUG("BIOS disk read of %u bytes at disk page %u is past the end of the disk.", n_bytes, disk_page);
+        return SYSCALL_ERROR;
+    }
+
+    /* One file read for the whole segment instead of one per page. */
+    std::vector<byte> pages(npages << PAGE_PSIZE);
+    try {
+        disk->read_pages(disk_page, npages, pages.data());
+    } catch (const Disk::DiskReadException& e) {
+        DEBUG("BIOS disk read failed: %s", e.what());
+        return SYSCALL_ERROR;
+    }
+    system_bus.write_bytes(paddr, pages.data(), n_bytes);
+    return 0;
+}
+
+/**
+ * @brief                    Runs a file syscall, turning a missing file system or any file system/disk
+ *                             error into @ref SYSCALL_ERROR so the guest gets an error instead of the
+ *                             emulator stopping.
+ */
+template <typename Func>
+static word file_syscall(FileSystem *fs, Func func)
+{
+    if (fs == nullptr) {
+        return SYSCALL_ERROR;
+    }
+
+    try {
+        return func(*fs);
+    } catch (const FileSystem::FileSystemException& e) {
+        DEBUG("File syscall failed: %s", e.what());
+    } catch (const Disk::DiskReadException& e) {
+        DEBUG("File syscall failed: %s", e.what());
+    } catch (const Disk::DiskWriteException& e) {
+        DEBUG("File syscall failed: %s", e.what());
+    } catch (const VirtualMemory::VirtualMemoryException& e) {
+        DEBUG("File syscall failed: %s", e.what());
     }
+    return SYSCALL_ERROR;
+}
+
+word Emulator32bit::_open(word path, word flags)
+{
+    return file_syscall(file_system, [&](FileSystem& fs) {
+        return fs.open(system_bus.read_string(path, AEMU_FS_NAME_LEN), flags);
+    });
+}
+
+word Emulator32bit::_close(word fd)
+{
+    return file_syscall(file_system, [&](FileSystem& fs) {
+        fs.close(fd);
+        return (word) 0;
+    });
+}
+
+word Emulator32bit::_lseek(word fd, sword offset, word whence)
+{
+    return file_syscall(file_system, [&](FileSystem& fs) {
+        return fs.seek(fd, offset, whence);
+    });
+}
+
+word Emulator32bit::_read(word fd, word buf, word count)
+{
+    return file_syscall(file_system, [&](FileSystem& fs) {
+        /* count comes from the guest, never buffer more than is left in the file. */
+        word size = fs.read_inode(fs.get_fd_inode(fd)).size;
+        word offset = fs.seek(fd, 0, AEMU_FS_SEEK_CUR);
+        if (count > size - offset) {
+            count = offset < size ? size - offset : 0;
+        }
+
+        /* The swi is retried once a fault is handled, the file offset must not move before that. */
+        if (!system_bus.probe_write(buf, count)) {
+            return SYSCALL_ERROR;
+        }
+
+        std::vector<byte> data(count);
+        word n_read = fs.read_fd(fd, data.data(), count);
+        system_bus.write_bytes(buf, data.data(), n_read);
+        return n_read;
+    });
+}
+
+word Emulator32bit::_write(word fd, word buf, word count)
+{
+    return file_syscall(file_system, [&](FileSystem& fs) {
+        /* A write larger than the whole file system can never succeed. */
+        const FileSystem::SuperBlock& superblock = fs.get_superblock();
+        if (count > ((unsigned long long) (superblock.npages - superblock.data_page) << PAGE_PSIZE)) {
+            return SYSCALL_ERROR;
+        }
+
+        std::vector<byte> data(count);
+        system_bus.read_bytes(buf, data.data(), count);
+        if (system_bus.has_fault()) {
+            /* Faulting pages read back as zeroes, which must not reach the file. */
+            return SYSCALL_ERROR;
+        }
+        return fs.write_fd(fd, data.data(), count);
+    });
+}
+
+word Emulator32bit::_mmap(word addr, word length, word prot, word fd, word offset)
+{
+    return file_syscall(file_system, [&](FileSystem& fs) {
+        long long pid = mmu->current_process();
+        if (pid == -1 || length == 0 || (addr & (PAGE_SIZE - 1)) != 0 || (offset & (PAGE_SIZE - 1)) != 0 ||
+                ((prot & PROT_WRITE) && !fs.is_fd_writable(fd))) {
+            return SYSCALL_ERROR;
+        }
+
+        /* Look up every page first so a mapping past the end of the file maps nothing. */
+        word inode = fs.get_fd_inode(fd);
+        word npages = (length + PAGE_SIZE - 1) >> PAGE_PSIZE;
+        std::vector<word> disk_pages;
+        for (word i = 0; i < npages; i++) {
+            disk_pages.push_back(fs.get_disk_page(inode, (offset >> PAGE_PSIZE) + i));
+        }
+
+        word vpage = addr >> PAGE_PSIZE;
+        for (word i = 0; i < npages; i++) {
+            try {
+                mmu->map_file_page(pid, vpage + i, disk_pages[i], prot & PROT_WRITE, prot & PROT_EXEC);
+            } catch (const VirtualMemory::VirtualMemoryException& e) {
+                for (word j = 0; j < i; j++) {
+                    mmu->remove_vpage(pid, vpage + j);
+                }
+                throw;
+            }
+        }
+        return addr;
+    });
+}
+
+word Emulator32bit::_munmap(word addr, word length)
+{
+    return file_syscall(file_system, [&](FileSystem& fs) {
+        UNUSED(fs);
+        long long pid = mmu->current_process();
+        if (pid == -1 || (addr & (PAGE_SIZE - 1)) != 0) {
+            return SYSCALL_ERROR;
+        }
 
-    std::cerr << msg << "\n";
+        std::vector<byte> page(PAGE_SIZE);
+        word vpage = addr >> PAGE_PSIZE;
+        word npages = (length + PAGE_SIZE - 1) >> PAGE_PSIZE;
+        for (word i = 0; i < npages; i++) {
+            word diskpage;
+            if (!mmu->get_file_page(pid, vpage + i, diskpage)) {
+                continue;
+            }
+
+            /* Write back the resident copy, it is the only up to date one. */
+            word ppage;
+            if (mmu->get_resident_file_page(diskpage, ppage)) {
+                system_bus.read_physical_page(ppage, page.data());
+                disk->write_page(diskpage, page);
+            }
+            mmu->remove_vpage(pid, vpage + i);
+        }
+        return (word) 0;
+    });
+}
+
+void Emulator32bit::register_default_syscalls()
+{
+    syscalls.register_syscall(1000, "emu_print", 0, [](Emulator32bit& emu, const word args[]) {
+        UNUSED(args);
+        emu._emu_print();
+    });
+    syscalls.register_syscall(1001, "emu_printr", 1, [](Emulator32bit& emu, const word args[]) {
+        emu._emu_printr(args[0]);
+    });
+    syscalls.register_syscall(1002, "emu_printm", 3, [](Emulator32bit& emu, const word args[]) {
+        emu._emu_printm(args[0], args[1], args[2]);
+    });
+    syscalls.register_syscall(1003, "emu_printp", 0, [](Emulator32bit& emu, const word args[]) {
+        UNUSED(args);
+        emu._emu_printp();
+    });
+
+    syscalls.register_syscall(1010, "emu_assertr", 3, [](Emulator32bit& emu, const word args[]) {
+        emu._emu_assertr(args[0], args[1], args[2]);
+    });
+    syscalls.register_syscall(1011, "emu_assertm", 5, [](Emulator32bit& emu, const word args[]) {
+        emu._emu_assertm(args[0], args[1], args[2], args[3], args[4]);
+    });
+    syscalls.register_syscall(1012, "emu_assertp", 2, [](Emulator32bit& emu, const word args[]) {
+        emu._emu_assertp(args[0], args[1]);
+    });
+
+    syscalls.register_syscall(1020, "emu_log", 1, [](Emulator32bit& emu, const word args[]) {
+        emu._emu_log(args[0]);
+    });
+    syscalls.register_syscall(1021, "emu_err", 1, [](Emulator32bit& emu, const word args[]) {
+        emu._emu_err(args[0]);
+    });
+    syscalls.register_syscall(1040, "wait_irq", 1, [](Emulator32bit& emu, const word args[]) {
+        emu._wait_irq(args[0]);
+    });
+
+    syscalls.register_syscall(93, "exit", 1, [](Emulator32bit& emu, const word args[]) {
+        emu._exit(args[0]);
+    });
+
+    syscalls.register_syscall(56, "open", 2, [](Emulator32bit& emu, const word args[]) {
+        emu.write_reg(0, emu._open(args[0], args[1]));
+    });
+    syscalls.register_syscall(57, "close", 1, [](Emulator32bit& emu, const word args[]) {
+        emu.write_reg(0, emu._close(args[0]));
+    });
+    syscalls.register_syscall(62, "lseek", 3, [](Emulator32bit& emu, const word args[]) {
+        emu.write_reg(0, emu._lseek(args[0], (sword) args[1], args[2]));
+    });
+    syscalls.register_syscall(63, "read", 3, [](Emulator32bit& emu, const word args[]) {
+        word ret = emu._read(args[0], args[1], args[2]);
+        if (!emu.system_bus.has_fault()) {
+            emu.write_reg(0, ret);
+        }
+    });
+    syscalls.register_syscall(64, "write", 3, [](Emulator32bit& emu, const word args[]) {
+        word ret = emu._write(args[0], args[1], args[2]);
+        if (!emu.system_bus.has_fault()) {
+            emu.write_reg(0, ret);
+        }
+    });
+    syscalls.register_syscall(215, "munmap", 2, [](Emulator32bit& emu, const word args[]) {
+        emu.write_reg(0, emu._munmap(args[0], args[1]));
+    });
+    syscalls.register_syscall(222, "mmap", 6, [](Emulator32bit& emu, const word args[]) {
+        emu.write_reg(0, emu._mmap(args[0], args[1], args[2], args[4], args[5]));
+    });
+
+    syscalls.register_syscall(AEMU_SYSCALL_BIOS_DISK_READ, "bios_disk_read", 3,
+            [](Emulator32bit& emu, const word args[]) {
+        emu.write_reg(0, emu._bios_disk_read(args[0], args[1], args[2]));
+    });
 }
 
 /**
@@ -125,6 +391,9 @@ void Emulator32bit::_emu_err(word err)
  *                             instead of using virtual memory. We could store that information in the PSTATE variable of the processor.
  *
  *                             File management would be simulated through creating a large file to represent a hard drive (something along the lines of ~16 MiB)
+ *
+ *                             Syscalls are dispatched through the table in @ref Emulator32bit::syscalls. The ones listed below are registered
+ *                             by @ref Emulator32bit::register_default_syscalls, host code may register more at runtime.
  * ______________________________________________________________________________________________________________________________________________________________________________________________
  * | ID |        NAME       |        arg x0           |        arg x1           |        arg x2           |        arg x3               |                arg x4                   |        arg x5            |
  * |____|__________________|_______________________|_______________________|_______________________|___________________________|_______________________________________|________________________|
@@ -166,6 +435,60 @@ void Emulator32bit::_emu_err(word err)
  * |
  * |    prints error to console and halts program
  * |
+ **|1030: bios_disk_read    word disk_page            word paddr                word n_bytes                -                            -                                        -
+ * |
+ * |    copies n_bytes from disk, starting at the beginning of disk_page, to physical memory at paddr,
+ * |    returns 0, or -1 if the range is past the end of the disk or the read fails
+ * |
+ **|1040: wait_irq            word mask                -                        -                        -                            -                                        -
+ * |
+ * |    returns the raised interrupt lines in mask, if none are raised stops Emulator32bit::step_slice
+ * |    with a BLOCKED stop reason and is retried when execution resumes
+ * |
+ * |
+ * |
+ * |======================= File Operations =========================
+ * |
+ * |    Operate on the file system mounted with Emulator32bit::mount. Return -1 in x0 on failure,
+ * |    including when no file system is mounted.
+ * |
+ **|0056: open                char* path                word flags                -                        -                            -                                        -
+ * |
+ * |    opens a file in the root directory, flags are AEMU_FS_O_* (same as Linux), returns fd
+ * |
+ **|0057: close                word fd                    -                        -                        -                            -                                        -
+ * |
+ * |    closes a file descriptor
+ * |
+ **|0062: lseek                word fd                    sword offset            word whence                -                            -                                        -
+ * |
+ * |    moves the file offset, whence is AEMU_FS_SEEK_*, returns the new offset
+ * |
+ **|0063: read                word fd                    void *buf                word count                -                            -                                        -
+ * |
+ * |    reads up to count bytes at the file offset, returns the number of bytes read
+ * |
+ **|0064: write                word fd                    void *buf                word count                -                            -                                        -
+ * |
+ * |    writes count bytes at the file offset, growing the file, returns count
+ * |
+ **|0215: munmap            void *addr                word length                -                        -                            -                                        -
+ * |
+ * |    unmaps file pages mapped with mmap, writing resident pages back to the file
+ * |
+ **|0222: mmap                void *addr                word length                word prot                word flags                    word fd                                    word offset
+ * |
+ * |    maps file pages at the page aligned addr of the current process, prot is 1 read | 2 write | 4 exec,
+ * |    flags are ignored (mappings are always shared), the file must cover the range, returns addr
+ * |
+ * |
+ * |
+ * |======================= Process Control =========================
+ * |
+ **|0093: exit                word status                -                        -                        -                            -                                        -
+ * |
+ * |    stops Emulator32bit::run with a SYSCALL_EXIT stop reason whose code is status
+ * |
  * |
  * |
  * |======================= I/O Operations ==========================
@@ -256,37 +579,27 @@ void Emulator32bit::_swi(word instr)
     // software interrupts.. perfect to add functionality to this like console print,
     // file operations, ports, etc
     word id = read_reg(NR);
-    word arg0 = read_reg(0);
-    word arg1 = read_reg(1);
-    word arg2 = read_reg(2);
-    word arg3 = read_reg(3);
-    word arg4 = read_reg(4);
-    word arg5 = read_reg(5);
-    UNUSED(arg5); // temporary
-    switch(id) {
-        case 1000:
-            _emu_print();
-            break;
-        case 1001:
-            _emu_printr(arg0);
-            break;
-        case 1002:
-            _emu_printm(arg0, arg1, arg2);
-            break;
-        case 1003:
-            _emu_printp();
-            break;
-
-        case 1010:
-            _emu_assertr(arg0, arg1, arg2);
-            break;
-        case 1011:
-            _emu_assertm(arg0, arg1, arg2, arg3, arg4);
-            break;
-        case 1012:
-            _emu_assertp(arg0, arg1);
-            break;
-        default:
-            throw Exception(BAD_INSTR, "Invalid syscall number " + std::to_string(id));
+    /* Hold the entry, the handler may re-register or remove its own syscall. */
+    std::shared_ptr<SyscallTable::Entry> syscall = syscalls.lookup(id);
+    if (UNLIKELY(syscall == nullptr)) {
+        DEBUG("Invalid syscall number %u", id);
+        raise_trap(StopReason::BAD_SYSCALL, id);
+        return;
+    }
+
+    /* Only read the registers the syscall actually takes. */
+    word args[AEMU_SYSCALL_MAX_ARGS];
+    for (byte i = 0; i < syscall->nargs; i++) {
+        args[i] = read_reg(i);
     }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    syscall->handler(*this, args);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    syscalls.record(*syscall,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+    /* The syscall may have switched processes, turning translation on or off. */
+    update_fastmem();
 }
\ No newline at end of file
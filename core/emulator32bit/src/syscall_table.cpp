@@ -0,0 +1,114 @@
+#include "emulator32bit/syscall_table.h"
+
+#include <stdio.h>
+
+SyscallTable::SyscallTable()
+{
+
+}
+
+SyscallTable::~SyscallTable()
+{
+
+}
+
+SyscallTable::Exception::Exception(const std::string& msg) :
+    message(msg)
+{
+
+}
+
+const char* SyscallTable::Exception::what() const noexcept
+{
+    return message.c_str();
+}
+
+void SyscallTable::register_syscall(word id, const std::string& name, byte nargs, Handler handler)
+{
+    if (id >= AEMU_SYSCALL_TABLE_SIZE)
+    {
+        throw Exception("Cannot register syscall " + name + " with id " + std::to_string(id) +
+                ". Syscall ids must be less than " + std::to_string(AEMU_SYSCALL_TABLE_SIZE) + ".");
+    }
+
+    if (nargs > AEMU_SYSCALL_MAX_ARGS)
+    {
+        throw Exception("Cannot register syscall " + name + " with " + std::to_string(nargs) +
+                " arguments. At most " + std::to_string(AEMU_SYSCALL_MAX_ARGS) +
+                " arguments are passed in registers.");
+    }
+
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+    entry->name = name;
+    entry->nargs = nargs;
+    entry->handler = handler;
+
+    m_entries[id] = entry;
+}
+
+void SyscallTable::unregister_syscall(word id)
+{
+    if (id >= AEMU_SYSCALL_TABLE_SIZE)
+    {
+        return;
+    }
+
+    m_entries[id] = nullptr;
+}
+
+const SyscallTable::Stats& SyscallTable::get_stats(word id)
+{
+    std::shared_ptr<Entry> entry = lookup(id);
+    if (entry == nullptr)
+    {
+        throw Exception("Syscall " + std::to_string(id) + " is not registered.");
+    }
+
+    return entry->stats;
+}
+
+void SyscallTable::reset_stats()
+{
+    for (word id = 0; id < AEMU_SYSCALL_TABLE_SIZE; id++)
+    {
+        if (m_entries[id] != nullptr)
+        {
+            m_entries[id]->stats = Stats();
+        }
+    }
+}
+
+void SyscallTable::print_stats()
+{
+    printf("Syscalls:\n");
+    for (word id = 0; id < AEMU_SYSCALL_TABLE_SIZE; id++)
+    {
+        const std::shared_ptr<Entry>& entry = m_entries[id];
+        if (entry == nullptr || entry->stats.count == 0)
+        {
+            continue;
+        }
+
+        printf("%4u %-16s calls=%llu avg=%lluns max=%lluns\n", id, entry->name.c_str(),
+                entry->stats.count, entry->stats.total_ns / entry->stats.count,
+                entry->stats.max_ns);
+
+        /* Only print the range of buckets that were hit to keep the output compact. */
+        int lo = 0;
+        int hi = AEMU_SYSCALL_LATENCY_BUCKETS - 1;
+        while (entry->stats.latency_hist[lo] == 0)
+        {
+            lo++;
+        }
+        while (entry->stats.latency_hist[hi] == 0)
+        {
+            hi--;
+        }
+
+        for (int bucket = lo; bucket <= hi; bucket++)
+        {
+            printf("     [%llu ns, %llu ns): %llu\n", 1ULL << bucket, 1ULL << (bucket + 1),
+                    entry->stats.latency_hist[bucket]);
+        }
+    }
+}
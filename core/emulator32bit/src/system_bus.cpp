@@ -1,12 +1,63 @@
 #include "emulator32bit/system_bus.h"
 
+#include <algorithm>
+#include <cstring>
+
+#define UNUSED(x) (void)(x)
+
+SystemBus::PageEntry SystemBus::s_empty_table[AEMU_BUS_TABLE_SIZE];
+
+/**
+ * @brief             Stands in for the missing device of a faulting access.
+ */
+class NullDevice : public Device
+{
+    public:
+        byte read_byte(word address) override { UNUSED(address); return 0; }
+        hword read_hword(word address) override { UNUSED(address); return 0; }
+        word read_word(word address) override { UNUSED(address); return 0; }
+        void write_byte(word address, byte value) override { UNUSED(address); UNUSED(value); }
+        void write_hword(word address, hword value) override { UNUSED(address); UNUSED(value); }
+        void write_word(word address, word value) override { UNUSED(address); UNUSED(value); }
+};
+
+static NullDevice s_null_device;
+
 SystemBus::SystemBus(RAM& ram, ROM& rom, Disk& disk, VirtualMemory& mmu) :
     ram(ram),
     rom(rom),
     disk(disk),
-    mmu(mmu)
+    mmu(mmu),
+    m_self(std::make_shared<SystemBus*>(this))
 {
+    for (word i = 0; i < AEMU_BUS_DIR_SIZE; i++)
+    {
+        m_page_dir[i] = s_empty_table;
+    }
 
+    /* Disk is not mapped, guests access it through a BlockDevice. */
+    BaseMemory *memories[] = {&ram, &rom};
+    for (BaseMemory *memory : memories)
+    {
+        if (memory->get_mem_pages() > 0)
+        {
+            register_device(memory->get_lo_page(), memory->get_hi_page(), *memory);
+        }
+    }
+}
+
+SystemBus::~SystemBus()
+{
+    /* Devices may already be destroyed, so they are told through the shared handle instead. */
+    *m_self = nullptr;
+
+    for (word i = 0; i < AEMU_BUS_DIR_SIZE; i++)
+    {
+        if (m_page_dir[i] != s_empty_table)
+        {
+            delete[] m_page_dir[i];
+        }
+    }
 }
 
 SystemBus::Exception::Exception(const std::string& msg) :
@@ -20,8 +71,385 @@ const char* SystemBus::Exception::what() const noexcept
     return message.c_str();
 }
 
+void SystemBus::register_device(word page_lo, word page_hi, Device& device)
+{
+    for (word page = page_lo; page <= page_hi; page++)
+    {
+        if (get_page(page << PAGE_PSIZE).device != nullptr)
+        {
+            throw Exception("Could not register device at pages " + std::to_string(page_lo) + " to " +
+                    std::to_string(page_hi) + ". Page " + std::to_string(page) + " already has a device.");
+        }
+    }
+
+    for (word page = page_lo; page <= page_hi; page++)
+    {
+        PageEntry *&table = m_page_dir[page >> AEMU_BUS_TABLE_PSIZE];
+        if (table == s_empty_table)
+        {
+            table = new PageEntry[AEMU_BUS_TABLE_SIZE];
+        }
+
+        PageEntry& entry = table[page & (AEMU_BUS_TABLE_SIZE - 1)];
+        entry.device = &device;
+        refresh_direct(entry, page);
+    }
+    device.m_bus = m_self;
+
+    if (m_fastmem != nullptr)
+    {
+        Memory *memory = dynamic_cast<Memory*>(&device);
+        if (memory != nullptr)
+        {
+            m_fastmem->add_memory(*memory);
+        }
+        update_direct(page_lo, page_hi);
+    }
+}
+
+void SystemBus::unregister_device(word page_lo, word page_hi)
+{
+    std::vector<Device*> detached;
+    for (word page = page_lo; page <= page_hi; page++)
+    {
+        PageEntry& entry = get_page(page << PAGE_PSIZE);
+        if (entry.device != nullptr)
+        {
+            if (std::find(detached.begin(), detached.end(), entry.device) == detached.end())
+            {
+                detached.push_back(entry.device);
+            }
+            entry = PageEntry();
+        }
+    }
+
+    /* A device only forgets the bus once none of its pages are left. */
+    for (Device *device : detached)
+    {
+        if (!has_device(*device))
+        {
+            device->m_bus.reset();
+        }
+    }
+
+    if (m_fastmem != nullptr)
+    {
+        sync_fastmem(page_lo, page_hi);
+    }
+}
+
+bool SystemBus::has_device(const Device& device) const
+{
+    for (word dir = 0; dir < AEMU_BUS_DIR_SIZE; dir++)
+    {
+        if (m_page_dir[dir] == s_empty_table)
+        {
+            continue;
+        }
+
+        for (word i = 0; i < AEMU_BUS_TABLE_SIZE; i++)
+        {
+            if (m_page_dir[dir][i].device == &device)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void SystemBus::detach_device(Device& device)
+{
+    for (word dir = 0; dir < AEMU_BUS_DIR_SIZE; dir++)
+    {
+        if (m_page_dir[dir] == s_empty_table)
+        {
+            continue;
+        }
+
+        for (word i = 0; i < AEMU_BUS_TABLE_SIZE; i++)
+        {
+            if (m_page_dir[dir][i].device == &device)
+            {
+                m_page_dir[dir][i] = PageEntry();
+
+                if (m_fastmem != nullptr)
+                {
+                    word page = (dir << AEMU_BUS_TABLE_PSIZE) + i;
+                    sync_fastmem(page, page);
+                }
+            }
+        }
+    }
+}
+
+void SystemBus::update_direct(word page_lo, word page_hi)
+{
+    for (word page = page_lo; page <= page_hi; page++)
+    {
+        PageEntry& entry = get_page(page << PAGE_PSIZE);
+        if (entry.device == nullptr)
+        {
+            continue;
+        }
+
+        /* A memory that stopped sharing its image is moved into the region, which moves its data. */
+        Memory *memory = m_fastmem != nullptr ? dynamic_cast<Memory*>(entry.device) : nullptr;
+        if (memory != nullptr)
+        {
+            m_fastmem->add_memory(*memory);
+        }
+        refresh_direct(entry, page);
+    }
+
+    if (m_fastmem != nullptr)
+    {
+        sync_fastmem(page_lo, page_hi);
+    }
+}
+
+bool SystemBus::set_page_watch(word page, byte access)
+{
+    /* Pages without a device share the empty table, which is never written to. */
+    PageEntry& entry = get_page(page << PAGE_PSIZE);
+    if (entry.device == nullptr)
+    {
+        return false;
+    }
+
+    entry.watch = access;
+    update_direct(page, page);
+    return true;
+}
+
+bool SystemBus::enable_fastmem()
+{
+    if (m_fastmem != nullptr)
+    {
+        return true;
+    }
+    if (!FastMemory::is_supported())
+    {
+        return false;
+    }
+
+    try
+    {
+        m_fastmem = std::make_unique<FastMemory>(*this);
+    }
+    catch (const FastMemory::FastMemoryException& e)
+    {
+        DEBUG("Could not enable fast memory: %s", e.what());
+        return false;
+    }
+
+    /* Move every memory already on the bus into the region. */
+    for (word dir = 0; dir < AEMU_BUS_DIR_SIZE; dir++)
+    {
+        if (m_page_dir[dir] == s_empty_table)
+        {
+            continue;
+        }
+
+        for (word i = 0; i < AEMU_BUS_TABLE_SIZE; i++)
+        {
+            Memory *memory = dynamic_cast<Memory*>(m_page_dir[dir][i].device);
+            if (memory != nullptr)
+            {
+                m_fastmem->add_memory(*memory);
+            }
+        }
+    }
+
+    update_direct(0, (AEMU_BUS_DIR_SIZE * AEMU_BUS_TABLE_SIZE) - 1);
+    return true;
+}
+
+void SystemBus::sync_fastmem(word page_lo, word page_hi)
+{
+    for (word page = page_lo; page <= page_hi; page++)
+    {
+        PageEntry& entry = get_page(page << PAGE_PSIZE);
+
+        /* Only memories are in the region, anything else has to go through the bus. */
+        bool is_memory = dynamic_cast<Memory*>(entry.device) != nullptr;
+        m_fastmem->protect(page, is_memory && entry.read != nullptr, is_memory && entry.write != nullptr);
+    }
+}
+
 void SystemBus::reset()
 {
+    /* ROM is not cleared, it holds the BIOS which has to survive a reset. */
     ram.reset();
-    rom.reset();     // Do we really want to reset rom??
-}
\ No newline at end of file
+    m_pending_irqs = 0;
+    m_fault = false;
+}
+
+void SystemBus::read_bytes(word address, byte *dst, word n_bytes)
+{
+    while (n_bytes > 0)
+    {
+        /* Copy up to the end of the current page, the next page may be mapped elsewhere. */
+        word chunk = PAGE_SIZE - (address & (PAGE_SIZE - 1));
+        if (chunk > n_bytes)
+        {
+            chunk = n_bytes;
+        }
+
+        word real_adr = translate_address(address);
+        if (UNLIKELY(m_fault))
+        {
+            /* Faulting reads return 0, never whatever page the failed translation points at. */
+            memset(dst, 0, n_bytes);
+            return;
+        }
+
+        PageEntry& page = get_page(real_adr);
+        if (page.read != nullptr)
+        {
+            memcpy(dst, page.read + (real_adr & (PAGE_SIZE - 1)), chunk);
+        }
+        else
+        {
+            Device *target = route_memory(page, real_adr, chunk);
+            for (word i = 0; i < chunk; i++)
+            {
+                dst[i] = target->read_byte(real_adr + i);
+            }
+        }
+
+        address += chunk;
+        dst += chunk;
+        n_bytes -= chunk;
+    }
+}
+
+void SystemBus::write_bytes(word address, const byte *src, word n_bytes)
+{
+    while (n_bytes > 0)
+    {
+        word chunk = PAGE_SIZE - (address & (PAGE_SIZE - 1));
+        if (chunk > n_bytes)
+        {
+            chunk = n_bytes;
+        }
+
+        word real_adr = translate_write_address(address);
+        if (UNLIKELY(m_fault))
+        {
+            return;
+        }
+
+        PageEntry& page = get_page(real_adr);
+        if (page.write != nullptr)
+        {
+            memcpy(page.write + (real_adr & (PAGE_SIZE - 1)), src, chunk);
+        }
+        else
+        {
+            Device *target = route_write(page, real_adr, chunk);
+            for (word i = 0; i < chunk; i++)
+            {
+                target->write_byte(real_adr + i, src[i]);
+            }
+        }
+
+        address += chunk;
+        src += chunk;
+        n_bytes -= chunk;
+    }
+}
+
+bool SystemBus::probe_write(word address, word n_bytes)
+{
+    while (n_bytes > 0)
+    {
+        word chunk = PAGE_SIZE - (address & (PAGE_SIZE - 1));
+        if (chunk > n_bytes)
+        {
+            chunk = n_bytes;
+        }
+
+        word real_adr = translate_write_address(address);
+        if (UNLIKELY(m_fault) || UNLIKELY(!check_writable(real_adr)))
+        {
+            return false;
+        }
+
+        address += chunk;
+        n_bytes -= chunk;
+    }
+    return true;
+}
+
+void SystemBus::read_physical_page(word ppage, byte *dst)
+{
+    word paddr = ppage << PAGE_PSIZE;
+    PageEntry& page = get_page(paddr);
+    if (page.read != nullptr)
+    {
+        memcpy(dst, page.read, PAGE_SIZE);
+        return;
+    }
+
+    Device *target = route_memory(page, paddr, PAGE_SIZE);
+    for (word i = 0; i < PAGE_SIZE; i++)
+    {
+        dst[i] = target->read_byte(paddr + i);
+    }
+}
+
+void SystemBus::write_physical_page(word ppage, const byte *src)
+{
+    word paddr = ppage << PAGE_PSIZE;
+    PageEntry& page = get_page(paddr);
+    if (page.write != nullptr)
+    {
+        memcpy(page.write, src, PAGE_SIZE);
+        return;
+    }
+
+    Device *target = route_write(page, paddr, PAGE_SIZE);
+    for (word i = 0; i < PAGE_SIZE; i++)
+    {
+        target->write_byte(paddr + i, src[i]);
+    }
+}
+
+Device* SystemBus::fault_device(word address)
+{
+    DEBUG("Could not route address %u to memory.", address);
+    set_fault(address);
+    return &s_null_device;
+}
+
+std::string SystemBus::read_string(word address, word max_len)
+{
+    std::string str;
+    byte buffer[256];
+    while (str.size() < max_len)
+    {
+        /* Read in small chunks that do not cross a page so we never read past a mapped page. */
+        word chunk = PAGE_SIZE - (address & (PAGE_SIZE - 1));
+        if (chunk > sizeof(buffer))
+        {
+            chunk = sizeof(buffer);
+        }
+        if (chunk > max_len - str.size())
+        {
+            chunk = max_len - str.size();
+        }
+
+        read_bytes(address, buffer, chunk);
+        for (word i = 0; i < chunk; i++)
+        {
+            if (buffer[i] == '\0')
+            {
+                return str;
+            }
+            str += (char) buffer[i];
+        }
+        address += chunk;
+    }
+    return str;
+}
@@ -1,7 +1,105 @@
 #include "emulator32bit/timer.h"
+#include "emulator32bit/emulator32bit.h"
 
-Timer::Timer(Emulator32bit *processor)
-    : processor(processor)
+#define UNUSED(x) (void)(x)
+
+Timer::Timer(Emulator32bit *processor, word irq) :
+    processor(processor),
+    m_irq(irq)
+{
+
+}
+
+byte Timer::read_byte(word address)
+{
+    return byte_from_word(read_word(address & ~3), (address & 3));
+}
+
+hword Timer::read_hword(word address)
+{
+    return read_word(address & ~3) >> ((address & 2) * 8);
+}
+
+word Timer::read_word(word address)
+{
+    switch (address & (PAGE_SIZE - 1))
+    {
+        case AEMU_TIMER_REG_TIME_LO:
+            return time();
+        case AEMU_TIMER_REG_TIME_HI:
+            return time() >> 32;
+        case AEMU_TIMER_REG_COMPARE_LO:
+            return m_compare;
+        case AEMU_TIMER_REG_COMPARE_HI:
+            return m_compare >> 32;
+        case AEMU_TIMER_REG_CTRL:
+            return m_ctrl;
+        case AEMU_TIMER_REG_ISR:
+            return m_isr;
+        default:
+            return 0;
+    }
+}
+
+void Timer::write_byte(word address, byte value)
 {
+    UNUSED(address);
+    UNUSED(value);
+}
 
-}
\ No newline at end of file
+void Timer::write_hword(word address, hword value)
+{
+    UNUSED(address);
+    UNUSED(value);
+}
+
+void Timer::write_word(word address, word value)
+{
+    switch (address & (PAGE_SIZE - 1))
+    {
+        case AEMU_TIMER_REG_COMPARE_LO:
+            m_compare = (m_compare & ~0xFFFFFFFFULL) | value;
+            rearm();
+            break;
+        case AEMU_TIMER_REG_COMPARE_HI:
+            m_compare = (m_compare & 0xFFFFFFFFULL) | (((unsigned long long) value) << 32);
+            rearm();
+            break;
+        case AEMU_TIMER_REG_CTRL:
+            m_ctrl = value;
+            rearm();
+            break;
+        case AEMU_TIMER_REG_ISR:
+            m_isr &= ~value;
+            if (m_isr == 0)
+            {
+                processor->system_bus.clear_irq(m_irq);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+unsigned long long Timer::time()
+{
+    return processor->get_time();
+}
+
+void Timer::update()
+{
+    if (get_deadline() > time())
+    {
+        return;
+    }
+
+    m_armed = false;
+    m_isr |= AEMU_TIMER_ISR_FIRED;
+    processor->system_bus.raise_irq(m_irq);
+}
+
+void Timer::rearm()
+{
+    m_armed = true;
+    processor->reschedule();
+}
@@ -3,6 +3,7 @@
 #define AEMU_ONLY_CRITICAL_LOG
 #include "util/logger.h"
 
+#include <algorithm>
 #include <unordered_set>
 
 VirtualMemory::VirtualMemory(Disk *disk) :
@@ -10,10 +11,7 @@ VirtualMemory::VirtualMemory(Disk *disk) :
     m_freepids(0, MAX_PROCESSES),
     m_freelist(0, NUM_PPAGES)
 {
-    for (int i = 0; i < NUM_PPAGES; i++)
-    {
-        m_physical_memory_map[i].ppage = (word) i;
-    }
+
 }
 
 VirtualMemory::~VirtualMemory()
@@ -25,6 +23,8 @@ VirtualMemory::~VirtualMemory()
         delete cur;
         cur = next;
     }
+
+    delete[] m_physical_memory_map;
 }
 
 VirtualMemory::VirtualMemoryException::VirtualMemoryException(const std::string& msg) :
@@ -109,7 +109,8 @@ VirtualMemory::PhysicalPage::PhysicalPage() :
     ppage(0),
     used(false),
     swappable(true),
-    kernel_locked(false)
+    kernel_locked(false),
+    merged(false)
 {
 
 }
@@ -199,11 +200,24 @@ void VirtualMemory::set_ppage_permissions(word ppage_begin, word ppage_end, word
 {
     for (word i = ppage_begin; i <= ppage_end; i++)
     {
-        m_physical_memory_map[i].swappable = swappable;
-        m_physical_memory_map[i].kernel_locked = kernel_locked;
+        physical_page(i).swappable = swappable;
+        physical_page(i).kernel_locked = kernel_locked;
     }
 }
 
+void VirtualMemory::set_frames(word ppage_lo, word ppage_hi)
+{
+    if (ppage_lo > 0)
+    {
+        m_freelist.remove_block(0, ppage_lo);
+    }
+    if (ppage_hi < NUM_PPAGES - 1)
+    {
+        m_freelist.remove_block(ppage_hi + 1, NUM_PPAGES - 1 - ppage_hi);
+    }
+    m_frames = ppage_hi - ppage_lo + 1;
+}
+
 void VirtualMemory::set_vpage_permissions(long long pid, word vpage_begin, word vpage_end, bool write, bool execute)
 {
     if (UNLIKELY(m_process_ptable_map.find(pid) == m_process_ptable_map.end()))
@@ -265,7 +279,7 @@ bool VirtualMemory::can_access_ppage(long long pid, word ppage)
     }
 
     PageTable *ptable = m_process_ptable_map.at(pid);
-    return !m_physical_memory_map[ppage].kernel_locked || ptable->kernel_privilege;
+    return !physical_page(ppage).kernel_locked || ptable->kernel_privilege;
 }
 
 void VirtualMemory::add_vpage(long long pid, word vpage, word length, bool write, bool execute)
@@ -309,7 +323,7 @@ void VirtualMemory::map_ppage(long long pid, word vpage, word ppage, Exception&
 
     add_vpage(vpage, 1, true, true, true);
 
-    if (m_physical_memory_map[ppage].used)
+    if (physical_page(ppage).used)
     {
         evict_ppage(ppage, exception);
     }
@@ -340,15 +354,55 @@ void VirtualMemory::remove_vpage(long long pid, word vpage)
     PageTableEntry *entry = ptable->entries.at(vpage);
     ptable->entries.erase(vpage);
 
-    if (entry->disk)
+    if (entry->file_backed)
     {
+        /* The disk page belongs to the file, only the physical page can be freed. */
+        if (!entry->disk)
+        {
+            std::vector<PageTableEntry*>& mapped_vpages = physical_page(entry->ppage).mapped_vpages;
+            mapped_vpages.erase(std::find(mapped_vpages.begin(), mapped_vpages.end(), entry));
+
+            if (mapped_vpages.empty())
+            {
+                physical_page(entry->ppage).used = false;
+                m_freelist.return_block(entry->ppage, 1);
+                m_file_pages.erase(entry->diskpage);
+            }
+        }
+
+        DEBUG("Unmapping file page %u from virtual page %u.", entry->diskpage, vpage);
+    }
+    else if (entry->disk)
+    {
+        /* A merged page on disk is only freed with the last of its virtual pages. */
+        auto merged = m_merged_swap.find(entry->diskpage);
+        if (merged != m_merged_swap.end())
+        {
+            std::vector<PageTableEntry*>& entries = merged->second;
+            entries.erase(std::find(entries.begin(), entries.end(), entry));
+            if (!entries.empty())
+            {
+                delete entry;
+                return;
+            }
+            m_merged_swap.erase(merged);
+        }
+
+        if (m_swap != nullptr)
+        {
+            m_swap->discard(entry->diskpage);
+        }
         m_disk->return_page(entry->diskpage);
 
         DEBUG("Returning disk page %u coressponding to virtual page %u.", entry->diskpage, vpage);
     }
+    else if (physical_page(entry->ppage).merged)
+    {
+        unshare(physical_page(entry->ppage), entry);
+    }
     else
     {
-        m_physical_memory_map[entry->ppage].used = false;
+        physical_page(entry->ppage).used = false;
 
         /* add back to free list */
         m_freelist.return_block(entry->ppage, 1);
@@ -363,7 +417,7 @@ void VirtualMemory::check_vm()
 {
     for (int i = 0; i < NUM_PPAGES; i++)
     {
-        PhysicalPage& ppage = m_physical_memory_map[i];
+        PhysicalPage& ppage = physical_page(i);
 
         EXPECT_TRUE((word) i == ppage.ppage, "Expected physical memory to match");
 
@@ -395,32 +449,54 @@ void VirtualMemory::evict_ppage(word ppage, Exception& exception)
 {
     DEBUG("Evicting physical page %u to disk.", ppage);
 
+    /* The page may have been freed since it was last used. */
+    PhysicalPage& evicted_ppage = physical_page(ppage);
+    if (!evicted_ppage.used || evicted_ppage.mapped_vpages.empty())
+    {
+        return;
+    }
+
+    evicted_ppage.used = false;
+    m_freelist.return_block(ppage, 1);
+
     /*
-     * NOTE: this location will be overwritten below since we return the
-     * block to the free list, and then request a free block immediately
+     * All virtual pages mapped to the physical page share one disk page. File pages go back to
+     * where they came from, anonymous pages get a fresh swap page.
      */
-    PhysicalPage& evicted_ppage = m_physical_memory_map[ppage];
-    evicted_ppage.used = false;
+    PageTableEntry *first_entry = evicted_ppage.mapped_vpages.at(0);
+    word diskpage = first_entry->file_backed ? first_entry->diskpage : m_disk->get_free_page();
+    if (first_entry->file_backed)
+    {
+        m_file_pages.erase(diskpage);
+    }
 
     for (PageTableEntry *removed_entry : evicted_ppage.mapped_vpages)
     {
         removed_entry->disk = true;
-        removed_entry->diskpage = m_disk->get_free_page();
-        word tlb_addr = removed_entry->vpage & (TLB_SIZE-1);
-        TLB_Entry& tlb_entry = tlb[tlb_addr];
-        if (tlb_entry.valid && tlb_entry.ppage == ppage && tlb_entry.vpage == removed_entry->vpage) // todo, this should check for pid i think.
+        removed_entry->diskpage = diskpage;
+        invalidate_tlb(removed_entry, ppage); // todo, this should check for pid i think.
+        if (removed_entry->prefetched)
         {
-            tlb_entry.valid = false;
+            removed_entry->prefetched = false;
+            m_readahead_stats.wasted++;
         }
     }
+
+    /* Merged pages stay merged on disk, they all come back in with the first fault. */
+    if (evicted_ppage.merged)
+    {
+        m_dedup_stats.pages_shared--;
+        m_dedup_stats.pages_sharing -= evicted_ppage.mapped_vpages.size() - 1;
+        evicted_ppage.merged = false;
+        m_merged_swap[diskpage] = std::move(evicted_ppage.mapped_vpages);
+    }
     evicted_ppage.mapped_vpages.clear();
 
     // exception to tell system bus to write to disk
-    exception.disk_page_return = evicted_ppage.mapped_vpages.at(0)->diskpage;        // there MUST be a mapped vpage or else we should not be evicting this ppage.
+    exception.disk_page_return = diskpage;
     exception.ppage_return = ppage;
+    exception.swap_return = !first_entry->file_backed;
     exception.type = Exception::Type::DISK_RETURN_AND_FETCH_SUCCESS;
-
-    m_freelist.return_block(ppage, 1);
 }
 
 void VirtualMemory::map_vpage_to_ppage(long long pid, word vpage, word ppage, Exception& exception)
@@ -433,27 +509,212 @@ void VirtualMemory::map_vpage_to_ppage(long long pid, word vpage, word ppage, Ex
     PageTable *ptable = m_process_ptable_map.at(pid);
 
     PageTableEntry *entry = ptable->entries.at(vpage);
-    exception.disk_fetch = m_disk->read_page(entry->diskpage);
+    if (!entry->file_backed && m_swap != nullptr)
+    {
+        exception.disk_fetch.resize(PAGE_SIZE);
+        exception.swap_fetch = m_swap->load(entry->diskpage, exception.disk_fetch.data());
+    }
+    if (!exception.swap_fetch)
+    {
+        exception.disk_fetch = m_disk->read_page(entry->diskpage);
+    }
 
     DEBUG("Disk Fetch from page %u to physical page %u.", entry->diskpage, ppage);
 
-    m_disk->return_page(entry->diskpage);
-
     if (exception.type != Exception::Type::DISK_RETURN_AND_FETCH_SUCCESS)
     {
         exception.type = Exception::Type::DISK_FETCH_SUCCESS;
     }
     exception.ppage_fetch = ppage;
+    bind_vpage(entry, ppage);
+}
+
+void VirtualMemory::bind_vpage(PageTableEntry *entry, word ppage)
+{
+    PhysicalPage& mapped_ppage = physical_page(ppage);
+    if (entry->file_backed)
+    {
+        m_file_pages[entry->diskpage] = ppage;
+    }
+    else
+    {
+        m_disk->return_page(entry->diskpage);
+
+        auto merged = m_merged_swap.find(entry->diskpage);
+        if (merged != m_merged_swap.end())
+        {
+            for (PageTableEntry *shared_entry : merged->second)
+            {
+                if (shared_entry != entry)
+                {
+                    shared_entry->ppage = ppage;
+                    shared_entry->disk = false;
+                    mapped_ppage.mapped_vpages.push_back(shared_entry);
+                }
+            }
+            mapped_ppage.merged = true;
+            m_dedup_stats.pages_shared++;
+            m_dedup_stats.pages_sharing += merged->second.size() - 1;
+            m_merged_swap.erase(merged);
+        }
+    }
+
     entry->ppage = ppage;
     entry->disk = false;
 
-    PhysicalPage& mapped_ppage = m_physical_memory_map[ppage];
     mapped_ppage.mapped_vpages.push_back(entry);
     mapped_ppage.used = true;
 
     add_lru(ppage);
 }
 
+void VirtualMemory::read_ahead(PageTable *ptable, word vpage, Exception& exception)
+{
+    m_readahead_stats.faults++;
+
+    const int delta = (int) (vpage - ptable->ra_last);
+    const bool pattern = (ptable->ra_stride != 0 && delta == ptable->ra_stride) ||
+            (ptable->ra_issued != 0 && vpage == ptable->ra_next);
+    ptable->ra_last = vpage;
+    if (!pattern)
+    {
+        ptable->ra_stride = (std::abs(delta) <= AEMU_READAHEAD_MAX_STRIDE) ? delta : 0;
+        ptable->ra_window = 2;
+        ptable->ra_issued = 0;
+        return;
+    }
+
+    /* Grow the window while everything read ahead gets used, shrink it when most does not. */
+    const word limit = std::max(std::min(m_readahead_max, m_frames / 2), 1U);
+    if (ptable->ra_issued != 0 && ptable->ra_hits == ptable->ra_issued)
+    {
+        ptable->ra_window *= 2;
+    }
+    else if (ptable->ra_hits * 2 < ptable->ra_issued)
+    {
+        ptable->ra_window /= 2;
+    }
+    ptable->ra_window = std::max(std::min(ptable->ra_window, limit), 1U);
+
+    std::vector<PageTableEntry*> entries;
+    std::vector<word> ppages;
+    for (word i = 1; i <= ptable->ra_window; i++)
+    {
+        auto it = ptable->entries.find(vpage + i * ptable->ra_stride);
+        if (it == ptable->entries.end() || !it->second->disk || it->second->mapped ||
+                (!it->second->file_backed && m_merged_swap.find(it->second->diskpage) != m_merged_swap.end()))
+        {
+            break;
+        }
+
+        /* Make room like for the fault, but never by evicting the pages just brought in. */
+        while (!m_freelist.can_fit(1) && !m_lru_map.empty())
+        {
+            word victim = remove_lru();
+            if (victim == exception.ppage_fetch || std::find(ppages.begin(), ppages.end(), victim) != ppages.end())
+            {
+                add_lru(victim);
+                break;
+            }
+
+            Exception evicted;
+            evict_ppage(victim, evicted);
+            if (evicted.type == Exception::Type::DISK_RETURN_AND_FETCH_SUCCESS)
+            {
+                exception.prefetch_returns.push_back({evicted.ppage_return, evicted.disk_page_return,
+                        evicted.swap_return});
+            }
+        }
+        if (!m_freelist.can_fit(1))
+        {
+            break;
+        }
+
+        entries.push_back(it->second);
+        ppages.push_back(m_freelist.get_free_block(1));
+    }
+
+    /* Pages not in the compressed pool are read from disk, consecutive disk pages at once. */
+    exception.disk_fetch.resize((entries.size() + 1) * PAGE_SIZE);
+    std::vector<bool> on_disk(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        byte *dst = exception.disk_fetch.data() + (i + 1) * PAGE_SIZE;
+        on_disk[i] = entries[i]->file_backed || m_swap == nullptr || !m_swap->load(entries[i]->diskpage, dst);
+    }
+    for (size_t i = 0; i < entries.size();)
+    {
+        if (!on_disk[i])
+        {
+            i++;
+            continue;
+        }
+
+        size_t n = 1;
+        while (i + n < entries.size() && on_disk[i + n] && entries[i + n]->diskpage == entries[i]->diskpage + n)
+        {
+            n++;
+        }
+        m_disk->read_pages(entries[i]->diskpage, n, exception.disk_fetch.data() + (i + 1) * PAGE_SIZE);
+        exception.prefetch_reads++;
+        i += n;
+    }
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        bind_vpage(entries[i], ppages[i]);
+        entries[i]->prefetched = true;
+    }
+    exception.prefetch_ppages = ppages;
+
+    ptable->ra_issued = entries.size();
+    ptable->ra_hits = 0;
+    ptable->ra_next = vpage + (entries.size() + 1) * ptable->ra_stride;
+    m_readahead_stats.prefetched += entries.size();
+    m_readahead_stats.disk_reads += exception.prefetch_reads;
+
+    DEBUG("Read ahead %zu pages after virtual page %u.", entries.size(), vpage);
+}
+
+word VirtualMemory::sample_working_set(long long pid)
+{
+    if (UNLIKELY(m_process_ptable_map.find(pid) == m_process_ptable_map.end()))
+    {
+        throw InvalidPIDException("Cannot sample working set since pid is invalid.", pid);
+    }
+
+    PageTable *ptable = m_process_ptable_map.at(pid);
+    word accessed = 0;
+    for (std::pair<const word, PageTableEntry*>& pair : ptable->entries)
+    {
+        PageTableEntry *entry = pair.second;
+        if (!entry->accessed)
+        {
+            continue;
+        }
+
+        accessed++;
+        entry->accessed = false;
+        TLB_Entry& tlb_entry = tlb[entry->vpage & (TLB_SIZE-1)];
+        if (tlb_entry.valid && tlb_entry.pid == pid && tlb_entry.vpage == entry->vpage)
+        {
+            tlb_entry.valid = false;
+        }
+    }
+
+    ptable->working_set = accessed;
+    return accessed;
+}
+
+word VirtualMemory::get_working_set(long long pid)
+{
+    if (UNLIKELY(m_process_ptable_map.find(pid) == m_process_ptable_map.end()))
+    {
+        throw InvalidPIDException("Cannot get working set since pid is invalid.", pid);
+    }
+    return m_process_ptable_map.at(pid)->working_set;
+}
+
 void VirtualMemory::ensure_physical_page_mapping(long long pid, word vpage, word ppage, Exception& exception)
 {
     if (UNLIKELY(!enabled))
@@ -493,6 +754,198 @@ void VirtualMemory::ensure_physical_page_mapping(long long pid, word vpage, word
     map_ppage(pid, vpage, ppage, exception);
 }
 
+void VirtualMemory::map_file_page(long long pid, word vpage, word diskpage, bool write, bool execute)
+{
+    if (UNLIKELY(m_process_ptable_map.find(pid) == m_process_ptable_map.end()))
+    {
+        throw InvalidPIDException("Cannot map file page because pid is invalid.", pid);
+    }
+
+    PageTable *ptable = m_process_ptable_map.at(pid);
+    if (ptable->entries.find(vpage) != ptable->entries.end())
+    {
+        throw InvalidVPageException("Cannot map file page to virtual page " + std::to_string(vpage) +
+                " because it is already mapped to process " + std::to_string(pid), vpage);
+    }
+
+    PageTableEntry *entry = new PageTableEntry(pid, vpage, diskpage, write, execute);
+    entry->file_backed = true;
+    ptable->entries.insert(std::make_pair(vpage, entry));
+
+    /* Share the physical page if another mapping already brought the file page in. */
+    if (m_file_pages.find(diskpage) != m_file_pages.end())
+    {
+        entry->ppage = m_file_pages.at(diskpage);
+        entry->disk = false;
+        physical_page(entry->ppage).mapped_vpages.push_back(entry);
+    }
+
+    DEBUG("Mapping file page %u to virtual page %u of process %llu.", diskpage, vpage, pid);
+}
+
+bool VirtualMemory::get_file_page(long long pid, word vpage, word& diskpage)
+{
+    if (UNLIKELY(m_process_ptable_map.find(pid) == m_process_ptable_map.end()))
+    {
+        throw InvalidPIDException("Cannot get file page because pid is invalid.", pid);
+    }
+
+    PageTable *ptable = m_process_ptable_map.at(pid);
+    if (ptable->entries.find(vpage) == ptable->entries.end() || !ptable->entries.at(vpage)->file_backed)
+    {
+        return false;
+    }
+
+    diskpage = ptable->entries.at(vpage)->diskpage;
+    return true;
+}
+
+bool VirtualMemory::get_resident_file_page(word diskpage, word& ppage)
+{
+    if (m_file_pages.find(diskpage) == m_file_pages.end())
+    {
+        return false;
+    }
+
+    ppage = m_file_pages.at(diskpage);
+    return true;
+}
+
+bool VirtualMemory::is_mergeable(word ppage)
+{
+    PhysicalPage& page = physical_page(ppage);
+    if (!page.used || !page.swappable || page.mapped_vpages.empty())
+    {
+        return false;
+    }
+
+    for (PageTableEntry *entry : page.mapped_vpages)
+    {
+        if (entry->file_backed || entry->mapped)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void VirtualMemory::merge_ppages(word ppage, word duplicate)
+{
+    if (ppage == duplicate || !is_mergeable(ppage) || !is_mergeable(duplicate))
+    {
+        throw VirtualMemoryException("Cannot merge physical page " + std::to_string(duplicate) +
+                " into " + std::to_string(ppage) + " because they are not both mergeable.");
+    }
+
+    PhysicalPage& kept = physical_page(ppage);
+    PhysicalPage& freed = physical_page(duplicate);
+    if (!kept.merged)
+    {
+        kept.merged = true;
+        m_dedup_stats.pages_shared++;
+    }
+    else
+    {
+        m_dedup_stats.pages_sharing--;
+    }
+
+    if (freed.merged)
+    {
+        freed.merged = false;
+        m_dedup_stats.pages_shared--;
+        m_dedup_stats.pages_sharing -= freed.mapped_vpages.size() - 1;
+    }
+
+    for (PageTableEntry *entry : freed.mapped_vpages)
+    {
+        entry->ppage = ppage;
+        invalidate_tlb(entry, duplicate);
+        kept.mapped_vpages.push_back(entry);
+        m_dedup_stats.pages_sharing++;
+    }
+    freed.mapped_vpages.clear();
+
+    /* Left in the LRU list like pages freed by remove_vpage, eviction skips it. */
+    freed.used = false;
+    m_freelist.return_block(duplicate, 1);
+
+    DEBUG("Merged physical page %u into %u.", duplicate, ppage);
+}
+
+std::vector<word> VirtualMemory::get_resident_ppages()
+{
+    std::vector<word> ppages;
+    for (const std::pair<const word, LRU_Node*>& pair : m_lru_map)
+    {
+        if (physical_page(pair.first).used)
+        {
+            ppages.push_back(pair.first);
+        }
+    }
+    std::sort(ppages.begin(), ppages.end());
+    return ppages;
+}
+
+word VirtualMemory::copy_on_write(word address, word paddr, Exception& exception)
+{
+    const word ppage = paddr >> PAGE_PSIZE;
+    if (!is_translating() || !physical_page(ppage).merged)
+    {
+        return paddr;
+    }
+
+    if (UNLIKELY(!m_freelist.can_fit(1)))
+    {
+        /* Evict anything but the page being copied. */
+        add_lru(ppage);
+        word victim = remove_lru();
+        if (victim == ppage)
+        {
+            add_lru(ppage);
+            throw VirtualMemoryException("Cannot copy shared physical page " + std::to_string(ppage) +
+                    " because there is no other physical page.");
+        }
+        evict_ppage(victim, exception);
+    }
+
+    PageTableEntry *entry = m_cur_ptable->entries.at(address >> PAGE_PSIZE);
+    unshare(physical_page(ppage), entry);
+
+    word copy = m_freelist.get_free_block(1);
+    entry->ppage = copy;
+    PhysicalPage& copy_ppage = physical_page(copy);
+    copy_ppage.mapped_vpages.push_back(entry);
+    copy_ppage.used = true;
+    add_lru(copy);
+    m_dedup_stats.cow_copies++;
+
+    if (exception.type != Exception::Type::DISK_RETURN_AND_FETCH_SUCCESS)
+    {
+        exception.type = Exception::Type::DISK_FETCH_SUCCESS;
+    }
+    exception.fetch_copy = true;
+    exception.ppage_copy = ppage;
+    exception.ppage_fetch = copy;
+
+    DEBUG("Copying shared physical page %u to %u on write.", ppage, copy);
+    return (copy << PAGE_PSIZE) | (paddr & (PAGE_SIZE - 1));
+}
+
+void VirtualMemory::unshare(PhysicalPage& ppage, PageTableEntry *entry)
+{
+    ppage.mapped_vpages.erase(std::find(ppage.mapped_vpages.begin(), ppage.mapped_vpages.end(), entry));
+    invalidate_tlb(entry, ppage.ppage);
+    if (ppage.mapped_vpages.size() == 1)
+    {
+        ppage.merged = false;
+        m_dedup_stats.pages_shared--;
+    }
+    else
+    {
+        m_dedup_stats.pages_sharing--;
+    }
+}
+
 void VirtualMemory::check_lru()
 {
     DEBUG("Checking LRU");
@@ -0,0 +1,87 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/bios.h>
+
+#include <cstring>
+
+#define RAM_PAGES 4
+#define SCRATCH_PAGE 3
+#define ROM_PAGE 4
+
+static Emulator32bit* create_machine(const std::string& path) {
+    std::vector<byte> rom = BIOS::rom_image(ROM_PAGE, 1, SCRATCH_PAGE);
+    return new Emulator32bit(new RAM(RAM_PAGES, 0), new ROM(rom.data(), 1, ROM_PAGE),
+            new Disk(File(path, true), 8, ROM_PAGE + 1));
+}
+
+TEST(bios, boots_kernel_from_disk) {
+    const std::string path = disk_path("bios_test_boot.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = create_machine(path);
+
+    // kernel at physical address 0x1000
+    // mov x0, #42
+    // hlt
+    std::vector<byte> kernel(PAGE_SIZE);
+    const word program[] = {
+        Emulator32bit::asm_format_o3(Emulator32bit::_op_mov, false, 0, 42),
+        Emulator32bit::asm_hlt(),
+    };
+    memcpy(kernel.data(), program, sizeof(program));
+
+    BootHeader header;
+    header.entry = PAGE_SIZE;
+    header.nsegments = 1;
+    header.segments[0] = {PAGE_SIZE, 1, sizeof(program)};
+    std::vector<byte> header_page(PAGE_SIZE);
+    memcpy(header_page.data(), &header, sizeof(header));
+
+    cpu->disk->write_page(AEMU_BOOT_DISK_PAGE, header_page);
+    cpu->disk->write_page(1, kernel);
+
+    cpu->power_on();
+    EXPECT_EQ(cpu->get_pc(), ROM_PAGE << PAGE_PSIZE) << "should start executing at the start of ROM";
+
+    cpu->run(0);
+
+    EXPECT_EQ(cpu->read_reg(0), 42) << "kernel loaded by the BIOS should have run";
+    EXPECT_EQ(cpu->system_bus.read_word(PAGE_SIZE), program[0]) << "kernel should be copied into RAM";
+    EXPECT_EQ(cpu->get_pc(), PAGE_SIZE + 4) << "should halt at the end of the kernel";
+    delete cpu;
+    remove_disk(path);
+}
+
+TEST(bios, no_operating_system) {
+    const std::string path = disk_path("bios_test_empty.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = create_machine(path);
+
+    cpu->power_on();
+    cpu->run(0);
+
+    EXPECT_GT(cpu->get_pc(), ROM_PAGE << PAGE_PSIZE) << "should halt inside the BIOS";
+    EXPECT_LT(cpu->get_pc(), (ROM_PAGE + 1) << PAGE_PSIZE) << "should halt inside the BIOS";
+    delete cpu;
+    remove_disk(path);
+}
+
+TEST(bios, segment_past_end_of_disk) {
+    const std::string path = disk_path("bios_test_bad_segment.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = create_machine(path);
+
+    BootHeader header;
+    header.entry = PAGE_SIZE;
+    header.nsegments = 1;
+    header.segments[0] = {PAGE_SIZE, 7, 0xFFFFFFFF};
+    std::vector<byte> header_page(PAGE_SIZE);
+    memcpy(header_page.data(), &header, sizeof(header));
+    cpu->disk->write_page(AEMU_BOOT_DISK_PAGE, header_page);
+
+    cpu->power_on();
+    cpu->run(0);
+
+    EXPECT_GT(cpu->get_pc(), ROM_PAGE << PAGE_PSIZE) << "should halt inside the BIOS";
+    EXPECT_LT(cpu->get_pc(), (ROM_PAGE + 1) << PAGE_PSIZE) << "should halt inside the BIOS";
+    delete cpu;
+    remove_disk(path);
+}
@@ -0,0 +1,145 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/block_device.h>
+
+#define DEVICE_PAGE 8
+#define DEVICE_ADDR (DEVICE_PAGE << PAGE_PSIZE)
+#define QUEUE_ADDR 0x100
+#define BLK_IRQ 3
+
+static void write_request(Emulator32bit *cpu, word index, word type, word disk_page, word paddr, word npages) {
+    word desc = QUEUE_ADDR + index * sizeof(BlockRequest);
+    cpu->system_bus.write_word(desc, type);
+    cpu->system_bus.write_word(desc + 4, disk_page);
+    cpu->system_bus.write_word(desc + 8, paddr);
+    cpu->system_bus.write_word(desc + 12, npages);
+    cpu->system_bus.write_word(desc + 16, 0xFFFFFFFF);
+}
+
+static word request_status(Emulator32bit *cpu, word index) {
+    return cpu->system_bus.read_word(QUEUE_ADDR + index * sizeof(BlockRequest) + 16);
+}
+
+TEST(block_device, registers) {
+    const std::string path = disk_path("block_device_test_regs.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = new Emulator32bit(4, 0, {}, 0, 0);
+    Disk *disk = new Disk(File(path, true), 8, 0);
+    BlockDevice device(cpu->system_bus, *disk, BLK_IRQ);
+    cpu->system_bus.register_device(DEVICE_PAGE, DEVICE_PAGE, device);
+
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_MAGIC), AEMU_BLK_MAGIC) << "magic should identify the device";
+    EXPECT_EQ(cpu->system_bus.read_byte(DEVICE_ADDR + AEMU_BLK_REG_MAGIC + 1), 'E') << "byte reads should come from the register";
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_CAPACITY), 8) << "capacity should be the number of disk pages";
+
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_QUEUE_ADDR, QUEUE_ADDR);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_QUEUE_SIZE, 4);
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_QUEUE_ADDR), QUEUE_ADDR) << "queue address should be stored";
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_QUEUE_SIZE), 4) << "queue size should be stored";
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_USED), 0) << "no requests should be used yet";
+
+    delete cpu;
+    delete disk;
+    remove_disk(path);
+}
+
+TEST(block_device, write_then_read_batch) {
+    const std::string path = disk_path("block_device_test_batch.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = new Emulator32bit(4, 0, {}, 0, 0);
+    Disk *disk = new Disk(File(path, true), 8, 0);
+    BlockDevice device(cpu->system_bus, *disk, BLK_IRQ);
+    cpu->system_bus.register_device(DEVICE_PAGE, DEVICE_PAGE, device);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_QUEUE_ADDR, QUEUE_ADDR);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_QUEUE_SIZE, 2);
+
+    // write two pages from RAM page 1 to disk page 5
+    cpu->system_bus.write_word(PAGE_SIZE, 0x12345678);
+    cpu->system_bus.write_word(2 * PAGE_SIZE + 8, 0xCAFEBABE);
+    write_request(cpu, 0, AEMU_BLK_T_WRITE, 5, PAGE_SIZE, 2);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_DOORBELL, 1);
+
+    EXPECT_EQ(request_status(cpu, 0), AEMU_BLK_S_OK) << "write should succeed";
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_USED), 1) << "write should be used";
+    EXPECT_EQ(disk->read_page(6)[8], 0xBE) << "second page should be written to disk";
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_ISR), AEMU_BLK_ISR_USED) << "completion should set the ISR";
+    EXPECT_EQ(cpu->system_bus.get_pending_irqs(), 1U << BLK_IRQ) << "completion should raise the interrupt line";
+
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_ISR, AEMU_BLK_ISR_USED);
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_ISR), 0) << "ISR should be acknowledged";
+    EXPECT_EQ(cpu->system_bus.get_pending_irqs(), 0) << "acknowledging should clear the interrupt line";
+
+    // ring wraps around, read the pages back into RAM page 3 and submit a bad request in one batch
+    write_request(cpu, 1, AEMU_BLK_T_READ, 6, 3 * PAGE_SIZE, 1);
+    write_request(cpu, 0, AEMU_BLK_T_READ, 7, 3 * PAGE_SIZE, 2);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_DOORBELL, 3);
+
+    EXPECT_EQ(request_status(cpu, 1), AEMU_BLK_S_OK) << "read should succeed";
+    EXPECT_EQ(cpu->system_bus.read_word(3 * PAGE_SIZE + 8), 0xCAFEBABE) << "disk page should be read into RAM";
+    EXPECT_EQ(request_status(cpu, 0), AEMU_BLK_S_IOERR) << "read past the end of the disk should fail";
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_USED), 3) << "both requests should be used";
+    EXPECT_EQ(cpu->system_bus.get_pending_irqs(), 1U << BLK_IRQ) << "batch should raise the interrupt line";
+
+    delete cpu;
+    delete disk;
+    remove_disk(path);
+}
+
+TEST(block_device, rejects_bad_descriptors) {
+    const std::string path = disk_path("block_device_test_bad.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = new Emulator32bit(4, 0, {}, 0, 0);
+    Disk *disk = new Disk(File(path, true), 8, 0);
+    BlockDevice device(cpu->system_bus, *disk, BLK_IRQ);
+    cpu->system_bus.register_device(DEVICE_PAGE, DEVICE_PAGE, device);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_QUEUE_ADDR, QUEUE_ADDR);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_QUEUE_SIZE, 4);
+
+    write_request(cpu, 0, AEMU_BLK_T_READ, 0, PAGE_SIZE, 0);
+    write_request(cpu, 1, AEMU_BLK_T_READ, 1, PAGE_SIZE, 0xFFFFFFFF);
+    write_request(cpu, 2, AEMU_BLK_T_WRITE, 0xFFFFFFFF, PAGE_SIZE, 2);
+    write_request(cpu, 3, AEMU_BLK_T_READ, 0, 0xFFFFF000, 2);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_DOORBELL, 4);
+
+    EXPECT_EQ(request_status(cpu, 0), AEMU_BLK_S_IOERR) << "empty request should fail";
+    EXPECT_EQ(request_status(cpu, 1), AEMU_BLK_S_IOERR) << "huge request should fail without allocating";
+    EXPECT_EQ(request_status(cpu, 2), AEMU_BLK_S_IOERR) << "disk range wrapping around should fail";
+    EXPECT_EQ(request_status(cpu, 3), AEMU_BLK_S_IOERR) << "guest buffer past the address space should fail";
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_USED), 4) << "failed requests should still be used";
+
+    // doorbell more than a ring ahead of the used index
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_ISR, AEMU_BLK_ISR_USED);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_DOORBELL, 4 + 5);
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_USED), 4) << "no descriptor should be processed";
+    EXPECT_EQ(cpu->system_bus.read_word(DEVICE_ADDR + AEMU_BLK_REG_ISR), AEMU_BLK_ISR_ERROR) << "device error should be reported";
+    EXPECT_EQ(cpu->system_bus.get_pending_irqs(), 1U << BLK_IRQ) << "device error should raise the interrupt line";
+
+    delete cpu;
+    delete disk;
+    remove_disk(path);
+}
+
+TEST(block_device, faulting_write_leaves_disk) {
+    const std::string path = disk_path("block_device_test_fault.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = new Emulator32bit(4, 0, {}, 0, 0);
+    Disk *disk = new Disk(File(path, true), 8, 0);
+    BlockDevice device(cpu->system_bus, *disk, BLK_IRQ);
+    cpu->system_bus.register_device(DEVICE_PAGE, DEVICE_PAGE, device);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_QUEUE_ADDR, QUEUE_ADDR);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_QUEUE_SIZE, 1);
+    disk->write_page(2, std::vector<byte>(PAGE_SIZE, 0xAA));
+    disk->write_page(3, std::vector<byte>(PAGE_SIZE, 0xBB));
+
+    // second page of the buffer is past the end of RAM
+    write_request(cpu, 0, AEMU_BLK_T_WRITE, 2, 3 * PAGE_SIZE, 2);
+    cpu->system_bus.write_word(DEVICE_ADDR + AEMU_BLK_REG_DOORBELL, 1);
+
+    EXPECT_EQ(request_status(cpu, 0), AEMU_BLK_S_IOERR) << "write from an unmapped buffer should fail";
+    EXPECT_EQ(cpu->system_bus.has_fault(), false) << "the device should not leave a fault for the CPU";
+    EXPECT_EQ(disk->read_page(2)[0], 0xAA) << "failed write should not reach the disk";
+    EXPECT_EQ(disk->read_page(3)[0], 0xBB) << "failed write should not reach the disk";
+
+    delete cpu;
+    delete disk;
+    remove_disk(path);
+}
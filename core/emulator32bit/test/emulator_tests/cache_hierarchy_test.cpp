@@ -0,0 +1,110 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/cache_hierarchy.h>
+
+static CacheHierarchy::Config small_config(bool threaded) {
+    CacheHierarchy::Config config;
+    config.l1i = {1024, 2, 32, CacheHierarchy::Replacement::LRU};
+    config.l1d = {2048, 4, 32, CacheHierarchy::Replacement::LRU};
+    config.l2 = {8192, 8, 64, CacheHierarchy::Replacement::LRU};
+    config.threaded = threaded;
+    return config;
+}
+
+TEST(cache_hierarchy, rejects_bad_geometry) {
+    CacheHierarchy::Config config = small_config(false);
+    config.l1d.size = 3 * 1024;
+    EXPECT_THROW(CacheHierarchy caches(config), CacheHierarchy::Exception) << "3 sets";
+
+    config = small_config(false);
+    config.l1i.line_size = 24;
+    EXPECT_THROW(CacheHierarchy caches(config), CacheHierarchy::Exception);
+
+    config = small_config(false);
+    config.l1i.size = 0;
+    EXPECT_THROW(CacheHierarchy caches(config), CacheHierarchy::Exception) << "no L1I";
+}
+
+TEST(cache_hierarchy, replacement_policies) {
+    /* One set of two ways. A B A C A evicts B under LRU but A under FIFO. */
+    const word order[] = {0, 64, 0, 128, 0};
+    const unsigned long long expected_misses[] = {3, 4};
+    const CacheHierarchy::Replacement policies[] = {CacheHierarchy::Replacement::LRU,
+            CacheHierarchy::Replacement::FIFO};
+
+    for (int i = 0; i < 2; i++) {
+        CacheHierarchy::Config config = small_config(false);
+        config.l1d = {64, 2, 32, policies[i]};
+        config.l2.size = 0;
+        CacheHierarchy caches(config);
+        for (word address : order) {
+            caches.record(0, address, CacheHierarchy::READ, 4);
+        }
+        EXPECT_EQ(caches.get_stats(CacheHierarchy::L1D).accesses, 5);
+        EXPECT_EQ(caches.get_stats(CacheHierarchy::L1D).misses, expected_misses[i]);
+        EXPECT_EQ(caches.get_stats(CacheHierarchy::L2).accesses, 0) << "no L2";
+    }
+}
+
+TEST(cache_hierarchy, access_spanning_lines) {
+    CacheHierarchy caches(small_config(false));
+    caches.record(0, 30, CacheHierarchy::WRITE, 4);
+    caches.record(0, 0xFFFFFFFE, CacheHierarchy::READ, 4);
+    EXPECT_EQ(caches.get_stats(CacheHierarchy::L1D).accesses, 4);
+    EXPECT_EQ(caches.get_stats(CacheHierarchy::L1D).misses, 3) << "wraps around to the first line";
+    EXPECT_EQ(caches.get_stats(CacheHierarchy::L2).accesses, 3);
+    EXPECT_EQ(caches.get_stats(CacheHierarchy::L2).misses, 2) << "first two lines share an L2 line";
+}
+
+TEST(cache_hierarchy, guest_accesses_per_symbol) {
+    for (bool threaded : {false, true}) {
+        Emulator32bit *cpu = new Emulator32bit(2, 0, {}, 0, 2);
+        CacheHierarchy caches(small_config(threaded));
+        caches.add_symbol("sum", 0, 12);
+        caches.add_symbol("end", 12, 16);
+        cpu->set_cache_hierarchy(&caches);
+
+        // ldr x2, [x1], #4
+        // cmp x1, x3
+        // b.lt -2
+        // hlt
+        cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 2, 1, 4, Emulator32bit::ADDR_POST_INC));
+        cpu->system_bus.write_word(4, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 1, 3, Emulator32bit::SHIFT_LSL, 0));
+        cpu->system_bus.write_word(8, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::LT, -2));
+        cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+        cpu->set_pc(0);
+        cpu->write_reg(1, PAGE_SIZE);
+        cpu->write_reg(3, PAGE_SIZE + 1024);
+
+        EXPECT_EQ(cpu->run(0).type, Emulator32bit::StopReason::HALT);
+
+        CacheHierarchy::Stats l1i = caches.get_stats(CacheHierarchy::L1I);
+        CacheHierarchy::Stats l1d = caches.get_stats(CacheHierarchy::L1D);
+        CacheHierarchy::Stats l2 = caches.get_stats(CacheHierarchy::L2);
+        EXPECT_EQ(l1i.accesses, 3 * 256 + 1) << "fused instructions are fetched too";
+        EXPECT_EQ(l1i.misses, 1);
+        EXPECT_EQ(l1d.accesses, 256);
+        EXPECT_EQ(l1d.misses, 1024 / 32) << "one miss per line of the array";
+        EXPECT_EQ(l2.accesses, 1 + 1024 / 32);
+        EXPECT_EQ(l2.misses, 1 + 1024 / 64);
+
+        std::vector<CacheHierarchy::SymbolStats> symbols = caches.get_symbol_stats();
+        ASSERT_EQ(symbols.size(), 2);
+        EXPECT_EQ(symbols[0].name, "sum");
+        EXPECT_EQ(symbols[0].levels[CacheHierarchy::L1D].misses, 1024 / 32);
+        EXPECT_EQ(symbols[0].levels[CacheHierarchy::L1I].misses, 1);
+        EXPECT_EQ(symbols[1].levels[CacheHierarchy::L1I].accesses, 1);
+        EXPECT_EQ(symbols[1].levels[CacheHierarchy::L1I].misses, 0);
+        EXPECT_EQ(caches.report().find("sum") != std::string::npos, true);
+
+        /* Nothing is recorded once it is unset. */
+        cpu->set_cache_hierarchy(nullptr);
+        cpu->set_pc(0);
+        cpu->write_reg(1, PAGE_SIZE);
+        EXPECT_EQ(cpu->run(0).type, Emulator32bit::StopReason::HALT);
+        EXPECT_EQ(caches.get_stats(CacheHierarchy::L1D).accesses, 256);
+
+        caches.clear();
+        EXPECT_EQ(caches.get_stats(CacheHierarchy::L1I).accesses, 0);
+        delete cpu;
+    }
+}
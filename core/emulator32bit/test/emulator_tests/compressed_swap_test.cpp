@@ -0,0 +1,133 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/compressed_swap.h>
+
+#include <cstring>
+
+#define DISK_PAGES 64
+
+/* Mostly a repeated word with a few others mixed in, like a sparse table. */
+static std::vector<byte> sparse_page(word seed) {
+    std::vector<byte> page(PAGE_SIZE);
+    for (word i = 0; i < PAGE_SIZE; i += 4) {
+        word val = (i % 256 == 0) ? i * seed : seed;
+        memcpy(page.data() + i, &val, sizeof(val));
+    }
+    return page;
+}
+
+TEST(compressed_swap, codec_round_trip) {
+    std::vector<std::vector<byte>> inputs = {sparse_page(3), std::vector<byte>(PAGE_SIZE, 0x5A), {}};
+    std::string text;
+    while (text.size() < PAGE_SIZE) {
+        text += "the quick brown fox jumps over the lazy dog " + std::to_string(text.size()) + "\n";
+    }
+    inputs.push_back(std::vector<byte>(text.begin(), text.begin() + PAGE_SIZE));
+    inputs.push_back(std::vector<byte>(text.begin(), text.begin() + 7));
+
+    for (const std::vector<byte>& input : inputs) {
+        std::vector<byte> compressed(PAGE_SIZE + 64);
+        word size = CompressedSwap::compress(input.data(), input.size(), compressed.data(), compressed.size());
+        ASSERT_EQ(size > 0, true);
+        if (input.size() == PAGE_SIZE) {
+            EXPECT_EQ(size < PAGE_SIZE / 2, true) << "should compress";
+        }
+
+        std::vector<byte> output(input.size());
+        EXPECT_EQ(CompressedSwap::decompress(compressed.data(), size, output.data(), output.size()), true);
+        EXPECT_EQ(output, input);
+        EXPECT_EQ(CompressedSwap::decompress(compressed.data(), size, output.data(), output.size() + 1), false)
+                << "wrong size";
+    }
+
+    /* xorshift32 noise does not compress. */
+    std::vector<byte> noise(PAGE_SIZE);
+    word x = 1;
+    for (byte& b : noise) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        b = (byte) x;
+    }
+    byte compressed[AEMU_SWAP_MAX_COMPRESSED];
+    EXPECT_EQ(CompressedSwap::compress(noise.data(), PAGE_SIZE, compressed, sizeof(compressed)), 0);
+}
+
+TEST(compressed_swap, pool_spills_oldest_to_disk) {
+    const std::string path = disk_path("compressed_swap_test_pool.bin");
+    remove_disk(path);
+    Disk disk(File(path, true), DISK_PAGES, 0);
+
+    std::vector<byte> page = sparse_page(7);
+    byte compressed[AEMU_SWAP_MAX_COMPRESSED];
+    word size = CompressedSwap::compress(page.data(), PAGE_SIZE, compressed, sizeof(compressed));
+    CompressedSwap swap(disk, 2 * size);
+
+    std::vector<byte> zero(PAGE_SIZE, 0);
+    EXPECT_EQ(swap.store(1, zero.data()), 0);
+    EXPECT_EQ(swap.get_stats().zero_pages, 1);
+    EXPECT_EQ(swap.get_stats().compressed_bytes, 0) << "zero pages take no pool space";
+
+    EXPECT_EQ(swap.store(2, sparse_page(7).data()), 0);
+    EXPECT_EQ(swap.store(3, sparse_page(7).data()), 0);
+    EXPECT_EQ(swap.store(4, sparse_page(7).data()), 1) << "pool is full, the oldest page spills";
+    EXPECT_EQ(swap.contains(2), false);
+    EXPECT_EQ(swap.get_stats().spilled_pages, 1);
+    EXPECT_EQ(swap.get_stats().stored_pages, 3);
+    EXPECT_EQ(disk.read_page(2), page) << "spilled page is on its disk page";
+
+    std::vector<byte> loaded(PAGE_SIZE);
+    EXPECT_EQ(swap.load(2, loaded.data()), false);
+    EXPECT_EQ(swap.load(3, loaded.data()), true);
+    EXPECT_EQ(loaded, page);
+    EXPECT_EQ(swap.contains(3), false) << "faulting in takes it out of the pool";
+    memset(loaded.data(), 0xFF, PAGE_SIZE);
+    EXPECT_EQ(swap.load(1, loaded.data()), true);
+    EXPECT_EQ(loaded, zero);
+
+    swap.discard(4);
+    EXPECT_EQ(swap.get_stats().stored_pages, 0);
+    EXPECT_EQ(swap.get_stats().compressed_bytes, 0);
+    remove_disk(path);
+}
+
+TEST(compressed_swap, oversubscribed_guest_pages) {
+    const std::string path = disk_path("compressed_swap_test_guest.bin");
+    remove_disk(path);
+    Disk *disk = new Disk(File(path, true), DISK_PAGES, 0);
+    Emulator32bit *cpu = disk_emulator(disk, 4);
+    CompressedSwap swap(*disk, 16 * PAGE_SIZE);
+    cpu->mmu->set_compressed_swap(&swap);
+
+    /* Twice as many pages as frames, every other one all zeroes. */
+    const word VPAGE = 16;
+    const word NPAGES = 8;
+    long long pid = cpu->mmu->begin_process();
+    cpu->mmu->add_vpage(pid, VPAGE, NPAGES, true, false);
+    for (word i = 0; i < NPAGES; i++) {
+        std::vector<byte> page = (i % 2 == 0) ? sparse_page(i + 1) : std::vector<byte>(PAGE_SIZE, 0);
+        for (word offset = 0; offset < PAGE_SIZE; offset += 4) {
+            word val;
+            memcpy(&val, page.data() + offset, sizeof(val));
+            cpu->system_bus.write_word((VPAGE + i) * PAGE_SIZE + offset, val);
+        }
+    }
+    EXPECT_EQ(swap.get_stats().stored_pages, NPAGES - 4) << "evicted pages should be in the pool";
+    EXPECT_EQ(swap.get_stats().zero_pages, 2);
+
+    for (word i = 0; i < NPAGES; i++) {
+        std::vector<byte> page = (i % 2 == 0) ? sparse_page(i + 1) : std::vector<byte>(PAGE_SIZE, 0);
+        for (word offset = 0; offset < PAGE_SIZE; offset += 4) {
+            word val;
+            memcpy(&val, page.data() + offset, sizeof(val));
+            ASSERT_EQ(cpu->system_bus.read_word((VPAGE + i) * PAGE_SIZE + offset), val) << "page " << i;
+        }
+    }
+    EXPECT_EQ(swap.get_stats().pool_hits >= 4, true);
+    EXPECT_EQ(swap.get_stats().spilled_pages, 0);
+    EXPECT_EQ(swap.get_stats().incompressible_pages, 0);
+
+    cpu->mmu->end_process(pid);
+    EXPECT_EQ(swap.get_stats().stored_pages, 0) << "removed pages leave the pool";
+    delete cpu;
+    remove_disk(path);
+}
@@ -0,0 +1,97 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/coverage.h>
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/shm.h>
+#endif
+
+/* Writes a call to a loop adding 1 to x0 until it reaches x1, then a hlt. */
+static void write_call_loop(Emulator32bit *cpu) {
+    // bl +3
+    // hlt
+    // nop
+    // add x0, x0, #1
+    // cmp x0, x1
+    // b.lt -2
+    // bx lr
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_b1(Emulator32bit::_op_bl, Emulator32bit::ConditionCode::AL, 3));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_hlt());
+    cpu->system_bus.write_word(8, Emulator32bit::asm_nop());
+    cpu->system_bus.write_word(12, Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 0, 0, 1));
+    cpu->system_bus.write_word(16, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 0, 1, Emulator32bit::SHIFT_LSL, 0));
+    cpu->system_bus.write_word(20, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::LT, -2));
+    cpu->system_bus.write_word(24, Emulator32bit::asm_format_b2(Emulator32bit::_op_bx, Emulator32bit::ConditionCode::AL, LINKR));
+    cpu->set_pc(0);
+    cpu->write_reg(0, 0);
+    cpu->write_reg(1, 5);
+}
+
+TEST(coverage, records_taken_branches) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    Coverage coverage;
+    cpu->set_coverage(&coverage);
+    write_call_loop(cpu);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(reason.fused_groups, 0) << "fusion should be suspended while coverage is on";
+    EXPECT_EQ(coverage.count_edges(), 3) << "call, loop back edge and return";
+    byte *map = coverage.get_map();
+    EXPECT_EQ(*std::max_element(map, map + AEMU_COVERAGE_MAP_SIZE), 4) << "loop back edge is taken 4 times";
+
+    coverage.clear();
+    cpu->set_coverage(nullptr);
+    write_call_loop(cpu);
+    reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(coverage.count_edges(), 0) << "nothing should be recorded once off";
+    EXPECT_EQ(reason.fused_groups > 0, true) << "fusion should be back on";
+    delete cpu;
+}
+
+TEST(coverage, counts_never_wrap_to_zero) {
+    Coverage coverage;
+    for (int i = 0; i < 256; i++) {
+        coverage.edge(0, 4);
+    }
+    EXPECT_EQ(coverage.count_edges(), 1);
+    byte *map = coverage.get_map();
+    EXPECT_EQ(*std::max_element(map, map + AEMU_COVERAGE_MAP_SIZE), 1);
+}
+
+TEST(coverage, afl_shared_memory) {
+#if defined(__unix__) || defined(__APPLE__)
+    /* Stands in for afl-fuzz: create the map, pass its id, run the target, read the map. */
+    int id = shmget(IPC_PRIVATE, AEMU_COVERAGE_MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+    ASSERT_EQ(id >= 0, true);
+    byte *fuzzer_map = (byte*) shmat(id, nullptr, 0);
+    setenv(AEMU_AFL_SHM_ENV, std::to_string(id).c_str(), 1);
+
+    std::unique_ptr<Coverage> coverage = Coverage::from_afl();
+    ASSERT_EQ(coverage != nullptr, true);
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    cpu->set_coverage(coverage.get());
+
+    for (word input : {1, 5}) {
+        memset(fuzzer_map, 0, AEMU_COVERAGE_MAP_SIZE);
+        cpu->reset();
+        write_call_loop(cpu);
+        cpu->write_reg(1, input);
+        EXPECT_EQ(cpu->run(0).type, Emulator32bit::StopReason::HALT);
+        EXPECT_EQ(*std::max_element(fuzzer_map, fuzzer_map + AEMU_COVERAGE_MAP_SIZE), input == 1 ? 1 : 4)
+                << "fuzzer should see the counts of the run";
+    }
+
+    delete cpu;
+    coverage.reset();
+    unsetenv(AEMU_AFL_SHM_ENV);
+    shmdt(fuzzer_map);
+    shmctl(id, IPC_RMID, nullptr);
+#else
+    GTEST_SKIP() << "shared memory is not supported on this host";
+#endif
+}
@@ -0,0 +1,168 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/debugger.h>
+#include <emulator32bit/gdb_stub.h>
+
+/* Writes a loop adding 1 to x0 until it reaches x1, followed by a hlt. */
+static void write_count_loop(Emulator32bit *cpu) {
+    // add x0, x0, #1
+    // cmp x0, x1
+    // b.lt -2
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 0, 0, 1));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 0, 1, Emulator32bit::SHIFT_LSL, 0));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::LT, -2));
+    cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(0, 0);
+    cpu->write_reg(1, 5);
+}
+
+TEST(debugger, breakpoint_stops_each_iteration) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    Debugger *debugger = new Debugger(cpu);
+    write_count_loop(cpu);
+    word add = cpu->system_bus.read_word(0);
+
+    EXPECT_EQ(debugger->insert_breakpoint(0), true);
+    byte code[4];
+    EXPECT_EQ(debugger->read_memory(0, code, 4), true);
+    EXPECT_EQ(code[0] | (code[1] << 8) | (code[2] << 16) | (code[3] << 24), add) << "should read the replaced instruction";
+
+    /* Resuming at a breakpoint runs its instruction instead of stopping again. */
+    for (word i = 1; i < 5; i++) {
+        Emulator32bit::StopReason reason = debugger->resume(0);
+        EXPECT_EQ(reason.type, Emulator32bit::StopReason::BREAKPOINT);
+        EXPECT_EQ(reason.pc, 0);
+        EXPECT_EQ(cpu->read_reg(0), i) << "should stop before the instruction runs";
+    }
+
+    EXPECT_EQ(debugger->remove_breakpoint(0), true);
+    EXPECT_EQ(cpu->system_bus.read_word(0), add) << "removing should restore the instruction";
+    Emulator32bit::StopReason reason = debugger->resume(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(cpu->read_reg(0), 5);
+    delete debugger;
+    delete cpu;
+}
+
+TEST(debugger, step_over_breakpoint) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    Debugger *debugger = new Debugger(cpu);
+    write_count_loop(cpu);
+    EXPECT_EQ(debugger->insert_breakpoint(0), true);
+
+    Emulator32bit::StopReason reason = debugger->step();
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::BUDGET_EXHAUSTED);
+    EXPECT_EQ(cpu->get_pc(), 4);
+    EXPECT_EQ(cpu->read_reg(0), 1);
+    EXPECT_EQ(debugger->has_breakpoint(0), true) << "breakpoint should be put back";
+    EXPECT_EQ(cpu->system_bus.read_word(0), Emulator32bit::asm_brk());
+    delete debugger;
+    delete cpu;
+}
+
+TEST(debugger, breakpoints_need_writable_memory) {
+    std::vector<byte> rom(PAGE_SIZE, 0);
+    Emulator32bit *cpu = new Emulator32bit(1, 0, rom.data(), 1, 1);
+    Debugger *debugger = new Debugger(cpu);
+
+    EXPECT_EQ(debugger->insert_breakpoint(PAGE_SIZE), false) << "ROM cannot be patched";
+    EXPECT_EQ(debugger->insert_breakpoint(8 * PAGE_SIZE), false) << "no memory there";
+    EXPECT_EQ(debugger->insert_breakpoint(2), false) << "not word aligned";
+    delete debugger;
+    delete cpu;
+}
+
+TEST(debugger, write_watchpoint) {
+    for (bool fastmem : {false, true}) {
+        Emulator32bit *cpu = new Emulator32bit(2, 0, {}, 0, 2);
+        if (fastmem && !cpu->system_bus.enable_fastmem()) {
+            delete cpu;
+            continue;
+        }
+        Debugger *debugger = new Debugger(cpu);
+        // str x0, [x1], #4
+        // b -1
+        cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_str, false, 0, 1, 4, Emulator32bit::ADDR_POST_INC));
+        cpu->system_bus.write_word(4, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::AL, -1));
+        cpu->set_pc(0);
+        cpu->write_reg(0, 7);
+        cpu->write_reg(1, PAGE_SIZE);
+
+        EXPECT_EQ(debugger->insert_watchpoint(PAGE_SIZE + 40, 4, AEMU_WATCH_WRITE), true);
+        Emulator32bit::StopReason reason = debugger->resume(0);
+
+        EXPECT_EQ(reason.type, Emulator32bit::StopReason::WATCHPOINT);
+        EXPECT_EQ(reason.code, PAGE_SIZE + 40);
+        EXPECT_EQ(reason.pc, 4) << "should stop after the store";
+        EXPECT_EQ(reason.instructions, 21);
+        EXPECT_EQ(cpu->system_bus.read_word(PAGE_SIZE + 40), 7) << "store should complete";
+        EXPECT_EQ(debugger->get_watch_address(), PAGE_SIZE + 40);
+        EXPECT_EQ(debugger->get_watch_access(), AEMU_WATCH_WRITE);
+
+        EXPECT_EQ(debugger->remove_watchpoint(PAGE_SIZE + 40, 4, AEMU_WATCH_WRITE), true);
+        reason = debugger->resume(100);
+        EXPECT_EQ(reason.type, Emulator32bit::StopReason::BUDGET_EXHAUSTED) << "should not stop once removed";
+        delete debugger;
+        delete cpu;
+    }
+}
+
+TEST(debugger, read_watchpoint_ignores_writes) {
+    Emulator32bit *cpu = new Emulator32bit(2, 0, {}, 0, 2);
+    Debugger *debugger = new Debugger(cpu);
+    // str x0, [x1]
+    // ldr x2, [x1, #4]
+    // ldr x3, [x1, #8]
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_str, false, 0, 1, 8, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 2, 1, 4, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 3, 1, 8, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(0, 9);
+    cpu->write_reg(1, PAGE_SIZE);
+
+    EXPECT_EQ(debugger->insert_watchpoint(PAGE_SIZE + 8, 4, AEMU_WATCH_READ), true);
+    Emulator32bit::StopReason reason = debugger->resume(0);
+
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::WATCHPOINT);
+    EXPECT_EQ(reason.pc, 12) << "only the load of the watched word should stop";
+    EXPECT_EQ(cpu->read_reg(3), 9);
+    delete debugger;
+    delete cpu;
+}
+
+TEST(debugger, gdb_packets) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    Debugger *debugger = new Debugger(cpu);
+    GdbStub stub(*debugger);
+    write_count_loop(cpu);
+
+    EXPECT_EQ(stub.handle_packet("?"), "S05");
+    EXPECT_EQ(stub.handle_packet("Z0,8,4"), "OK");
+    EXPECT_EQ(stub.handle_packet("c"), "T05swbreak:;");
+    EXPECT_EQ(stub.handle_packet("p20"), "08000000") << "pc should be at the breakpoint";
+    EXPECT_EQ(stub.handle_packet("p0"), "01000000");
+    EXPECT_EQ(stub.handle_packet("g").size(), (NUM_REG + 2) * 8);
+
+    EXPECT_EQ(stub.handle_packet("P1=02000000"), "OK");
+    EXPECT_EQ(stub.handle_packet("z0,8,4"), "OK");
+    EXPECT_EQ(stub.handle_packet("c"), "W00");
+    EXPECT_EQ(cpu->read_reg(0), 2);
+
+    EXPECT_EQ(stub.handle_packet("M100,4:efbeadde"), "OK");
+    EXPECT_EQ(cpu->system_bus.read_word(0x100), 0xDEADBEEF);
+    EXPECT_EQ(stub.handle_packet("m100,2"), "efbe");
+    EXPECT_EQ(stub.handle_packet("m10000,4"), "E01") << "no memory there";
+
+    std::string xml = stub.handle_packet("qXfer:features:read:target.xml:0,1000");
+    EXPECT_EQ(xml.rfind("l<?xml", 0), 0);
+    EXPECT_EQ(xml.find("name=\"pc\"") != std::string::npos, true);
+    EXPECT_EQ(stub.handle_packet("vMustReplyEmpty"), "");
+
+    EXPECT_EQ(stub.handle_packet("D"), "OK");
+    EXPECT_EQ(stub.is_done(), true);
+    delete debugger;
+    delete cpu;
+}
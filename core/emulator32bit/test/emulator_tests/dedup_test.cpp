@@ -0,0 +1,141 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/page_dedup.h>
+
+#define DISK_PAGES 64
+#define VPAGE 16
+
+/* Fills a virtual page of the current process, seed 0 for all zeroes. */
+static void fill_page(Emulator32bit *cpu, word vpage, word seed) {
+    for (word offset = 0; offset < PAGE_SIZE; offset += 4) {
+        cpu->system_bus.write_word(vpage * PAGE_SIZE + offset, seed * (offset + 1));
+    }
+}
+
+static bool page_is(Emulator32bit *cpu, word vpage, word seed) {
+    for (word offset = 0; offset < PAGE_SIZE; offset += 4) {
+        if (cpu->system_bus.read_word(vpage * PAGE_SIZE + offset) != seed * (offset + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST(dedup, merges_identical_pages_across_processes) {
+    const std::string path = disk_path("dedup_test_merge.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = disk_emulator(new Disk(File(path, true), DISK_PAGES, 0), 8);
+    PageDeduplicator dedup(cpu->system_bus);
+
+    long long pid1 = cpu->mmu->begin_process();
+    cpu->mmu->add_vpage(pid1, VPAGE, 3, true, false);
+    fill_page(cpu, VPAGE, 5);
+    fill_page(cpu, VPAGE + 1, 9);
+    fill_page(cpu, VPAGE + 2, 0);
+    long long pid2 = cpu->mmu->begin_process();
+    cpu->mmu->add_vpage(pid2, VPAGE, 2, true, false);
+    fill_page(cpu, VPAGE, 5);
+    fill_page(cpu, VPAGE + 1, 0);
+
+    EXPECT_EQ(dedup.scan(5), 0) << "pages are only merged once unchanged for a pass";
+    EXPECT_EQ(dedup.scan(5), 2);
+    EXPECT_EQ(cpu->mmu->get_dedup_stats().pages_shared, 2);
+    EXPECT_EQ(cpu->mmu->get_dedup_stats().pages_sharing, 2);
+    EXPECT_EQ(dedup.get_saved_bytes(), 2 * PAGE_SIZE);
+    EXPECT_EQ(cpu->mmu->get_resident_ppages().size(), 3);
+    EXPECT_EQ(page_is(cpu, VPAGE, 5), true);
+    EXPECT_EQ(page_is(cpu, VPAGE + 1, 0), true);
+
+    /* Writing gives the writer its own copy. */
+    cpu->system_bus.write_word(VPAGE * PAGE_SIZE, 1234);
+    EXPECT_EQ(cpu->mmu->get_dedup_stats().cow_copies, 1);
+    EXPECT_EQ(cpu->mmu->get_dedup_stats().pages_shared, 1);
+    EXPECT_EQ(cpu->system_bus.read_word(VPAGE * PAGE_SIZE), 1234);
+    EXPECT_EQ(cpu->system_bus.read_word(VPAGE * PAGE_SIZE + 4), 5 * 5);
+    cpu->mmu->set_process(pid1);
+    EXPECT_EQ(page_is(cpu, VPAGE, 5), true) << "the other process still sees the old page";
+    EXPECT_EQ(page_is(cpu, VPAGE + 1, 9), true);
+    EXPECT_EQ(page_is(cpu, VPAGE + 2, 0), true);
+
+    cpu->mmu->end_process(pid2);
+    EXPECT_EQ(cpu->mmu->get_dedup_stats().pages_shared, 0);
+    EXPECT_EQ(page_is(cpu, VPAGE + 2, 0), true) << "ending a sharer keeps the page";
+    cpu->mmu->end_process(pid1);
+    EXPECT_EQ(cpu->mmu->get_resident_ppages().size(), 0);
+    delete cpu;
+    remove_disk(path);
+}
+
+TEST(dedup, skips_pages_written_between_passes) {
+    const std::string path = disk_path("dedup_test_volatile.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = disk_emulator(new Disk(File(path, true), DISK_PAGES, 0), 8);
+    PageDeduplicator dedup(cpu->system_bus);
+
+    long long pid = cpu->mmu->begin_process();
+    cpu->mmu->add_vpage(pid, VPAGE, 2, true, false);
+    fill_page(cpu, VPAGE, 3);
+    fill_page(cpu, VPAGE + 1, 4);
+    EXPECT_EQ(dedup.scan(2), 0);
+
+    fill_page(cpu, VPAGE + 1, 3);
+    EXPECT_EQ(dedup.scan(2), 0) << "changed since the last pass";
+    EXPECT_EQ(dedup.scan(2), 1);
+    EXPECT_EQ(dedup.get_stats().full_scans, 3);
+    EXPECT_EQ(dedup.get_stats().pages_merged, 1);
+
+    /* Both virtual pages of one process share it. */
+    cpu->system_bus.write_word((VPAGE + 1) * PAGE_SIZE, 7);
+    EXPECT_EQ(page_is(cpu, VPAGE, 3), true);
+    EXPECT_EQ(cpu->system_bus.read_word((VPAGE + 1) * PAGE_SIZE), 7);
+    EXPECT_EQ(cpu->mmu->get_dedup_stats().pages_shared, 0);
+    cpu->mmu->end_process(pid);
+    delete cpu;
+    remove_disk(path);
+}
+
+TEST(dedup, merged_pages_survive_eviction) {
+    const std::string path = disk_path("dedup_test_evict.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = disk_emulator(new Disk(File(path, true), DISK_PAGES, 0), 4);
+    PageDeduplicator dedup(cpu->system_bus);
+
+    long long pid1 = cpu->mmu->begin_process();
+    cpu->mmu->add_vpage(pid1, VPAGE, 1, true, false);
+    fill_page(cpu, VPAGE, 6);
+    long long pid2 = cpu->mmu->begin_process();
+    cpu->mmu->add_vpage(pid2, VPAGE, 1, true, false);
+    fill_page(cpu, VPAGE, 6);
+    dedup.scan(2);
+    EXPECT_EQ(dedup.scan(2), 1);
+
+    /* Push the merged page out to disk. */
+    long long pid3 = cpu->mmu->begin_process();
+    cpu->mmu->add_vpage(pid3, VPAGE, 4, true, false);
+    for (word i = 0; i < 4; i++) {
+        fill_page(cpu, VPAGE + i, 10 + i);
+    }
+    EXPECT_EQ(cpu->mmu->get_dedup_stats().pages_shared, 0);
+
+    cpu->mmu->set_process(pid1);
+    EXPECT_EQ(page_is(cpu, VPAGE, 6), true);
+    EXPECT_EQ(cpu->mmu->get_dedup_stats().pages_shared, 1) << "faulted back in still merged";
+    cpu->mmu->set_process(pid2);
+    EXPECT_EQ(page_is(cpu, VPAGE, 6), true);
+
+    fill_page(cpu, VPAGE, 8);
+    EXPECT_EQ(cpu->mmu->get_dedup_stats().cow_copies, 1);
+    cpu->mmu->set_process(pid1);
+    EXPECT_EQ(page_is(cpu, VPAGE, 6), true);
+    cpu->mmu->set_process(pid3);
+    for (word i = 0; i < 4; i++) {
+        EXPECT_EQ(page_is(cpu, VPAGE + i, 10 + i), true) << "page " << i;
+    }
+    cpu->mmu->set_process(pid2);
+    EXPECT_EQ(page_is(cpu, VPAGE, 8), true);
+
+    cpu->mmu->end_process(pid1);
+    cpu->mmu->end_process(pid2);
+    cpu->mmu->end_process(pid3);
+    delete cpu;
+    remove_disk(path);
+}
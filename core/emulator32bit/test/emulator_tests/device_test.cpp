@@ -0,0 +1,125 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/device.h>
+
+/* Device that records the last access and reads back a fixed value. */
+class TestDevice : public Device
+{
+    public:
+        word last_address = 0;
+        word last_value = 0;
+        int reads = 0;
+        int writes = 0;
+
+        byte read_byte(word address) override { reads++; last_address = address; return 0x12; }
+        hword read_hword(word address) override { reads++; last_address = address; return 0x1234; }
+        word read_word(word address) override { reads++; last_address = address; return 0x12345678; }
+        void write_byte(word address, byte value) override { writes++; last_address = address; last_value = value; }
+        void write_hword(word address, hword value) override { writes++; last_address = address; last_value = value; }
+        void write_word(word address, word value) override { writes++; last_address = address; last_value = value; }
+};
+
+/* Device that exposes its reads directly but traps writes. */
+class DirectReadDevice : public TestDevice
+{
+    public:
+        byte memory[PAGE_SIZE] = {};
+
+        byte* get_direct_read(word page) override { (void) page; return memory; }
+};
+
+TEST(device, callbacks) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    TestDevice device;
+    cpu->system_bus.register_device(4, 5, device);
+
+    EXPECT_EQ(cpu->system_bus.read_word(4 * PAGE_SIZE + 8), 0x12345678) << "read should go to the device";
+    EXPECT_EQ(device.last_address, 4 * PAGE_SIZE + 8) << "device should get the physical address";
+
+    cpu->system_bus.write_hword(5 * PAGE_SIZE + 2, 0xBEEF);
+    EXPECT_EQ(device.writes, 1) << "write should go to the device";
+    EXPECT_EQ(device.last_address, 5 * PAGE_SIZE + 2) << "device should get the physical address";
+    EXPECT_EQ(device.last_value, 0xBEEF) << "device should get the written value";
+
+    EXPECT_EQ(cpu->system_bus.get_device(4), &device) << "device should be registered at page 4";
+    EXPECT_EQ(cpu->system_bus.get_device(6), nullptr) << "device should not be registered past page 5";
+    delete cpu;
+}
+
+TEST(device, direct_memory) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    DirectReadDevice device;
+    device.memory[16] = 0xAB;
+    cpu->system_bus.register_device(4, 4, device);
+
+    EXPECT_EQ(cpu->system_bus.read_byte(4 * PAGE_SIZE + 16), 0xAB) << "read should come from direct memory";
+    EXPECT_EQ(device.reads, 0) << "direct read should not call the device";
+
+    cpu->system_bus.write_byte(4 * PAGE_SIZE + 16, 0xCD);
+    EXPECT_EQ(device.writes, 1) << "write without direct memory should call the device";
+    EXPECT_EQ(device.memory[16], 0xAB) << "trapped write should not change direct memory";
+    delete cpu;
+}
+
+TEST(device, ldr_from_device) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    TestDevice device;
+    cpu->system_bus.register_device(4, 4, device);
+
+    // ldr x0, [x1]
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 0, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->set_pc(0);
+    cpu->write_reg(1, 4 * PAGE_SIZE);
+
+    cpu->run(1);
+
+    EXPECT_EQ(cpu->read_reg(0), 0x12345678) << "ldr should read from the device";
+    delete cpu;
+}
+
+TEST(device, overlapping_registration) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    TestDevice device;
+
+    EXPECT_THROW(cpu->system_bus.register_device(0, 0, device), SystemBus::Exception) << "RAM is already at page 0";
+
+    cpu->system_bus.register_device(4, 4, device);
+    cpu->system_bus.unregister_device(4, 4);
+    EXPECT_EQ(cpu->system_bus.read_word(4 * PAGE_SIZE), 0) << "unregistered page should not route";
+    EXPECT_EQ(cpu->system_bus.has_fault(), true) << "access to an unregistered page should fault";
+    EXPECT_EQ(cpu->system_bus.get_fault_address(), 4 * PAGE_SIZE);
+    delete cpu;
+}
+
+TEST(device, destroyed_before_bus) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    TestDevice *device = new TestDevice();
+    cpu->system_bus.register_device(4, 5, *device);
+    delete device;
+
+    EXPECT_EQ(cpu->system_bus.get_device(4), nullptr) << "destroyed device should detach itself";
+    EXPECT_EQ(cpu->system_bus.get_device(5), nullptr) << "destroyed device should detach itself";
+    EXPECT_EQ(cpu->system_bus.read_word(4 * PAGE_SIZE), 0) << "detached page should not route";
+    EXPECT_EQ(cpu->system_bus.has_fault(), true) << "access to a detached page should fault";
+    delete cpu;
+}
+
+TEST(device, partially_unregistered) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    TestDevice *device = new TestDevice();
+    cpu->system_bus.register_device(4, 5, *device);
+    cpu->system_bus.unregister_device(4, 4);
+    delete device;
+
+    EXPECT_EQ(cpu->system_bus.get_device(5), nullptr) << "pages left registered should be detached too";
+    delete cpu;
+}
+
+TEST(device, bus_destroyed_first) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    TestDevice *device = new TestDevice();
+    cpu->system_bus.register_device(4, 4, *device);
+    delete cpu;
+
+    // must not reach back into the destroyed bus
+    delete device;
+}
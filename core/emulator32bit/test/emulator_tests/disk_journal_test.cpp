@@ -0,0 +1,107 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+
+#include <filesystem>
+#include <fstream>
+
+#define DISK_PAGES 64
+
+static std::vector<byte> page_of(byte val) {
+    return std::vector<byte>(PAGE_SIZE, val);
+}
+
+static Disk::JournalConfig journal(word group_commit, bool fsync, word checkpoint_bytes) {
+    Disk::JournalConfig config;
+    config.group_commit = group_commit;
+    config.fsync = fsync;
+    config.checkpoint_bytes = checkpoint_bytes;
+    return config;
+}
+
+TEST(disk_journal, recovers_committed_changes) {
+    const std::string path = disk_path("disk_journal_test_recover.bin");
+    remove_disk(path);
+
+    {
+        Disk disk(File(path, true), DISK_PAGES, 0);
+        disk.save();
+        disk.set_journal(journal(1, true, 1 << 20));
+        for (word i = 0; i < 3; i++) {
+            EXPECT_EQ(disk.get_free_page(), i);
+        }
+        disk.return_page(1);
+        disk.write_page(0, page_of(0x11));
+        std::vector<byte> pages(2 * PAGE_SIZE, 0x22);
+        disk.write_pages(2, 2, pages.data());
+        disk.sync();
+        EXPECT_EQ(disk.get_journal_stats().commits, disk.get_journal_stats().records);
+        EXPECT_EQ(disk.get_journal_stats().fsyncs, disk.get_journal_stats().commits);
+        EXPECT_EQ(disk.get_journal_stats().checkpoints, 0);
+    }
+
+    /* Tear the pages written in place, and a group that never finished committing. */
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(0);
+        file.write(std::string(PAGE_SIZE, 0).data(), PAGE_SIZE);
+        file.seekp(3 * PAGE_SIZE + 100);
+        file.write("torn", 4);
+        std::ofstream wal(path + ".wal", std::ios::binary | std::ios::app);
+        wal.write("\x01\x00\x00\x00garbage", 11);
+    }
+
+    Disk disk(File(path, true), DISK_PAGES, 0);
+    EXPECT_EQ(disk.get_journal_stats().recovered_records, 7);
+    EXPECT_EQ(disk.read_page(0), page_of(0x11));
+    EXPECT_EQ(disk.read_page(2), page_of(0x22));
+    EXPECT_EQ(disk.read_page(3), page_of(0x22));
+    EXPECT_EQ(std::filesystem::exists(path + ".wal"), false) << "recovery checkpoints";
+    EXPECT_EQ(disk.get_free_page(), 1) << "free pages are replayed";
+    EXPECT_EQ(disk.get_free_page(), 3);
+    remove_disk(path);
+}
+
+TEST(disk_journal, group_commit_loses_only_uncommitted) {
+    const std::string path = disk_path("disk_journal_test_group.bin");
+    remove_disk(path);
+
+    {
+        Disk disk(File(path, true), DISK_PAGES, 0);
+        disk.save();
+        disk.set_journal(journal(8, false, 1 << 20));
+        for (word i = 0; i < 20; i++) {
+            disk.get_free_page();
+        }
+        EXPECT_EQ(disk.get_journal_stats().records, 20);
+        EXPECT_EQ(disk.get_journal_stats().commits, 2);
+        EXPECT_EQ(disk.get_journal_stats().fsyncs, 0);
+    }
+
+    Disk disk(File(path, true), DISK_PAGES, 0);
+    EXPECT_EQ(disk.get_journal_stats().recovered_records, 16);
+    EXPECT_EQ(disk.get_free_page(), 16) << "the last 4 allocations were never committed";
+    remove_disk(path);
+}
+
+TEST(disk_journal, checkpoints_bound_the_log) {
+    const std::string path = disk_path("disk_journal_test_checkpoint.bin");
+    remove_disk(path);
+
+    {
+        Disk disk(File(path, true), DISK_PAGES, 0);
+        disk.set_journal(journal(2, false, 4 * PAGE_SIZE));
+        for (word i = 0; i < 32; i++) {
+            disk.write_page(disk.get_free_page(), page_of(i));
+        }
+        disk.save();
+        EXPECT_EQ(disk.get_journal_stats().checkpoints >= 4, true);
+        EXPECT_EQ(std::filesystem::file_size(path + ".wal") < 8 * PAGE_SIZE, true);
+    }
+
+    Disk disk(File(path, true), DISK_PAGES, 0);
+    EXPECT_EQ(disk.get_journal_stats().recovered_records < 32, true);
+    for (word i = 0; i < 32; i++) {
+        ASSERT_EQ(disk.read_page(i), page_of(i)) << "page " << i;
+    }
+    EXPECT_EQ(disk.get_free_page(), 32);
+    remove_disk(path);
+}
@@ -0,0 +1,69 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+
+#define DISK_LO_PAGE 16
+#define DISK_PAGES 64
+#define DISK_ADDR(page, offset) ((DISK_LO_PAGE + (page)) * PAGE_SIZE + (offset))
+
+TEST(disk_mapping, resident_pages_are_direct) {
+    const std::string path = disk_path("disk_mapping_test_direct.bin");
+    remove_disk(path);
+
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    Disk disk(File(path, true), DISK_PAGES, DISK_LO_PAGE);
+    cpu->system_bus.register_device(DISK_LO_PAGE, DISK_LO_PAGE + DISK_PAGES - 1, disk);
+    unsigned long long stalls = 0;
+    cpu->system_bus.set_stall_counter(&stalls, 1, 0);
+
+    EXPECT_EQ(disk.get_direct_read(DISK_LO_PAGE), nullptr) << "not resident yet";
+    EXPECT_EQ(cpu->system_bus.read_word(DISK_ADDR(0, 8)), 0);
+    EXPECT_EQ(stalls, 1) << "a page that is not resident takes the slow path";
+    EXPECT_NE(disk.get_direct_read(DISK_LO_PAGE), nullptr);
+    EXPECT_EQ(disk.get_direct_write(DISK_LO_PAGE), nullptr) << "clean frames are not written directly";
+
+    cpu->system_bus.write_word(DISK_ADDR(0, 8), 0x12345678);
+    EXPECT_EQ(disk.get_direct_write(DISK_LO_PAGE), disk.get_direct_read(DISK_LO_PAGE)) << "the first write marks the frame dirty";
+    cpu->system_bus.write_word(DISK_ADDR(0, 12), 0x9ABCDEF0);
+    EXPECT_EQ(cpu->system_bus.read_word(DISK_ADDR(0, 8)), 0x12345678);
+    EXPECT_EQ(cpu->system_bus.read_word(DISK_ADDR(0, 12)), 0x9ABCDEF0);
+    EXPECT_EQ(stalls, 1) << "resident pages cost the same as RAM";
+
+    /* Page AEMU_DISK_CACHE_SIZE takes the frame of page 0, which is written back. */
+    cpu->system_bus.write_word(DISK_ADDR(AEMU_DISK_CACHE_SIZE, 0), 0xCAFEBABE);
+    EXPECT_EQ(disk.get_direct_read(DISK_LO_PAGE), nullptr) << "evicted";
+    EXPECT_EQ(cpu->system_bus.read_word(DISK_ADDR(0, 12)), 0x9ABCDEF0) << "written back on eviction";
+    EXPECT_EQ(cpu->system_bus.read_word(DISK_ADDR(AEMU_DISK_CACHE_SIZE, 0)), 0xCAFEBABE);
+
+    /* Words across pages go through both frames. */
+    cpu->system_bus.write_word(DISK_ADDR(1, PAGE_SIZE - 2), 0x11223344);
+    EXPECT_EQ(cpu->system_bus.read_word(DISK_ADDR(1, PAGE_SIZE - 2)), 0x11223344);
+    EXPECT_EQ(disk.read_page(2)[1], 0x11);
+
+    delete cpu;
+    remove_disk(path);
+}
+
+TEST(disk_mapping, saving_cleans_frames) {
+    const std::string path = disk_path("disk_mapping_test_save.bin");
+    remove_disk(path);
+
+    {
+        Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+        Disk disk(File(path, true), DISK_PAGES, DISK_LO_PAGE);
+        cpu->system_bus.register_device(DISK_LO_PAGE, DISK_LO_PAGE + DISK_PAGES - 1, disk);
+
+        cpu->system_bus.write_word(DISK_ADDR(3, 0), 1);
+        disk.save();
+        EXPECT_EQ(disk.get_direct_write(DISK_LO_PAGE + 3), nullptr) << "saved frames are clean";
+
+        /* Has to mark the frame dirty again, or it would never be saved. */
+        cpu->system_bus.write_word(DISK_ADDR(3, 4), 2);
+        disk.save();
+        delete cpu;
+    }
+
+    Disk disk(File(path, true), DISK_PAGES, DISK_LO_PAGE);
+    std::vector<byte> page = disk.read_page(3);
+    EXPECT_EQ(page[0], 1);
+    EXPECT_EQ(page[4], 2);
+    remove_disk(path);
+}
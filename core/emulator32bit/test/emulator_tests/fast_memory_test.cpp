@@ -0,0 +1,221 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/fast_memory.h>
+
+/* Device that counts word accesses and reads back a fixed value. */
+class CountingDevice : public Device
+{
+    public:
+        int reads = 0;
+        int writes = 0;
+        word last_value = 0;
+
+        byte read_byte(word address) override { (void) address; return 0; }
+        hword read_hword(word address) override { (void) address; return 0; }
+        word read_word(word address) override { (void) address; reads++; return 0xCAFE; }
+        void write_byte(word address, byte value) override { (void) address; (void) value; }
+        void write_hword(word address, hword value) override { (void) address; (void) value; }
+        void write_word(word address, word value) override { (void) address; writes++; last_value = value; }
+};
+
+static Emulator32bit* create_fastmem_machine(const byte rom_data[], word rom_npages) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, rom_data, rom_npages, 1);
+    EXPECT_EQ(cpu->system_bus.enable_fastmem(), true);
+    return cpu;
+}
+
+TEST(fast_memory, loads_and_stores) {
+    if (!FastMemory::is_supported()) {
+        GTEST_SKIP() << "fast memory is not supported on this host";
+    }
+    Emulator32bit *cpu = create_fastmem_machine({}, 0);
+    // str x0, [x1], #4
+    // ldr x2, [x1, #-4]
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_str, false, 0, 1, 4, Emulator32bit::ADDR_POST_INC));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 2, 1, -4, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(0, 0x1234);
+    cpu->write_reg(1, 0x100);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(cpu->read_reg(2), 0x1234) << "load should see the store";
+    EXPECT_EQ(cpu->read_reg(1), 0x104) << "base should be written back";
+    EXPECT_EQ(cpu->system_bus.read_word(0x100), 0x1234) << "bus should see stores made through fast memory";
+    delete cpu;
+}
+
+TEST(fast_memory, fault_and_resume) {
+    if (!FastMemory::is_supported()) {
+        GTEST_SKIP() << "fast memory is not supported on this host";
+    }
+    Emulator32bit *cpu = create_fastmem_machine({}, 0);
+    // ldr x0, [x1], #4
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 0, 1, 4, Emulator32bit::ADDR_POST_INC));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(0, 7);
+    cpu->write_reg(1, 4 * PAGE_SIZE + 8);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::FAULT);
+    EXPECT_EQ(reason.address, 4 * PAGE_SIZE + 8);
+    EXPECT_EQ(cpu->read_reg(0), 7) << "faulting load should not write its destination";
+    EXPECT_EQ(cpu->read_reg(1), 4 * PAGE_SIZE + 8) << "faulting load should not write back its base";
+
+    RAM extra(1, 4);
+    cpu->system_bus.register_device(4, 4, extra);
+    cpu->system_bus.write_word(4 * PAGE_SIZE + 8, 42);
+
+    reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(cpu->read_reg(0), 42) << "memory registered later should be in the region";
+    delete cpu;
+}
+
+TEST(fast_memory, device_access_goes_through_bus) {
+    if (!FastMemory::is_supported()) {
+        GTEST_SKIP() << "fast memory is not supported on this host";
+    }
+    Emulator32bit *cpu = create_fastmem_machine({}, 0);
+    CountingDevice device;
+    cpu->system_bus.register_device(4, 4, device);
+    // ldr x0, [x1]
+    // str x2, [x1]
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 0, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_m(Emulator32bit::_op_str, false, 2, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(1, 4 * PAGE_SIZE);
+    cpu->write_reg(2, 99);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(reason.instructions, 2);
+    EXPECT_EQ(cpu->read_reg(0), 0xCAFE) << "load should be routed to the device";
+    EXPECT_EQ(device.reads, 1) << "device should be read once";
+    EXPECT_EQ(device.writes, 1) << "device should be written once";
+    EXPECT_EQ(device.last_value, 99);
+    delete cpu;
+}
+
+TEST(fast_memory, rom_writes_fault) {
+    if (!FastMemory::is_supported()) {
+        GTEST_SKIP() << "fast memory is not supported on this host";
+    }
+    std::vector<byte> rom(PAGE_SIZE, 0);
+    rom[0] = 0x55;
+    Emulator32bit *cpu = create_fastmem_machine(rom.data(), 1);
+    // ldrb x0, [x1]
+    // strb x2, [x1]
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_ldrb, false, 0, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_m(Emulator32bit::_op_strb, false, 2, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(1, PAGE_SIZE);
+    cpu->write_reg(2, 0x66);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::FAULT);
+    EXPECT_EQ(reason.pc, 4) << "should stop at the store";
+    EXPECT_EQ(reason.address, PAGE_SIZE);
+    EXPECT_EQ(cpu->read_reg(0), 0x55) << "ROM should be readable directly";
+    EXPECT_EQ(cpu->rom->data[0], 0x55) << "ROM should not be written";
+
+    byte value = 0x66;
+    cpu->rom->flash(PAGE_SIZE, &value, 1);
+    EXPECT_EQ(cpu->system_bus.read_byte(PAGE_SIZE), 0x66) << "flash should reach the fast memory view";
+    delete cpu;
+}
+
+TEST(fast_memory, physical_translation) {
+    if (!FastMemory::is_supported()) {
+        GTEST_SKIP() << "fast memory is not supported on this host";
+    }
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1, Emulator32bit::AddressTranslation::PHYSICAL);
+    EXPECT_EQ(cpu->system_bus.enable_fastmem(), true);
+    CountingDevice device;
+    cpu->system_bus.register_device(4, 4, device);
+    // str x0, [x1]
+    // ldr x2, [x1]
+    // ldr x3, [x4]
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_str, false, 0, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 2, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 3, 4, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(0, 0x1234);
+    cpu->write_reg(1, 0x100);
+    cpu->write_reg(4, 4 * PAGE_SIZE);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(reason.instructions, 3);
+    EXPECT_EQ(cpu->read_reg(2), 0x1234) << "load should see the store";
+    EXPECT_EQ(cpu->read_reg(3), 0xCAFE) << "device load should be retried through the bus";
+    EXPECT_EQ(device.reads, 1);
+    EXPECT_EQ(cpu->system_bus.read_word(0x100), 0x1234);
+    delete cpu;
+}
+
+TEST(fast_memory, reset_zeroes_view) {
+    if (!FastMemory::is_supported()) {
+        GTEST_SKIP() << "fast memory is not supported on this host";
+    }
+    Emulator32bit *cpu = create_fastmem_machine({}, 0);
+    cpu->system_bus.write_word(0x100, 0x1234);
+    cpu->system_bus.write_word(PAGE_SIZE - 4, 0x5678);
+
+    cpu->system_bus.reset();
+
+    EXPECT_EQ(cpu->system_bus.read_word(0x100), 0) << "reset should zero memory moved into fast memory";
+    EXPECT_EQ(cpu->system_bus.read_word(PAGE_SIZE - 4), 0) << "reset should zero the whole page";
+    delete cpu;
+}
+
+TEST(fast_memory, rom_images_are_shared) {
+    if (!FastMemory::is_supported()) {
+        GTEST_SKIP() << "fast memory is not supported on this host";
+    }
+    std::vector<byte> contents(PAGE_SIZE, 0);
+    contents[0] = 0x55;
+    std::shared_ptr<ROM::Image> image = std::make_shared<ROM::Image>(contents.data(), contents.size(), 1);
+    const std::string first_path = disk_path("fast_memory_test_rom_first.bin");
+    const std::string second_path = disk_path("fast_memory_test_rom_second.bin");
+    remove_disk(first_path);
+    remove_disk(second_path);
+    Emulator32bit *first = new Emulator32bit(new RAM(1, 0), new ROM(image, 1), new Disk(File(first_path, true), 4, 0));
+    Emulator32bit *second = new Emulator32bit(new RAM(1, 0), new ROM(image, 1), new Disk(File(second_path, true), 4, 0));
+    EXPECT_EQ(first->system_bus.enable_fastmem(), true);
+    EXPECT_EQ(second->system_bus.enable_fastmem(), true);
+    EXPECT_EQ(first->rom->get_image_fd(), image->get_fd()) << "ROM should be mapped from the image, not copied";
+
+    byte value = 0x66;
+    first->rom->flash(PAGE_SIZE, &value, 1);
+    EXPECT_EQ(first->rom->get_image_fd(), -1) << "flashed ROM should stop sharing the image";
+
+    // ldrb x0, [x1]
+    // hlt
+    for (Emulator32bit *cpu : {first, second}) {
+        cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_ldrb, false, 0, 1, 0, Emulator32bit::ADDR_OFFSET));
+        cpu->system_bus.write_word(4, Emulator32bit::asm_hlt());
+        cpu->set_pc(0);
+        cpu->write_reg(1, PAGE_SIZE);
+        EXPECT_EQ(cpu->run(0).type, Emulator32bit::StopReason::HALT);
+    }
+    EXPECT_EQ(first->read_reg(0), 0x66) << "flash should reach the fast memory region";
+    EXPECT_EQ(second->read_reg(0), 0x55) << "flash should not reach other ROMs of the image";
+    delete first;
+    delete second;
+    remove_disk(first_path);
+    remove_disk(second_path);
+}
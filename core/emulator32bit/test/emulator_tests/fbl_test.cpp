@@ -89,4 +89,17 @@ TEST(fbl, out_of_order)
     fbl.return_block (b3, 1);
     ASSERT_EQ (fbl.size (), 4);
     ASSERT_EQ (fbl.get_blocks ().size (), 1);
-}
\ No newline at end of file
+}
+TEST (fbl, remove_block_keeps_both_sides)
+{
+    FreeBlockList fbl (0, 8);
+    fbl.remove_block (2, 3);
+
+    ASSERT_EQ (fbl.size (), 5);
+    std::vector<std::pair<word,word>> blocks = fbl.get_blocks ();
+    ASSERT_EQ (blocks.size (), 2);
+    EXPECT_EQ (blocks[0].first, 0);
+    EXPECT_EQ (blocks[0].second, 2);
+    EXPECT_EQ (blocks[1].first, 5);
+    EXPECT_EQ (blocks[1].second, 3);
+}
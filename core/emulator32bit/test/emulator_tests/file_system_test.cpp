@@ -0,0 +1,252 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/file_system.h>
+
+#include <cstring>
+
+#define DISK_PAGES 64
+#define FS_PAGE 16
+#define FS_PAGES 40
+
+static std::vector<byte> pattern(word n_bytes, byte seed) {
+    std::vector<byte> data(n_bytes);
+    for (word i = 0; i < n_bytes; i++) {
+        data[i] = (byte) (i * 7 + seed);
+    }
+    return data;
+}
+
+static word syscall(Emulator32bit *cpu, word id, std::vector<word> args) {
+    args.resize(AEMU_SYSCALL_MAX_ARGS);
+    cpu->syscalls.lookup(id)->handler(*cpu, args.data());
+    return cpu->read_reg(0);
+}
+
+TEST(file_system, write_read_and_remount) {
+    const std::string path = disk_path("file_system_test_rw.bin");
+    remove_disk(path);
+    Disk disk(File(path, true), DISK_PAGES, 0);
+    FileSystem::format(disk, FS_PAGE, FS_PAGES, 16);
+
+    std::vector<byte> data = pattern(3 * PAGE_SIZE + 100, 1);
+    {
+        FileSystem fs(disk, FS_PAGE);
+        word inode = fs.create("hello");
+        EXPECT_EQ(fs.lookup("hello"), inode) << "created file should be found";
+        EXPECT_EQ(fs.lookup("missing"), 0) << "missing file should not be found";
+
+        fs.write(inode, 0, data.data(), data.size());
+        std::vector<byte> patch = pattern(200, 9);
+        fs.write(inode, PAGE_SIZE - 100, patch.data(), patch.size());
+        std::copy(patch.begin(), patch.end(), data.begin() + PAGE_SIZE - 100);
+
+        EXPECT_EQ(fs.read_inode(inode).size, data.size()) << "size should be the furthest byte written";
+        EXPECT_EQ(fs.read_inode(inode).nextents, 1) << "sequential writes should stay in one extent";
+        EXPECT_THROW(fs.create("hello"), FileSystem::FileSystemException) << "names should be unique";
+    }
+
+    FileSystem fs(disk, FS_PAGE);
+    word inode = fs.lookup("hello");
+    ASSERT_NE(inode, 0) << "file should survive a remount";
+
+    std::vector<byte> read_back(data.size() + 50);
+    EXPECT_EQ(fs.read(inode, 0, read_back.data(), read_back.size()), data.size()) << "read should stop at the end of the file";
+    read_back.resize(data.size());
+    EXPECT_EQ(read_back, data) << "file contents should match what was written";
+
+    std::vector<FileSystem::FileInfo> files = fs.list();
+    ASSERT_EQ(files.size(), 1) << "root directory should have one file";
+    EXPECT_EQ(files[0].name, "hello");
+    EXPECT_EQ(files[0].size, data.size());
+
+    remove_disk(path);
+}
+
+TEST(file_system, fragmented_files_and_remove) {
+    const std::string path = disk_path("file_system_test_frag.bin");
+    remove_disk(path);
+    Disk disk(File(path, true), DISK_PAGES, 0);
+    FileSystem::format(disk, FS_PAGE, FS_PAGES, 16);
+    FileSystem fs(disk, FS_PAGE);
+    word free_pages = fs.get_free_pages();
+
+    // interleave page sized appends so neither file can grow its last extent
+    word a = fs.create("a");
+    word b = fs.create("b");
+    std::vector<byte> data_a = pattern(10 * PAGE_SIZE, 3);
+    std::vector<byte> data_b = pattern(10 * PAGE_SIZE, 5);
+    for (word i = 0; i < 10; i++) {
+        fs.write(a, i * PAGE_SIZE, data_a.data() + i * PAGE_SIZE, PAGE_SIZE);
+        fs.write(b, i * PAGE_SIZE, data_b.data() + i * PAGE_SIZE, PAGE_SIZE);
+    }
+
+    EXPECT_GT(fs.read_inode(a).nextents, AEMU_FS_INLINE_EXTENTS) << "file should spill into an extent page";
+
+    std::vector<byte> read_back(10 * PAGE_SIZE);
+    fs.read(a, 0, read_back.data(), read_back.size());
+    EXPECT_EQ(read_back, data_a) << "fragmented file should read back in order";
+    fs.read(b, 0, read_back.data(), read_back.size());
+    EXPECT_EQ(read_back, data_b) << "fragmented file should read back in order";
+
+    fs.remove("a");
+    fs.remove("b");
+    EXPECT_EQ(fs.lookup("a"), 0) << "removed file should not be found";
+    EXPECT_EQ(fs.get_free_pages(), free_pages - 1) << "all pages except the root directory's should be freed";
+
+    std::vector<byte> too_big(FS_PAGES * PAGE_SIZE);
+    word c = fs.create("c");
+    EXPECT_THROW(fs.write(c, 0, too_big.data(), too_big.size()), FileSystem::FileSystemException) << "should run out of space";
+
+    remove_disk(path);
+}
+
+TEST(file_system, failed_writes_change_nothing) {
+    const std::string path = disk_path("file_system_test_full.bin");
+    remove_disk(path);
+    Disk disk(File(path, true), DISK_PAGES, 0);
+    FileSystem::format(disk, FS_PAGE, FS_PAGES, 16);
+    FileSystem fs(disk, FS_PAGE);
+
+    word inode = fs.create("full");
+    std::vector<byte> data = pattern(PAGE_SIZE, 5);
+    fs.write(inode, 0, data.data(), data.size());
+    word free_pages = fs.get_free_pages();
+
+    EXPECT_THROW(fs.write(inode, 0xFFFFFF00, data.data(), data.size()), FileSystem::FileSystemException) << "write ending past 4GiB should fail";
+
+    std::vector<byte> big = pattern((free_pages + 2) * PAGE_SIZE, 6);
+    EXPECT_THROW(fs.write(inode, PAGE_SIZE, big.data(), big.size()), FileSystem::FileSystemException) << "write larger than the free space should fail";
+    EXPECT_EQ(fs.get_free_pages(), free_pages) << "pages of the failed write should be freed";
+    EXPECT_EQ(fs.read_inode(inode).size, PAGE_SIZE) << "failed write should not change the size";
+
+    std::vector<byte> read_back(PAGE_SIZE);
+    EXPECT_EQ(fs.read(inode, 0, read_back.data(), read_back.size()), PAGE_SIZE);
+    EXPECT_EQ(read_back, data) << "failed write should not change the contents";
+    remove_disk(path);
+}
+
+TEST(file_system, file_syscalls) {
+    const std::string path = disk_path("file_system_test_syscalls.bin");
+    remove_disk(path);
+    Disk *disk = new Disk(File(path, true), DISK_PAGES, 0);
+    FileSystem::format(*disk, FS_PAGE, FS_PAGES, 16);
+    FileSystem fs(*disk, FS_PAGE);
+    Emulator32bit *cpu = disk_emulator(disk, 4);
+
+    EXPECT_EQ(syscall(cpu, 56, {0x100, AEMU_FS_O_RDONLY}), (word) -1) << "should fail without a file system";
+    cpu->mount(&fs);
+
+    const char name[] = "data";
+    const char message[] = "hello, file";
+    cpu->system_bus.write_bytes(0x100, (const byte*) name, sizeof(name));
+    cpu->system_bus.write_bytes(0x200, (const byte*) message, sizeof(message));
+
+    EXPECT_EQ(syscall(cpu, 56, {0x100, AEMU_FS_O_RDONLY}), (word) -1) << "open of a missing file should fail";
+    word fd = syscall(cpu, 56, {0x100, AEMU_FS_O_RDWR | AEMU_FS_O_CREAT});
+    ASSERT_NE(fd, (word) -1) << "open with O_CREAT should create the file";
+
+    EXPECT_EQ(syscall(cpu, 64, {fd, 0x200, sizeof(message)}), sizeof(message)) << "write should return the count";
+    EXPECT_EQ(syscall(cpu, 62, {fd, 0, AEMU_FS_SEEK_SET}), 0) << "lseek should return the new offset";
+    EXPECT_EQ(syscall(cpu, 63, {fd, 0x400, 100}), sizeof(message)) << "read should stop at the end of the file";
+    EXPECT_EQ(cpu->system_bus.read_string(0x400), message) << "read should copy the file into memory";
+    EXPECT_EQ(syscall(cpu, 62, {fd, 0, AEMU_FS_SEEK_SET}), 0) << "lseek should return the new offset";
+    EXPECT_EQ(syscall(cpu, 63, {fd, 0x400, 0xFFFFFFFF}), sizeof(message)) << "huge read should be clamped to the file";
+    EXPECT_EQ(syscall(cpu, 64, {fd, 0x200, 0xFFFFFFFF}), (word) -1) << "write larger than the file system should fail";
+    EXPECT_EQ(syscall(cpu, 57, {fd}), 0) << "close should succeed";
+    EXPECT_EQ(syscall(cpu, 63, {fd, 0x400, 100}), (word) -1) << "read of a closed fd should fail";
+
+    delete cpu;
+    remove_disk(path);
+}
+
+TEST(file_system, faulting_buffers_change_nothing) {
+    const std::string path = disk_path("file_system_test_fault.bin");
+    remove_disk(path);
+    Disk *disk = new Disk(File(path, true), DISK_PAGES, 0);
+    FileSystem::format(*disk, FS_PAGE, FS_PAGES, 16);
+    FileSystem fs(*disk, FS_PAGE);
+    Emulator32bit *cpu = disk_emulator(disk, 4);
+    cpu->mount(&fs);
+
+    const char name[] = "data";
+    const char message[] = "hello, file";
+    cpu->system_bus.write_bytes(0x100, (const byte*) name, sizeof(name));
+    cpu->system_bus.write_bytes(0x200, (const byte*) message, sizeof(message));
+    word fd = syscall(cpu, 56, {0x100, AEMU_FS_O_RDWR | AEMU_FS_O_CREAT});
+    ASSERT_NE(fd, (word) -1) << "open with O_CREAT should create the file";
+    EXPECT_EQ(syscall(cpu, 64, {fd, 0x200, sizeof(message)}), sizeof(message)) << "write should return the count";
+    EXPECT_EQ(syscall(cpu, 62, {fd, 0, AEMU_FS_SEEK_SET}), 0) << "lseek should return the new offset";
+
+    /* Page 4 is the read only ROM, page 5 has no device. */
+    cpu->write_reg(0, fd);
+    EXPECT_EQ(syscall(cpu, 64, {fd, 5 * PAGE_SIZE - 4, 8}), fd) << "faulting write should leave x0 for the retry";
+    EXPECT_EQ(cpu->system_bus.has_fault(), true) << "write from an unmapped buffer should fault";
+    cpu->system_bus.clear_fault();
+    EXPECT_EQ(syscall(cpu, 63, {fd, 4 * PAGE_SIZE - 4, 8}), fd) << "faulting read should leave x0 for the retry";
+    EXPECT_EQ(cpu->system_bus.has_fault(), true) << "read into the ROM should fault";
+    cpu->system_bus.clear_fault();
+
+    EXPECT_EQ(syscall(cpu, 62, {fd, 0, AEMU_FS_SEEK_CUR}), 0) << "faulting syscalls should not move the offset";
+    EXPECT_EQ(fs.read_inode(fs.get_fd_inode(fd)).size, sizeof(message)) << "faulting write should not grow the file";
+    EXPECT_EQ(syscall(cpu, 63, {fd, 0x400, 100}), sizeof(message)) << "read should still see the whole file";
+    EXPECT_EQ(cpu->system_bus.read_string(0x400), message) << "faulting write should not change the file";
+
+    delete cpu;
+    remove_disk(path);
+}
+
+TEST(file_system, mmap_shares_pages_with_file_io) {
+    const std::string path = disk_path("file_system_test_mmap.bin");
+    remove_disk(path);
+    Disk *disk = new Disk(File(path, true), DISK_PAGES, 0);
+    FileSystem::format(*disk, FS_PAGE, FS_PAGES, 16);
+    FileSystem fs(*disk, FS_PAGE);
+    Emulator32bit *cpu = disk_emulator(disk, 4);
+    cpu->mount(&fs);
+
+    word inode = fs.create("map");
+    std::vector<byte> data = pattern(2 * PAGE_SIZE, 11);
+    fs.write(inode, 0, data.data(), data.size());
+    word fd = fs.open("map", AEMU_FS_O_RDWR);
+    word diskpage = fs.get_disk_page(inode, 0);
+
+    const word MAP_ADDR = 0x10000;
+    const word SHARED_ADDR = 0x20000;
+    long long pid = cpu->mmu->begin_process();
+    EXPECT_EQ(syscall(cpu, 222, {MAP_ADDR, 2 * PAGE_SIZE, 3, 1, fd, 0}), MAP_ADDR) << "mmap should return the address";
+    EXPECT_EQ(syscall(cpu, 222, {MAP_ADDR + 4 * PAGE_SIZE, 3 * PAGE_SIZE, 3, 1, fd, 0}), (word) -1) << "mapping past the end of the file should fail";
+
+    word first;
+    memcpy(&first, data.data(), sizeof(word));
+    EXPECT_EQ(cpu->system_bus.read_word(MAP_ADDR), first) << "mapped page should hold the file contents";
+
+    // guest store is seen by file reads, file writes are seen by guest loads
+    cpu->system_bus.write_word(MAP_ADDR + 4, 0xCAFEBABE);
+    word value = 0;
+    fs.read(inode, 4, (byte*) &value, sizeof(value));
+    EXPECT_EQ(value, 0xCAFEBABE) << "file read should see the resident page";
+    value = 0x12345678;
+    fs.write(inode, 8, (const byte*) &value, sizeof(value));
+    EXPECT_EQ(cpu->system_bus.read_word(MAP_ADDR + 8), 0x12345678) << "mapped page should see the file write";
+
+    // a second process shares the resident physical page
+    word ppage;
+    ASSERT_TRUE(cpu->mmu->get_resident_file_page(diskpage, ppage)) << "file page should be resident";
+    long long pid2 = cpu->mmu->begin_process();
+    EXPECT_EQ(syscall(cpu, 222, {SHARED_ADDR, PAGE_SIZE, 1, 1, fd, 0}), SHARED_ADDR) << "mmap should return the address";
+    EXPECT_EQ(cpu->system_bus.read_word(SHARED_ADDR + 4), 0xCAFEBABE) << "second mapping should share the page";
+    EXPECT_EQ(syscall(cpu, 215, {SHARED_ADDR, PAGE_SIZE}), 0) << "munmap should succeed";
+    EXPECT_EQ(cpu->mmu->get_resident_file_page(diskpage, ppage), true) << "page should stay resident while still mapped";
+
+    cpu->mmu->set_process(pid);
+    EXPECT_EQ(syscall(cpu, 215, {MAP_ADDR, 2 * PAGE_SIZE}), 0) << "munmap should succeed";
+    EXPECT_EQ(cpu->mmu->get_resident_file_page(diskpage, ppage), false) << "page should be freed after the last unmap";
+
+    std::vector<byte> page = disk->read_page(diskpage);
+    memcpy(&value, page.data() + 4, sizeof(value));
+    EXPECT_EQ(value, 0xCAFEBABE) << "munmap should write the page back to the file";
+
+    cpu->mmu->end_process(pid2);
+    cpu->mmu->end_process(pid);
+    delete cpu;
+    remove_disk(path);
+}
@@ -0,0 +1,95 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+
+/* Runs cmp x1, x2 followed by a b with a condition and returns the pc it halts at. */
+static word run_cmp_b(bool fusion, word op1, word op2, byte cond, word& pstate, Emulator32bit::StopReason& reason) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    cpu->set_fusion(fusion);
+    // cmp x1, x2
+    // b.cond +2
+    // hlt
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 1, 2, Emulator32bit::SHIFT_LSL, 0));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, (Emulator32bit::ConditionCode) cond, 2));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_hlt());
+    cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(1, op1);
+    cpu->write_reg(2, op2);
+
+    reason = cpu->run(0);
+    pstate = (cpu->get_flag(N_FLAG) << 3) | (cpu->get_flag(Z_FLAG) << 2) | (cpu->get_flag(C_FLAG) << 1) |
+            cpu->get_flag(V_FLAG);
+    delete cpu;
+    return reason.pc;
+}
+
+TEST(fusion, cmp_b_matches_unfused) {
+    const word values[] = {0, 1, 5, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF};
+    for (word op1 : values) {
+        for (word op2 : values) {
+            for (byte cond = 0; cond < 16; cond++) {
+                word fused_pstate, pstate;
+                Emulator32bit::StopReason fused_reason, reason;
+                word fused_pc = run_cmp_b(true, op1, op2, cond, fused_pstate, fused_reason);
+                word pc = run_cmp_b(false, op1, op2, cond, pstate, reason);
+
+                EXPECT_EQ(fused_pc, pc) << "cond " << (int) cond << " of " << op1 << " and " << op2;
+                EXPECT_EQ(fused_pstate, pstate) << "flags should be written the same";
+                EXPECT_EQ(fused_reason.instructions, reason.instructions);
+                EXPECT_EQ(fused_reason.fused_groups, 1);
+                EXPECT_EQ(reason.fused_groups, 0);
+            }
+        }
+    }
+}
+
+TEST(fusion, sub_cmp_b_loop) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    // sub x0, x0, #1
+    // cmp x0, #0
+    // b.gt -2
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_o(Emulator32bit::_op_sub, false, 0, 0, 1));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 0, 0));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::GT, -2));
+    cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(0, 100);
+
+    Emulator32bit::StopReason reason = cpu->run(4);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::BUDGET_EXHAUSTED);
+    EXPECT_EQ(reason.instructions, 4) << "groups should not run past the budget";
+    EXPECT_EQ(reason.fused_groups, 1);
+    EXPECT_EQ(cpu->get_pc(), 4);
+    EXPECT_EQ(cpu->read_reg(0), 98);
+
+    reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(reason.pc, 12);
+    EXPECT_EQ(reason.instructions, 296);
+    EXPECT_EQ(reason.fused_groups, 99) << "a cmp and b pair and then every iteration should be fused";
+    EXPECT_EQ(reason.fused_instructions, 296);
+    EXPECT_EQ(cpu->read_reg(0), 0);
+    delete cpu;
+}
+
+TEST(fusion, groups_do_not_cross_pages) {
+    Emulator32bit *cpu = new Emulator32bit(2, 0, {}, 0, 2);
+    // cmp x0, #0
+    // b.eq +2
+    // hlt
+    // hlt
+    cpu->system_bus.write_word(PAGE_SIZE - 4, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 0, 0));
+    cpu->system_bus.write_word(PAGE_SIZE, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::EQ, 2));
+    cpu->system_bus.write_word(PAGE_SIZE + 4, Emulator32bit::asm_hlt());
+    cpu->system_bus.write_word(PAGE_SIZE + 8, Emulator32bit::asm_hlt());
+    cpu->set_pc(PAGE_SIZE - 4);
+    cpu->write_reg(0, 0);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(reason.pc, PAGE_SIZE + 8) << "branch should be taken";
+    EXPECT_EQ(reason.fusion_candidates, 1);
+    EXPECT_EQ(reason.fused_groups, 0);
+    delete cpu;
+}
@@ -0,0 +1,101 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+
+#include <cstdio>
+#include <fstream>
+
+TEST(memory, starts_zeroed) {
+    RAM ram(4, 2);
+    for (word page = 2; page < 6; page++) {
+        EXPECT_EQ(ram.read_word(page << PAGE_PSIZE), 0);
+        EXPECT_EQ(ram.read_word(((page + 1) << PAGE_PSIZE) - 4), 0);
+    }
+}
+
+TEST(memory, reset_zeroes_every_page) {
+    RAM ram(4, 2);
+    for (word page = 2; page < 6; page++) {
+        ram.write_word(page << PAGE_PSIZE, 0xDEADBEEF);
+        ram.write_word(((page + 1) << PAGE_PSIZE) - 4, 0xDEADBEEF);
+    }
+
+    ram.reset();
+
+    for (word page = 2; page < 6; page++) {
+        EXPECT_EQ(ram.read_word(page << PAGE_PSIZE), 0) << "page " << page;
+        EXPECT_EQ(ram.read_word(((page + 1) << PAGE_PSIZE) - 4), 0) << "last word of page " << page;
+    }
+}
+
+TEST(memory, touched_pages) {
+    RAM ram(4, 0);
+    ram.reset();
+    ram.write_byte(2 * PAGE_SIZE + 5, 1);
+
+    std::vector<bool> touched = ram.get_touched_pages();
+    ASSERT_EQ(touched.size(), 4);
+    EXPECT_EQ(touched[2], true) << "written page should be touched";
+    EXPECT_EQ(touched[1], false) << "page of 0 should not be touched";
+
+    ram.reset();
+    EXPECT_EQ(ram.read_byte(2 * PAGE_SIZE + 5), 0);
+}
+
+TEST(memory, copy) {
+    RAM ram(4, 0);
+    ram.write_word(0, 1);
+    ram.write_word(3 * PAGE_SIZE + 8, 2);
+
+    RAM copy(ram);
+    EXPECT_EQ(copy.read_word(0), 1);
+    EXPECT_EQ(copy.read_word(3 * PAGE_SIZE + 8), 2);
+    EXPECT_EQ(copy.read_word(PAGE_SIZE), 0);
+
+    copy.write_word(0, 3);
+    EXPECT_EQ(ram.read_word(0), 1) << "copy should not share contents";
+}
+
+TEST(memory, rom_images_are_shared) {
+    std::vector<byte> contents(PAGE_SIZE + 4, 0);
+    contents[0] = 0x12;
+    contents[PAGE_SIZE] = 0x34;
+    std::shared_ptr<ROM::Image> image = std::make_shared<ROM::Image>(contents.data(), contents.size(), 2);
+
+    ROM first(image, 4);
+    ROM second(image, 8);
+    EXPECT_EQ(first.read_byte(4 * PAGE_SIZE), 0x12);
+    EXPECT_EQ(first.read_byte(5 * PAGE_SIZE), 0x34);
+    EXPECT_EQ(first.read_byte(5 * PAGE_SIZE + 8), 0) << "rest of the image should be 0";
+    EXPECT_EQ(second.read_byte(8 * PAGE_SIZE), 0x12);
+
+    byte value = 0x56;
+    first.flash(4 * PAGE_SIZE, &value, 1);
+    EXPECT_EQ(first.read_byte(4 * PAGE_SIZE), 0x56);
+    EXPECT_EQ(second.read_byte(8 * PAGE_SIZE), 0x12) << "flash should not change other ROMs of the image";
+    EXPECT_THROW(first.flash(6 * PAGE_SIZE, &value, 1), ROM::ROM_Exception);
+}
+
+TEST(memory, rom_files_are_loaded_once) {
+    std::string path = testing::TempDir() + "memory_test_rom.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.put(0x42);
+    }
+
+    std::shared_ptr<ROM::Image> image = ROM::Image::load(File(path), 1);
+    EXPECT_EQ(ROM::Image::load(File(path), 1), image) << "a file still in use should not be loaded again";
+
+    ROM rom(File(path), 1, 0);
+    EXPECT_EQ(rom.read_byte(0), 0x42);
+    std::remove(path.c_str());
+}
+
+TEST(memory, rom_writes_fault) {
+    std::vector<byte> rom(PAGE_SIZE, 0);
+    rom[0] = 0x55;
+    Emulator32bit *cpu = new Emulator32bit(1, 0, rom.data(), 1, 1);
+    cpu->system_bus.write_byte(PAGE_SIZE, 0x66);
+    EXPECT_EQ(cpu->system_bus.has_fault(), true);
+    EXPECT_EQ(cpu->system_bus.get_fault_address(), PAGE_SIZE);
+    EXPECT_EQ(cpu->system_bus.read_byte(PAGE_SIZE), 0x55);
+    delete cpu;
+}
@@ -0,0 +1,101 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/overlay_disk.h>
+
+#include <filesystem>
+
+#define DISK_PAGES 16
+
+static std::vector<byte> page_of(byte val) {
+    return std::vector<byte>(PAGE_SIZE, val);
+}
+
+/* Saved base image with page i filled with i + 1. */
+static void make_base(const std::string& path) {
+    remove_disk(path);
+    Disk base(File(path, true), DISK_PAGES, 0);
+    for (word i = 0; i < 4; i++) {
+        EXPECT_EQ(base.get_free_page(), i);
+        base.write_page(i, page_of(i + 1));
+    }
+    base.save();
+}
+
+TEST(overlay_disk, reads_fall_through_to_base) {
+    const std::string base_path = disk_path("overlay_disk_test_base.bin");
+    const std::string a_path = disk_path("overlay_disk_test_a.bin");
+    const std::string b_path = disk_path("overlay_disk_test_b.bin");
+    make_base(base_path);
+    remove_disk(a_path);
+    remove_disk(b_path);
+
+    {
+        OverlayDisk a(File(base_path), File(a_path), DISK_PAGES, 0);
+        OverlayDisk b(File(base_path), File(b_path), DISK_PAGES, 0);
+        EXPECT_EQ(std::filesystem::file_size(a_path), 0) << "creating an overlay copies nothing";
+
+        a.write_page(1, page_of(0xAA));
+        EXPECT_EQ(a.read_page(1), page_of(0xAA));
+        EXPECT_EQ(a.read_page(2), page_of(3));
+        EXPECT_EQ(b.read_page(1), page_of(2)) << "overlays do not see each other";
+
+        EXPECT_EQ(a.get_free_page(), 4) << "starts with the free pages of the base";
+        EXPECT_EQ(b.get_free_page(), 4);
+        a.write_page(4, page_of(0xBB));
+        a.save();
+        EXPECT_EQ(a.get_overlay_pages(), 2);
+        EXPECT_EQ(std::filesystem::file_size(a_path), 2 * PAGE_SIZE);
+
+        std::vector<byte> pages(4 * PAGE_SIZE);
+        a.read_pages(1, 4, pages.data());
+        EXPECT_EQ(std::vector<byte>(pages.begin(), pages.begin() + PAGE_SIZE), page_of(0xAA));
+        EXPECT_EQ(std::vector<byte>(pages.begin() + PAGE_SIZE, pages.begin() + 2 * PAGE_SIZE), page_of(3));
+        EXPECT_EQ(std::vector<byte>(pages.begin() + 3 * PAGE_SIZE, pages.end()), page_of(0xBB));
+    }
+
+    Disk base(File(base_path, true), DISK_PAGES, 0);
+    EXPECT_EQ(base.read_page(1), page_of(2)) << "the base is never written";
+
+    OverlayDisk reopened(File(base_path), File(a_path), DISK_PAGES, 0);
+    EXPECT_EQ(reopened.get_overlay_pages(), 2);
+    EXPECT_EQ(reopened.read_page(1), page_of(0xAA));
+    EXPECT_EQ(reopened.get_free_page(), 5);
+
+    remove_disk(base_path);
+    remove_disk(a_path);
+    remove_disk(b_path);
+}
+
+TEST(overlay_disk, commit_and_discard) {
+    const std::string base_path = disk_path("overlay_disk_test_commit_base.bin");
+    const std::string path = disk_path("overlay_disk_test_commit.bin");
+    make_base(base_path);
+    remove_disk(path);
+    remove_disk(disk_path("overlay_disk_test_next.bin"));
+
+    {
+        OverlayDisk overlay(File(base_path), File(path), DISK_PAGES, 0);
+        overlay.write_word(2 * PAGE_SIZE, 0x12345678);
+        EXPECT_EQ(overlay.get_free_page(), 4);
+        overlay.save();
+        EXPECT_EQ(overlay.get_overlay_pages(), 1);
+
+        overlay.discard();
+        EXPECT_EQ(overlay.get_overlay_pages(), 0);
+        EXPECT_EQ(overlay.read_page(2), page_of(3));
+        EXPECT_EQ(overlay.get_free_page(), 4) << "free pages go back to the base's";
+
+        overlay.write_page(3, page_of(0xCC));
+        overlay.commit();
+        EXPECT_EQ(overlay.get_overlay_pages(), 0);
+        EXPECT_EQ(std::filesystem::file_size(path), 0);
+        EXPECT_EQ(overlay.read_page(3), page_of(0xCC));
+    }
+
+    OverlayDisk next(File(base_path), File(disk_path("overlay_disk_test_next.bin")), DISK_PAGES, 0);
+    EXPECT_EQ(next.read_page(3), page_of(0xCC));
+    EXPECT_EQ(next.get_free_page(), 5) << "committed allocations are kept";
+
+    remove_disk(base_path);
+    remove_disk(path);
+    remove_disk(disk_path("overlay_disk_test_next.bin"));
+}
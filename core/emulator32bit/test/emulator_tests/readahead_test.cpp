@@ -0,0 +1,95 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+
+#define DISK_PAGES 128
+#define RAM_PAGES 16
+#define VPAGE 16
+
+/* Writes a word to each of npages pages, more than fit in RAM, so the first ones end up swapped out. */
+static long long swapped_out_array(Emulator32bit *cpu, word npages) {
+    long long pid = cpu->mmu->begin_process();
+    cpu->mmu->add_vpage(pid, VPAGE, npages, true, false);
+    for (word i = 0; i < npages; i++) {
+        cpu->system_bus.write_word((VPAGE + i) * PAGE_SIZE + 8, i * 7 + 1);
+    }
+    return pid;
+}
+
+TEST(readahead, sequential_scan_batches_faults) {
+    const std::string path = disk_path("readahead_test_sequential.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = disk_emulator(new Disk(File(path, true), DISK_PAGES, 0), RAM_PAGES);
+    const word NPAGES = 2 * RAM_PAGES;
+    long long pid = swapped_out_array(cpu, NPAGES);
+
+    cpu->mmu->set_readahead(8);
+    for (word i = 0; i < NPAGES; i++) {
+        ASSERT_EQ(cpu->system_bus.read_word((VPAGE + i) * PAGE_SIZE + 8), i * 7 + 1) << "page " << i;
+    }
+
+    VirtualMemory::ReadaheadStats stats = cpu->mmu->get_readahead_stats();
+    EXPECT_EQ(stats.faults + stats.hits, NPAGES);
+    EXPECT_EQ(stats.faults <= NPAGES / 3, true) << "faults: " << stats.faults;
+    EXPECT_EQ(stats.hits, stats.prefetched) << "all the pages read ahead get used";
+    EXPECT_EQ(stats.wasted, 0);
+    EXPECT_EQ(stats.disk_reads < stats.prefetched, true) << "reads are batched";
+
+    cpu->mmu->end_process(pid);
+    delete cpu;
+    remove_disk(path);
+}
+
+TEST(readahead, strided_and_random_faults) {
+    const std::string path = disk_path("readahead_test_strided.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = disk_emulator(new Disk(File(path, true), DISK_PAGES, 0), RAM_PAGES);
+    const word NPAGES = 3 * RAM_PAGES;
+    long long pid = swapped_out_array(cpu, NPAGES);
+
+    /* Every third page, backwards. */
+    cpu->mmu->set_readahead(4);
+    for (word i = 0; i < RAM_PAGES; i++) {
+        word page = 3 * (RAM_PAGES - 1 - i);
+        ASSERT_EQ(cpu->system_bus.read_word((VPAGE + page) * PAGE_SIZE + 8), page * 7 + 1) << "page " << page;
+    }
+    VirtualMemory::ReadaheadStats stats = cpu->mmu->get_readahead_stats();
+    EXPECT_EQ(stats.hits > stats.faults, true) << "hits: " << stats.hits << ", faults: " << stats.faults;
+    EXPECT_EQ(stats.wasted, 0);
+
+    /* Jumping around more than AEMU_READAHEAD_MAX_STRIDE pages at a time reads nothing ahead. */
+    const unsigned long long prefetched = stats.prefetched;
+    for (word i = 0; i < NPAGES; i++) {
+        word page = (i * 29) % NPAGES;
+        ASSERT_EQ(cpu->system_bus.read_word((VPAGE + page) * PAGE_SIZE + 8), page * 7 + 1) << "page " << page;
+    }
+    EXPECT_EQ(cpu->mmu->get_readahead_stats().prefetched, prefetched);
+
+    cpu->mmu->end_process(pid);
+    delete cpu;
+    remove_disk(path);
+}
+
+TEST(readahead, working_set_sampling) {
+    const std::string path = disk_path("readahead_test_working_set.bin");
+    remove_disk(path);
+    Emulator32bit *cpu = disk_emulator(new Disk(File(path, true), DISK_PAGES, 0), RAM_PAGES);
+    long long pid = cpu->mmu->begin_process();
+    cpu->mmu->add_vpage(pid, VPAGE, 8, true, false);
+    for (word i = 0; i < 8; i++) {
+        cpu->system_bus.write_word((VPAGE + i) * PAGE_SIZE, i);
+    }
+    EXPECT_EQ(cpu->mmu->sample_working_set(pid), 8);
+
+    for (int repeat = 0; repeat < 3; repeat++) {
+        for (word i = 0; i < 3; i++) {
+            EXPECT_EQ(cpu->system_bus.read_word((VPAGE + i) * PAGE_SIZE), i);
+        }
+        EXPECT_EQ(cpu->mmu->sample_working_set(pid), 3) << "pages in the TLB are counted again";
+    }
+    EXPECT_EQ(cpu->mmu->get_working_set(pid), 3);
+    EXPECT_EQ(cpu->mmu->sample_working_set(pid), 0);
+    EXPECT_EQ(cpu->mmu->get_working_set(pid), 0);
+
+    cpu->mmu->end_process(pid);
+    delete cpu;
+    remove_disk(path);
+}
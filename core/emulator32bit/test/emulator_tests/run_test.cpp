@@ -0,0 +1,196 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+
+TEST(run, halt) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    // nop
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_nop());
+    cpu->system_bus.write_word(4, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(reason.pc, 4) << "should stop at the hlt";
+    EXPECT_EQ(reason.instructions, 1) << "hlt should not be counted";
+    delete cpu;
+}
+
+TEST(run, budget_exhausted_and_resume) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    // add x0, x0, #1
+    // add x0, x0, #1
+    // add x0, x0, #1
+    // hlt
+    for (word i = 0; i < 3; i++) {
+        cpu->system_bus.write_word(i * 4, Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 0, 0, 1));
+    }
+    cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(0, 0);
+
+    Emulator32bit::StopReason reason = cpu->run(2);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::BUDGET_EXHAUSTED);
+    EXPECT_EQ(reason.instructions, 2);
+    EXPECT_EQ(cpu->get_pc(), 8) << "should stop before the next instruction";
+    EXPECT_EQ(cpu->read_reg(0), 2);
+
+    reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT) << "should resume where it stopped";
+    EXPECT_EQ(reason.instructions, 1);
+    EXPECT_EQ(cpu->read_reg(0), 3);
+    delete cpu;
+}
+
+TEST(run, fault_and_resume) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    // ldr x0, [x1], #4
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 0, 1, 4, Emulator32bit::ADDR_POST_INC));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(0, 7);
+    cpu->write_reg(1, 4 * PAGE_SIZE);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::FAULT);
+    EXPECT_EQ(reason.address, 4 * PAGE_SIZE) << "should report the address with no device";
+    EXPECT_EQ(reason.pc, 0) << "should stop at the faulting load";
+    EXPECT_EQ(cpu->read_reg(0), 7) << "faulting load should not write its destination";
+    EXPECT_EQ(cpu->read_reg(1), 4 * PAGE_SIZE) << "faulting load should not write back its base";
+    EXPECT_EQ(cpu->system_bus.has_fault(), false) << "run should consume the fault";
+
+    RAM extra(1, 4);
+    cpu->system_bus.register_device(4, 4, extra);
+    cpu->system_bus.write_word(4 * PAGE_SIZE, 42);
+
+    reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(reason.instructions, 1) << "the load should be retried";
+    EXPECT_EQ(cpu->read_reg(0), 42);
+    EXPECT_EQ(cpu->read_reg(1), 4 * PAGE_SIZE + 4);
+    delete cpu;
+}
+
+TEST(run, faulting_store_across_pages) {
+    std::vector<byte> rom(PAGE_SIZE, 0);
+    Emulator32bit *cpu = new Emulator32bit(1, 0, rom.data(), 1, 1);
+    // str x0, [x1]
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_str, false, 0, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->set_pc(0);
+    cpu->write_reg(0, 0x12345678);
+    cpu->write_reg(1, PAGE_SIZE - 2);
+
+    Emulator32bit::StopReason reason = cpu->run(1);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::FAULT) << "store reaching into ROM should fault";
+    EXPECT_EQ(reason.address, PAGE_SIZE);
+    EXPECT_EQ(cpu->system_bus.read_hword(PAGE_SIZE - 2), 0) << "faulting store should not write the RAM half";
+    delete cpu;
+}
+
+TEST(run, syscall_exit) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    // swi
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_b1(Emulator32bit::_op_swi, Emulator32bit::ConditionCode::AL, 0));
+    cpu->set_pc(0);
+    cpu->write_reg(NR, 93);
+    cpu->write_reg(0, 3);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::SYSCALL_EXIT);
+    EXPECT_EQ(reason.code, 3) << "exit status should be x0";
+
+    cpu->set_pc(0);
+    cpu->write_reg(NR, 12345);
+    reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::BAD_SYSCALL);
+    EXPECT_EQ(reason.code, 12345);
+    delete cpu;
+}
+
+TEST(run, round_robin_slices) {
+    // add x0, x0, #1
+    // b -4
+    const word program[] = {
+        Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 0, 0, 1),
+        Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::AL, -1),
+    };
+
+    std::vector<Emulator32bit*> cpus;
+    for (int i = 0; i < 3; i++) {
+        Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+        cpu->system_bus.write_word(0, program[0]);
+        cpu->system_bus.write_word(4, program[1]);
+        cpu->set_pc(0);
+        cpu->write_reg(0, 0);
+        cpus.push_back(cpu);
+    }
+
+    for (int round = 0; round < 5; round++) {
+        for (Emulator32bit *cpu : cpus) {
+            Emulator32bit::StopReason reason = cpu->step_slice(10);
+            EXPECT_EQ(reason.type, Emulator32bit::StopReason::BUDGET_EXHAUSTED);
+            EXPECT_EQ(reason.instructions, 10);
+        }
+    }
+
+    for (Emulator32bit *cpu : cpus) {
+        EXPECT_EQ(cpu->read_reg(0), 25) << "each emulator should keep its own state between slices";
+        EXPECT_EQ(cpu->get_pc(), 0);
+        delete cpu;
+    }
+}
+
+TEST(run, blocked_syscall_is_retried) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    // swi
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_b1(Emulator32bit::_op_swi, Emulator32bit::ConditionCode::AL, 0));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(NR, 1040);
+    cpu->write_reg(0, 0b100);
+
+    Emulator32bit::StopReason reason = cpu->step_slice(100);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::BLOCKED) << "no interrupt is raised yet";
+    EXPECT_EQ(reason.pc, 0) << "should stay at the syscall";
+    EXPECT_EQ(reason.instructions, 0);
+
+    cpu->system_bus.raise_irq(2);
+    reason = cpu->step_slice(100);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(reason.instructions, 1) << "the syscall should complete once the interrupt is raised";
+    EXPECT_EQ(cpu->read_reg(0), 0b100) << "should return the raised lines";
+    delete cpu;
+}
+
+TEST(run, physical_translation) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1, Emulator32bit::AddressTranslation::PHYSICAL);
+    // str x0, [x1], #4
+    // ldr x2, [x1, #-4]
+    // ldrh x3, [x4]
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_str, false, 0, 1, 4, Emulator32bit::ADDR_POST_INC));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 2, 1, -4, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_format_m(Emulator32bit::_op_ldrh, false, 3, 4, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(0, 0x1234);
+    cpu->write_reg(1, 0x100);
+    cpu->write_reg(4, 4 * PAGE_SIZE);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::FAULT);
+    EXPECT_EQ(reason.address, 4 * PAGE_SIZE);
+    EXPECT_EQ(reason.pc, 8) << "should stop at the faulting load";
+    EXPECT_EQ(cpu->read_reg(2), 0x1234) << "load should see the store";
+
+    RAM extra(1, 4);
+    cpu->system_bus.register_device(4, 4, extra);
+    cpu->system_bus.write_word(4 * PAGE_SIZE, 0xABCD);
+
+    reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(cpu->read_reg(3), 0xABCD);
+    delete cpu;
+}
@@ -0,0 +1,149 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/sampler.h>
+
+#include <cmath>
+
+#define OUTER_ITERATIONS 12
+
+/* Alternates between a countdown loop and a loop loading the array at page 1, so runs have two
+   phases with different behaviour. */
+static Emulator32bit* two_phase_program() {
+    Emulator32bit *cpu = new Emulator32bit(2, 0, {}, 0, 2);
+    // add x0, xzr, #300
+    // sub x0, x0, #1
+    // cmp x0, #0
+    // b.ne -2
+    // add x1, xzr, #PAGE_SIZE
+    // add x3, xzr, #PAGE_SIZE + 1024
+    // ldr x2, [x1], #4
+    // cmp x1, x3
+    // b.lt -2
+    // sub x5, x5, #1
+    // cmp x5, #0
+    // b.ne -11
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 0, XZR, 300));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_o(Emulator32bit::_op_sub, false, 0, 0, 1));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 0, 0));
+    cpu->system_bus.write_word(12, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::NE, -2));
+    cpu->system_bus.write_word(16, Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 1, XZR, PAGE_SIZE));
+    cpu->system_bus.write_word(20, Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 3, XZR, PAGE_SIZE + 1024));
+    cpu->system_bus.write_word(24, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 2, 1, 4, Emulator32bit::ADDR_POST_INC));
+    cpu->system_bus.write_word(28, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 1, 3, Emulator32bit::SHIFT_LSL, 0));
+    cpu->system_bus.write_word(32, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::LT, -2));
+    cpu->system_bus.write_word(36, Emulator32bit::asm_format_o(Emulator32bit::_op_sub, false, 5, 5, 1));
+    cpu->system_bus.write_word(40, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 5, 0));
+    cpu->system_bus.write_word(44, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::NE, -11));
+    cpu->system_bus.write_word(48, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(5, OUTER_ITERATIONS);
+    return cpu;
+}
+
+static CacheHierarchy::Config small_config() {
+    CacheHierarchy::Config config;
+    config.l1i = {1024, 2, 32, CacheHierarchy::Replacement::LRU};
+    config.l1d = {256, 2, 32, CacheHierarchy::Replacement::LRU};
+    config.threaded = false;
+    return config;
+}
+
+TEST(sampler, snapshot_reruns_program) {
+    Emulator32bit *cpu = new Emulator32bit(2, 0, {}, 0, 2);
+    // ldr x2, [x1]
+    // add x2, x2, #1
+    // str x2, [x1]
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 2, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 2, 2, 1));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_format_m(Emulator32bit::_op_str, false, 2, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(1, PAGE_SIZE);
+    cpu->system_bus.write_word(PAGE_SIZE, 41);
+    cpu->system_bus.raise_irq(2);
+
+    Emulator32bit::Snapshot snapshot = cpu->save_snapshot();
+    EXPECT_EQ(cpu->run(0).type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(cpu->system_bus.read_word(PAGE_SIZE), 42);
+    cpu->system_bus.clear_irq(2);
+    cpu->system_bus.raise_irq(4);
+
+    cpu->restore_snapshot(snapshot);
+    EXPECT_EQ(cpu->get_pc(), 0);
+    EXPECT_EQ(cpu->get_time(), 0);
+    EXPECT_EQ(cpu->system_bus.read_word(PAGE_SIZE), 41) << "RAM is put back";
+    EXPECT_EQ(cpu->system_bus.get_pending_irqs(), 1U << 2);
+    EXPECT_EQ(cpu->run(0).type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(cpu->system_bus.read_word(PAGE_SIZE), 42) << "reruns the same way";
+    EXPECT_EQ(cpu->get_time(), 3);
+    delete cpu;
+}
+
+TEST(sampler, block_vectors_per_phase) {
+    Emulator32bit *cpu = two_phase_program();
+    Sampler::Config config;
+    config.interval = 450;
+    config.max_phases = 4;
+    Sampler sampler(*cpu, config);
+
+    Emulator32bit::StopReason reason = sampler.profile(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    const unsigned long long outer = 1 + 900 + 2 + 768 + 3;
+    EXPECT_EQ(reason.instructions, OUTER_ITERATIONS * outer);
+    EXPECT_EQ(sampler.get_num_intervals(), (OUTER_ITERATIONS * outer + 449) / 450);
+
+    const std::vector<Sampler::SimPoint>& points = sampler.pick();
+    ASSERT_EQ(points.empty(), false);
+    EXPECT_EQ(points.size() <= 4, true);
+    double weight = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        weight += points[i].weight;
+        if (i > 0) {
+            EXPECT_EQ(points[i - 1].interval < points[i].interval, true) << "in run order";
+        }
+    }
+    EXPECT_NEAR(weight, 1, 1e-9);
+
+    /* Profiling suspends fusion and leaves it as it was. */
+    cpu->set_pc(0);
+    cpu->write_reg(5, 1);
+    EXPECT_EQ(cpu->run(0).fused_groups > 0, true);
+    delete cpu;
+}
+
+TEST(sampler, estimate_matches_detailed_run) {
+    Emulator32bit *cpu = two_phase_program();
+    Sampler::Config config;
+    config.interval = 500;
+    config.max_phases = 6;
+    config.warmup = 200;
+    Sampler sampler(*cpu, config);
+    Emulator32bit::Snapshot start = cpu->save_snapshot();
+
+    EXPECT_EQ(sampler.profile(0).type, Emulator32bit::StopReason::HALT);
+    sampler.pick();
+    CacheHierarchy caches(small_config());
+    Emulator32bit::Latencies latencies;
+    Sampler::Estimate estimate = sampler.measure(&caches, latencies);
+    EXPECT_EQ(cpu->is_timing(), false);
+    EXPECT_EQ(estimate.detailed_instructions < estimate.instructions / 2, true) << "most of it is fast forwarded";
+
+    /* Whole run in detail. */
+    cpu->restore_snapshot(start);
+    CacheHierarchy reference_caches(small_config());
+    cpu->set_cache_hierarchy(&reference_caches);
+    cpu->set_timing(true, latencies, false);
+    unsigned long long cycles = cpu->get_cycles();
+    Emulator32bit::StopReason reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(cpu->get_time(), estimate.instructions) << "guest time is unchanged by counting cycles";
+    cycles = cpu->get_cycles() - cycles;
+
+    EXPECT_NEAR(estimate.cycles / cycles, 1, 0.05);
+    CacheHierarchy::Stats l1d = reference_caches.get_stats(CacheHierarchy::L1D);
+    EXPECT_NEAR(estimate.accesses[CacheHierarchy::L1D] / l1d.accesses, 1, 0.05);
+    EXPECT_NEAR(estimate.misses[CacheHierarchy::L1D] / l1d.misses, 1, 0.1);
+    cpu->set_cache_hierarchy(nullptr);
+    delete cpu;
+}
@@ -0,0 +1,35 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+
+#include <filesystem>
+
+#define DISK_PAGES 4096
+
+TEST(sparse_disk, costs_only_used_pages) {
+    const std::string path = disk_path("sparse_disk_test.bin");
+    remove_disk(path);
+
+    Disk disk(File(path, true), DISK_PAGES, 0);
+    EXPECT_EQ(disk.get_logical_bytes(), (unsigned long long) DISK_PAGES * PAGE_SIZE);
+    EXPECT_EQ(std::filesystem::file_size(path), (unsigned long long) DISK_PAGES * PAGE_SIZE);
+    EXPECT_EQ(disk.get_allocated_bytes() < 16 * PAGE_SIZE, true) << "created as a hole";
+
+    for (word i = 0; i < 64; i++) {
+        EXPECT_EQ(disk.get_free_page(), i);
+        disk.write_page(i, std::vector<byte>(PAGE_SIZE, i + 1));
+    }
+    disk.save();
+    const unsigned long long used = disk.get_allocated_bytes();
+    EXPECT_EQ(used >= 64 * PAGE_SIZE, true);
+
+    for (word i = 0; i < 32; i++) {
+        disk.return_page(i);
+    }
+    EXPECT_EQ(disk.get_allocated_bytes() <= used - 32 * PAGE_SIZE, true) << "returned pages are punched out";
+    EXPECT_EQ(disk.read_page(0), std::vector<byte>(PAGE_SIZE, 0));
+    EXPECT_EQ(disk.read_page(32), std::vector<byte>(PAGE_SIZE, 33)) << "pages in use are kept";
+
+    disk.return_all_pages();
+    EXPECT_EQ(disk.get_allocated_bytes() < 16 * PAGE_SIZE, true);
+    EXPECT_EQ(std::filesystem::file_size(path), (unsigned long long) DISK_PAGES * PAGE_SIZE) << "the size is kept";
+    remove_disk(path);
+}
@@ -0,0 +1,161 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+
+#include <cstring>
+#include <vector>
+
+TEST(syscall, registered_handler_gets_register_args) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    word received[AEMU_SYSCALL_MAX_ARGS] = {};
+    int calls = 0;
+    cpu->syscalls.register_syscall(7, "test", 3, [&](Emulator32bit& emu, const word args[]) {
+        for (int i = 0; i < 3; i++) {
+            received[i] = args[i];
+        }
+        calls++;
+        emu.write_reg(0, 99);
+    });
+
+    // swi
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_b1(Emulator32bit::_op_swi, Emulator32bit::ConditionCode::AL, 0));
+    cpu->set_pc(0);
+    cpu->write_reg(NR, 7);
+    cpu->write_reg(0, 10);
+    cpu->write_reg(1, 11);
+    cpu->write_reg(2, 12);
+
+    cpu->run(1);
+
+    EXPECT_EQ(calls, 1) << "handler should be called once";
+    EXPECT_EQ(received[0], 10) << "x0 should be passed as the first argument";
+    EXPECT_EQ(received[1], 11) << "x1 should be passed as the second argument";
+    EXPECT_EQ(received[2], 12) << "x2 should be passed as the third argument";
+    EXPECT_EQ(cpu->read_reg(0), 99) << "handler should be able to return a value in x0";
+    EXPECT_EQ(cpu->syscalls.get_stats(7).count, 1) << "call should be counted";
+    delete cpu;
+}
+
+TEST(syscall, condition_not_met) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    int calls = 0;
+    cpu->syscalls.register_syscall(7, "test", 0, [&](Emulator32bit& emu, const word args[]) {
+        (void) emu;
+        (void) args;
+        calls++;
+    });
+
+    // swi.eq
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_b1(Emulator32bit::_op_swi, Emulator32bit::ConditionCode::EQ, 0));
+    cpu->set_pc(0);
+    cpu->write_reg(NR, 7);
+    cpu->set_NZCV(0, 0, 0, 0);
+
+    cpu->run(1);
+
+    EXPECT_EQ(calls, 0) << "handler should not be called when the condition fails";
+    EXPECT_EQ(cpu->syscalls.get_stats(7).count, 0) << "skipped call should not be counted";
+    delete cpu;
+}
+
+TEST(syscall, unregistered) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    int calls = 0;
+    cpu->syscalls.register_syscall(7, "test", 0, [&](Emulator32bit& emu, const word args[]) {
+        (void) emu;
+        (void) args;
+        calls++;
+    });
+    cpu->syscalls.unregister_syscall(7);
+
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_b1(Emulator32bit::_op_swi, Emulator32bit::ConditionCode::AL, 0));
+    cpu->set_pc(0);
+    cpu->write_reg(NR, 7);
+
+    cpu->run(1);
+
+    EXPECT_EQ(calls, 0) << "removed syscall should not be called";
+    EXPECT_EQ(cpu->syscalls.lookup(7), nullptr) << "removed syscall should not be found";
+    EXPECT_EQ(cpu->syscalls.lookup(AEMU_SYSCALL_TABLE_SIZE), nullptr) << "out of range syscall should not be found";
+    delete cpu;
+}
+
+TEST(syscall, handler_replaces_itself) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    std::vector<int> calls(2);
+    std::vector<int> *counter = &calls;
+    cpu->syscalls.register_syscall(7, "first", 0, [counter](Emulator32bit& emu, const word args[]) {
+        (void) args;
+        emu.syscalls.register_syscall(7, "second", 0, [counter](Emulator32bit& emu, const word args[]) {
+            (void) args;
+            (*counter)[1]++;
+            emu.syscalls.unregister_syscall(7);
+        });
+        (*counter)[0]++;
+    });
+
+    // swi; swi; swi
+    for (word i = 0; i < 3; i++) {
+        cpu->system_bus.write_word(i * 4, Emulator32bit::asm_format_b1(Emulator32bit::_op_swi, Emulator32bit::ConditionCode::AL, 0));
+    }
+    cpu->set_pc(0);
+    cpu->write_reg(NR, 7);
+
+    cpu->run(2);
+
+    EXPECT_EQ(calls[0], 1) << "first handler should run once";
+    EXPECT_EQ(calls[1], 1) << "replacement should handle the next call";
+    EXPECT_EQ(cpu->syscalls.lookup(7), nullptr) << "handler should be able to remove itself";
+
+    Emulator32bit::StopReason reason = cpu->run(1);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::BAD_SYSCALL) << "removed syscall should trap";
+    delete cpu;
+}
+
+TEST(syscall, bulk_memory_across_pages) {
+    Emulator32bit *cpu = new Emulator32bit(2, 0, {}, 0, 2);
+    const byte data[12] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+
+    cpu->system_bus.write_bytes(PAGE_SIZE - 6, data, sizeof(data));
+
+    for (word i = 0; i < sizeof(data); i++) {
+        EXPECT_EQ(cpu->system_bus.read_byte(PAGE_SIZE - 6 + i), data[i]) << "byte " << i << " should be written";
+    }
+
+    byte read[12] = {};
+    cpu->system_bus.read_bytes(PAGE_SIZE - 6, read, sizeof(read));
+    for (word i = 0; i < sizeof(data); i++) {
+        EXPECT_EQ(read[i], data[i]) << "byte " << i << " should be read";
+    }
+
+    const char str[] = "hello";
+    cpu->system_bus.write_bytes(PAGE_SIZE - 3, (const byte*) str, sizeof(str));
+    EXPECT_EQ(cpu->system_bus.read_string(PAGE_SIZE - 3), "hello") << "string should be read across pages";
+    EXPECT_EQ(cpu->system_bus.read_string(PAGE_SIZE - 3, 2), "he") << "string should stop at max length";
+    delete cpu;
+}
+
+TEST(syscall, bulk_read_fault) {
+    Emulator32bit *cpu = new Emulator32bit(4, 0, {}, 0, 4);
+    const byte secret[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    cpu->system_bus.write_bytes(0, secret, sizeof(secret));
+
+    long long pid = cpu->mmu->begin_process();
+    cpu->mmu->add_vpage(pid, 16, 1, true, false);
+    const byte data[4] = {9, 9, 9, 9};
+    cpu->system_bus.write_bytes(17 * PAGE_SIZE - 4, data, sizeof(data));
+    EXPECT_EQ(cpu->system_bus.has_fault(), false) << "mapped page should not fault";
+
+    // second half of the buffer is in an unmapped page
+    byte read[12];
+    memset(read, 0xFF, sizeof(read));
+    cpu->system_bus.read_bytes(17 * PAGE_SIZE - 4, read, sizeof(read));
+    EXPECT_EQ(cpu->system_bus.has_fault(), true) << "unmapped page should fault";
+    for (word i = 0; i < 4; i++) {
+        EXPECT_EQ(read[i], 9) << "byte " << i << " before the fault should be read";
+    }
+    for (word i = 4; i < sizeof(read); i++) {
+        EXPECT_EQ(read[i], 0) << "byte " << i << " after the fault should read as 0";
+    }
+
+    cpu->mmu->end_process(pid);
+    delete cpu;
+}
@@ -0,0 +1,131 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/timer.h>
+
+#define TIMER_PAGE 4
+
+/* Writes a loop polling the word at x1 until it is not 0, followed by a hlt. */
+static void write_poll_loop(Emulator32bit *cpu) {
+    // ldr x2, [x1]
+    // cmp x2, #0
+    // b.eq -2
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 2, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 2, 0));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::EQ, -2));
+    cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+}
+
+TEST(timer, fires_at_deadline) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    Timer timer(cpu, 3);
+    cpu->system_bus.register_device(TIMER_PAGE, TIMER_PAGE, timer);
+    cpu->timer = &timer;
+    // add x0, x0, #1
+    // b -1
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 0, 0, 1));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::AL, -1));
+    cpu->set_pc(0);
+    cpu->write_reg(0, 0);
+    cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_COMPARE_LO, 501);
+    cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_CTRL, AEMU_TIMER_CTRL_ENABLE);
+
+    Emulator32bit::StopReason reason = cpu->run(500);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::BUDGET_EXHAUSTED);
+    EXPECT_EQ(cpu->system_bus.get_pending_irqs(), 0) << "should not fire before the deadline";
+
+    reason = cpu->run(1000);
+    EXPECT_EQ(reason.skipped_instructions, 0) << "a loop that counts should not be fast forwarded";
+    EXPECT_EQ(cpu->read_reg(0), 750);
+    EXPECT_EQ(cpu->get_time(), 1500);
+    EXPECT_EQ(cpu->system_bus.get_pending_irqs(), 1U << 3);
+    EXPECT_EQ(cpu->system_bus.read_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_ISR), AEMU_TIMER_ISR_FIRED);
+
+    cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_ISR, AEMU_TIMER_ISR_FIRED);
+    EXPECT_EQ(cpu->system_bus.get_pending_irqs(), 0) << "writing the ISR should acknowledge the interrupt";
+    delete cpu;
+}
+
+TEST(timer, poll_loop_is_fast_forwarded) {
+    for (bool fusion : {true, false}) {
+        Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+        Timer timer(cpu);
+        cpu->system_bus.register_device(TIMER_PAGE, TIMER_PAGE, timer);
+        cpu->timer = &timer;
+        cpu->set_fusion(fusion);
+        write_poll_loop(cpu);
+        cpu->write_reg(1, TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_ISR);
+        cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_COMPARE_LO, 0);
+        cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_COMPARE_HI, 1);
+        cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_CTRL, AEMU_TIMER_CTRL_ENABLE);
+
+        Emulator32bit::StopReason reason = cpu->run(0);
+
+        EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+        EXPECT_EQ(reason.pc, 12);
+        EXPECT_EQ(cpu->read_reg(2), AEMU_TIMER_ISR_FIRED);
+        EXPECT_EQ(reason.skipped_instructions > (1ULL << 32) - 100, true) << "the wait should be skipped";
+        EXPECT_EQ(cpu->get_time(), reason.instructions);
+        EXPECT_EQ(cpu->get_time() >= (1ULL << 32), true) << "should not wake before the deadline";
+        EXPECT_EQ(cpu->get_time() < (1ULL << 32) + 6, true) << "should wake the iteration after the deadline";
+        delete cpu;
+    }
+}
+
+TEST(timer, spin_without_deadline_is_idle) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    write_poll_loop(cpu);
+    cpu->write_reg(1, 0x100);
+    cpu->system_bus.write_word(0x100, 0);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::IDLE);
+    EXPECT_EQ(reason.pc, 0) << "should stop at the head of the loop";
+    EXPECT_EQ(reason.instructions % 3, 0) << "should stop after a whole iteration";
+
+    cpu->system_bus.write_word(0x100, 1);
+    reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT) << "should resume once the memory changes";
+    EXPECT_EQ(reason.instructions, 3);
+    delete cpu;
+}
+
+TEST(timer, loops_that_store_are_not_skipped) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    // str x2, [x1]
+    // b -1
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_str, false, 2, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::AL, -1));
+    cpu->set_pc(0);
+    cpu->write_reg(1, 0x100);
+
+    Emulator32bit::StopReason reason = cpu->run(1000);
+
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::BUDGET_EXHAUSTED);
+    EXPECT_EQ(reason.instructions, 1000);
+    EXPECT_EQ(reason.skipped_instructions, 0);
+    delete cpu;
+}
+
+TEST(timer, other_branches_to_the_loop_head_are_not_iterations) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    write_poll_loop(cpu);
+    // str x2, [x3]
+    // b -4
+    cpu->system_bus.write_word(12, Emulator32bit::asm_format_m(Emulator32bit::_op_str, false, 2, 3, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(16, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::AL, -4));
+    cpu->write_reg(1, 0x100);
+    cpu->write_reg(3, 0x200);
+    cpu->system_bus.write_word(0x100, 0);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::IDLE);
+
+    cpu->system_bus.write_word(0x100, 1);
+    reason = cpu->run(1000);
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::BUDGET_EXHAUSTED) << "the outer loop stores, it should not be idle";
+    EXPECT_EQ(reason.instructions, 1000);
+    EXPECT_EQ(reason.skipped_instructions, 0);
+    delete cpu;
+}
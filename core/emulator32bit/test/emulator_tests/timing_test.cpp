@@ -0,0 +1,111 @@
+#include <emulator32bit_test/emulator32bit_test.h>
+#include <emulator32bit/timer.h>
+
+#define TIMER_PAGE 4
+
+TEST(timing, latencies_per_instruction_kind) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    cpu->set_timing(true);
+    EXPECT_EQ(cpu->is_timing(), true);
+    // add x0, x0, #1
+    // mul x0, x0, x0
+    // ldr x2, [x1]
+    // b.eq +2
+    // b +2
+    // nop
+    // hlt
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 0, 0, 1));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_o(Emulator32bit::_op_mul, false, 0, 0, 0, Emulator32bit::SHIFT_LSL, 0));
+    cpu->system_bus.write_word(8, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 2, 1, 0, Emulator32bit::ADDR_OFFSET));
+    cpu->system_bus.write_word(12, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::EQ, 2));
+    cpu->system_bus.write_word(16, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::AL, 2));
+    cpu->system_bus.write_word(20, Emulator32bit::asm_nop());
+    cpu->system_bus.write_word(24, Emulator32bit::asm_hlt());
+    cpu->set_pc(0);
+    cpu->write_reg(0, 0);
+    cpu->write_reg(1, 0x100);
+
+    Emulator32bit::StopReason reason = cpu->run(0);
+
+    Emulator32bit::Latencies latencies;
+    unsigned long long expected = latencies.alu + latencies.mul + latencies.load + latencies.branch +
+            latencies.branch + latencies.branch_taken;
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+    EXPECT_EQ(reason.instructions, 5);
+    EXPECT_EQ(reason.cycles, expected) << "the hlt that stopped it does not count";
+    EXPECT_EQ(cpu->get_time(), expected);
+
+    /* Time carries on in instructions once it is off. */
+    cpu->set_timing(false);
+    cpu->set_pc(0);
+    cpu->run(0);
+    EXPECT_EQ(cpu->get_time(), expected + 5);
+    delete cpu;
+}
+
+TEST(timing, timer_deadline_in_cycles) {
+    Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+    Timer timer(cpu, 3);
+    cpu->system_bus.register_device(TIMER_PAGE, TIMER_PAGE, timer);
+    cpu->timer = &timer;
+    Emulator32bit::Latencies latencies;
+    latencies.device_access = 0;
+    cpu->set_timing(true, latencies);
+    // add x0, x0, #1
+    // b -1
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_o(Emulator32bit::_op_add, false, 0, 0, 1));
+    cpu->system_bus.write_word(4, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::AL, -1));
+    cpu->set_pc(0);
+    cpu->write_reg(0, 0);
+    cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_COMPARE_LO, 1000);
+    cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_CTRL, AEMU_TIMER_CTRL_ENABLE);
+
+    /* Each iteration is an add, a branch and a taken branch, 4 cycles. */
+    Emulator32bit::StopReason reason = cpu->run(400);
+    EXPECT_EQ(reason.cycles, 800);
+    EXPECT_EQ(cpu->system_bus.get_pending_irqs(), 0) << "should not fire before the deadline";
+
+    reason = cpu->run(200);
+    EXPECT_EQ(cpu->get_time(), 1200);
+    EXPECT_EQ(cpu->system_bus.get_pending_irqs(), 1U << 3);
+    EXPECT_EQ(cpu->system_bus.read_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_TIME_LO), 1200)
+            << "guests read time in cycles";
+    delete cpu;
+}
+
+TEST(timing, device_access_and_poll_loop) {
+    for (bool fusion : {true, false}) {
+        Emulator32bit *cpu = new Emulator32bit(1, 0, {}, 0, 1);
+        Timer timer(cpu);
+        cpu->system_bus.register_device(TIMER_PAGE, TIMER_PAGE, timer);
+        cpu->timer = &timer;
+        cpu->set_fusion(fusion);
+        cpu->set_timing(true);
+        // ldr x2, [x1]
+        // cmp x2, #0
+        // b.eq -2
+        // hlt
+        cpu->system_bus.write_word(0, Emulator32bit::asm_format_m(Emulator32bit::_op_ldr, false, 2, 1, 0, Emulator32bit::ADDR_OFFSET));
+        cpu->system_bus.write_word(4, Emulator32bit::asm_format_o(Emulator32bit::_op_cmp, false, 0, 2, 0));
+        cpu->system_bus.write_word(8, Emulator32bit::asm_format_b1(Emulator32bit::_op_b, Emulator32bit::ConditionCode::EQ, -2));
+        cpu->system_bus.write_word(12, Emulator32bit::asm_hlt());
+        cpu->set_pc(0);
+        cpu->write_reg(1, TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_ISR);
+        cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_COMPARE_LO, 0);
+        cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_COMPARE_HI, 1);
+        cpu->system_bus.write_word(TIMER_PAGE * PAGE_SIZE + AEMU_TIMER_REG_CTRL, AEMU_TIMER_CTRL_ENABLE);
+
+        Emulator32bit::StopReason reason = cpu->step_slice(1);
+        Emulator32bit::Latencies latencies;
+        EXPECT_EQ(reason.cycles, latencies.load + latencies.device_access) << "the timer is not memory";
+
+        reason = cpu->run(0);
+        unsigned long long iteration = latencies.load + latencies.device_access + latencies.alu +
+                latencies.branch + latencies.branch_taken;
+        EXPECT_EQ(reason.type, Emulator32bit::StopReason::HALT);
+        EXPECT_EQ(reason.skipped_instructions > 0, true) << "the wait should be skipped";
+        EXPECT_EQ(cpu->get_time() >= (1ULL << 32), true) << "should not wake before the deadline";
+        EXPECT_EQ(cpu->get_time() < (1ULL << 32) + 2 * iteration, true) << "should wake the iteration after the deadline";
+        delete cpu;
+    }
+}
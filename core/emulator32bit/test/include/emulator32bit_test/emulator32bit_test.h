@@ -6,4 +6,39 @@
 #include <emulator32bit/emulator32bit.h>
 #include <emulator32bit/emulator32bit_util.h>
 
-#endif /* EMULATOR32BITTEST_H */
\ No newline at end of file
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+/**
+ * @brief             Path of a scratch disk file in the temp directory.
+ */
+inline std::string disk_path(const std::string& name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+/**
+ * @brief             Removes a disk file along with the files a Disk or OverlayDisk keeps next to it.
+ */
+inline void remove_disk(const std::string& path)
+{
+    std::remove(path.c_str());
+    std::remove((path + ".info").c_str());
+    std::remove((path + ".index").c_str());
+    std::remove((path + ".wal").c_str());
+}
+
+/**
+ * @brief             Emulator with ram_pages of RAM at page 0, an empty ROM page right after it and
+ *                     the given disk. Virtual pages are only brought into the RAM pages.
+ */
+inline Emulator32bit* disk_emulator(Disk *disk, word ram_pages)
+{
+    byte rom_data[PAGE_SIZE] = {};
+    Emulator32bit *cpu = new Emulator32bit(new RAM(ram_pages, 0), new ROM(rom_data, 1, ram_pages), disk);
+    cpu->mmu->set_frames(0, ram_pages - 1);
+    return cpu;
+}
+
+#endif /* EMULATOR32BITTEST_H */
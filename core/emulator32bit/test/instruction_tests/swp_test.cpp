@@ -2,10 +2,9 @@
 
 #include <iostream>
 
-static const byte data[PAGE_SIZE] = {0x07, 0x16, 0x25, 0x34};
-
 TEST(swp, basic) {
-    Emulator32bit *cpu = new Emulator32bit(1, 0, data, 1, 1);
+    Emulator32bit *cpu = new Emulator32bit(2, 0, {}, 0, 2);
+    cpu->system_bus.write_word(PAGE_SIZE, 0x34251607);
     // swp x0, x1, [x2]
     cpu->system_bus.write_word(0, Emulator32bit::asm_format_m1(Emulator32bit::_op_swp, 0, 1, 2));
     cpu->set_pc(0);
@@ -24,4 +23,23 @@ TEST(swp, basic) {
     EXPECT_EQ(cpu->get_flag(C_FLAG), 0) << "operation should not cause C flag to be set";
     EXPECT_EQ(cpu->get_flag(V_FLAG), 0) << "operation should not cause V flag to be set";
     delete cpu;
-}
\ No newline at end of file
+}
+
+TEST(swp, faulting_store) {
+    std::vector<byte> rom(PAGE_SIZE, 0);
+    rom[0] = 0x55;
+    Emulator32bit *cpu = new Emulator32bit(1, 0, rom.data(), 1, 1);
+    // swp x0, x1, [x2]
+    cpu->system_bus.write_word(0, Emulator32bit::asm_format_m1(Emulator32bit::_op_swp, 0, 1, 2));
+    cpu->set_pc(0);
+    cpu->write_reg(0, 7);
+    cpu->write_reg(1, 0x76543210);
+    cpu->write_reg(2, PAGE_SIZE);
+
+    Emulator32bit::StopReason reason = cpu->run(1);
+
+    EXPECT_EQ(reason.type, Emulator32bit::StopReason::FAULT) << "swap into ROM should fault";
+    EXPECT_EQ(cpu->read_reg(0), 7) << "faulting swap should not write \'x0\'";
+    EXPECT_EQ(cpu->system_bus.read_word(PAGE_SIZE), 0x55) << "faulting swap should not change memory";
+    delete cpu;
+}